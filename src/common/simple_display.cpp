@@ -140,6 +140,14 @@ std::unique_ptr<SimpleDisplay> NullDisplay::Create()
   return std::make_unique<NullDisplay>();
 }
 
-void NullDisplay::ResizeFramebuffer(u32 width, u32 height) {}
+void NullDisplay::ResizeFramebuffer(u32 width, u32 height)
+{
+  // Keep a framebuffer in memory, so that frames can still be rendered and inspected.
+  m_framebuffer_width = width;
+  m_framebuffer_height = height;
+  m_framebuffer_data = std::vector<u32>(width * height);
+  m_framebuffer_pointer = reinterpret_cast<byte*>(m_framebuffer_data.data());
+  m_framebuffer_pitch = sizeof(u32) * width;
+}
 
 void NullDisplay::DisplayFramebuffer() {}
@@ -2,6 +2,7 @@
 #include "YBaseLib/Timer.h"
 #include "types.h"
 #include <memory>
+#include <vector>
 
 class SimpleDisplay
 {
@@ -72,4 +73,7 @@ public:
 
   void ResizeFramebuffer(u32 width, u32 height) override;
   void DisplayFramebuffer() override;
+
+private:
+  std::vector<u32> m_framebuffer_data;
 };
\ No newline at end of file
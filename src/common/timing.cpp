@@ -259,7 +259,7 @@ bool TimingManager::LoadState(BinaryReader& reader)
 
   SortEvents();
 
-  Log_DevPrintf("Loaded %u events from save state.", event_count);
+  Log_TracePrintf("Loaded %u events from save state.", event_count);
   return true;
 }
 
@@ -296,7 +296,7 @@ bool TimingManager::SaveState(BinaryWriter& writer)
       !writer.SafeSeekAbsolute(end_offset))
     return false;
 
-  Log_DevPrintf("Wrote %u events to save state.", event_count);
+  Log_TracePrintf("Wrote %u events to save state.", event_count);
   return true;
 }
 
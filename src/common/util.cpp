@@ -12,21 +12,25 @@ std::string Util::StringFromFormat(const char* format, ...)
 
 std::string Util::StringFromFormatV(const char* format, std::va_list ap)
 {
+  // The arguments are read twice, once to measure the string and once to format it.
+  std::va_list ap_copy;
+  va_copy(ap_copy, ap);
+
   std::string ret;
 #ifdef _MSC_VER
-  int len = _vscprintf(format, ap);
+  int len = _vscprintf(format, ap_copy);
+#else
+  int len = vsnprintf(nullptr, 0, format, ap_copy);
+#endif
+  va_end(ap_copy);
   if (len <= 0)
     return {};
 
   ret.resize(len);
+#ifdef _MSC_VER
   _vsnprintf_s(ret.data(), len + 1, _TRUNCATE, format, ap);
 #else
-  int len = vsnprintf(nullptr, 0, format, ap);
-  if (len <= 0)
-    return {};
-
-  ret.resize(len);
-  vsnprintf(ret.data(), len + 1, _TRUNCATE, format, ap);
+  vsnprintf(ret.data(), len + 1, format, ap);
 #endif
   return ret;
 }
@@ -0,0 +1,894 @@
+#include "machine.h"
+#include "YBaseLib/Log.h"
+#include "i8080/cpu.inl"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+Log_SetChannel(CPM);
+
+// Machine is final, so the CPU's memory and I/O accesses are direct calls which can be inlined.
+template class i8080::CPU<CPM::Machine>;
+
+namespace CPM {
+
+// FCB fields.
+static constexpr u16 FCB_DRIVE = 0;
+static constexpr u16 FCB_NAME = 1;
+static constexpr u16 FCB_EXTENT = 12;
+static constexpr u16 FCB_MODULE = 14;
+static constexpr u16 FCB_RECORD_COUNT = 15;
+static constexpr u16 FCB_ALLOCATION = 16;
+static constexpr u16 FCB_CURRENT_RECORD = 32;
+static constexpr u16 FCB_RANDOM_RECORD = 33;
+static constexpr u32 FCB_SIZE = 36;
+
+// Marks an allocation map holding a file index, rather than whatever the program left there.
+static constexpr u8 FCB_FILE_MAGIC[2] = {0xC9, 0x8F};
+
+static constexpr i8080::MemoryAddress DEFAULT_DMA_ADDRESS = 0x0080;
+static constexpr i8080::MemoryAddress DEFAULT_FCB1 = 0x005C;
+static constexpr i8080::MemoryAddress DEFAULT_FCB2 = 0x006C;
+static constexpr u8 END_OF_FILE = 0x1A;
+
+// BDOS functions which take an FCB in DE.
+static bool IsFCBFunction(u8 function)
+{
+  switch (function)
+  {
+    case 15: // open file
+    case 16: // close file
+    case 17: // search for first
+    case 19: // delete file
+    case 20: // read sequential
+    case 21: // write sequential
+    case 22: // make file
+    case 23: // rename file
+    case 33: // read random
+    case 34: // write random
+    case 35: // compute file size
+    case 36: // set random record
+    case 40: // write random with zero fill
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Parses a name such as "B:FOO*.?XT" into an 11 character name field, expanding * to ?. Returns the drive, or zero for
+// the default drive.
+static u8 ParseFileName(const std::string& text, u8* name)
+{
+  std::fill_n(name, 11, ' ');
+
+  size_t pos = 0;
+  u8 drive = 0;
+  if (text.size() >= 2 && text[1] == ':')
+  {
+    drive = static_cast<u8>(std::toupper(static_cast<unsigned char>(text[0])) - 'A' + 1);
+    pos = 2;
+  }
+
+  u32 field_start = 0;
+  u32 field_size = 8;
+  u32 length = 0;
+  for (; pos < text.size(); pos++)
+  {
+    const char ch = static_cast<char>(std::toupper(static_cast<unsigned char>(text[pos])));
+    if (ch == '.')
+    {
+      if (field_start != 0)
+        break;
+
+      field_start = 8;
+      field_size = 3;
+      length = 0;
+    }
+    else if (ch == '*')
+    {
+      for (; length < field_size; length++)
+        name[field_start + length] = '?';
+    }
+    else if (length < field_size)
+    {
+      name[field_start + length++] = static_cast<u8>(ch);
+    }
+  }
+
+  return drive;
+}
+
+// Converts a host file name to an 11 character name field, returning false if it doesn't fit in 8.3.
+static bool GetFileNameFromHost(const std::string& host_name, u8* name)
+{
+  const size_t dot = host_name.find('.');
+  const size_t name_length = std::min(dot, host_name.size());
+  const size_t extension_length = (dot != std::string::npos) ? (host_name.size() - dot - 1) : 0;
+  if (name_length == 0 || name_length > 8 || extension_length > 3 ||
+      (dot != std::string::npos && host_name.find('.', dot + 1) != std::string::npos))
+  {
+    return false;
+  }
+
+  std::fill_n(name, 11, ' ');
+  for (size_t i = 0; i < name_length; i++)
+    name[i] = static_cast<u8>(std::toupper(static_cast<unsigned char>(host_name[i])));
+  for (size_t i = 0; i < extension_length; i++)
+    name[8 + i] = static_cast<u8>(std::toupper(static_cast<unsigned char>(host_name[dot + 1 + i])));
+
+  return true;
+}
+
+static std::string GetHostNameFromFileName(const u8* name)
+{
+  std::string host_name;
+  for (u32 i = 0; i < 8 && name[i] != ' '; i++)
+    host_name.push_back(static_cast<char>(name[i]));
+  if (name[8] != ' ')
+  {
+    host_name.push_back('.');
+    for (u32 i = 8; i < 11 && name[i] != ' '; i++)
+      host_name.push_back(static_cast<char>(name[i]));
+  }
+
+  return host_name;
+}
+
+Machine::Machine() : m_cpu(this)
+{
+  m_cpu.MapMemory(0x0000, 0x10000, m_ram, m_ram);
+
+  // Each entry point holds a RET, which returns to the caller once the handler has run.
+  m_cpu.SetTrap(BDOS_ENTRY, [this](i8080::MemoryAddress) { return HandleBDOSCall(); });
+  for (u32 i = 0; i < BIOS_FUNCTION_COUNT; i++)
+  {
+    m_cpu.SetTrap(static_cast<i8080::MemoryAddress>(BIOS_START + i * 3),
+                  [this, i](i8080::MemoryAddress) { return HandleBIOSCall(i); });
+  }
+
+  Reset();
+}
+
+Machine::~Machine()
+{
+  CloseAllFiles();
+}
+
+void Machine::SetConsoleInput(std::string input)
+{
+  m_console_input = std::move(input);
+  m_console_input_position = 0;
+}
+
+void Machine::Reset()
+{
+  CloseAllFiles();
+  m_search_results.clear();
+  m_search_position = 0;
+  m_console_output.clear();
+  m_cycles_executed = 0;
+  m_dma_address = DEFAULT_DMA_ADDRESS;
+  m_exited = false;
+
+  // jmp wboot, iobyte, current drive, jmp bdos
+  std::memset(m_ram, 0, sizeof(m_ram));
+  m_ram[0x0000] = 0xC3;
+  m_ram[0x0001] = Truncate8(BIOS_START + 3);
+  m_ram[0x0002] = Truncate8((BIOS_START + 3) >> 8);
+  m_ram[0x0005] = 0xC3;
+  m_ram[0x0006] = Truncate8(BDOS_ENTRY);
+  m_ram[0x0007] = Truncate8(BDOS_ENTRY >> 8);
+  m_ram[BDOS_ENTRY] = 0xC9;
+  for (u32 i = 0; i < BIOS_FUNCTION_COUNT; i++)
+    m_ram[BIOS_START + i * 3] = 0xC9;
+
+  m_cpu.Reset();
+  m_cpu.FlushCodeCache();
+
+  // Programs may return to the CCP instead of jumping to 0000, which warm boots either way.
+  i8080::Registers& regs = m_cpu.GetRegs();
+  regs.pc = TPA_START;
+  regs.sp = BDOS_ENTRY - 2;
+  m_ram[regs.sp] = 0x00;
+  m_ram[regs.sp + 1] = 0x00;
+}
+
+bool Machine::LoadProgram(const char* filename, const char* arguments)
+{
+  Reset();
+
+  std::FILE* fp = std::fopen(filename, "rb");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s'", filename);
+    return false;
+  }
+
+  // Read one byte past the TPA, to detect programs which don't fit.
+  const size_t max_size = BDOS_ENTRY - TPA_START;
+  std::vector<u8> data(max_size + 1);
+  const size_t size = std::fread(data.data(), 1, data.size(), fp);
+  std::fclose(fp);
+  if (size == 0 || size > max_size)
+  {
+    Log_ErrorPrintf("'%s' must be between 1 and %zu bytes", filename, max_size);
+    return false;
+  }
+
+  Log_DevPrintf("Loading %zu bytes at %04X from %s", size, TPA_START, filename);
+  std::memcpy(m_ram + TPA_START, data.data(), size);
+  SetupCommandLine(arguments);
+  m_cpu.FlushCodeCache();
+  return true;
+}
+
+void Machine::SetupCommandLine(const char* arguments)
+{
+  // The CCP converts the command line to upper case, and passes it with the leading space.
+  std::string tail;
+  for (const char* ch = arguments; *ch != '\0' && tail.size() < 126; ch++)
+  {
+    if (tail.empty())
+      tail.push_back(' ');
+    tail.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(*ch))));
+  }
+
+  m_ram[DEFAULT_DMA_ADDRESS] = static_cast<u8>(tail.size());
+  std::memcpy(&m_ram[DEFAULT_DMA_ADDRESS + 1], tail.data(), tail.size());
+
+  std::vector<std::string> words;
+  size_t pos = 0;
+  while ((pos = tail.find_first_not_of(' ', pos)) != std::string::npos)
+  {
+    const size_t end = std::min(tail.find(' ', pos), tail.size());
+    words.push_back(tail.substr(pos, end - pos));
+    pos = end;
+  }
+
+  const i8080::MemoryAddress fcbs[] = {DEFAULT_FCB1, DEFAULT_FCB2};
+  for (size_t i = 0; i < 2; i++)
+    m_ram[fcbs[i] + FCB_DRIVE] = ParseFileName((i < words.size()) ? words[i] : std::string(), &m_ram[fcbs[i] + FCB_NAME]);
+}
+
+void Machine::WriteGuestMemory(i8080::MemoryAddress address, const void* data, u32 size)
+{
+  const u8* bytes = static_cast<const u8*>(data);
+  while (size > 0)
+  {
+    const u32 count = std::min(size, 0x10000 - ZeroExtend32(address));
+    std::memcpy(&m_ram[address], bytes, count);
+    m_cpu.InvalidateCode(address, count);
+    address = static_cast<i8080::MemoryAddress>(address + count);
+    bytes += count;
+    size -= count;
+  }
+}
+
+bool Machine::Run(CycleCount max_cycles)
+{
+  static constexpr CycleCount SLICE_CYCLES = 1000000;
+
+  const CycleCount start_cycles = m_cycles_executed;
+  while (!m_exited)
+  {
+    CycleCount slice_cycles = SLICE_CYCLES;
+    if (max_cycles > 0)
+    {
+      const CycleCount remaining_cycles = max_cycles - (m_cycles_executed - start_cycles);
+      if (remaining_cycles <= 0)
+        break;
+
+      slice_cycles = std::min(slice_cycles, remaining_cycles);
+    }
+
+    m_cpu.ExecuteCycles(slice_cycles);
+
+    // Nothing raises interrupts, so a halted program can never continue.
+    if (m_cpu.IsHalted())
+    {
+      Log_WarningPrintf("Program halted at %04X", m_cpu.GetRegs().pc);
+      Exit();
+    }
+  }
+
+  FlushConsoleOutput();
+  return m_exited;
+}
+
+void Machine::Exit()
+{
+  // Programs are expected to close files they have written, but the host files may as well be complete.
+  CloseAllFiles();
+  m_exited = true;
+}
+
+void Machine::FlushConsoleOutput()
+{
+  if (m_console_output.empty())
+    return;
+
+  if (m_console_output_callback)
+  {
+    m_console_output_callback(m_console_output.data(), static_cast<u32>(m_console_output.size()));
+  }
+  else
+  {
+    std::fwrite(m_console_output.data(), 1, m_console_output.size(), stdout);
+    std::fflush(stdout);
+  }
+
+  m_console_output.clear();
+}
+
+void Machine::WriteConsole(u8 ch)
+{
+  m_console_output.push_back(static_cast<char>(ch));
+  if (m_console_output.size() >= CONSOLE_BUFFER_SIZE)
+    FlushConsoleOutput();
+}
+
+bool Machine::ReadConsole(u8* ch)
+{
+  // Show any prompt before the program waits for input.
+  FlushConsoleOutput();
+
+  if (!IsConsoleInputAvailable())
+  {
+    Exit();
+    return false;
+  }
+
+  *ch = static_cast<u8>(m_console_input[m_console_input_position++]);
+  return true;
+}
+
+bool Machine::ReadConsoleBuffer(i8080::MemoryAddress buffer)
+{
+  // Reads a line with echo. A line feed following the carriage return is skipped, so that input can use either.
+  const u8 max_length = m_ram[buffer];
+  u8 length = 0;
+  while (length < max_length)
+  {
+    u8 ch;
+    if (!ReadConsole(&ch))
+      return false;
+
+    if (ch == '\r' || ch == '\n')
+    {
+      if (ch == '\r' && IsConsoleInputAvailable() && m_console_input[m_console_input_position] == '\n')
+        m_console_input_position++;
+
+      break;
+    }
+
+    WriteConsole(ch);
+    WriteGuestByte(static_cast<i8080::MemoryAddress>(buffer + 2 + length++), ch);
+  }
+
+  WriteConsole('\r');
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(buffer + 1), length);
+  return true;
+}
+
+bool Machine::HandleBDOSCall()
+{
+  i8080::Registers& regs = m_cpu.GetRegs();
+  const i8080::MemoryAddress de = regs.de;
+  u16 result = 0;
+
+  // The FCB functions access the whole FCB, so one running past the top of memory is refused.
+  if (IsFCBFunction(regs.c) && ZeroExtend32(de) > (0x10000 - FCB_SIZE))
+  {
+    Log_WarningPrintf("FCB at %04X for BDOS function %u runs past the top of memory", de, regs.c);
+    regs.hl = 0x00FF;
+    regs.a = 0xFF;
+    regs.b = 0x00;
+    return true;
+  }
+
+  switch (regs.c)
+  {
+    case 0: // system reset
+      Exit();
+      return false;
+
+    case 1: // console input
+    {
+      u8 ch;
+      if (!ReadConsole(&ch))
+        return false;
+
+      WriteConsole(ch);
+      result = ch;
+    }
+    break;
+
+    case 2: // console output
+      WriteConsole(regs.e);
+      break;
+
+    case 3: // reader input
+      result = END_OF_FILE;
+      break;
+
+    case 4: // punch output
+    case 5: // list output
+      break;
+
+    case 6: // direct console I/O, which never waits
+    {
+      if (regs.e == 0xFF)
+        result = IsConsoleInputAvailable() ? static_cast<u8>(m_console_input[m_console_input_position++]) : 0;
+      else if (regs.e == 0xFE)
+        result = IsConsoleInputAvailable() ? 0xFF : 0x00;
+      else
+        WriteConsole(regs.e);
+    }
+    break;
+
+    case 7: // get iobyte
+      result = m_ram[0x0003];
+      break;
+
+    case 8: // set iobyte
+      WriteGuestByte(0x0003, regs.e);
+      break;
+
+    case 9: // print string
+    {
+      // The string may wrap around the top of memory, but without a '$' it would never end.
+      u32 length = 0;
+      for (; length < 0x10000; length++)
+      {
+        const u8 ch = m_ram[static_cast<i8080::MemoryAddress>(de + length)];
+        if (ch == '$')
+          break;
+
+        WriteConsole(ch);
+      }
+      if (length == 0x10000)
+        Log_WarningPrintf("String at %04X for BDOS function 9 has no terminating '$'", de);
+    }
+    break;
+
+    case 10: // read console buffer
+    {
+      if (!ReadConsoleBuffer(de))
+        return false;
+    }
+    break;
+
+    case 11: // console status
+      result = IsConsoleInputAvailable() ? 0xFF : 0x00;
+      break;
+
+    case 12: // version number, 2.2
+      result = 0x0022;
+      break;
+
+    case 13: // reset disk system
+      m_dma_address = DEFAULT_DMA_ADDRESS;
+      break;
+
+    case 14: // select disk
+    case 25: // current disk
+    case 28: // write protect disk
+    case 29: // read-only vector
+    case 30: // set file attributes
+    case 32: // get/set user code
+      break;
+
+    case 15: // open file
+      result = OpenFile(de);
+      break;
+
+    case 16: // close file
+      result = CloseFile(de);
+      break;
+
+    case 17: // search for first
+      result = SearchFirst(de);
+      break;
+
+    case 18: // search for next
+      result = SearchNext();
+      break;
+
+    case 19: // delete file
+      result = DeleteFiles(de);
+      break;
+
+    case 20: // read sequential
+    {
+      const u32 record = GetSequentialRecord(de);
+      result = ReadRecord(de, record);
+      if (result == 0)
+        SetSequentialRecord(de, record + 1);
+    }
+    break;
+
+    case 21: // write sequential
+    {
+      const u32 record = GetSequentialRecord(de);
+      result = WriteRecord(de, record);
+      if (result == 0)
+        SetSequentialRecord(de, record + 1);
+    }
+    break;
+
+    case 22: // make file
+      result = MakeFile(de);
+      break;
+
+    case 23: // rename file
+      result = RenameFile(de);
+      break;
+
+    case 24: // login vector, only A:
+      result = 0x0001;
+      break;
+
+    case 26: // set dma address
+      m_dma_address = de;
+      break;
+
+    case 33: // read random
+    case 34: // write random
+    case 40: // write random with zero fill, which the host file system does anyway
+    {
+      // The sequential position moves to the record, so that a sequential read or write accesses it again.
+      const u32 record = GetRandomRecord(de);
+      if (record > 0xFFFF)
+      {
+        result = 6;
+        break;
+      }
+
+      result = (regs.c == 33) ? ReadRecord(de, record) : WriteRecord(de, record);
+      if (result == 0 || result == 1)
+        SetSequentialRecord(de, record);
+    }
+    break;
+
+    case 35: // compute file size
+      result = ComputeFileSize(de);
+      break;
+
+    case 36: // set random record
+      SetRandomRecord(de, GetSequentialRecord(de));
+      break;
+
+    default:
+      Log_WarningPrintf("Unsupported BDOS function %u", regs.c);
+      result = 0x00FF;
+      break;
+  }
+
+  // Results are returned in both A and HL, and B holds the high byte for compatibility with CP/M 1.4.
+  regs.hl = result;
+  regs.a = Truncate8(result);
+  regs.b = Truncate8(result >> 8);
+  return true;
+}
+
+bool Machine::HandleBIOSCall(u32 function)
+{
+  i8080::Registers& regs = m_cpu.GetRegs();
+  switch (function)
+  {
+    case 0: // boot
+    case 1: // warm boot
+      Exit();
+      return false;
+
+    case 2: // console status
+      regs.a = IsConsoleInputAvailable() ? 0xFF : 0x00;
+      break;
+
+    case 3: // console input
+    {
+      u8 ch;
+      if (!ReadConsole(&ch))
+        return false;
+
+      regs.a = ch;
+    }
+    break;
+
+    case 4: // console output
+      WriteConsole(regs.c);
+      break;
+
+    case 7: // reader input
+      regs.a = END_OF_FILE;
+      break;
+
+    case 9: // select disk, there are no disk parameter headers
+      regs.hl = 0;
+      break;
+
+    case 13: // read sector
+    case 14: // write sector
+      regs.a = 1;
+      break;
+
+    case 15: // list status
+      regs.a = 0xFF;
+      break;
+
+    case 16: // sector translate
+      regs.hl = regs.bc;
+      break;
+
+    default: // list, punch, home, set track/sector/dma
+      break;
+  }
+
+  return true;
+}
+
+std::vector<Machine::DirectoryEntry> Machine::FindFiles(const FileName& pattern) const
+{
+  std::vector<DirectoryEntry> entries;
+  std::error_code error;
+  for (const auto& it : std::filesystem::directory_iterator(m_file_directory, error))
+  {
+    if (!it.is_regular_file(error))
+      continue;
+
+    DirectoryEntry entry;
+    entry.host_name = it.path().filename().string();
+    if (!GetFileNameFromHost(entry.host_name, entry.name.data()))
+      continue;
+
+    bool matches = true;
+    for (size_t i = 0; i < pattern.size() && matches; i++)
+      matches = (pattern[i] == '?' || pattern[i] == entry.name[i]);
+    if (!matches)
+      continue;
+
+    const u64 size = static_cast<u64>(it.file_size(error));
+    entry.records = static_cast<u32>(std::min<u64>((size + RECORD_SIZE - 1) / RECORD_SIZE, 0x10000));
+    entries.push_back(std::move(entry));
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const DirectoryEntry& lhs, const DirectoryEntry& rhs) { return lhs.name < rhs.name; });
+  return entries;
+}
+
+std::string Machine::GetHostPath(const std::string& host_name) const
+{
+  return (std::filesystem::path(m_file_directory) / host_name).string();
+}
+
+Machine::FileName Machine::ReadFileName(i8080::MemoryAddress address) const
+{
+  // The top bits of the name are attributes.
+  FileName name;
+  for (size_t i = 0; i < name.size(); i++)
+    name[i] = static_cast<u8>(std::toupper(m_ram[static_cast<i8080::MemoryAddress>(address + i)] & 0x7F));
+
+  return name;
+}
+
+std::FILE* Machine::GetFCBFile(i8080::MemoryAddress fcb) const
+{
+  const u8* allocation = &m_ram[static_cast<i8080::MemoryAddress>(fcb + FCB_ALLOCATION)];
+  if (allocation[2] != FCB_FILE_MAGIC[0] || allocation[3] != FCB_FILE_MAGIC[1])
+    return nullptr;
+
+  const u32 index = ZeroExtend32(allocation[0]) | (ZeroExtend32(allocation[1]) << 8);
+  return (index < m_files.size()) ? m_files[index] : nullptr;
+}
+
+void Machine::SetFCBFile(i8080::MemoryAddress fcb, std::FILE* fp)
+{
+  auto it = std::find(m_files.begin(), m_files.end(), nullptr);
+  if (it == m_files.end())
+    it = m_files.insert(it, nullptr);
+  *it = fp;
+
+  const u32 index = static_cast<u32>(it - m_files.begin());
+  const u8 allocation[16] = {Truncate8(index), Truncate8(index >> 8), FCB_FILE_MAGIC[0], FCB_FILE_MAGIC[1]};
+  WriteGuestMemory(static_cast<i8080::MemoryAddress>(fcb + FCB_ALLOCATION), allocation, sizeof(allocation));
+}
+
+void Machine::CloseAllFiles()
+{
+  for (std::FILE* fp : m_files)
+  {
+    if (fp)
+      std::fclose(fp);
+  }
+
+  m_files.clear();
+}
+
+u32 Machine::GetSequentialRecord(i8080::MemoryAddress fcb) const
+{
+  return (ZeroExtend32(m_ram[fcb + FCB_MODULE] & 0x3F) << 12) | (ZeroExtend32(m_ram[fcb + FCB_EXTENT] & 0x1F) << 7) |
+         ZeroExtend32(m_ram[fcb + FCB_CURRENT_RECORD] & 0x7F);
+}
+
+void Machine::SetSequentialRecord(i8080::MemoryAddress fcb, u32 record)
+{
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_CURRENT_RECORD), Truncate8(record & 0x7F));
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_EXTENT), Truncate8((record >> 7) & 0x1F));
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_MODULE), Truncate8((record >> 12) & 0x3F));
+}
+
+u32 Machine::GetRandomRecord(i8080::MemoryAddress fcb) const
+{
+  return ZeroExtend32(m_ram[fcb + FCB_RANDOM_RECORD]) | (ZeroExtend32(m_ram[fcb + FCB_RANDOM_RECORD + 1]) << 8) |
+         (ZeroExtend32(m_ram[fcb + FCB_RANDOM_RECORD + 2]) << 16);
+}
+
+void Machine::SetRandomRecord(i8080::MemoryAddress fcb, u32 record)
+{
+  const u8 data[3] = {Truncate8(record), Truncate8(record >> 8), Truncate8(record >> 16)};
+  WriteGuestMemory(static_cast<i8080::MemoryAddress>(fcb + FCB_RANDOM_RECORD), data, sizeof(data));
+}
+
+u8 Machine::OpenFile(i8080::MemoryAddress fcb)
+{
+  const std::vector<DirectoryEntry> entries = FindFiles(ReadFileName(fcb + FCB_NAME));
+  if (entries.empty())
+    return 0xFF;
+
+  // Fall back to read-only access for files the host won't let us write.
+  const std::string path = GetHostPath(entries[0].host_name);
+  std::FILE* fp = std::fopen(path.c_str(), "r+b");
+  if (!fp)
+    fp = std::fopen(path.c_str(), "rb");
+  if (!fp)
+    return 0xFF;
+
+  WriteGuestMemory(static_cast<i8080::MemoryAddress>(fcb + FCB_NAME), entries[0].name.data(),
+                   static_cast<u32>(entries[0].name.size()));
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_MODULE), 0);
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_RECORD_COUNT),
+                 Truncate8(std::min<u32>(entries[0].records, 0x80)));
+  SetFCBFile(fcb, fp);
+  return 0;
+}
+
+u8 Machine::CloseFile(i8080::MemoryAddress fcb)
+{
+  std::FILE* fp = GetFCBFile(fcb);
+  if (!fp)
+    return 0;
+
+  std::fclose(fp);
+  *std::find(m_files.begin(), m_files.end(), fp) = nullptr;
+  const u8 allocation[16] = {};
+  WriteGuestMemory(static_cast<i8080::MemoryAddress>(fcb + FCB_ALLOCATION), allocation, sizeof(allocation));
+  return 0;
+}
+
+u8 Machine::SearchFirst(i8080::MemoryAddress fcb)
+{
+  // A drive of ? also matches every extent and user in CP/M, which makes no difference here.
+  FileName pattern = ReadFileName(fcb + FCB_NAME);
+  if (m_ram[fcb + FCB_DRIVE] == '?')
+    pattern.fill('?');
+
+  m_search_results = FindFiles(pattern);
+  m_search_position = 0;
+  return SearchNext();
+}
+
+u8 Machine::SearchNext()
+{
+  if (m_search_position == m_search_results.size())
+    return 0xFF;
+
+  // The entry is returned as the first of the four directory entries in the record at the DMA address.
+  const DirectoryEntry& entry = m_search_results[m_search_position++];
+  u8 record[RECORD_SIZE];
+  std::memset(record, 0, 32);
+  std::memset(record + 32, 0xE5, sizeof(record) - 32);
+  std::memcpy(record + FCB_NAME, entry.name.data(), entry.name.size());
+  record[FCB_RECORD_COUNT] = Truncate8(std::min<u32>(entry.records, 0x80));
+  WriteGuestMemory(m_dma_address, record, sizeof(record));
+
+  return 0;
+}
+
+u8 Machine::DeleteFiles(i8080::MemoryAddress fcb)
+{
+  const std::vector<DirectoryEntry> entries = FindFiles(ReadFileName(fcb + FCB_NAME));
+  for (const DirectoryEntry& entry : entries)
+  {
+    std::error_code error;
+    std::filesystem::remove(GetHostPath(entry.host_name), error);
+  }
+
+  return entries.empty() ? 0xFF : 0;
+}
+
+u8 Machine::MakeFile(i8080::MemoryAddress fcb)
+{
+  const FileName name = ReadFileName(fcb + FCB_NAME);
+  if (std::find(name.begin(), name.end(), '?') != name.end())
+    return 0xFF;
+
+  // Replace an existing file with a different case, rather than adding a second one.
+  const std::vector<DirectoryEntry> entries = FindFiles(name);
+  const std::string host_name = entries.empty() ? GetHostNameFromFileName(name.data()) : entries[0].host_name;
+  std::FILE* fp = std::fopen(GetHostPath(host_name).c_str(), "w+b");
+  if (!fp)
+    return 0xFF;
+
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_MODULE), 0);
+  WriteGuestByte(static_cast<i8080::MemoryAddress>(fcb + FCB_RECORD_COUNT), 0);
+  SetFCBFile(fcb, fp);
+  return 0;
+}
+
+u8 Machine::RenameFile(i8080::MemoryAddress fcb)
+{
+  // The new name is in the second half of the FCB, where the allocation map usually is.
+  const std::vector<DirectoryEntry> entries = FindFiles(ReadFileName(fcb + FCB_NAME));
+  const FileName new_name = ReadFileName(fcb + FCB_ALLOCATION + FCB_NAME);
+  if (entries.empty() || std::find(new_name.begin(), new_name.end(), '?') != new_name.end())
+    return 0xFF;
+
+  std::error_code error;
+  std::filesystem::rename(GetHostPath(entries[0].host_name), GetHostPath(GetHostNameFromFileName(new_name.data())),
+                          error);
+  return error ? 0xFF : 0;
+}
+
+u8 Machine::ReadRecord(i8080::MemoryAddress fcb, u32 record)
+{
+  std::FILE* fp = GetFCBFile(fcb);
+  if (!fp)
+    return 9;
+
+  // A partial record at the end of the file is padded with end of file markers.
+  u8 data[RECORD_SIZE];
+  if (std::fseek(fp, static_cast<long>(record * RECORD_SIZE), SEEK_SET) != 0)
+    return 1;
+
+  const size_t size = std::fread(data, 1, sizeof(data), fp);
+  if (size == 0)
+    return 1;
+
+  std::fill(data + size, data + sizeof(data), END_OF_FILE);
+  WriteGuestMemory(m_dma_address, data, sizeof(data));
+
+  return 0;
+}
+
+u8 Machine::WriteRecord(i8080::MemoryAddress fcb, u32 record)
+{
+  std::FILE* fp = GetFCBFile(fcb);
+  if (!fp)
+    return 9;
+
+  u8 data[RECORD_SIZE];
+  for (u32 i = 0; i < RECORD_SIZE; i++)
+    data[i] = m_ram[static_cast<i8080::MemoryAddress>(m_dma_address + i)];
+
+  if (std::fseek(fp, static_cast<long>(record * RECORD_SIZE), SEEK_SET) != 0 ||
+      std::fwrite(data, sizeof(data), 1, fp) != 1)
+  {
+    return 2;
+  }
+
+  return 0;
+}
+
+u8 Machine::ComputeFileSize(i8080::MemoryAddress fcb)
+{
+  const std::vector<DirectoryEntry> entries = FindFiles(ReadFileName(fcb + FCB_NAME));
+  if (entries.empty())
+    return 0xFF;
+
+  SetRandomRecord(fcb, entries[0].records);
+  return 0;
+}
+
+} // namespace CPM
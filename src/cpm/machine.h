@@ -0,0 +1,150 @@
+#pragma once
+#include "common/types.h"
+#include "i8080/bus.h"
+#include "i8080/cpu.h"
+#include <array>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace CPM {
+
+// A CP/M 2.2 machine with 64KB of RAM, for running CP/M programs such as test suites, compilers and interpreters.
+//
+// The BDOS and BIOS entry points are CPU traps on RET instructions, so programs run at full speed between calls and the
+// calls are handled by the host. Console output is buffered and passed to the host in blocks. Files are host files in
+// a single directory, which stands in for every drive. Direct disk access through the BIOS is not supported.
+class Machine final : public i8080::Bus
+{
+public:
+  using CPUType = i8080::CPU<Machine>;
+
+  // Receives console output. The data is passed through unmodified, and may contain any byte value.
+  using ConsoleOutputCallback = std::function<void(const char* data, u32 size)>;
+
+  static constexpr i8080::MemoryAddress TPA_START = 0x0100;
+
+  // The word at 0006 points here, so programs which size the TPA from it can use everything below the BDOS.
+  static constexpr i8080::MemoryAddress BDOS_ENTRY = 0xFE00;
+  static constexpr i8080::MemoryAddress BIOS_START = 0xFF00;
+  static constexpr u32 BIOS_FUNCTION_COUNT = 17;
+
+  static constexpr u32 CONSOLE_BUFFER_SIZE = 4096;
+  static constexpr u32 RECORD_SIZE = 128;
+
+  Machine();
+  ~Machine();
+
+  const CPUType& GetCPU() const { return m_cpu; }
+  CPUType& GetCPU() { return m_cpu; }
+
+  const u8* GetRAM() const { return m_ram; }
+  u8* GetRAM() { return m_ram; }
+
+  CycleCount GetCyclesExecuted() const { return m_cycles_executed; }
+
+  // Directory holding the files the program can access, the current directory by default.
+  void SetFileDirectory(std::string directory) { m_file_directory = std::move(directory); }
+
+  // Without a callback, console output is written to stdout.
+  void SetConsoleOutputCallback(ConsoleOutputCallback callback) { m_console_output_callback = std::move(callback); }
+
+  // Characters returned by console input. Once they have all been read, the next read ends the program, so that
+  // interactive programs can be run from a script.
+  void SetConsoleInput(std::string input);
+
+  // Clears memory, closes all files and sets up page zero, with the stack holding a return to the warm boot entry.
+  void Reset();
+
+  // Resets the machine and loads a .COM file at TPA_START. The arguments form the command tail at 0080 and the first
+  // two are parsed into the default FCBs, as the CCP would.
+  bool LoadProgram(const char* filename, const char* arguments = "");
+
+  // Executes until the program returns to CP/M, or for about max_cycles when it is not zero. Console output is flushed
+  // before returning. Returns true if the program has exited.
+  bool Run(CycleCount max_cycles = 0);
+  bool HasExited() const { return m_exited; }
+
+  void FlushConsoleOutput();
+
+  // Inherited via Bus
+  void AddCycles(CycleCount cycles) override { m_cycles_executed += cycles; }
+  u8 ReadMemory(i8080::MemoryAddress address) override { return m_ram[address]; }
+  void WriteMemory(i8080::MemoryAddress address, u8 value) override { m_ram[address] = value; }
+  u8 ReadIO(i8080::MemoryAddress address) override { return 0xFF; }
+  void WriteIO(i8080::MemoryAddress address, u8 value) override {}
+
+private:
+  using FileName = std::array<u8, 11>;
+
+  struct DirectoryEntry
+  {
+    std::string host_name;
+    FileName name;
+    u32 records;
+  };
+
+  bool HandleBDOSCall();
+  bool HandleBIOSCall(u32 function);
+  void Exit();
+
+  void WriteConsole(u8 ch);
+  bool ReadConsole(u8* ch);
+  bool IsConsoleInputAvailable() const { return m_console_input_position < m_console_input.size(); }
+  bool ReadConsoleBuffer(i8080::MemoryAddress buffer);
+
+  void SetupCommandLine(const char* arguments);
+
+  // Writes from the host into guest memory, wrapping around at the top. Any code decoded from the memory is discarded,
+  // since programs load overlays with file reads.
+  void WriteGuestMemory(i8080::MemoryAddress address, const void* data, u32 size);
+  void WriteGuestByte(i8080::MemoryAddress address, u8 value) { WriteGuestMemory(address, &value, 1); }
+
+  // Files are opened by searching the directory for a host file with a matching 8.3 name, ignoring case.
+  std::vector<DirectoryEntry> FindFiles(const FileName& pattern) const;
+  std::string GetHostPath(const std::string& host_name) const;
+  FileName ReadFileName(i8080::MemoryAddress address) const;
+
+  // Open files are referenced from the FCB's allocation map, which belongs to the BDOS. The FCBs passed to these and
+  // the file functions below have been checked to fit below the top of memory.
+  std::FILE* GetFCBFile(i8080::MemoryAddress fcb) const;
+  void SetFCBFile(i8080::MemoryAddress fcb, std::FILE* fp);
+  void CloseAllFiles();
+
+  u32 GetSequentialRecord(i8080::MemoryAddress fcb) const;
+  void SetSequentialRecord(i8080::MemoryAddress fcb, u32 record);
+  u32 GetRandomRecord(i8080::MemoryAddress fcb) const;
+  void SetRandomRecord(i8080::MemoryAddress fcb, u32 record);
+
+  u8 OpenFile(i8080::MemoryAddress fcb);
+  u8 CloseFile(i8080::MemoryAddress fcb);
+  u8 SearchFirst(i8080::MemoryAddress fcb);
+  u8 SearchNext();
+  u8 DeleteFiles(i8080::MemoryAddress fcb);
+  u8 MakeFile(i8080::MemoryAddress fcb);
+  u8 RenameFile(i8080::MemoryAddress fcb);
+  u8 ReadRecord(i8080::MemoryAddress fcb, u32 record);
+  u8 WriteRecord(i8080::MemoryAddress fcb, u32 record);
+  u8 ComputeFileSize(i8080::MemoryAddress fcb);
+
+  CPUType m_cpu;
+  u8 m_ram[0x10000] = {};
+  CycleCount m_cycles_executed = 0;
+  bool m_exited = false;
+
+  std::string m_console_output;
+  ConsoleOutputCallback m_console_output_callback;
+  std::string m_console_input;
+  size_t m_console_input_position = 0;
+
+  std::string m_file_directory = ".";
+  std::vector<std::FILE*> m_files;
+  i8080::MemoryAddress m_dma_address = 0x0080;
+
+  // Remaining results of the last directory search.
+  std::vector<DirectoryEntry> m_search_results;
+  size_t m_search_position = 0;
+};
+
+} // namespace CPM
@@ -0,0 +1,851 @@
+#include "YBaseLib/Log.h"
+#include "YBaseLib/String.h"
+#include "YBaseLib/Timer.h"
+#include "i8080/bus.h"
+#include "i8080/cpu.inl"
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+Log_SetChannel(Fuzz);
+
+// Differential fuzzer for the execution engines. Each case is a random 64KB memory image, which the CPU decodes as an
+// instruction stream, random registers, a list of cycle slices, and events applied before slices: interrupt requests
+// and writes to memory by the host. The interpreter executes the case one instruction at a time as the reference, and
+// the engine under test executes each slice with ExecuteCycles(). After every slice the registers, flags, instruction
+// and cycle counts, memory and the ordered list of bus writes must match. Slices range from a single instruction to
+// many blocks, so that the block engines are compared both instruction by instruction and across whole blocks.
+
+// Memory is mapped like a typical machine: read-only memory whose writes reach the bus, directly mapped RAM, and a
+// mirror of part of the RAM which is only accessible through the bus, leaving the top of the memory image unused. Bus
+// writes are recorded in order, so that stores are compared as well as the final memory.
+class FuzzBus final : public i8080::Bus
+{
+public:
+  static constexpr u32 ROM_SIZE = 0x4000;
+  static constexpr u32 RAM_START = 0x4000;
+  static constexpr u32 RAM_SIZE = 0x8000;
+  static constexpr u32 MIRROR_START = 0xC000;
+  static constexpr u32 MIRROR_OFFSET = MIRROR_START - RAM_START;
+
+  // Set in the address of I/O writes, which are logged along with memory writes.
+  static constexpr u32 IO_WRITE_FLAG = 0x10000;
+
+  struct Write
+  {
+    u32 address;
+    u8 value;
+
+    bool operator==(const Write& rhs) const { return address == rhs.address && value == rhs.value; }
+    bool operator!=(const Write& rhs) const { return !operator==(rhs); }
+  };
+
+  const u8* GetRAM() const { return m_ram; }
+  u8* GetRAM() { return m_ram; }
+
+  // Code decoded from the RAM behind the mirror is invalidated by writes through it.
+  void SetCPU(i8080::CPU<FuzzBus>* cpu) { m_cpu = cpu; }
+
+  // Address in the memory image which holds an address, resolving the mirror.
+  static i8080::MemoryAddress GetImageAddress(i8080::MemoryAddress address)
+  {
+    return (address >= MIRROR_START) ? static_cast<i8080::MemoryAddress>(address - MIRROR_OFFSET) : address;
+  }
+
+  CycleCount GetCyclesExecuted() const { return m_cycles_executed; }
+  const std::vector<Write>& GetWrites() const { return m_writes; }
+  void ClearWrites() { m_writes.clear(); }
+
+  void Reset()
+  {
+    m_cycles_executed = 0;
+    m_io_reads = 0;
+    m_writes.clear();
+  }
+
+  void AddCycles(CycleCount cycles) override { m_cycles_executed += cycles; }
+
+  // Reads of the mirror, and writes to everything but the directly mapped RAM.
+  u8 ReadMemory(i8080::MemoryAddress address) override { return m_ram[GetImageAddress(address)]; }
+  void WriteMemory(i8080::MemoryAddress address, u8 value) override;
+
+  // Port reads return a hash of the port and the number of reads so far, which both machines see identically for as
+  // long as their execution matches.
+  u8 ReadIO(i8080::MemoryAddress address) override
+  {
+    const u32 hash = (m_io_reads++ * UINT32_C(0x9E3779B9)) ^ (ZeroExtend32(address) * UINT32_C(0x85EBCA6B));
+    return Truncate8(hash >> 24);
+  }
+  void WriteIO(i8080::MemoryAddress address, u8 value) override { m_writes.push_back({IO_WRITE_FLAG | address, value}); }
+
+private:
+  u8 m_ram[0x10000] = {};
+  i8080::CPU<FuzzBus>* m_cpu = nullptr;
+  CycleCount m_cycles_executed = 0;
+  u32 m_io_reads = 0;
+  std::vector<Write> m_writes;
+};
+
+using FuzzCPU = i8080::CPU<FuzzBus>;
+template class i8080::CPU<FuzzBus>;
+
+inline void FuzzBus::WriteMemory(i8080::MemoryAddress address, u8 value)
+{
+  const i8080::MemoryAddress image_address = GetImageAddress(address);
+  m_ram[image_address] = value;
+  m_writes.push_back({address, value});
+  if (image_address != address)
+    m_cpu->InvalidateCode(image_address, 1);
+}
+
+// Registers are kept as pairs, since i8080::Registers isn't assignable.
+struct FuzzRegisters
+{
+  u16 af, bc, de, hl, sp, pc;
+
+  // Clears the flag bits which can't be modified, as Flags::Fixup() does.
+  void FixupFlags() { af = static_cast<u16>((af & 0xFFD5) | 0x0002); }
+};
+
+// Applied to both machines before a slice, in order.
+struct FuzzEvent
+{
+  enum class Type : u8
+  {
+    Interrupt,
+    HostWrite
+  };
+
+  u32 slice;
+  Type type;
+
+  // The interrupt's rst vector, or the value written.
+  u8 value;
+
+  // Host writes are relative to PC, so that they can hit code which has just been decoded.
+  u16 pc_offset;
+};
+
+struct FuzzCase
+{
+  FuzzRegisters regs = {};
+  std::vector<u8> memory = std::vector<u8>(0x10000);
+  std::vector<CycleCount> slices;
+  std::vector<FuzzEvent> events;
+};
+
+struct FuzzMachine
+{
+  FuzzMachine() : cpu(&bus)
+  {
+    bus.SetCPU(&cpu);
+    cpu.MapMemory(0x0000, FuzzBus::ROM_SIZE, bus.GetRAM(), nullptr);
+    cpu.MapMemory(FuzzBus::RAM_START, FuzzBus::RAM_SIZE, bus.GetRAM() + FuzzBus::RAM_START,
+                  bus.GetRAM() + FuzzBus::RAM_START);
+  }
+
+  void Load(const FuzzCase& fc, i8080::ExecutionMode mode)
+  {
+    std::memcpy(bus.GetRAM(), fc.memory.data(), fc.memory.size());
+    bus.Reset();
+    cpu.Reset();
+    cpu.SetExecutionMode(mode);
+    cpu.FlushCodeCache();
+    i8080::Registers& regs = cpu.GetRegs();
+    regs.af = fc.regs.af;
+    regs.bc = fc.regs.bc;
+    regs.de = fc.regs.de;
+    regs.hl = fc.regs.hl;
+    regs.sp = fc.regs.sp;
+    regs.pc = fc.regs.pc;
+    start_instructions = cpu.GetExecutedInstructionCount();
+  }
+
+  u64 GetInstructions() const { return cpu.GetExecutedInstructionCount() - start_instructions; }
+
+  void ApplyEvent(const FuzzEvent& event)
+  {
+    if (event.type == FuzzEvent::Type::Interrupt)
+    {
+      cpu.InterruptRequest(true, event.value);
+      return;
+    }
+
+    // The host writes the memory behind the mirror, as a device would.
+    const i8080::MemoryAddress address =
+      FuzzBus::GetImageAddress(static_cast<i8080::MemoryAddress>(cpu.GetRegs().pc + event.pc_offset));
+    bus.GetRAM()[address] = event.value;
+    cpu.InvalidateCode(address, 1);
+  }
+
+  FuzzBus bus;
+  FuzzCPU cpu;
+  u64 start_instructions = 0;
+};
+
+// Machines are reused between cases, since creating the recompiler's code buffer is relatively expensive.
+struct FuzzContext
+{
+  FuzzMachine reference;
+  FuzzMachine engine;
+
+  // Reference instruction count at the start of each slice of the last case run, for replaying its events.
+  std::vector<u64> slice_start_instructions;
+};
+
+struct Mismatch
+{
+  size_t slice = 0;
+  u64 instruction = 0;
+  SmallString description;
+};
+
+// xorshift64*, which is plenty for generating cases and much faster than the standard library engines.
+class Random
+{
+public:
+  explicit Random(u64 seed) : m_state(seed ? seed : 1) {}
+
+  u64 Next()
+  {
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * UINT64_C(0x2545F4914F6CDD1D);
+  }
+
+  u32 NextRange(u32 count) { return static_cast<u32>(Next() % count); }
+
+private:
+  u64 m_state;
+};
+
+// Gives each case an independent seed, so that any case can be regenerated from the run's seed and its index.
+static u64 GetCaseSeed(u64 seed, u64 index)
+{
+  u64 z = seed + (index + 1) * UINT64_C(0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+static void GenerateCase(u64 seed, FuzzCase* fc)
+{
+  Random random(seed);
+  for (size_t i = 0; i < fc->memory.size(); i += sizeof(u64))
+  {
+    const u64 value = random.Next();
+    std::memcpy(&fc->memory[i], &value, sizeof(value));
+  }
+
+  // The stack pointer is random too, so pushes regularly overwrite code.
+  fc->regs.af = static_cast<u16>(random.Next());
+  fc->regs.bc = static_cast<u16>(random.Next());
+  fc->regs.de = static_cast<u16>(random.Next());
+  fc->regs.hl = static_cast<u16>(random.Next());
+  fc->regs.sp = static_cast<u16>(random.Next());
+  fc->regs.pc = static_cast<u16>(random.Next());
+  fc->regs.FixupFlags();
+
+  // Mostly short slices, which compare the block engines within blocks, with some long enough to run whole blocks.
+  fc->slices.resize(1 + random.NextRange(64));
+  for (CycleCount& slice : fc->slices)
+  {
+    const u32 kind = random.NextRange(8);
+    if (kind < 4)
+      slice = 1 + random.NextRange(20);
+    else if (kind < 7)
+      slice = 20 + random.NextRange(500);
+    else
+      slice = 500 + random.NextRange(5000);
+  }
+
+  // Interrupts are accepted between blocks, after ei and when halted. Host writes land mostly around PC, where they
+  // overwrite the block which has just run or the one about to.
+  fc->events.clear();
+  for (u32 slice = 0; slice < static_cast<u32>(fc->slices.size()); slice++)
+  {
+    if (random.NextRange(8) == 0)
+      fc->events.push_back({slice, FuzzEvent::Type::Interrupt, static_cast<u8>(random.NextRange(8)), 0});
+
+    if (random.NextRange(4) == 0)
+    {
+      const u32 count = 1 + random.NextRange(4);
+      for (u32 i = 0; i < count; i++)
+      {
+        const u16 pc_offset =
+          static_cast<u16>((random.NextRange(4) == 0) ? random.Next() : (random.NextRange(128) - 64));
+        fc->events.push_back({slice, FuzzEvent::Type::HostWrite, static_cast<u8>(random.Next()), pc_offset});
+      }
+    }
+  }
+}
+
+static void DescribeWrite(const std::vector<FuzzBus::Write>& writes, size_t index, SmallString* dest)
+{
+  if (index >= writes.size())
+    dest->Format("none");
+  else if (writes[index].address & FuzzBus::IO_WRITE_FLAG)
+    dest->Format("out %02X=%02X", writes[index].address & 0xFF, writes[index].value);
+  else
+    dest->Format("%04X=%02X", writes[index].address, writes[index].value);
+}
+
+// Compares the machines after a slice. Cycles are not compared once the reference has halted, since hlt consumes the
+// rest of the engine's slice.
+static bool CompareMachines(FuzzContext& ctx, bool compare_cycles, Mismatch* mismatch)
+{
+  FuzzMachine& reference = ctx.reference;
+  FuzzMachine& engine = ctx.engine;
+  const bool halted = reference.cpu.IsHalted();
+  SmallString reference_state, engine_state;
+  reference.cpu.GetStateString(&reference_state);
+  engine.cpu.GetStateString(&engine_state);
+
+  mismatch->instruction = reference.GetInstructions();
+  if (std::memcmp(&reference.cpu.GetRegs(), &engine.cpu.GetRegs(), sizeof(i8080::Registers)) != 0 ||
+      halted != engine.cpu.IsHalted())
+  {
+    mismatch->description.Format("registers differ:\n  reference %s%s\n  engine    %s%s",
+                                 reference_state.GetCharArray(), halted ? " (halted)" : "", engine_state.GetCharArray(),
+                                 engine.cpu.IsHalted() ? " (halted)" : "");
+    return false;
+  }
+
+  if (reference.GetInstructions() != engine.GetInstructions())
+  {
+    mismatch->description.Format("instruction counts differ: reference %" PRIu64 ", engine %" PRIu64,
+                                 reference.GetInstructions(), engine.GetInstructions());
+    return false;
+  }
+
+  if (compare_cycles && reference.bus.GetCyclesExecuted() != engine.bus.GetCyclesExecuted())
+  {
+    mismatch->description.Format("cycle counts differ: reference %" PRId64 ", engine %" PRId64 " at %s",
+                                 reference.bus.GetCyclesExecuted(), engine.bus.GetCyclesExecuted(),
+                                 reference_state.GetCharArray());
+    return false;
+  }
+
+  const std::vector<FuzzBus::Write>& reference_writes = reference.bus.GetWrites();
+  const std::vector<FuzzBus::Write>& engine_writes = engine.bus.GetWrites();
+  if (reference_writes != engine_writes)
+  {
+    size_t index = 0;
+    while (index < reference_writes.size() && index < engine_writes.size() &&
+           reference_writes[index] == engine_writes[index])
+    {
+      index++;
+    }
+
+    SmallString reference_write, engine_write;
+    DescribeWrite(reference_writes, index, &reference_write);
+    DescribeWrite(engine_writes, index, &engine_write);
+    mismatch->description.Format("write %zu of the slice differs: reference %s, engine %s at %s", index,
+                                 reference_write.GetCharArray(), engine_write.GetCharArray(),
+                                 reference_state.GetCharArray());
+    return false;
+  }
+
+  // Writes to the directly mapped RAM don't reach the bus.
+  const u8* reference_ram = reference.bus.GetRAM();
+  const u8* engine_ram = engine.bus.GetRAM();
+  if (std::memcmp(reference_ram, engine_ram, 0x10000) != 0)
+  {
+    const u32 address = static_cast<u32>(std::mismatch(reference_ram, reference_ram + 0x10000, engine_ram).first -
+                                          reference_ram);
+    mismatch->description.Format("memory at %04X differs: reference %02X, engine %02X at %s", address,
+                                 reference_ram[address], engine_ram[address], reference_state.GetCharArray());
+    return false;
+  }
+
+  reference.bus.ClearWrites();
+  engine.bus.ClearWrites();
+  return true;
+}
+
+// Runs a case on the reference and the engine. Returns false and describes the first difference if they disagree.
+static bool RunCase(FuzzContext& ctx, const FuzzCase& fc, i8080::ExecutionMode mode, Mismatch* mismatch,
+                    u64* instructions)
+{
+  FuzzMachine& reference = ctx.reference;
+  FuzzMachine& engine = ctx.engine;
+  reference.Load(fc, i8080::ExecutionMode::Interpreter);
+  engine.Load(fc, mode);
+  ctx.slice_start_instructions.clear();
+
+  bool result = true;
+  bool reference_halted = false;
+  auto event = fc.events.begin();
+  for (size_t i = 0; i < fc.slices.size(); i++)
+  {
+    ctx.slice_start_instructions.push_back(reference.GetInstructions());
+    for (; event != fc.events.end() && event->slice <= i; ++event)
+    {
+      reference.ApplyEvent(*event);
+      engine.ApplyEvent(*event);
+    }
+
+    // A halted reference only continues if an interrupt is accepted, which the first step does.
+    engine.cpu.ExecuteCycles(fc.slices[i]);
+    while (reference.GetInstructions() < engine.GetInstructions())
+    {
+      reference.cpu.SingleStep();
+      if (reference.cpu.IsHalted())
+        break;
+    }
+
+    reference_halted |= reference.cpu.IsHalted();
+    mismatch->slice = i;
+    if (!CompareMachines(ctx, !reference_halted, mismatch))
+    {
+      result = false;
+      break;
+    }
+  }
+
+  *instructions = reference.GetInstructions();
+  return result;
+}
+
+// Reduces a failing case to the fewest slices, shortest slices and fewest non-zero (nop) bytes of memory and registers
+// which still produce a mismatch, which is usually a handful of instructions.
+static void MinimizeCase(FuzzContext& ctx, FuzzCase* fc, i8080::ExecutionMode mode, Mismatch* mismatch)
+{
+  u64 instructions;
+  auto try_case = [&](const FuzzCase& candidate) {
+    Mismatch candidate_mismatch;
+    if (RunCase(ctx, candidate, mode, &candidate_mismatch, &instructions))
+      return false;
+
+    *fc = candidate;
+    *mismatch = candidate_mismatch;
+    return true;
+  };
+
+  // Nothing after the mismatch matters.
+  auto truncate = [](FuzzCase* fc, size_t slice_count) {
+    fc->slices.resize(slice_count);
+    fc->events.erase(std::remove_if(fc->events.begin(), fc->events.end(),
+                                    [slice_count](const FuzzEvent& event) { return event.slice >= slice_count; }),
+                     fc->events.end());
+  };
+  truncate(fc, mismatch->slice + 1);
+
+  // The events of a removed slice happen before the next one instead.
+  FuzzCase candidate = *fc;
+  for (size_t i = 0; i < fc->slices.size() && fc->slices.size() > 1;)
+  {
+    candidate = *fc;
+    candidate.slices.erase(candidate.slices.begin() + i);
+    for (FuzzEvent& event : candidate.events)
+    {
+      if (event.slice > i)
+        event.slice--;
+    }
+
+    if (!try_case(candidate))
+      i++;
+  }
+
+  for (size_t i = 0; i < fc->events.size();)
+  {
+    candidate = *fc;
+    candidate.events.erase(candidate.events.begin() + i);
+    if (!try_case(candidate))
+      i++;
+  }
+
+  for (size_t i = 0; i < fc->slices.size(); i++)
+  {
+    while (fc->slices[i] > 1)
+    {
+      candidate = *fc;
+      candidate.slices[i] /= 2;
+      if (!try_case(candidate))
+        break;
+    }
+  }
+
+  if (mismatch->slice + 1 < fc->slices.size())
+    truncate(fc, mismatch->slice + 1);
+
+  for (u32 size = 0x1000; size > 0; size /= 2)
+  {
+    for (u32 start = 0; start < 0x10000; start += size)
+    {
+      const auto begin = fc->memory.begin() + start;
+      if (std::all_of(begin, begin + size, [](u8 value) { return value == 0; }))
+        continue;
+
+      candidate = *fc;
+      std::fill_n(candidate.memory.begin() + start, size, u8(0));
+      try_case(candidate);
+    }
+  }
+
+  for (u32 index = 0; index < 6; index++)
+  {
+    candidate = *fc;
+    u16* const pairs[] = {&candidate.regs.af, &candidate.regs.bc, &candidate.regs.de,
+                          &candidate.regs.hl, &candidate.regs.sp, &candidate.regs.pc};
+    if (*pairs[index] == 0)
+      continue;
+
+    *pairs[index] = 0;
+    candidate.regs.FixupFlags();
+    try_case(candidate);
+  }
+}
+
+static bool SaveCase(const char* filename, const FuzzCase& fc, i8080::ExecutionMode mode)
+{
+  std::FILE* fp = std::fopen(filename, "w");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s' for writing", filename);
+    return false;
+  }
+
+  const FuzzRegisters& regs = fc.regs;
+  std::fprintf(fp, "# replay with: fuzz --replay %s\n", filename);
+  std::fprintf(fp, "mode %s\n", i8080::GetExecutionModeName(mode));
+  std::fprintf(fp, "regs %04X %04X %04X %04X %04X %04X\n", regs.af, regs.bc, regs.de, regs.hl, regs.sp, regs.pc);
+  std::fprintf(fp, "slices");
+  for (const CycleCount slice : fc.slices)
+    std::fprintf(fp, " %" PRId64, slice);
+  std::fprintf(fp, "\n");
+
+  for (const FuzzEvent& event : fc.events)
+  {
+    if (event.type == FuzzEvent::Type::Interrupt)
+      std::fprintf(fp, "interrupt %u %u\n", event.slice, event.value);
+    else
+      std::fprintf(fp, "write %u %04X %02X\n", event.slice, event.pc_offset, event.value);
+  }
+
+  // Only lines holding something other than nops.
+  for (u32 address = 0; address < fc.memory.size(); address += 16)
+  {
+    const auto begin = fc.memory.begin() + address;
+    if (std::all_of(begin, begin + 16, [](u8 value) { return value == 0; }))
+      continue;
+
+    std::fprintf(fp, "memory %04X ", address);
+    for (u32 i = 0; i < 16; i++)
+      std::fprintf(fp, "%02X", fc.memory[address + i]);
+    std::fprintf(fp, "\n");
+  }
+
+  std::fclose(fp);
+  return true;
+}
+
+static bool LoadCase(const char* filename, FuzzCase* fc, i8080::ExecutionMode* mode)
+{
+  std::FILE* fp = std::fopen(filename, "r");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s'", filename);
+    return false;
+  }
+
+  *fc = FuzzCase();
+  *mode = i8080::ExecutionMode::CachedInterpreter;
+
+  char line[256];
+  bool result = true;
+  while (result && std::fgets(line, sizeof(line), fp))
+  {
+    char name[32], data[64];
+    unsigned int values[6];
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    if (std::sscanf(line, "mode %31s", name) == 1)
+    {
+      result = false;
+      for (const i8080::ExecutionMode candidate : {i8080::ExecutionMode::Interpreter,
+                                                   i8080::ExecutionMode::CachedInterpreter,
+                                                   i8080::ExecutionMode::Recompiler})
+      {
+        if (std::strcmp(name, i8080::GetExecutionModeName(candidate)) == 0)
+        {
+          *mode = candidate;
+          result = true;
+        }
+      }
+    }
+    else if (std::sscanf(line, "regs %x %x %x %x %x %x", &values[0], &values[1], &values[2], &values[3], &values[4],
+                         &values[5]) == 6)
+    {
+      fc->regs.af = static_cast<u16>(values[0]);
+      fc->regs.bc = static_cast<u16>(values[1]);
+      fc->regs.de = static_cast<u16>(values[2]);
+      fc->regs.hl = static_cast<u16>(values[3]);
+      fc->regs.sp = static_cast<u16>(values[4]);
+      fc->regs.pc = static_cast<u16>(values[5]);
+    }
+    else if (std::strncmp(line, "slices", 6) == 0)
+    {
+      char* end = line + 6;
+      for (;;)
+      {
+        char* next;
+        const CycleCount slice = std::strtoll(end, &next, 10);
+        if (next == end)
+          break;
+
+        fc->slices.push_back(slice);
+        end = next;
+      }
+    }
+    else if (std::sscanf(line, "interrupt %u %u", &values[0], &values[1]) == 2 && values[1] < 8)
+    {
+      fc->events.push_back({values[0], FuzzEvent::Type::Interrupt, static_cast<u8>(values[1]), 0});
+    }
+    else if (std::sscanf(line, "write %u %x %x", &values[0], &values[1], &values[2]) == 3)
+    {
+      fc->events.push_back(
+        {values[0], FuzzEvent::Type::HostWrite, static_cast<u8>(values[2]), static_cast<u16>(values[1])});
+    }
+    else if (std::sscanf(line, "memory %x %63s", &values[0], data) == 2 && values[0] <= 0x10000 - 16 &&
+             std::strlen(data) == 32)
+    {
+      for (u32 i = 0; i < 16; i++)
+      {
+        unsigned int value;
+        std::sscanf(&data[i * 2], "%2x", &value);
+        fc->memory[values[0] + i] = static_cast<u8>(value);
+      }
+    }
+    else
+    {
+      result = false;
+    }
+  }
+
+  std::fclose(fp);
+  if (!result || fc->slices.empty())
+  {
+    Log_ErrorPrintf("'%s' is not a valid case", filename);
+    return false;
+  }
+
+  std::stable_sort(fc->events.begin(), fc->events.end(),
+                   [](const FuzzEvent& lhs, const FuzzEvent& rhs) { return lhs.slice < rhs.slice; });
+  return true;
+}
+
+static void PrintMismatch(const FuzzCase& fc, i8080::ExecutionMode mode, const Mismatch& mismatch)
+{
+  Log_ErrorPrintf("%s: mismatch after slice %zu of %zu, %" PRIu64 " instructions: %s",
+                  i8080::GetExecutionModeName(mode), mismatch.slice + 1, fc.slices.size(), mismatch.instruction,
+                  mismatch.description.GetCharArray());
+}
+
+// Prints the last instructions executed by the reference, which for a minimized case is the whole story. Runs of nops,
+// which the minimizer leaves in place of irrelevant code, are collapsed. The case is run against the engine first, to
+// find where the reference was at the start of each slice, when the events were applied.
+static void PrintReferenceTrace(FuzzContext& ctx, const FuzzCase& fc, i8080::ExecutionMode mode, u64 instructions)
+{
+  static constexpr size_t MAX_TRACE_LINES = 256;
+
+  Mismatch mismatch;
+  u64 case_instructions;
+  RunCase(ctx, fc, mode, &mismatch, &case_instructions);
+  const std::vector<u64> slice_start_instructions = ctx.slice_start_instructions;
+
+  FuzzMachine& reference = ctx.reference;
+  reference.Load(fc, i8080::ExecutionMode::Interpreter);
+
+  std::vector<SmallString> lines;
+  SmallString state;
+  u64 nops = 0;
+  size_t slice = 0;
+  auto event = fc.events.begin();
+  for (u64 i = 0; i <= instructions; i++)
+  {
+    for (; slice < slice_start_instructions.size() && slice_start_instructions[slice] <= i; slice++)
+    {
+      for (; event != fc.events.end() && event->slice <= slice; ++event)
+        reference.ApplyEvent(*event);
+    }
+
+    if (i < instructions && reference.bus.ReadMemory(reference.cpu.GetRegs().pc) == 0x00)
+    {
+      nops++;
+    }
+    else
+    {
+      if (nops > 0)
+      {
+        state.Format("%8" PRIu64 " (%" PRIu64 " nops)", i - nops, nops);
+        lines.push_back(state);
+        nops = 0;
+      }
+
+      SmallString line;
+      reference.cpu.GetStateString(&state);
+      line.Format("%8" PRIu64 " %s", i, state.GetCharArray());
+      lines.push_back(line);
+    }
+
+    if (i == instructions)
+      break;
+
+    // Halted for good, unless an interrupt was accepted.
+    reference.cpu.SingleStep();
+    if (reference.GetInstructions() == i)
+      break;
+  }
+
+  const size_t first = (lines.size() > MAX_TRACE_LINES) ? (lines.size() - MAX_TRACE_LINES) : 0;
+  for (size_t i = first; i < lines.size(); i++)
+    std::printf("%s\n", lines[i].GetCharArray());
+  std::fflush(stdout);
+}
+
+static int ReplayCase(const char* filename)
+{
+  FuzzCase fc;
+  i8080::ExecutionMode mode;
+  if (!LoadCase(filename, &fc, &mode))
+    return EXIT_FAILURE;
+
+  auto ctx = std::make_unique<FuzzContext>();
+  Mismatch mismatch;
+  u64 instructions;
+  const bool passed = RunCase(*ctx, fc, mode, &mismatch, &instructions);
+  PrintReferenceTrace(*ctx, fc, mode, passed ? instructions : mismatch.instruction);
+  if (passed)
+  {
+    Log_InfoPrintf("%s: %" PRIu64 " instructions match", i8080::GetExecutionModeName(mode), instructions);
+    return EXIT_SUCCESS;
+  }
+
+  PrintMismatch(fc, mode, mismatch);
+  return EXIT_FAILURE;
+}
+
+static int Fuzz(u64 case_count, u64 seed, const std::vector<i8080::ExecutionMode>& modes)
+{
+  const u32 thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+  std::atomic<u64> next_case{0};
+  std::atomic<u64> total_instructions{0};
+  std::atomic<bool> failed{false};
+  std::mutex failure_lock;
+  u64 failed_case = 0;
+  i8080::ExecutionMode failed_mode = modes[0];
+
+  Log_InfoPrintf("Running %" PRIu64 " cases with seed %" PRIu64 " on %u threads", case_count, seed, thread_count);
+
+  Timer timer;
+  std::vector<std::thread> threads;
+  for (u32 i = 0; i < thread_count; i++)
+  {
+    threads.emplace_back([&]() {
+      auto ctx = std::make_unique<FuzzContext>();
+      FuzzCase fc;
+      Mismatch mismatch;
+      u64 case_index;
+      while (!failed && (case_index = next_case.fetch_add(1)) < case_count)
+      {
+        GenerateCase(GetCaseSeed(seed, case_index), &fc);
+        for (const i8080::ExecutionMode mode : modes)
+        {
+          u64 instructions;
+          const bool passed = RunCase(*ctx, fc, mode, &mismatch, &instructions);
+          total_instructions += instructions;
+          if (!passed)
+          {
+            std::lock_guard<std::mutex> guard(failure_lock);
+            if (!failed.exchange(true) || case_index < failed_case)
+            {
+              failed_case = case_index;
+              failed_mode = mode;
+            }
+            break;
+          }
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+
+  const double seconds = timer.GetTimeSeconds();
+  const u64 cases_run = std::min<u64>(next_case, case_count);
+  Log_InfoPrintf("%" PRIu64 " cases, %" PRIu64 " reference instructions in %.3f seconds, %.2f million per second",
+                 cases_run, total_instructions.load(), seconds,
+                 static_cast<double>(total_instructions) / seconds / 1000000.0);
+  if (!failed)
+    return EXIT_SUCCESS;
+
+  auto ctx = std::make_unique<FuzzContext>();
+  FuzzCase fc;
+  Mismatch mismatch;
+  u64 instructions;
+  GenerateCase(GetCaseSeed(seed, failed_case), &fc);
+  RunCase(*ctx, fc, failed_mode, &mismatch, &instructions);
+  Log_ErrorPrintf("Case %" PRIu64 " failed, minimizing", failed_case);
+  PrintMismatch(fc, failed_mode, mismatch);
+
+  MinimizeCase(*ctx, &fc, failed_mode, &mismatch);
+  PrintReferenceTrace(*ctx, fc, failed_mode, mismatch.instruction);
+  PrintMismatch(fc, failed_mode, mismatch);
+
+  char filename[64];
+  std::snprintf(filename, sizeof(filename), "fuzz_%s_%016" PRIX64 ".txt", i8080::GetExecutionModeName(failed_mode),
+                GetCaseSeed(seed, failed_case));
+  if (SaveCase(filename, fc, failed_mode))
+    Log_InfoPrintf("Saved minimized case to %s", filename);
+
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[])
+{
+  Log::GetInstance().SetConsoleOutputParams(true);
+
+  if (argc >= 3 && std::strcmp(argv[1], "--replay") == 0)
+    return ReplayCase(argv[2]);
+
+  if (argc >= 2 && argv[1][0] == '-')
+  {
+    std::fprintf(stderr,
+                 "usage: %s [cases] [seed] [interpreter|cached|recompiler|all]\n"
+                 "       %s --replay <case file>\n",
+                 argv[0], argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const u64 case_count = (argc >= 2) ? std::strtoull(argv[1], nullptr, 10) : UINT64_C(100000);
+  const u64 seed = (argc >= 3) ? std::strtoull(argv[2], nullptr, 10) : UINT64_C(1);
+
+  // The interpreter mode still runs through ExecuteCycles(), with its own dispatch loop and slice handling.
+  std::vector<i8080::ExecutionMode> modes = {i8080::ExecutionMode::Interpreter, i8080::ExecutionMode::CachedInterpreter,
+                                             i8080::ExecutionMode::Recompiler};
+  if (argc >= 4 && std::strcmp(argv[3], "all") != 0)
+  {
+    modes.erase(std::remove_if(modes.begin(), modes.end(),
+                               [argv](i8080::ExecutionMode mode) {
+                                 return std::strcmp(argv[3], i8080::GetExecutionModeName(mode)) != 0;
+                               }),
+                modes.end());
+    if (modes.empty())
+    {
+      Log_ErrorPrintf("Unknown execution mode '%s'", argv[3]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return Fuzz(case_count, seed, modes);
+}
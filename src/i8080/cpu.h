@@ -1,79 +1,387 @@
 #pragma once
+#include "flag_tables.h"
+#include "instruction_info.h"
 #include "types.h"
 #include "YBaseLib/String.h"
+#include <array>
+#include <bitset>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class BinaryReader;
+class BinaryWriter;
+
+// Threaded dispatch relies on the "labels as values" extension, so it is only available with GCC and Clang.
+// Define I8080_DISABLE_THREADED_DISPATCH to build the portable switch-based interpreter instead.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(I8080_DISABLE_THREADED_DISPATCH)
+#define I8080_THREADED_DISPATCH 1
+#else
+#define I8080_THREADED_DISPATCH 0
+#endif
+
+// Execution tracing adds a check before every instruction, so it is only compiled in when I8080_ENABLE_TRACE is defined.
+// Otherwise TRACE_EXECUTION is a constant and the checks fold away.
+#if defined(I8080_ENABLE_TRACE)
+#define I8080_TRACE 1
+#else
+#define I8080_TRACE 0
+#endif
+
+// Likewise, profiling is only compiled in when I8080_ENABLE_PROFILE is defined.
+#if defined(I8080_ENABLE_PROFILE)
+#define I8080_PROFILE 1
+#else
+#define I8080_PROFILE 0
+#endif
 
 namespace i8080 {
 
 class Bus;
+class Profiler;
+class Recompiler;
+class TraceBuffer;
+struct StaticBlock;
+struct StaticCode;
+
+enum class ExecutionMode : u8
+{
+  // Fetch and decode every instruction from memory.
+  Interpreter,
+
+  // Decode straight-line runs of instructions once, and replay the decoded form on later visits.
+  CachedInterpreter,
+
+  // Translate decoded blocks to host code. Falls back to the cached interpreter on hosts without a code generator.
+  Recompiler,
 
+  // Run blocks translated ahead of time by staticrec (see SetStaticCode), and interpret everything else.
+  Static
+};
+
+inline const char* GetExecutionModeName(ExecutionMode mode)
+{
+  static constexpr const char* names[] = {"interpreter", "cached", "recompiler", "static"};
+  return names[static_cast<u8>(mode)];
+}
+
+// Called when execution reaches a trap address, see CPU::SetTrap(). Returns false to end the current slice.
+using TrapHandler = std::function<bool(MemoryAddress address)>;
+
+// BusType provides AddCycles, ReadMemory, WriteMemory, ReadIO and WriteIO. Instantiating the CPU with a concrete
+// (final) bus class lets the compiler inline the accesses, CPU<Bus> dispatches them through the virtual interface.
+// Template definitions live in cpu.inl, which must be included where a new bus type is instantiated.
+template<typename BusType = Bus>
 class CPU
 {
 public:
-  CPU(Bus* bus);
+  CPU(BusType* bus);
   ~CPU();
 
-  Bus* GetBus() const { return m_bus; }
+  BusType* GetBus() const { return m_bus; }
 
   const Registers& GetRegs() const { return m_regs; }
   Registers& GetRegs() { return m_regs; }
 
+  // Total number of instructions executed, for throughput measurements.
+  u64 GetExecutedInstructionCount() const { return m_executed_instructions; }
+
+  // Total number of cycles passed to the bus.
+  u64 GetExecutedCycleCount() const { return m_executed_cycles; }
+
+  // Set by hlt, until an interrupt is dispatched.
+  bool IsHalted() const { return m_halted; }
+
   void DisassembleInstruction(MemoryAddress address, String* dest) const;
   void GetStateString(String* dest) const;
 
   void Reset();
   void SingleStep();
 
+  // Serializes the registers, interrupt state and counters. States must be saved and loaded between slices, not from
+  // trap handlers. Memory belongs to the owner, which should call InvalidateCode() for any memory it restores.
+  bool LoadState(BinaryReader& reader);
+  bool SaveState(BinaryWriter& writer);
+
   void ExecuteCycles(CycleCount cycles);
 
   void InterruptRequest(bool enable, u8 vector = 0);
 
+  // While TRACE_EXECUTION is set, a record is appended to the buffer before each instruction. Without a buffer, the
+  // state and disassembly of each instruction is printed instead, which is far slower.
+  TraceBuffer* GetTraceBuffer() const { return m_trace_buffer; }
+  void SetTraceBuffer(TraceBuffer* buffer) { m_trace_buffer = buffer; }
+
+  // While a profiler is attached, instructions are executed one at a time and each is recorded along with calls and
+  // returns. Has no effect unless built with I8080_ENABLE_PROFILE.
+  Profiler* GetProfiler() const { return m_profiler; }
+  void SetProfiler(Profiler* profiler) { m_profiler = profiler; }
+
+  ExecutionMode GetExecutionMode() const { return m_execution_mode; }
+  void SetExecutionMode(ExecutionMode mode);
+
+  // Traps call the handler when execution reaches the address, before the instruction there executes, e.g. to provide
+  // operating system calls or high-level hooks. The handler sees up to date registers, and may modify them and memory.
+  // If PC is left at the trap address, the instruction executes as normal, otherwise execution continues from the new
+  // PC. Traps are not affected by Reset().
+  // The interpreter tests for a trap before each instruction. Decoded blocks end before trap addresses, so the cached
+  // interpreter, recompiler and static code only test between blocks, and run at full speed everywhere else.
+  void SetTrap(MemoryAddress address, TrapHandler handler);
+  void RemoveTrap(MemoryAddress address);
+
+  // Discards all decoded blocks. Writes made by the CPU are tracked automatically, but the owner must call this after
+  // modifying mapped memory from outside the CPU (e.g. loading a program) while the cached interpreter is in use.
+  void FlushCodeCache();
+
+  // Discards the decoded blocks overlapping a range of memory, which ends at the top of memory. Cheap for pages without
+  // code, so that restoring RAM for a save state doesn't throw away code decoded from ROM.
+  void InvalidateCode(MemoryAddress start_address, u32 size);
+
+  // Attaches code generated by staticrec for use in ExecutionMode::Static, or detaches it when null. Returns false if the
+  // memory it was translated from currently holds a different program. That memory must not be written while attached.
+  bool SetStaticCode(const StaticCode* code);
+
+  // Memory can be mapped directly into the CPU's page tables in 1KB pages, so that accesses are a single indexed
+  // load/store. Pages with a null read or write pointer fall back to the bus, which allows read-only and
+  // mirrored/unmapped regions to keep their existing handlers. Mappings are not affected by Reset().
+  // The cached interpreter only decodes blocks from pages mapped for reading, and assumes that a write through the bus
+  // can only modify memory at the address written, so mirrors of memory containing code should be left unmapped.
+  static constexpr u32 MEMORY_PAGE_SHIFT = 10;
+  static constexpr u32 MEMORY_PAGE_SIZE = 1u << MEMORY_PAGE_SHIFT;
+  static constexpr u32 MEMORY_PAGE_MASK = MEMORY_PAGE_SIZE - 1;
+  static constexpr u32 MEMORY_PAGE_COUNT = 0x10000u >> MEMORY_PAGE_SHIFT;
+
+  void MapMemory(MemoryAddress start_address, u32 size, const u8* read_ptr, u8* write_ptr);
+  void UnmapMemory(MemoryAddress start_address, u32 size);
+
 private:
+  enum class LoopMode
+  {
+    SingleStep,
+    Interpreter,
+    CachedInterpreter
+  };
+
+  // Handler index which replaces the opcode of every instruction in an invalidated block, so that a block which
+  // overwrites its own code leaves through the lookup path before reaching the stale instructions.
+  static constexpr u16 BLOCK_EXIT_HANDLER = 0x100;
+
+  // Handlers for ALU instructions whose flags are all overwritten before being read, which only compute the result:
+  // 0x80-0xBF, then the eight immediate forms, then inr and dcr for each register.
+  static constexpr u16 FLAGLESS_HANDLER_BASE = BLOCK_EXIT_HANDLER + 1;
+  static constexpr u16 GetFlaglessHandler(u8 opcode)
+  {
+    if (opcode >= 0x80 && opcode < 0xC0)
+      return FLAGLESS_HANDLER_BASE + (opcode - 0x80);
+    else if ((opcode & 0xC7) == 0xC6)
+      return FLAGLESS_HANDLER_BASE + 64 + ((opcode >> 3) & 7);
+    else if ((opcode & 0xC7) == 0x04)
+      return FLAGLESS_HANDLER_BASE + 72 + ((opcode >> 3) & 7);
+    else if ((opcode & 0xC7) == 0x05)
+      return FLAGLESS_HANDLER_BASE + 80 + ((opcode >> 3) & 7);
+    else
+      return opcode;
+  }
+
+  // Handlers which run both instructions of a pair in FUSED_PAIRS, in the same order.
+  static constexpr u16 FUSED_HANDLER_BASE = FLAGLESS_HANDLER_BASE + 64 + 8 + 8 + 8;
+  static constexpr u16 HANDLER_COUNT = FUSED_HANDLER_BASE + static_cast<u16>(FUSED_PAIRS.size());
+
+  // Returns the fused handler for a pair of opcodes, or zero if the pair isn't fused.
+  static constexpr u16 GetFusedHandler(u8 first, u8 second)
+  {
+    for (u16 i = 0; i < static_cast<u16>(FUSED_PAIRS.size()); i++)
+    {
+      if (FUSED_PAIRS[i].first == first && FUSED_PAIRS[i].second == second)
+        return FUSED_HANDLER_BASE + i;
+    }
+
+    return 0;
+  }
+
+  static constexpr u32 MAX_BLOCK_INSTRUCTIONS = 64;
+
+  static constexpr u32 SAVE_STATE_SIGNATURE = 0x53555043;
+
+  struct CodeBlock
+  {
+    MemoryAddress start_pc;
+    u32 end_address; // one past the last byte of the last instruction
+    u32 first_page;
+    u32 last_page;
+
+    // Sum of the instruction timings, assuming every conditional call/return is taken.
+    CycleCount max_cycles;
+
+    // Translated prefix of the block, and its worst case timing. Null when the block is only interpreted.
+    const void* host_code;
+    CycleCount host_max_cycles;
+
+    // The block only reads memory and modifies registers, and ends with a jump back to its start. If an iteration leaves
+    // the registers unchanged, every later iteration will too until an interrupt, so the loop can be skipped.
+    bool idle_loop;
+
+    std::vector<DecodedInstruction> instructions;
+  };
+
+  struct CodePage
+  {
+    // Blocks starting in this page, indexed by the offset of their first instruction.
+    std::array<std::unique_ptr<CodeBlock>, MEMORY_PAGE_SIZE> blocks_by_offset;
+
+    // Every block with instructions in this page, including ones which started in the previous page.
+    std::vector<CodeBlock*> blocks;
+
+    // Bytes which belong to at least one decoded instruction. Writes to other bytes in the page skip invalidation.
+    std::bitset<MEMORY_PAGE_SIZE> code_bytes;
+  };
+
   u8 ReadMemoryByte(MemoryAddress address);
   u16 ReadMemoryWord(MemoryAddress address);
   void WriteMemoryByte(MemoryAddress address, u8 value);
   void WriteMemoryWord(MemoryAddress address, u16 value);
-  void PushWord(u16 value);
-  u16 PopWord();
+  void PushWord(Registers& regs, u16 value);
+  u16 PopWord(Registers& regs);
   u8 ReadIOByte(u8 port);
   void WriteIOByte(u8 port, u8 value);
   void DispatchInterrupt();
   void Halt();
 
-  void ExecuteInstruction();
+  // Dispatches pending interrupts and traps, and returns true if there are cycles left to execute an instruction.
+  bool BeginInstruction();
+
+  bool IsTrapAddress(MemoryAddress address) const { return m_trap_addresses[address]; }
+
+  // Calls the handler for the trap at PC. Returns true if the instruction at PC should execute next, or false if the
+  // handler moved PC or ended the slice.
+  bool RunTrapHandler();
+  void TraceInstruction();
+
+  // Executes one instruction, recording it in the profiler if one is attached.
+  void StepInstruction();
+  bool IsProfiling() const { return I8080_PROFILE && m_profiler; }
+
+  template<LoopMode mode>
+  void ExecuteInstructions();
+
+  CodeBlock* LookupBlock(MemoryAddress pc);
+  CodeBlock* CompileBlock(MemoryAddress pc);
+  void InvalidateCode(MemoryAddress address);
+  void InvalidateBlock(CodeBlock* block);
+  void RemoveBlockFromPage(u32 page_index, CodeBlock* block);
+  bool CompileHostCode(CodeBlock* block);
+  void SkipIdleLoop(const CodeBlock* block);
+
+  void ExecuteStaticCode();
+  void BuildStaticBlockTable();
+  const StaticBlock* LookupStaticBlock(MemoryAddress pc) const
+  {
+    const u32 offset = ZeroExtend32(pc) - m_static_code_start;
+    return (offset < m_static_code_size) ? m_static_block_table[offset] : nullptr;
+  }
 
-  u8 ReadImmediateByte();
-  u16 ReadImmediateWord();
+  // Entry points for code generated by the recompiler, also used by static code.
+  static u8 RecompilerReadMemory(void* cpu, u32 address);
+  static void RecompilerWriteMemory(void* cpu, u32 address, u32 value);
+  static void RecompilerInterpretInstruction(void* cpu);
+
+  // Helpers used by the instruction handlers take the registers as a parameter, since the handlers work on a copy which
+  // is only written back to m_regs when leaving the execution loop.
+  u8 ReadImmediateByte(Registers& regs);
+  u16 ReadImmediateWord(Registers& regs);
+
+  void SetLazyFlags(FlagOp op, u8 result, u8 operands = 0);
+  bool GetFlagS(const Registers& regs) const;
+  bool GetFlagZ(const Registers& regs) const;
+  bool GetFlagH(const Registers& regs) const;
+  bool GetFlagP(const Registers& regs) const;
+  void MaterializeFlags(Registers& regs);
 
   u8 op_inr(u8 rhs);
   u8 op_dcr(u8 rhs);
-  u8 op_add(u8 lhs, u8 rhs);
-  u8 op_adc(u8 lhs, u8 rhs);
-  u8 op_sub(u8 lhs, u8 rhs);
-  u8 op_sbb(u8 lhs, u8 rhs);
-  u8 op_and(u8 lhs, u8 rhs);
-  u8 op_xor(u8 lhs, u8 rhs);
-  u8 op_or(u8 lhs, u8 rhs);
-  u8 op_rlc(u8 rhs);
-  u8 op_rrc(u8 rhs);
-  u8 op_ral(u8 rhs);
-  u8 op_rar(u8 rhs);
-  u8 op_daa(u8 rhs);
-  u16 op_dad(u16 lhs, u16 rhs);
-  void op_jmp(u16 rhs);
-  void op_call(u16 rhs);
-  void op_ret();
-  void op_xthl();
-
-  Bus* m_bus;
+  u8 op_add(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_adc(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_sub(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_sbb(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_and(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_xor(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_or(Registers& regs, u8 lhs, u8 rhs);
+  u8 op_rlc(Registers& regs, u8 rhs);
+  u8 op_rrc(Registers& regs, u8 rhs);
+  u8 op_ral(Registers& regs, u8 rhs);
+  u8 op_rar(Registers& regs, u8 rhs);
+  u8 op_daa(Registers& regs, u8 rhs);
+  u16 op_dad(Registers& regs, u16 lhs, u16 rhs);
+  void op_jmp(Registers& regs, u16 rhs);
+  void op_call(Registers& regs, u16 rhs);
+  void op_ret(Registers& regs);
+  void op_xthl(Registers& regs);
+
+  BusType* m_bus;
+  std::array<const u8*, MEMORY_PAGE_COUNT> m_read_page_table = {};
+  std::array<u8*, MEMORY_PAGE_COUNT> m_write_page_table = {};
+
+  // Write pointers as mapped. m_write_page_table holds null for pages containing decoded code, so that writes take the
+  // slow path and can invalidate the blocks.
+  std::array<u8*, MEMORY_PAGE_COUNT> m_mapped_write_page_table = {};
+
+  std::array<std::unique_ptr<CodePage>, MEMORY_PAGE_COUNT> m_code_pages;
+
+  // Invalidated blocks may still be executing, so they are only freed at the next block lookup.
+  std::vector<std::unique_ptr<CodeBlock>> m_invalidated_blocks;
+
+  std::unique_ptr<Recompiler> m_recompiler;
+
+  // Static code and its blocks indexed by start address, relative to the start of the translated memory.
+  const StaticCode* m_static_code = nullptr;
+  std::unique_ptr<const StaticBlock*[]> m_static_block_table;
+  u32 m_static_code_start = 0;
+  u32 m_static_code_size = 0;
+
+  std::bitset<0x10000> m_trap_addresses;
+  std::unordered_map<MemoryAddress, TrapHandler> m_trap_handlers;
+
+  // State on the last entry to an idle loop candidate, compared on the next entry to detect a loop which is waiting for
+  // an interrupt.
+  const CodeBlock* m_idle_loop_block = nullptr;
+  Registers m_idle_loop_regs = {};
+  u64 m_idle_loop_executed_instructions = 0;
+  u32 m_idle_loop_bus_reads = 0;
+
+  // Number of memory reads handled by the bus, which may have side effects or return different values each time.
+  u32 m_bus_reads = 0;
+
   CycleCount m_cycles_left = 0;
   CycleCount m_pending_cycles = 0;
   Registers m_regs = {};
+
+  // S, Z, H and P are evaluated lazily: ALU instructions record their result, and the bits in m_regs.f are only rebuilt
+  // when an instruction reads them, or before the registers are visible outside of the CPU. Carry is always up to date.
+  FlagOp m_flag_op = FlagOp::None;
+  u8 m_flag_result = 0;
+  u8 m_flag_operands = 0;
+
+  u64 m_executed_instructions = 0;
+  u64 m_executed_cycles = 0;
+  TraceBuffer* m_trace_buffer = nullptr;
+  Profiler* m_profiler = nullptr;
+  ExecutionMode m_execution_mode = ExecutionMode::Interpreter;
   bool m_halted = false;
+
+  // Set whenever a block is invalidated, so that generated code can stop after a write which modified code.
+  bool m_code_invalidated = false;
   bool m_interrupt_enabled = true;
   bool m_interrupt_request = false;
   u8 m_interrupt_request_vector = 0;
 };
 
+extern template class CPU<Bus>;
+
+#if I8080_TRACE
 extern bool TRACE_EXECUTION;
+#else
+constexpr bool TRACE_EXECUTION = false;
+#endif
 
 } // namespace i8080
\ No newline at end of file
@@ -0,0 +1,1694 @@
+#pragma once
+#include "cpu.h"
+#include "disassembler.h"
+#include "instruction_info.h"
+#include "profiler.h"
+#include "recompiler.h"
+#include "static_code.h"
+#include "trace.h"
+#include "YBaseLib/Assert.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/Memory.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+// Template implementation of the CPU core. Include this in the translation unit which explicitly instantiates
+// CPU for a bus type, so that the bus's memory and I/O handlers can be inlined into the instruction handlers.
+
+namespace i8080 {
+
+template<typename BusType>
+CPU<BusType>::CPU(BusType* bus) : m_bus(bus)
+{
+  Reset();
+}
+
+template<typename BusType>
+CPU<BusType>::~CPU() = default;
+
+template<typename BusType>
+void CPU<BusType>::DisassembleInstruction(MemoryAddress address, String* dest) const
+{
+  u8 bytes[3];
+  bytes[0] = m_bus->ReadMemory(address);
+  for (u8 i = 1; i < INSTRUCTION_INFO[bytes[0]].length; i++)
+    bytes[i] = m_bus->ReadMemory(static_cast<MemoryAddress>(address + i));
+
+  Disassemble(address, bytes, dest);
+}
+
+template<typename BusType>
+void CPU<BusType>::GetStateString(String* dest) const
+{
+  SmallString disasm;
+  DisassembleInstruction(m_regs.pc, &disasm);
+
+  dest->Format("A: %02X F: %02X_%c%c%c%c%c B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X %s", m_regs.a,
+               m_regs.f.bits, m_regs.f.s ? 'S' : 's', m_regs.f.z ? 'Z' : 'z', m_regs.f.h ? 'H' : 'h',
+               m_regs.f.p ? 'P' : 'p', m_regs.f.c ? 'C' : 'c', m_regs.b, m_regs.c, m_regs.d, m_regs.e, m_regs.h,
+               m_regs.l, m_regs.sp, disasm.GetCharArray());
+}
+
+template<typename BusType>
+void CPU<BusType>::Reset()
+{
+  std::memset(static_cast<void*>(&m_regs), 0, sizeof(m_regs));
+  m_flag_op = FlagOp::None;
+  m_cycles_left = 0;
+  m_pending_cycles = 0;
+  m_halted = false;
+  m_interrupt_enabled = true;
+  m_interrupt_request = false;
+  m_interrupt_request_vector = 0;
+}
+
+template<typename BusType>
+bool CPU<BusType>::LoadState(BinaryReader& reader)
+{
+  u32 signature;
+  if (!reader.SafeReadUInt32(&signature) || signature != SAVE_STATE_SIGNATURE)
+    return false;
+
+  Registers regs = {};
+  if (!reader.SafeReadUInt16(&regs.bc) || !reader.SafeReadUInt16(&regs.de) || !reader.SafeReadUInt16(&regs.hl) ||
+      !reader.SafeReadUInt16(&regs.af) || !reader.SafeReadUInt16(&regs.sp) || !reader.SafeReadUInt16(&regs.pc) ||
+      !reader.SafeReadUInt64(&m_executed_instructions) || !reader.SafeReadUInt64(&m_executed_cycles) ||
+      !reader.SafeReadBool(&m_halted) || !reader.SafeReadBool(&m_interrupt_enabled) ||
+      !reader.SafeReadBool(&m_interrupt_request) || !reader.SafeReadUInt8(&m_interrupt_request_vector))
+  {
+    return false;
+  }
+
+  std::memcpy(static_cast<void*>(&m_regs), &regs, sizeof(m_regs));
+  m_flag_op = FlagOp::None;
+  m_cycles_left = 0;
+  m_pending_cycles = 0;
+  m_idle_loop_block = nullptr;
+  return true;
+}
+
+template<typename BusType>
+bool CPU<BusType>::SaveState(BinaryWriter& writer)
+{
+  DebugAssert(m_pending_cycles == 0);
+
+  // The flags are saved in F, rather than as the operation which produces them.
+  MaterializeFlags(m_regs);
+
+  return (writer.SafeWriteUInt32(SAVE_STATE_SIGNATURE) && writer.SafeWriteUInt16(m_regs.bc) &&
+          writer.SafeWriteUInt16(m_regs.de) && writer.SafeWriteUInt16(m_regs.hl) &&
+          writer.SafeWriteUInt16(m_regs.af) && writer.SafeWriteUInt16(m_regs.sp) &&
+          writer.SafeWriteUInt16(m_regs.pc) && writer.SafeWriteUInt64(m_executed_instructions) &&
+          writer.SafeWriteUInt64(m_executed_cycles) && writer.SafeWriteBool(m_halted) &&
+          writer.SafeWriteBool(m_interrupt_enabled) && writer.SafeWriteBool(m_interrupt_request) &&
+          writer.SafeWriteUInt8(m_interrupt_request_vector));
+}
+
+template<typename BusType>
+void CPU<BusType>::SingleStep()
+{
+  DispatchInterrupt();
+  if (m_halted || (IsTrapAddress(m_regs.pc) && !RunTrapHandler()))
+    return;
+
+  if (TRACE_EXECUTION)
+    TraceInstruction();
+
+  StepInstruction();
+
+  m_bus->AddCycles(m_pending_cycles);
+  m_executed_cycles += static_cast<u64>(m_pending_cycles);
+  m_pending_cycles = 0;
+}
+
+template<typename BusType>
+void CPU<BusType>::ExecuteCycles(CycleCount cycles)
+{
+  m_cycles_left += cycles;
+
+  // Memory may have been modified from outside the CPU since the last slice.
+  m_idle_loop_block = nullptr;
+
+  if (TRACE_EXECUTION || IsProfiling())
+  {
+    // Tracing and profiling need a hook around every instruction, so step one at a time.
+    while (BeginInstruction())
+    {
+      if (TRACE_EXECUTION)
+        TraceInstruction();
+
+      StepInstruction();
+    }
+  }
+  else if (m_execution_mode == ExecutionMode::Static)
+  {
+    ExecuteStaticCode();
+  }
+  else if (m_execution_mode != ExecutionMode::Interpreter)
+  {
+    ExecuteInstructions<LoopMode::CachedInterpreter>();
+  }
+  else if (BeginInstruction())
+  {
+    ExecuteInstructions<LoopMode::Interpreter>();
+  }
+
+  MaterializeFlags(m_regs);
+  m_bus->AddCycles(m_pending_cycles);
+  m_executed_cycles += static_cast<u64>(m_pending_cycles);
+  m_pending_cycles = 0;
+}
+
+template<typename BusType>
+void CPU<BusType>::InterruptRequest(bool enable, u8 vector)
+{
+  m_interrupt_request = enable;
+  m_interrupt_request_vector = vector;
+}
+
+template<typename BusType>
+void CPU<BusType>::SetExecutionMode(ExecutionMode mode)
+{
+  if (m_execution_mode == mode)
+    return;
+
+  FlushCodeCache();
+  m_invalidated_blocks.clear();
+  m_recompiler.reset();
+
+#if I8080_RECOMPILER_SUPPORTED
+  if (mode == ExecutionMode::Recompiler)
+  {
+    auto Offset = [this](const void* member) {
+      return static_cast<u32>(static_cast<const u8*>(member) - reinterpret_cast<const u8*>(this));
+    };
+
+    Recompiler::StateLayout layout;
+    layout.regs = Offset(&m_regs);
+    layout.cycles_left = Offset(&m_cycles_left);
+    layout.pending_cycles = Offset(&m_pending_cycles);
+    layout.executed_instructions = Offset(&m_executed_instructions);
+    layout.interrupt_enabled = Offset(&m_interrupt_enabled);
+    layout.code_invalidated = Offset(&m_code_invalidated);
+    layout.read_page_table = Offset(m_read_page_table.data());
+    layout.write_page_table = Offset(m_write_page_table.data());
+
+    Recompiler::Helpers helpers;
+    helpers.read_memory = &CPU::RecompilerReadMemory;
+    helpers.write_memory = &CPU::RecompilerWriteMemory;
+    helpers.interpret_instruction = &CPU::RecompilerInterpretInstruction;
+
+    m_recompiler = std::make_unique<Recompiler>(layout, helpers);
+  }
+#else
+  if (mode == ExecutionMode::Recompiler)
+    mode = ExecutionMode::CachedInterpreter;
+#endif
+
+  m_execution_mode = mode;
+}
+
+template<typename BusType>
+void CPU<BusType>::SetTrap(MemoryAddress address, TrapHandler handler)
+{
+  m_trap_handlers[address] = std::move(handler);
+  if (IsTrapAddress(address))
+    return;
+
+  // Blocks decoded across the address must now end before it, and generated code must not be entered there.
+  m_trap_addresses[address] = true;
+  if (m_code_pages[address >> MEMORY_PAGE_SHIFT])
+    InvalidateCode(address);
+  if (m_static_code)
+    BuildStaticBlockTable();
+}
+
+template<typename BusType>
+void CPU<BusType>::RemoveTrap(MemoryAddress address)
+{
+  if (!IsTrapAddress(address))
+    return;
+
+  // Let the block at the address be decoded again with generated code and idle loop detection.
+  m_trap_handlers.erase(address);
+  m_trap_addresses[address] = false;
+  if (m_code_pages[address >> MEMORY_PAGE_SHIFT])
+    InvalidateCode(address);
+  if (m_static_code)
+    BuildStaticBlockTable();
+}
+
+template<typename BusType>
+bool CPU<BusType>::SetStaticCode(const StaticCode* code)
+{
+  m_static_code = nullptr;
+  m_static_block_table.reset();
+  m_static_code_start = 0;
+  m_static_code_size = 0;
+  if (!code)
+    return true;
+
+  std::vector<u8> memory(code->size);
+  for (u32 i = 0; i < code->size; i++)
+    memory[i] = m_bus->ReadMemory(static_cast<MemoryAddress>(code->start_address + i));
+  if (ComputeStaticCodeChecksum(memory.data(), code->size) != code->checksum)
+    return false;
+
+  m_static_block_table = std::make_unique<const StaticBlock*[]>(code->size);
+  m_static_code = code;
+  m_static_code_start = code->start_address;
+  m_static_code_size = code->size;
+  BuildStaticBlockTable();
+  return true;
+}
+
+template<typename BusType>
+void CPU<BusType>::BuildStaticBlockTable()
+{
+  std::fill_n(m_static_block_table.get(), m_static_code_size, nullptr);
+  for (u32 i = 0; i < m_static_code->block_count; i++)
+  {
+    // Blocks always run to the end, so those with a trap after their first instruction are left to the interpreter.
+    const StaticBlock& block = m_static_code->blocks[i];
+    const u32 end_address = ZeroExtend32(block.start_pc) + block.length;
+    bool contains_trap = false;
+    for (u32 address = ZeroExtend32(block.start_pc) + 1; address < end_address && !contains_trap; address++)
+      contains_trap = IsTrapAddress(static_cast<MemoryAddress>(address));
+
+    if (!contains_trap)
+      m_static_block_table[block.start_pc - m_static_code_start] = &block;
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::FlushCodeCache()
+{
+  for (std::unique_ptr<CodePage>& page : m_code_pages)
+  {
+    while (page && !page->blocks.empty())
+      InvalidateBlock(page->blocks.back());
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::InvalidateCode(MemoryAddress start_address, u32 size)
+{
+  if (size == 0)
+    return;
+
+  // Blocks in the same pages are kept, since the host often writes data next to code (e.g. CP/M's DMA buffer).
+  const u32 start = ZeroExtend32(start_address);
+  const u32 end = std::min(start + size, 0x10000u);
+  for (u32 page_index = start >> MEMORY_PAGE_SHIFT; page_index <= ((end - 1) >> MEMORY_PAGE_SHIFT); page_index++)
+  {
+    CodePage* page = m_code_pages[page_index].get();
+    if (!page)
+      continue;
+
+    for (size_t i = 0; i < page->blocks.size();)
+    {
+      CodeBlock* block = page->blocks[i];
+      if (block->start_pc < end && block->end_address > start)
+        InvalidateBlock(block);
+      else
+        i++;
+    }
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::MapMemory(MemoryAddress start_address, u32 size, const u8* read_ptr, u8* write_ptr)
+{
+  DebugAssert((start_address & MEMORY_PAGE_MASK) == 0 && (size & MEMORY_PAGE_MASK) == 0);
+  DebugAssert((ZeroExtend32(start_address) + size) <= 0x10000);
+
+  // Decoded blocks may refer to the old mapping.
+  FlushCodeCache();
+
+  const u32 start_page = ZeroExtend32(start_address) >> MEMORY_PAGE_SHIFT;
+  const u32 num_pages = size >> MEMORY_PAGE_SHIFT;
+  for (u32 i = 0; i < num_pages; i++)
+  {
+    const u32 offset = i * MEMORY_PAGE_SIZE;
+    m_read_page_table[start_page + i] = read_ptr ? (read_ptr + offset) : nullptr;
+    m_write_page_table[start_page + i] = write_ptr ? (write_ptr + offset) : nullptr;
+    m_mapped_write_page_table[start_page + i] = m_write_page_table[start_page + i];
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::UnmapMemory(MemoryAddress start_address, u32 size)
+{
+  MapMemory(start_address, size, nullptr, nullptr);
+}
+
+template<typename BusType>
+u8 CPU<BusType>::ReadMemoryByte(MemoryAddress address)
+{
+  const u8* page = m_read_page_table[address >> MEMORY_PAGE_SHIFT];
+  if (page)
+    return page[address & MEMORY_PAGE_MASK];
+
+  m_bus_reads++;
+  return m_bus->ReadMemory(address);
+}
+
+template<typename BusType>
+u16 CPU<BusType>::ReadMemoryWord(MemoryAddress address)
+{
+  const u8 low = ReadMemoryByte(address);
+  const u8 high = ReadMemoryByte(static_cast<MemoryAddress>(address + 1));
+  return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+}
+
+template<typename BusType>
+void CPU<BusType>::WriteMemoryByte(MemoryAddress address, u8 value)
+{
+  u8* page = m_write_page_table[address >> MEMORY_PAGE_SHIFT];
+  if (page)
+  {
+    page[address & MEMORY_PAGE_MASK] = value;
+    return;
+  }
+
+  const u32 page_index = address >> MEMORY_PAGE_SHIFT;
+  const u32 offset = address & MEMORY_PAGE_MASK;
+  u8* mapped_page = m_mapped_write_page_table[page_index];
+  const CodePage* code_page = m_code_pages[page_index].get();
+  if (code_page && code_page->code_bytes[offset])
+  {
+    // Compare through the read mapping, so that writes the bus discards (e.g. to ROM) keep the blocks.
+    const u8* read_page = m_read_page_table[page_index];
+    const u8 old_value = read_page[offset];
+    if (mapped_page)
+      mapped_page[offset] = value;
+    else
+      m_bus->WriteMemory(address, value);
+
+    if (read_page[offset] != old_value)
+      InvalidateCode(address);
+
+    return;
+  }
+
+  if (mapped_page)
+    mapped_page[offset] = value;
+  else
+    m_bus->WriteMemory(address, value);
+}
+
+template<typename BusType>
+void CPU<BusType>::WriteMemoryWord(MemoryAddress address, u16 value)
+{
+  WriteMemoryByte(address, Truncate8(value));
+  WriteMemoryByte(static_cast<MemoryAddress>(address + 1), Truncate8(value >> 8));
+}
+
+template<typename BusType>
+void CPU<BusType>::PushWord(Registers& regs, u16 value)
+{
+  WriteMemoryByte(--regs.sp, Truncate8(value >> 8));
+  WriteMemoryByte(--regs.sp, Truncate8(value));
+}
+
+template<typename BusType>
+u16 CPU<BusType>::PopWord(Registers& regs)
+{
+  const u8 low = ReadMemoryByte(regs.sp++);
+  const u8 high = ReadMemoryByte(regs.sp++);
+  return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+}
+
+template<typename BusType>
+u8 CPU<BusType>::ReadIOByte(u8 port)
+{
+  return m_bus->ReadIO(ZeroExtend16(port));
+}
+
+template<typename BusType>
+void CPU<BusType>::WriteIOByte(u8 port, u8 value)
+{
+  return m_bus->WriteIO(ZeroExtend16(port), value);
+}
+
+template<typename BusType>
+void CPU<BusType>::DispatchInterrupt()
+{
+  if (!(m_interrupt_request & m_interrupt_enabled))
+    return;
+
+  PushWord(m_regs, m_regs.pc);
+  m_regs.pc = ZeroExtend16(m_interrupt_request_vector) * u16(8);
+  if (IsProfiling())
+    m_profiler->RecordCall(m_regs.pc);
+
+  m_interrupt_enabled = false;
+  m_interrupt_request = false;
+  m_interrupt_request_vector = 0;
+  m_halted = false;
+  m_idle_loop_block = nullptr;
+}
+
+template<typename BusType>
+void CPU<BusType>::Halt()
+{
+  m_halted = true;
+  if (m_cycles_left > 0)
+  {
+    m_pending_cycles += m_cycles_left;
+    m_cycles_left = 0;
+  }
+}
+
+template<typename BusType>
+bool CPU<BusType>::BeginInstruction()
+{
+  // A trap handler can move PC to another trap, or enable interrupts.
+  for (;;)
+  {
+    if (m_cycles_left <= 0)
+      return false;
+
+    DispatchInterrupt();
+    if (m_halted)
+    {
+      // Still halted at the start of a slice, so time passes until the next interrupt.
+      Halt();
+      return false;
+    }
+
+    if (!IsTrapAddress(m_regs.pc) || RunTrapHandler())
+      return true;
+  }
+}
+
+template<typename BusType>
+bool CPU<BusType>::RunTrapHandler()
+{
+  const MemoryAddress address = m_regs.pc;
+  MaterializeFlags(m_regs);
+
+  // Copied, since the handler may replace or remove its own trap.
+  const TrapHandler handler = m_trap_handlers[address];
+  if (!handler(address))
+  {
+    if (m_cycles_left > 0)
+      m_cycles_left = 0;
+
+    return false;
+  }
+
+  return (m_regs.pc == address);
+}
+
+template<typename BusType>
+typename CPU<BusType>::CodeBlock* CPU<BusType>::LookupBlock(MemoryAddress pc)
+{
+  // Nothing can still be executing from an invalidated block once we are looking for the next one.
+  if (!m_invalidated_blocks.empty())
+    m_invalidated_blocks.clear();
+
+  const CodePage* page = m_code_pages[pc >> MEMORY_PAGE_SHIFT].get();
+  if (page)
+  {
+    CodeBlock* block = page->blocks_by_offset[pc & MEMORY_PAGE_MASK].get();
+    if (block)
+      return block;
+  }
+
+  CodeBlock* block = CompileBlock(pc);
+  if (block && m_recompiler && !CompileHostCode(block))
+  {
+    // The code buffer is full. Nothing is executing, so discard every block and start again.
+    FlushCodeCache();
+    m_recompiler->Reset();
+    block = CompileBlock(pc);
+    CompileHostCode(block);
+  }
+
+  return block;
+}
+
+template<typename BusType>
+typename CPU<BusType>::CodeBlock* CPU<BusType>::CompileBlock(MemoryAddress pc)
+{
+  auto ReadCodeByte = [this](u32 address) {
+    return m_read_page_table[address >> MEMORY_PAGE_SHIFT][address & MEMORY_PAGE_MASK];
+  };
+
+  const u32 first_page = pc >> MEMORY_PAGE_SHIFT;
+  if (!m_read_page_table[first_page])
+    return nullptr;
+
+  std::unique_ptr<CodeBlock> block = std::make_unique<CodeBlock>();
+  block->start_pc = pc;
+  block->end_address = pc;
+  block->first_page = first_page;
+  block->last_page = first_page;
+  block->max_cycles = 0;
+  block->host_code = nullptr;
+  block->host_max_cycles = 0;
+  block->idle_loop = false;
+
+  u32 address = pc;
+  for (;;)
+  {
+    const u8 opcode = ReadCodeByte(address);
+    const InstructionInfo& info = INSTRUCTION_INFO[opcode];
+    const u32 end_address = address + info.length;
+    const u32 last_page = (end_address - 1) >> MEMORY_PAGE_SHIFT;
+    if (end_address > 0x10000 || !m_read_page_table[last_page])
+      break;
+
+    DecodedInstruction instruction;
+    instruction.handler = opcode;
+    instruction.opcode = opcode;
+    instruction.operand = 0;
+    instruction.pc = static_cast<MemoryAddress>(address);
+    instruction.length = info.length;
+    if (info.length >= 2)
+      instruction.operand = ZeroExtend16(ReadCodeByte(address + 1));
+    if (info.length == 3)
+      instruction.operand |= ZeroExtend16(ReadCodeByte(address + 2)) << 8;
+
+    block->instructions.push_back(instruction);
+    block->max_cycles += info.cycles;
+    block->end_address = end_address;
+    block->last_page = last_page;
+
+    address = end_address;
+    if ((info.flags & InstructionFlag_EndsBlock) || block->instructions.size() == MAX_BLOCK_INSTRUCTIONS ||
+        address >= 0x10000 || !m_read_page_table[address >> MEMORY_PAGE_SHIFT] ||
+        IsTrapAddress(static_cast<MemoryAddress>(address)))
+    {
+      break;
+    }
+  }
+
+  // An instruction running off the end of mapped memory is left to the interpreter.
+  if (block->instructions.empty())
+    return nullptr;
+
+  // Walk the block backwards to find ALU instructions whose flags are all overwritten before anything reads them, and
+  // switch them to handlers which only compute the result. Every flag is live at the end of the block, and after each
+  // write to memory, since the write may invalidate the rest of the block.
+  u8 live_flags = FlagMask_All;
+  for (auto it = block->instructions.rbegin(); it != block->instructions.rend(); ++it)
+  {
+    const u8 written = GetFlagsWritten(it->opcode);
+    if (INSTRUCTION_INFO[it->opcode].flags & InstructionFlag_HasSideEffects)
+      live_flags = FlagMask_All;
+    if (written != 0 && (written & live_flags) == 0)
+      it->handler = GetFlaglessHandler(it->opcode);
+
+    live_flags = (live_flags & ~written) | GetFlagsRead(it->opcode);
+  }
+
+  // Run frequent pairs with a single handler. Pairs are only fused when the first instruction doesn't write memory,
+  // since a write could invalidate the second.
+  for (size_t i = 0; i + 1 < block->instructions.size(); i++)
+  {
+    DecodedInstruction& first = block->instructions[i];
+    if (first.handler != first.opcode || (INSTRUCTION_INFO[first.opcode].flags & InstructionFlag_HasSideEffects))
+      continue;
+
+    const u16 fused_handler = GetFusedHandler(first.opcode, block->instructions[i + 1].opcode);
+    if (fused_handler != 0)
+    {
+      first.handler = fused_handler;
+      i++;
+    }
+  }
+
+  const DecodedInstruction& last = block->instructions.back();
+  const u8 last_opcode = last.opcode;
+  const bool jumps_to_start =
+    (last_opcode == 0xC3 || last_opcode == 0xCB || (last_opcode & 0xC7) == 0xC2) && last.operand == pc;
+  block->idle_loop =
+    jumps_to_start && !IsTrapAddress(pc) &&
+    std::none_of(block->instructions.begin(), block->instructions.end(), [](const DecodedInstruction& i) {
+      return (INSTRUCTION_INFO[i.opcode].flags & InstructionFlag_HasSideEffects) != 0;
+    });
+
+  for (u32 page_index = block->first_page; page_index <= block->last_page; page_index++)
+  {
+    std::unique_ptr<CodePage>& page = m_code_pages[page_index];
+    if (!page)
+      page = std::make_unique<CodePage>();
+
+    page->blocks.push_back(block.get());
+
+    const u32 page_start = page_index << MEMORY_PAGE_SHIFT;
+    const u32 first_byte = std::max(page_start, ZeroExtend32(block->start_pc));
+    const u32 last_byte = std::min(page_start + MEMORY_PAGE_SIZE, block->end_address);
+    for (u32 byte = first_byte; byte < last_byte; byte++)
+      page->code_bytes.set(byte & MEMORY_PAGE_MASK);
+
+    // Route writes to this page through the slow path, which checks code_bytes.
+    m_write_page_table[page_index] = nullptr;
+  }
+
+  CodeBlock* block_ptr = block.get();
+  m_code_pages[first_page]->blocks_by_offset[pc & MEMORY_PAGE_MASK] = std::move(block);
+  return block_ptr;
+}
+
+template<typename BusType>
+bool CPU<BusType>::CompileHostCode(CodeBlock* block)
+{
+  const u32 count =
+    Recompiler::GetCompilableInstructionCount(block->instructions.data(), static_cast<u32>(block->instructions.size()));
+  // Generated code jumps between blocks without returning to the CPU, so blocks starting at a trap are interpreted.
+  if (count == 0 || IsTrapAddress(block->start_pc) || !m_recompiler->ShouldCompileBlock(block->start_pc))
+    return true;
+
+  CycleCount max_cycles = 0;
+  for (u32 i = 0; i < count; i++)
+    max_cycles += INSTRUCTION_INFO[block->instructions[i].opcode].cycles;
+
+  block->host_code =
+    m_recompiler->CompileBlock(block->start_pc, block->instructions.data(), count, max_cycles, !block->idle_loop);
+  block->host_max_cycles = max_cycles;
+  return (block->host_code != nullptr);
+}
+
+template<typename BusType>
+void CPU<BusType>::SkipIdleLoop(const CodeBlock* block)
+{
+  MaterializeFlags(m_regs);
+
+  // If the last iteration ran the whole block without any other code in between, and finished with the same registers
+  // without reading from the bus, it is waiting for an interrupt to change memory. Interrupts are only raised between
+  // slices, so skip every full iteration that fits in this one and let the remaining part run normally.
+  if (block == m_idle_loop_block && m_bus_reads == m_idle_loop_bus_reads &&
+      m_executed_instructions == m_idle_loop_executed_instructions + block->instructions.size() &&
+      std::memcmp(&m_regs, &m_idle_loop_regs, sizeof(m_regs)) == 0)
+  {
+    const CycleCount iterations = (m_cycles_left - 1) / block->max_cycles;
+    const CycleCount cycles = iterations * block->max_cycles;
+    m_cycles_left -= cycles;
+    m_pending_cycles += cycles;
+    m_executed_instructions += static_cast<u64>(iterations) * block->instructions.size();
+  }
+
+  m_idle_loop_block = block;
+  std::memcpy(static_cast<void*>(&m_idle_loop_regs), &m_regs, sizeof(m_regs));
+  m_idle_loop_executed_instructions = m_executed_instructions;
+  m_idle_loop_bus_reads = m_bus_reads;
+}
+
+template<typename BusType>
+void CPU<BusType>::InvalidateCode(MemoryAddress address)
+{
+  CodePage* page = m_code_pages[address >> MEMORY_PAGE_SHIFT].get();
+  for (size_t i = 0; i < page->blocks.size();)
+  {
+    CodeBlock* block = page->blocks[i];
+    if (address >= block->start_pc && address < block->end_address)
+      InvalidateBlock(block);
+    else
+      i++;
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::InvalidateBlock(CodeBlock* block)
+{
+  // The block may be the one currently executing, so send any remaining instructions back to the lookup.
+  for (DecodedInstruction& instruction : block->instructions)
+    instruction.handler = BLOCK_EXIT_HANDLER;
+
+  // Generated code checks the flag after writes, and jumps to the block are unlinked.
+  m_code_invalidated = true;
+  if (block->host_code)
+    m_recompiler->InvalidateBlock(block->start_pc);
+
+  for (u32 page_index = block->first_page; page_index <= block->last_page; page_index++)
+    RemoveBlockFromPage(page_index, block);
+
+  if (m_idle_loop_block == block)
+    m_idle_loop_block = nullptr;
+
+  m_invalidated_blocks.push_back(
+    std::move(m_code_pages[block->first_page]->blocks_by_offset[block->start_pc & MEMORY_PAGE_MASK]));
+}
+
+template<typename BusType>
+void CPU<BusType>::RemoveBlockFromPage(u32 page_index, CodeBlock* block)
+{
+  CodePage* page = m_code_pages[page_index].get();
+  auto iter = std::find(page->blocks.begin(), page->blocks.end(), block);
+  DebugAssert(iter != page->blocks.end());
+  page->blocks.erase(iter);
+
+  if (page->blocks.empty())
+  {
+    page->code_bytes.reset();
+    m_write_page_table[page_index] = m_mapped_write_page_table[page_index];
+  }
+}
+
+template<typename BusType>
+void CPU<BusType>::ExecuteStaticCode()
+{
+  if (!m_static_code)
+  {
+    if (BeginInstruction())
+      ExecuteInstructions<LoopMode::Interpreter>();
+
+    return;
+  }
+
+  StaticCodeState state;
+  state.read_page_table = m_read_page_table.data();
+  state.write_page_table = m_write_page_table.data();
+  state.cpu = this;
+  state.read_memory = &CPU::RecompilerReadMemory;
+  state.write_memory = &CPU::RecompilerWriteMemory;
+
+  while (BeginInstruction())
+  {
+    const StaticBlock* block = LookupStaticBlock(m_regs.pc);
+    if (!block || block->max_cycles >= m_cycles_left)
+    {
+      // Addresses the translator did not discover, and blocks which may not finish in this slice, are interpreted.
+      ExecuteInstructions<LoopMode::SingleStep>();
+      continue;
+    }
+
+    MaterializeFlags(m_regs);
+    std::memcpy(static_cast<void*>(&state.regs), &m_regs, sizeof(state.regs));
+    state.cycles_left = m_cycles_left;
+    state.pending_cycles = m_pending_cycles;
+    state.executed_instructions = m_executed_instructions;
+
+    // Blocks can't raise or accept interrupts, so they are chained until one may not fit in the remaining cycles, or
+    // starts at a trap.
+    do
+    {
+      block->function(state);
+      block = LookupStaticBlock(state.regs.pc);
+    } while (block && block->max_cycles < state.cycles_left && !IsTrapAddress(state.regs.pc));
+
+    std::memcpy(static_cast<void*>(&m_regs), &state.regs, sizeof(m_regs));
+    m_cycles_left = state.cycles_left;
+    m_pending_cycles = state.pending_cycles;
+    m_executed_instructions = state.executed_instructions;
+  }
+}
+
+template<typename BusType>
+u8 CPU<BusType>::RecompilerReadMemory(void* cpu, u32 address)
+{
+  return static_cast<CPU*>(cpu)->ReadMemoryByte(static_cast<MemoryAddress>(address));
+}
+
+template<typename BusType>
+void CPU<BusType>::RecompilerWriteMemory(void* cpu, u32 address, u32 value)
+{
+  static_cast<CPU*>(cpu)->WriteMemoryByte(static_cast<MemoryAddress>(address), Truncate8(value));
+}
+
+template<typename BusType>
+void CPU<BusType>::RecompilerInterpretInstruction(void* cpu)
+{
+  CPU* this_cpu = static_cast<CPU*>(cpu);
+  this_cpu->template ExecuteInstructions<LoopMode::SingleStep>();
+  this_cpu->MaterializeFlags(this_cpu->m_regs);
+}
+
+template<typename BusType>
+void CPU<BusType>::StepInstruction()
+{
+  if (!IsProfiling())
+  {
+    ExecuteInstructions<LoopMode::SingleStep>();
+    MaterializeFlags(m_regs);
+    return;
+  }
+
+  const MemoryAddress pc = m_regs.pc;
+  const u8 opcode = m_bus->ReadMemory(pc);
+  const CycleCount start_cycles = m_pending_cycles;
+  ExecuteInstructions<LoopMode::SingleStep>();
+  MaterializeFlags(m_regs);
+  m_profiler->RecordInstruction(pc, opcode, m_pending_cycles - start_cycles);
+}
+
+template<typename BusType>
+void CPU<BusType>::TraceInstruction()
+{
+  if (m_trace_buffer)
+  {
+    TraceRecord& record = m_trace_buffer->Append();
+    record.cycle = m_executed_cycles + static_cast<u64>(m_pending_cycles);
+    std::memcpy(static_cast<void*>(&record.regs), &m_regs, sizeof(record.regs));
+    record.bytes[0] = m_bus->ReadMemory(m_regs.pc);
+    record.length = INSTRUCTION_INFO[record.bytes[0]].length;
+    for (u8 i = 1; i < sizeof(record.bytes); i++)
+      record.bytes[i] = (i < record.length) ? m_bus->ReadMemory(static_cast<MemoryAddress>(m_regs.pc + i)) : 0;
+    return;
+  }
+
+  SmallString str;
+  GetStateString(&str);
+  std::puts(str);
+}
+
+template<typename BusType>
+template<typename CPU<BusType>::LoopMode mode>
+void CPU<BusType>::ExecuteInstructions()
+{
+  // The register file and counters live in locals while executing, so that the compiler can keep them in host registers
+  // rather than reloading them from the CPU object after every store through a memory pointer. They are written back
+  // before leaving the loop, and around anything outside of the instruction handlers which can observe them: I/O, hlt,
+  // interrupt dispatch and the block lookup.
+  Registers regs;
+  CycleCount cycles_left;
+  CycleCount pending_cycles;
+  u64 executed_instructions;
+
+#define LOAD_STATE()                                                                                                   \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    std::memcpy(static_cast<void*>(&regs), &m_regs, sizeof(regs));                                                     \
+    cycles_left = m_cycles_left;                                                                                       \
+    pending_cycles = m_pending_cycles;                                                                                 \
+    executed_instructions = m_executed_instructions;                                                                   \
+  } while (0)
+#define STORE_STATE()                                                                                                  \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    std::memcpy(static_cast<void*>(&m_regs), &regs, sizeof(m_regs));                                                   \
+    m_cycles_left = cycles_left;                                                                                       \
+    m_pending_cycles = pending_cycles;                                                                                 \
+    m_executed_instructions = executed_instructions;                                                                   \
+  } while (0)
+
+#define CYCLES(n) do { cycles_left -= (n); pending_cycles += (n); } while (0)
+
+  // The cached interpreter uses the operands captured at decode time. PC has already been advanced past the whole
+  // instruction when the handler runs, so handlers observe the same state as when fetching from memory.
+#define IMM8() ((mode == LoopMode::CachedInterpreter) ? Truncate8(instruction->operand) : ReadImmediateByte(regs))
+#define IMM16() ((mode == LoopMode::CachedInterpreter) ? instruction->operand : ReadImmediateWord(regs))
+
+  // Moves to the next decoded instruction in the block, or fetches the next opcode from memory. Blocks only run when
+  // their worst case timing fits in the remaining cycles, so the cycle count isn't checked between instructions.
+#define FETCH_NEXT()                                                                                                   \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    if constexpr (mode == LoopMode::CachedInterpreter)                                                                 \
+    {                                                                                                                  \
+      if (++instruction == block_end)                                                                                  \
+        goto next_block;                                                                                               \
+      executed_instructions++;                                                                                         \
+      regs.pc = static_cast<MemoryAddress>(instruction->pc + instruction->length);                                     \
+      DISPATCH(instruction->handler);                                                                                  \
+    }                                                                                                                  \
+    else                                                                                                               \
+    {                                                                                                                  \
+      if (mode == LoopMode::SingleStep)                                                                                \
+      {                                                                                                                \
+        STORE_STATE();                                                                                                 \
+        return;                                                                                                        \
+      }                                                                                                                \
+      if (cycles_left <= 0 || (m_interrupt_request & m_interrupt_enabled) || IsTrapAddress(regs.pc))                   \
+      {                                                                                                                \
+        STORE_STATE();                                                                                                 \
+        if (!BeginInstruction())                                                                                       \
+          return;                                                                                                      \
+        LOAD_STATE();                                                                                                  \
+      }                                                                                                                \
+      executed_instructions++;                                                                                         \
+      DISPATCH(ReadImmediateByte(regs));                                                                               \
+    }                                                                                                                  \
+  } while (0)
+
+  // Moves to the second instruction of a fused pair. Fused handlers are only used by the cached interpreter. Blocks
+  // never end in the middle of a pair, and the first instruction of a pair doesn't write memory, so the second can't
+  // have been invalidated.
+#define FUSE_NEXT_INSTRUCTION()                                                                                        \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    if constexpr (mode == LoopMode::CachedInterpreter)                                                                 \
+    {                                                                                                                  \
+      instruction++;                                                                                                   \
+      executed_instructions++;                                                                                         \
+      regs.pc = static_cast<MemoryAddress>(instruction->pc + instruction->length);                                     \
+    }                                                                                                                  \
+  } while (0)
+
+  u16 tgt;
+  const DecodedInstruction* instruction = nullptr;
+  const DecodedInstruction* block_end = nullptr;
+
+#if I8080_THREADED_DISPATCH
+  // Each handler ends by jumping straight to the next handler, so every opcode gets its own indirect branch.
+#define OPCODE(n) op_##n
+#define FLAGLESS_OPCODE(n) op_flagless_##n
+#define FUSED_OPCODE(n) op_fused_##n
+#define DISPATCH(handler) goto* dispatch_table[handler]
+#define NEXT() FETCH_NEXT()
+#define OPCODE_ROW(h)                                                                                                  \
+  &&op_0x##h##0, &&op_0x##h##1, &&op_0x##h##2, &&op_0x##h##3, &&op_0x##h##4, &&op_0x##h##5, &&op_0x##h##6,             \
+    &&op_0x##h##7, &&op_0x##h##8, &&op_0x##h##9, &&op_0x##h##A, &&op_0x##h##B, &&op_0x##h##C, &&op_0x##h##D,           \
+    &&op_0x##h##E, &&op_0x##h##F
+#define FLAGLESS_ROW(h)                                                                                                \
+  &&op_flagless_0x##h##0, &&op_flagless_0x##h##1, &&op_flagless_0x##h##2, &&op_flagless_0x##h##3,                     \
+    &&op_flagless_0x##h##4, &&op_flagless_0x##h##5, &&op_flagless_0x##h##6, &&op_flagless_0x##h##7,                    \
+    &&op_flagless_0x##h##8, &&op_flagless_0x##h##9, &&op_flagless_0x##h##A, &&op_flagless_0x##h##B,                    \
+    &&op_flagless_0x##h##C, &&op_flagless_0x##h##D, &&op_flagless_0x##h##E, &&op_flagless_0x##h##F
+
+  static const void* const dispatch_table[HANDLER_COUNT] = {
+    OPCODE_ROW(0), OPCODE_ROW(1), OPCODE_ROW(2), OPCODE_ROW(3),
+    OPCODE_ROW(4), OPCODE_ROW(5), OPCODE_ROW(6), OPCODE_ROW(7),
+    OPCODE_ROW(8), OPCODE_ROW(9), OPCODE_ROW(A), OPCODE_ROW(B),
+    OPCODE_ROW(C), OPCODE_ROW(D), OPCODE_ROW(E), OPCODE_ROW(F),
+    &&op_BLOCK_EXIT_HANDLER,
+    FLAGLESS_ROW(8), FLAGLESS_ROW(9), FLAGLESS_ROW(A), FLAGLESS_ROW(B),
+    &&op_flagless_0xC6, &&op_flagless_0xCE, &&op_flagless_0xD6, &&op_flagless_0xDE,
+    &&op_flagless_0xE6, &&op_flagless_0xEE, &&op_flagless_0xF6, &&op_flagless_0xFE,
+    &&op_flagless_0x04, &&op_flagless_0x0C, &&op_flagless_0x14, &&op_flagless_0x1C,
+    &&op_flagless_0x24, &&op_flagless_0x2C, &&op_flagless_0x34, &&op_flagless_0x3C,
+    &&op_flagless_0x05, &&op_flagless_0x0D, &&op_flagless_0x15, &&op_flagless_0x1D,
+    &&op_flagless_0x25, &&op_flagless_0x2D, &&op_flagless_0x35, &&op_flagless_0x3D,
+    &&op_fused_0, &&op_fused_1};
+  static_assert(FUSED_PAIRS.size() == 2, "every fused pair needs a handler");
+#else
+#define OPCODE(n) case n
+#define FLAGLESS_OPCODE(n) case GetFlaglessHandler(n)
+#define FUSED_OPCODE(n) case FUSED_HANDLER_BASE + n
+#define DISPATCH(h)                                                                                                    \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    handler = (h);                                                                                                     \
+    goto dispatch;                                                                                                     \
+  } while (0)
+#define NEXT() goto next_instruction
+
+  u32 handler;
+#endif
+
+  LOAD_STATE();
+  if constexpr (mode == LoopMode::CachedInterpreter)
+    goto next_block;
+
+  executed_instructions++;
+  DISPATCH(ReadImmediateByte(regs));
+
+#if I8080_THREADED_DISPATCH
+  {
+#else
+dispatch:
+  switch (handler)
+  {
+#endif
+
+      // clang-format off
+    OPCODE(0x00): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x08): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x10): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x18): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x20): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x28): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x30): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x38): CYCLES(4); NEXT();                                                                      // nop
+    OPCODE(0x01): CYCLES(10); regs.bc = IMM16(); NEXT();                                                  // lxi b, d16
+    OPCODE(0x11): CYCLES(10); regs.de = IMM16(); NEXT();                                                  // lxi d, d16
+    OPCODE(0x21): CYCLES(10); regs.hl = IMM16(); NEXT();                                                  // lxi h, d16
+    OPCODE(0x31): CYCLES(10); regs.sp = IMM16(); NEXT();                                                  // lxi sp, d16
+    OPCODE(0x0A): CYCLES(7); regs.a = ReadMemoryByte(regs.bc); NEXT();                                    // ldax b
+    OPCODE(0x1A): CYCLES(7); regs.a = ReadMemoryByte(regs.de); NEXT();                                    // ldax d
+    OPCODE(0x02): CYCLES(7); WriteMemoryByte(regs.bc, regs.a); NEXT();                                    // stax b
+    OPCODE(0x12): CYCLES(7); WriteMemoryByte(regs.de, regs.a); NEXT();                                    // stax d
+    OPCODE(0x3A): CYCLES(13); regs.a = ReadMemoryByte(IMM16()); NEXT();                                   // lda a16
+    OPCODE(0x32): CYCLES(13); WriteMemoryByte(IMM16(), regs.a); NEXT();                                   // sta a16
+    OPCODE(0x2A): CYCLES(16); regs.hl = ReadMemoryWord(IMM16()); NEXT();                                  // lhld
+    OPCODE(0x22): CYCLES(16); WriteMemoryWord(IMM16(), regs.hl); NEXT();                                  // shld
+    OPCODE(0x03): CYCLES(5); regs.bc++; NEXT();                                                           // inx b
+    OPCODE(0x13): CYCLES(5); regs.de++; NEXT();                                                           // inx d
+    OPCODE(0x23): CYCLES(5); regs.hl++; NEXT();                                                           // inx h
+    OPCODE(0x33): CYCLES(5); regs.sp++; NEXT();                                                           // inx sp
+    OPCODE(0x0B): CYCLES(5); regs.bc--; NEXT();                                                           // dcx b
+    OPCODE(0x1B): CYCLES(5); regs.de--; NEXT();                                                           // dcx d
+    OPCODE(0x2B): CYCLES(5); regs.hl--; NEXT();                                                           // dcx h
+    OPCODE(0x3B): CYCLES(5); regs.sp--; NEXT();                                                           // dcx sp
+    OPCODE(0x09): CYCLES(10); regs.hl = op_dad(regs, regs.hl, regs.bc); NEXT();                           // dad b
+    OPCODE(0x19): CYCLES(10); regs.hl = op_dad(regs, regs.hl, regs.de); NEXT();                           // dad d
+    OPCODE(0x29): CYCLES(10); regs.hl = op_dad(regs, regs.hl, regs.hl); NEXT();                           // dad h
+    OPCODE(0x39): CYCLES(10); regs.hl = op_dad(regs, regs.hl, regs.sp); NEXT();                           // dad sp
+    OPCODE(0x3C): CYCLES(5); regs.a = op_inr(regs.a); NEXT();                                             // inr a
+    OPCODE(0x04): CYCLES(5); regs.b = op_inr(regs.b); NEXT();                                             // inr b
+    OPCODE(0x0C): CYCLES(5); regs.c = op_inr(regs.c); NEXT();                                             // inr c
+    OPCODE(0x14): CYCLES(5); regs.d = op_inr(regs.d); NEXT();                                             // inr d
+    OPCODE(0x1C): CYCLES(5); regs.e = op_inr(regs.e); NEXT();                                             // inr e
+    OPCODE(0x24): CYCLES(5); regs.h = op_inr(regs.h); NEXT();                                             // inr h
+    OPCODE(0x2C): CYCLES(5); regs.l = op_inr(regs.l); NEXT();                                             // inr l
+    OPCODE(0x34): CYCLES(10); WriteMemoryByte(regs.hl, op_inr(ReadMemoryByte(regs.hl))); NEXT();          // inr m
+    OPCODE(0x3D): CYCLES(5); regs.a = op_dcr(regs.a); NEXT();                                             // dcr a
+    OPCODE(0x05): CYCLES(5); regs.b = op_dcr(regs.b); NEXT();                                             // dcr b
+    OPCODE(0x0D): CYCLES(5); regs.c = op_dcr(regs.c); NEXT();                                             // dcr c
+    OPCODE(0x15): CYCLES(5); regs.d = op_dcr(regs.d); NEXT();                                             // dcr d
+    OPCODE(0x1D): CYCLES(5); regs.e = op_dcr(regs.e); NEXT();                                             // dcr e
+    OPCODE(0x25): CYCLES(5); regs.h = op_dcr(regs.h); NEXT();                                             // dcr h
+    OPCODE(0x2D): CYCLES(5); regs.l = op_dcr(regs.l); NEXT();                                             // dcr l
+    OPCODE(0x35): CYCLES(10); WriteMemoryByte(regs.hl, op_dcr(ReadMemoryByte(regs.hl))); NEXT();          // dcr m
+    OPCODE(0x3E): CYCLES(7); regs.a = IMM8(); NEXT();                                                     // mvi a, d8
+    OPCODE(0x06): CYCLES(7); regs.b = IMM8(); NEXT();                                                     // mvi b, d8
+    OPCODE(0x0E): CYCLES(7); regs.c = IMM8(); NEXT();                                                     // mvi c, d8
+    OPCODE(0x16): CYCLES(7); regs.d = IMM8(); NEXT();                                                     // mvi d, d8
+    OPCODE(0x1E): CYCLES(7); regs.e = IMM8(); NEXT();                                                     // mvi e, d8
+    OPCODE(0x26): CYCLES(7); regs.h = IMM8(); NEXT();                                                     // mvi h, d8
+    OPCODE(0x2E): CYCLES(7); regs.l = IMM8(); NEXT();                                                     // mvi l, d8
+    OPCODE(0x36): CYCLES(10); WriteMemoryByte(regs.hl, IMM8()); NEXT();                                   // mvi m, d8
+    OPCODE(0x07): CYCLES(4); regs.a = op_rlc(regs, regs.a); NEXT();                                       // rlc
+    OPCODE(0x17): CYCLES(4); regs.a = op_ral(regs, regs.a); NEXT();                                       // ral
+    OPCODE(0x0F): CYCLES(4); regs.a = op_rrc(regs, regs.a); NEXT();                                       // rrc
+    OPCODE(0x1F): CYCLES(4); regs.a = op_rar(regs, regs.a); NEXT();                                       // rar
+    OPCODE(0x27): CYCLES(4); regs.a = op_daa(regs, regs.a); NEXT();                                       // daa
+    OPCODE(0x2F): CYCLES(4); regs.a = ~regs.a; NEXT();                                                    // cma
+    OPCODE(0x37): CYCLES(4); regs.f.c = true; NEXT();                                                     // stc
+    OPCODE(0x3F): CYCLES(4); regs.f.c = !regs.f.c; NEXT();                                                // cmc
+    OPCODE(0x76): CYCLES(7); STORE_STATE(); Halt(); LOAD_STATE(); NEXT();                                 // hlt
+    OPCODE(0x47): CYCLES(5); regs.b = regs.a; NEXT();                                                     // mov b, a
+    OPCODE(0x40): CYCLES(5); regs.b = regs.b; NEXT();                                                     // mov b, b
+    OPCODE(0x41): CYCLES(5); regs.b = regs.c; NEXT();                                                     // mov b, c
+    OPCODE(0x42): CYCLES(5); regs.b = regs.d; NEXT();                                                     // mov b, d
+    OPCODE(0x43): CYCLES(5); regs.b = regs.e; NEXT();                                                     // mov b, e
+    OPCODE(0x44): CYCLES(5); regs.b = regs.h; NEXT();                                                     // mov b, h
+    OPCODE(0x45): CYCLES(5); regs.b = regs.l; NEXT();                                                     // mov b, l
+    OPCODE(0x46): CYCLES(7); regs.b = ReadMemoryByte(regs.hl); NEXT();                                    // mov b, m
+    OPCODE(0x4F): CYCLES(5); regs.c = regs.a; NEXT();                                                     // mov c, a
+    OPCODE(0x48): CYCLES(5); regs.c = regs.b; NEXT();                                                     // mov c, b
+    OPCODE(0x49): CYCLES(5); regs.c = regs.c; NEXT();                                                     // mov c, c
+    OPCODE(0x4A): CYCLES(5); regs.c = regs.d; NEXT();                                                     // mov c, d
+    OPCODE(0x4B): CYCLES(5); regs.c = regs.e; NEXT();                                                     // mov c, e
+    OPCODE(0x4C): CYCLES(5); regs.c = regs.h; NEXT();                                                     // mov c, h
+    OPCODE(0x4D): CYCLES(5); regs.c = regs.l; NEXT();                                                     // mov c, l
+    OPCODE(0x4E): CYCLES(7); regs.c = ReadMemoryByte(regs.hl); NEXT();                                    // mov c, m
+    OPCODE(0x57): CYCLES(5); regs.d = regs.a; NEXT();                                                     // mov d, a
+    OPCODE(0x50): CYCLES(5); regs.d = regs.b; NEXT();                                                     // mov d, b
+    OPCODE(0x51): CYCLES(5); regs.d = regs.c; NEXT();                                                     // mov d, c
+    OPCODE(0x52): CYCLES(5); regs.d = regs.d; NEXT();                                                     // mov d, d
+    OPCODE(0x53): CYCLES(5); regs.d = regs.e; NEXT();                                                     // mov d, e
+    OPCODE(0x54): CYCLES(5); regs.d = regs.h; NEXT();                                                     // mov d, h
+    OPCODE(0x55): CYCLES(5); regs.d = regs.l; NEXT();                                                     // mov d, l
+    OPCODE(0x56): CYCLES(7); regs.d = ReadMemoryByte(regs.hl); NEXT();                                    // mov d, m
+    OPCODE(0x5F): CYCLES(5); regs.e = regs.a; NEXT();                                                     // mov e, a
+    OPCODE(0x58): CYCLES(5); regs.e = regs.b; NEXT();                                                     // mov e, b
+    OPCODE(0x59): CYCLES(5); regs.e = regs.c; NEXT();                                                     // mov e, c
+    OPCODE(0x5A): CYCLES(5); regs.e = regs.d; NEXT();                                                     // mov e, d
+    OPCODE(0x5B): CYCLES(5); regs.e = regs.e; NEXT();                                                     // mov e, e
+    OPCODE(0x5C): CYCLES(5); regs.e = regs.h; NEXT();                                                     // mov e, h
+    OPCODE(0x5D): CYCLES(5); regs.e = regs.l; NEXT();                                                     // mov e, l
+    OPCODE(0x5E): CYCLES(7); regs.e = ReadMemoryByte(regs.hl); NEXT();                                    // mov e, m
+    OPCODE(0x67): CYCLES(5); regs.h = regs.a; NEXT();                                                     // mov h, a
+    OPCODE(0x60): CYCLES(5); regs.h = regs.b; NEXT();                                                     // mov h, b
+    OPCODE(0x61): CYCLES(5); regs.h = regs.c; NEXT();                                                     // mov h, c
+    OPCODE(0x62): CYCLES(5); regs.h = regs.d; NEXT();                                                     // mov h, d
+    OPCODE(0x63): CYCLES(5); regs.h = regs.e; NEXT();                                                     // mov h, e
+    OPCODE(0x64): CYCLES(5); regs.h = regs.h; NEXT();                                                     // mov h, h
+    OPCODE(0x65): CYCLES(5); regs.h = regs.l; NEXT();                                                     // mov h, l
+    OPCODE(0x66): CYCLES(7); regs.h = ReadMemoryByte(regs.hl); NEXT();                                    // mov h, m
+    OPCODE(0x6F): CYCLES(5); regs.l = regs.a; NEXT();                                                     // mov l, a
+    OPCODE(0x68): CYCLES(5); regs.l = regs.b; NEXT();                                                     // mov l, b
+    OPCODE(0x69): CYCLES(5); regs.l = regs.c; NEXT();                                                     // mov l, c
+    OPCODE(0x6A): CYCLES(5); regs.l = regs.d; NEXT();                                                     // mov l, d
+    OPCODE(0x6B): CYCLES(5); regs.l = regs.e; NEXT();                                                     // mov l, e
+    OPCODE(0x6C): CYCLES(5); regs.l = regs.h; NEXT();                                                     // mov l, h
+    OPCODE(0x6D): CYCLES(5); regs.l = regs.l; NEXT();                                                     // mov l, l
+    OPCODE(0x6E): CYCLES(7); regs.l = ReadMemoryByte(regs.hl); NEXT();                                    // mov l, m
+    OPCODE(0x7F): CYCLES(5); regs.a = regs.a; NEXT();                                                     // mov a, a
+    OPCODE(0x78): CYCLES(5); regs.a = regs.b; NEXT();                                                     // mov a, b
+    OPCODE(0x79): CYCLES(5); regs.a = regs.c; NEXT();                                                     // mov a, c
+    OPCODE(0x7A): CYCLES(5); regs.a = regs.d; NEXT();                                                     // mov a, d
+    OPCODE(0x7B): CYCLES(5); regs.a = regs.e; NEXT();                                                     // mov a, e
+    OPCODE(0x7C): CYCLES(5); regs.a = regs.h; NEXT();                                                     // mov a, h
+    OPCODE(0x7D): CYCLES(5); regs.a = regs.l; NEXT();                                                     // mov a, l
+    OPCODE(0x7E): CYCLES(7); regs.a = ReadMemoryByte(regs.hl); NEXT();                                    // mov a, m
+    OPCODE(0x77): CYCLES(7); WriteMemoryByte(regs.hl, regs.a); NEXT();                                    // mov m, a
+    OPCODE(0x70): CYCLES(7); WriteMemoryByte(regs.hl, regs.b); NEXT();                                    // mov m, b
+    OPCODE(0x71): CYCLES(7); WriteMemoryByte(regs.hl, regs.c); NEXT();                                    // mov m, c
+    OPCODE(0x72): CYCLES(7); WriteMemoryByte(regs.hl, regs.d); NEXT();                                    // mov m, d
+    OPCODE(0x73): CYCLES(7); WriteMemoryByte(regs.hl, regs.e); NEXT();                                    // mov m, e
+    OPCODE(0x74): CYCLES(7); WriteMemoryByte(regs.hl, regs.h); NEXT();                                    // mov m, h
+    OPCODE(0x75): CYCLES(7); WriteMemoryByte(regs.hl, regs.l); NEXT();                                    // mov m, l
+    OPCODE(0x87): CYCLES(4); regs.a = op_add(regs, regs.a, regs.a); NEXT();                               // add a
+    OPCODE(0x80): CYCLES(4); regs.a = op_add(regs, regs.a, regs.b); NEXT();                               // add b
+    OPCODE(0x81): CYCLES(4); regs.a = op_add(regs, regs.a, regs.c); NEXT();                               // add c
+    OPCODE(0x82): CYCLES(4); regs.a = op_add(regs, regs.a, regs.d); NEXT();                               // add d
+    OPCODE(0x83): CYCLES(4); regs.a = op_add(regs, regs.a, regs.e); NEXT();                               // add e
+    OPCODE(0x84): CYCLES(4); regs.a = op_add(regs, regs.a, regs.h); NEXT();                               // add h
+    OPCODE(0x85): CYCLES(4); regs.a = op_add(regs, regs.a, regs.l); NEXT();                               // add l
+    OPCODE(0x86): CYCLES(4); regs.a = op_add(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // add m
+    OPCODE(0xC6): CYCLES(7); regs.a = op_add(regs, regs.a, IMM8()); NEXT();                               // adi d8
+    OPCODE(0x8F): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.a); NEXT();                               // adc a
+    OPCODE(0x88): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.b); NEXT();                               // adc b
+    OPCODE(0x89): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.c); NEXT();                               // adc c
+    OPCODE(0x8A): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.d); NEXT();                               // adc d
+    OPCODE(0x8B): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.e); NEXT();                               // adc e
+    OPCODE(0x8C): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.h); NEXT();                               // adc h
+    OPCODE(0x8D): CYCLES(4); regs.a = op_adc(regs, regs.a, regs.l); NEXT();                               // adc l
+    OPCODE(0x8E): CYCLES(4); regs.a = op_adc(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // adc m
+    OPCODE(0xCE): CYCLES(7); regs.a = op_adc(regs, regs.a, IMM8()); NEXT();                               // aci d8
+    OPCODE(0x97): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.a); NEXT();                               // sub a
+    OPCODE(0x90): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.b); NEXT();                               // sub b
+    OPCODE(0x91): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.c); NEXT();                               // sub c
+    OPCODE(0x92): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.d); NEXT();                               // sub d
+    OPCODE(0x93): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.e); NEXT();                               // sub e
+    OPCODE(0x94): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.h); NEXT();                               // sub h
+    OPCODE(0x95): CYCLES(4); regs.a = op_sub(regs, regs.a, regs.l); NEXT();                               // sub l
+    OPCODE(0x96): CYCLES(4); regs.a = op_sub(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // sub m
+    OPCODE(0xD6): CYCLES(7); regs.a = op_sub(regs, regs.a, IMM8()); NEXT();                               // sui d8
+    OPCODE(0x9F): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.a); NEXT();                               // sbc a
+    OPCODE(0x98): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.b); NEXT();                               // sbc b
+    OPCODE(0x99): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.c); NEXT();                               // sbc c
+    OPCODE(0x9A): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.d); NEXT();                               // sbc d
+    OPCODE(0x9B): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.e); NEXT();                               // sbc e
+    OPCODE(0x9C): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.h); NEXT();                               // sbc h
+    OPCODE(0x9D): CYCLES(4); regs.a = op_sbb(regs, regs.a, regs.l); NEXT();                               // sbc l
+    OPCODE(0x9E): CYCLES(4); regs.a = op_sbb(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // sbc m
+    OPCODE(0xDE): CYCLES(7); regs.a = op_sbb(regs, regs.a, IMM8()); NEXT();                               // sbi d8
+    OPCODE(0xA7): CYCLES(4); regs.a = op_and(regs, regs.a, regs.a); NEXT();                               // ana a
+    OPCODE(0xA0): CYCLES(4); regs.a = op_and(regs, regs.a, regs.b); NEXT();                               // ana b
+    OPCODE(0xA1): CYCLES(4); regs.a = op_and(regs, regs.a, regs.c); NEXT();                               // ana c
+    OPCODE(0xA2): CYCLES(4); regs.a = op_and(regs, regs.a, regs.d); NEXT();                               // ana d
+    OPCODE(0xA3): CYCLES(4); regs.a = op_and(regs, regs.a, regs.e); NEXT();                               // ana e
+    OPCODE(0xA4): CYCLES(4); regs.a = op_and(regs, regs.a, regs.h); NEXT();                               // ana h
+    OPCODE(0xA5): CYCLES(4); regs.a = op_and(regs, regs.a, regs.l); NEXT();                               // ana l
+    OPCODE(0xA6): CYCLES(4); regs.a = op_and(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // ana m
+    OPCODE(0xE6): CYCLES(7); regs.a = op_and(regs, regs.a, IMM8()); NEXT();                               // ani d8
+    OPCODE(0xAF): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.a); NEXT();                               // xra a
+    OPCODE(0xA8): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.b); NEXT();                               // xra b
+    OPCODE(0xA9): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.c); NEXT();                               // xra c
+    OPCODE(0xAA): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.d); NEXT();                               // xra d
+    OPCODE(0xAB): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.e); NEXT();                               // xra e
+    OPCODE(0xAC): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.h); NEXT();                               // xra h
+    OPCODE(0xAD): CYCLES(4); regs.a = op_xor(regs, regs.a, regs.l); NEXT();                               // xra l
+    OPCODE(0xAE): CYCLES(4); regs.a = op_xor(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();              // xra m
+    OPCODE(0xEE): CYCLES(7); regs.a = op_xor(regs, regs.a, IMM8()); NEXT();                               // xri d8
+    OPCODE(0xB7): CYCLES(4); regs.a = op_or(regs, regs.a, regs.a); NEXT();                                // ora a
+    OPCODE(0xB0): CYCLES(4); regs.a = op_or(regs, regs.a, regs.b); NEXT();                                // ora b
+    OPCODE(0xB1): CYCLES(4); regs.a = op_or(regs, regs.a, regs.c); NEXT();                                // ora c
+    OPCODE(0xB2): CYCLES(4); regs.a = op_or(regs, regs.a, regs.d); NEXT();                                // ora d
+    OPCODE(0xB3): CYCLES(4); regs.a = op_or(regs, regs.a, regs.e); NEXT();                                // ora e
+    OPCODE(0xB4): CYCLES(4); regs.a = op_or(regs, regs.a, regs.h); NEXT();                                // ora h
+    OPCODE(0xB5): CYCLES(4); regs.a = op_or(regs, regs.a, regs.l); NEXT();                                // ora l
+    OPCODE(0xB6): CYCLES(4); regs.a = op_or(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();               // ora m
+    OPCODE(0xF6): CYCLES(7); regs.a = op_or(regs, regs.a, IMM8()); NEXT();                                // ori d8
+    OPCODE(0xBF): CYCLES(4); op_sub(regs, regs.a, regs.a); NEXT();                                        // cmp a
+    OPCODE(0xB8): CYCLES(4); op_sub(regs, regs.a, regs.b); NEXT();                                        // cmp b
+    OPCODE(0xB9): CYCLES(4); op_sub(regs, regs.a, regs.c); NEXT();                                        // cmp c
+    OPCODE(0xBA): CYCLES(4); op_sub(regs, regs.a, regs.d); NEXT();                                        // cmp d
+    OPCODE(0xBB): CYCLES(4); op_sub(regs, regs.a, regs.e); NEXT();                                        // cmp e
+    OPCODE(0xBC): CYCLES(4); op_sub(regs, regs.a, regs.h); NEXT();                                        // cmp h
+    OPCODE(0xBD): CYCLES(4); op_sub(regs, regs.a, regs.l); NEXT();                                        // cmp l
+    OPCODE(0xBE): CYCLES(4); op_sub(regs, regs.a, ReadMemoryByte(regs.hl)); NEXT();                       // cmp m
+    OPCODE(0xFE): CYCLES(7); op_sub(regs, regs.a, IMM8()); NEXT();                                        // cpi d8
+    OPCODE(0xC3): CYCLES(10); tgt = IMM16(); op_jmp(regs, tgt); NEXT();                                   // jmp a16
+    OPCODE(0xCB): CYCLES(10); tgt = IMM16(); op_jmp(regs, tgt); NEXT();                                   // jmp a16
+    OPCODE(0xC2): CYCLES(10); tgt = IMM16(); if (!GetFlagZ(regs)) { op_jmp(regs, tgt); } NEXT();          // jnz a16
+    OPCODE(0xD2): CYCLES(10); tgt = IMM16(); if (!regs.f.c) { op_jmp(regs, tgt); } NEXT();                // jnc a16
+    OPCODE(0xE2): CYCLES(10); tgt = IMM16(); if (!GetFlagP(regs)) { op_jmp(regs, tgt); } NEXT();          // jpo a16
+    OPCODE(0xF2): CYCLES(10); tgt = IMM16(); if (!GetFlagS(regs)) { op_jmp(regs, tgt); } NEXT();          // jp a16
+    OPCODE(0xCA): CYCLES(10); tgt = IMM16(); if (GetFlagZ(regs)) { op_jmp(regs, tgt); } NEXT();           // jz a16
+    OPCODE(0xDA): CYCLES(10); tgt = IMM16(); if (regs.f.c) { op_jmp(regs, tgt); } NEXT();                 // jc a16
+    OPCODE(0xEA): CYCLES(10); tgt = IMM16(); if (GetFlagP(regs)) { op_jmp(regs, tgt); } NEXT();           // jo a16
+    OPCODE(0xFA): CYCLES(10); tgt = IMM16(); if (GetFlagS(regs)) { op_jmp(regs, tgt); } NEXT();           // jm a16
+    OPCODE(0xCD): CYCLES(17); tgt = IMM16(); op_call(regs, tgt); NEXT();                                  // call a16
+    OPCODE(0xDD): CYCLES(17); tgt = IMM16(); op_call(regs, tgt); NEXT();                                  // call a16
+    OPCODE(0xED): CYCLES(17); tgt = IMM16(); op_call(regs, tgt); NEXT();                                  // call a16
+    OPCODE(0xFD): CYCLES(17); tgt = IMM16(); op_call(regs, tgt); NEXT();                                  // call a16
+    OPCODE(0xC4): tgt = IMM16();                                                                          // cnz a16
+                  if (!GetFlagZ(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xD4): tgt = IMM16();                                                                          // cnc a16
+                  if (!regs.f.c) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xE4): tgt = IMM16();                                                                          // cpo a16
+                  if (!GetFlagP(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xF4): tgt = IMM16();                                                                          // cp a16
+                  if (!GetFlagS(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xCC): tgt = IMM16();                                                                          // cz a16
+                  if (GetFlagZ(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xDC): tgt = IMM16();                                                                          // cc a16
+                  if (regs.f.c) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xEC): tgt = IMM16();                                                                          // cpe a16
+                  if (GetFlagP(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xFC): tgt = IMM16();                                                                          // cm a16
+                  if (GetFlagS(regs)) { CYCLES(17); op_call(regs, tgt); } else { CYCLES(11); } NEXT();
+    OPCODE(0xC9): CYCLES(10); op_ret(regs); NEXT();                                                       // ret
+    OPCODE(0xD9): CYCLES(10); op_ret(regs); NEXT();                                                       // ret
+    OPCODE(0xC0): if (!GetFlagZ(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();          // rnz
+    OPCODE(0xD0): if (!regs.f.c) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();                // rnc
+    OPCODE(0xE0): if (!GetFlagP(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();          // rpo
+    OPCODE(0xF0): if (!GetFlagS(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();          // rp
+    OPCODE(0xC8): if (GetFlagZ(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();           // rz
+    OPCODE(0xD8): if (regs.f.c) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();                 // rc
+    OPCODE(0xE8): if (GetFlagP(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();           // rpe
+    OPCODE(0xF8): if (GetFlagS(regs)) { CYCLES(11); op_ret(regs); } else { CYCLES(5); } NEXT();           // rm
+    OPCODE(0xC7): CYCLES(11); op_call(regs, 0x0000); NEXT();                                              // rst 0
+    OPCODE(0xCF): CYCLES(11); op_call(regs, 0x0008); NEXT();                                              // rst 1
+    OPCODE(0xD7): CYCLES(11); op_call(regs, 0x0010); NEXT();                                              // rst 2
+    OPCODE(0xDF): CYCLES(11); op_call(regs, 0x0018); NEXT();                                              // rst 3
+    OPCODE(0xE7): CYCLES(11); op_call(regs, 0x0020); NEXT();                                              // rst 4
+    OPCODE(0xEF): CYCLES(11); op_call(regs, 0x0028); NEXT();                                              // rst 5
+    OPCODE(0xF7): CYCLES(11); op_call(regs, 0x0030); NEXT();                                              // rst 6
+    OPCODE(0xFF): CYCLES(11); op_call(regs, 0x0038); NEXT();                                              // rst 7
+    OPCODE(0xF5): CYCLES(11); MaterializeFlags(regs); PushWord(regs, regs.af); NEXT();                    // push psw
+    OPCODE(0xC5): CYCLES(11); PushWord(regs, regs.bc); NEXT();                                            // push b
+    OPCODE(0xD5): CYCLES(11); PushWord(regs, regs.de); NEXT();                                            // push d
+    OPCODE(0xE5): CYCLES(11); PushWord(regs, regs.hl); NEXT();                                            // push h
+    OPCODE(0xC1): CYCLES(10); regs.bc = PopWord(regs); NEXT();                                            // pop b
+    OPCODE(0xD1): CYCLES(10); regs.de = PopWord(regs); NEXT();                                            // pop d
+    OPCODE(0xE1): CYCLES(10); regs.hl = PopWord(regs); NEXT();                                            // pop h
+    OPCODE(0xF1): CYCLES(10); regs.af = PopWord(regs); regs.f.Fixup(); m_flag_op = FlagOp::None; NEXT();  // pop psw
+    OPCODE(0xEB): CYCLES(5); std::swap(regs.de, regs.hl); NEXT();                                         // xchg
+    OPCODE(0xE3): CYCLES(18); op_xthl(regs); NEXT();                                                      // xthl
+    OPCODE(0xE9): CYCLES(5); regs.pc = regs.hl; NEXT();                                                   // pchl
+    OPCODE(0xF9): CYCLES(5); regs.sp = regs.hl; NEXT();                                                   // sphl
+    OPCODE(0xF3): CYCLES(4); m_interrupt_enabled = false; NEXT();                                         // di
+    OPCODE(0xFB): CYCLES(4); m_interrupt_enabled = true; NEXT();                                          // ei
+    OPCODE(0xDB): CYCLES(10); tgt = IMM8();                                                               // in d8
+                  STORE_STATE(); m_regs.a = ReadIOByte(Truncate8(tgt)); LOAD_STATE(); NEXT();
+    OPCODE(0xD3): CYCLES(10); tgt = IMM8();                                                               // out d8
+                  STORE_STATE(); WriteIOByte(Truncate8(tgt), regs.a); LOAD_STATE(); NEXT();
+
+      // Variants used by the cached interpreter when every flag the instruction writes is dead, see CompileBlock().
+      // cmp still reads memory so that bus accesses are unchanged.
+    FLAGLESS_OPCODE(0x80): CYCLES(4); regs.a += regs.b; NEXT();                                           // add b
+    FLAGLESS_OPCODE(0x81): CYCLES(4); regs.a += regs.c; NEXT();                                           // add c
+    FLAGLESS_OPCODE(0x82): CYCLES(4); regs.a += regs.d; NEXT();                                           // add d
+    FLAGLESS_OPCODE(0x83): CYCLES(4); regs.a += regs.e; NEXT();                                           // add e
+    FLAGLESS_OPCODE(0x84): CYCLES(4); regs.a += regs.h; NEXT();                                           // add h
+    FLAGLESS_OPCODE(0x85): CYCLES(4); regs.a += regs.l; NEXT();                                           // add l
+    FLAGLESS_OPCODE(0x86): CYCLES(4); regs.a += ReadMemoryByte(regs.hl); NEXT();                          // add m
+    FLAGLESS_OPCODE(0x87): CYCLES(4); regs.a += regs.a; NEXT();                                           // add a
+    FLAGLESS_OPCODE(0xC6): CYCLES(7); regs.a += IMM8(); NEXT();                                           // adi d8
+    FLAGLESS_OPCODE(0x88): CYCLES(4); regs.a += regs.b + BoolToUInt8(regs.f.c); NEXT();                   // adc b
+    FLAGLESS_OPCODE(0x89): CYCLES(4); regs.a += regs.c + BoolToUInt8(regs.f.c); NEXT();                   // adc c
+    FLAGLESS_OPCODE(0x8A): CYCLES(4); regs.a += regs.d + BoolToUInt8(regs.f.c); NEXT();                   // adc d
+    FLAGLESS_OPCODE(0x8B): CYCLES(4); regs.a += regs.e + BoolToUInt8(regs.f.c); NEXT();                   // adc e
+    FLAGLESS_OPCODE(0x8C): CYCLES(4); regs.a += regs.h + BoolToUInt8(regs.f.c); NEXT();                   // adc h
+    FLAGLESS_OPCODE(0x8D): CYCLES(4); regs.a += regs.l + BoolToUInt8(regs.f.c); NEXT();                   // adc l
+    FLAGLESS_OPCODE(0x8E): CYCLES(4); regs.a += ReadMemoryByte(regs.hl) + BoolToUInt8(regs.f.c); NEXT();  // adc m
+    FLAGLESS_OPCODE(0x8F): CYCLES(4); regs.a += regs.a + BoolToUInt8(regs.f.c); NEXT();                   // adc a
+    FLAGLESS_OPCODE(0xCE): CYCLES(7); regs.a += IMM8() + BoolToUInt8(regs.f.c); NEXT();                   // aci d8
+    FLAGLESS_OPCODE(0x90): CYCLES(4); regs.a -= regs.b; NEXT();                                           // sub b
+    FLAGLESS_OPCODE(0x91): CYCLES(4); regs.a -= regs.c; NEXT();                                           // sub c
+    FLAGLESS_OPCODE(0x92): CYCLES(4); regs.a -= regs.d; NEXT();                                           // sub d
+    FLAGLESS_OPCODE(0x93): CYCLES(4); regs.a -= regs.e; NEXT();                                           // sub e
+    FLAGLESS_OPCODE(0x94): CYCLES(4); regs.a -= regs.h; NEXT();                                           // sub h
+    FLAGLESS_OPCODE(0x95): CYCLES(4); regs.a -= regs.l; NEXT();                                           // sub l
+    FLAGLESS_OPCODE(0x96): CYCLES(4); regs.a -= ReadMemoryByte(regs.hl); NEXT();                          // sub m
+    FLAGLESS_OPCODE(0x97): CYCLES(4); regs.a -= regs.a; NEXT();                                           // sub a
+    FLAGLESS_OPCODE(0xD6): CYCLES(7); regs.a -= IMM8(); NEXT();                                           // sui d8
+    FLAGLESS_OPCODE(0x98): CYCLES(4); regs.a -= regs.b + BoolToUInt8(regs.f.c); NEXT();                   // sbc b
+    FLAGLESS_OPCODE(0x99): CYCLES(4); regs.a -= regs.c + BoolToUInt8(regs.f.c); NEXT();                   // sbc c
+    FLAGLESS_OPCODE(0x9A): CYCLES(4); regs.a -= regs.d + BoolToUInt8(regs.f.c); NEXT();                   // sbc d
+    FLAGLESS_OPCODE(0x9B): CYCLES(4); regs.a -= regs.e + BoolToUInt8(regs.f.c); NEXT();                   // sbc e
+    FLAGLESS_OPCODE(0x9C): CYCLES(4); regs.a -= regs.h + BoolToUInt8(regs.f.c); NEXT();                   // sbc h
+    FLAGLESS_OPCODE(0x9D): CYCLES(4); regs.a -= regs.l + BoolToUInt8(regs.f.c); NEXT();                   // sbc l
+    FLAGLESS_OPCODE(0x9E): CYCLES(4); regs.a -= ReadMemoryByte(regs.hl) + BoolToUInt8(regs.f.c); NEXT();  // sbc m
+    FLAGLESS_OPCODE(0x9F): CYCLES(4); regs.a -= regs.a + BoolToUInt8(regs.f.c); NEXT();                   // sbc a
+    FLAGLESS_OPCODE(0xDE): CYCLES(7); regs.a -= IMM8() + BoolToUInt8(regs.f.c); NEXT();                   // sbi d8
+    FLAGLESS_OPCODE(0xA0): CYCLES(4); regs.a &= regs.b; NEXT();                                           // ana b
+    FLAGLESS_OPCODE(0xA1): CYCLES(4); regs.a &= regs.c; NEXT();                                           // ana c
+    FLAGLESS_OPCODE(0xA2): CYCLES(4); regs.a &= regs.d; NEXT();                                           // ana d
+    FLAGLESS_OPCODE(0xA3): CYCLES(4); regs.a &= regs.e; NEXT();                                           // ana e
+    FLAGLESS_OPCODE(0xA4): CYCLES(4); regs.a &= regs.h; NEXT();                                           // ana h
+    FLAGLESS_OPCODE(0xA5): CYCLES(4); regs.a &= regs.l; NEXT();                                           // ana l
+    FLAGLESS_OPCODE(0xA6): CYCLES(4); regs.a &= ReadMemoryByte(regs.hl); NEXT();                          // ana m
+    FLAGLESS_OPCODE(0xA7): CYCLES(4); regs.a &= regs.a; NEXT();                                           // ana a
+    FLAGLESS_OPCODE(0xE6): CYCLES(7); regs.a &= IMM8(); NEXT();                                           // ani d8
+    FLAGLESS_OPCODE(0xA8): CYCLES(4); regs.a ^= regs.b; NEXT();                                           // xra b
+    FLAGLESS_OPCODE(0xA9): CYCLES(4); regs.a ^= regs.c; NEXT();                                           // xra c
+    FLAGLESS_OPCODE(0xAA): CYCLES(4); regs.a ^= regs.d; NEXT();                                           // xra d
+    FLAGLESS_OPCODE(0xAB): CYCLES(4); regs.a ^= regs.e; NEXT();                                           // xra e
+    FLAGLESS_OPCODE(0xAC): CYCLES(4); regs.a ^= regs.h; NEXT();                                           // xra h
+    FLAGLESS_OPCODE(0xAD): CYCLES(4); regs.a ^= regs.l; NEXT();                                           // xra l
+    FLAGLESS_OPCODE(0xAE): CYCLES(4); regs.a ^= ReadMemoryByte(regs.hl); NEXT();                          // xra m
+    FLAGLESS_OPCODE(0xAF): CYCLES(4); regs.a ^= regs.a; NEXT();                                           // xra a
+    FLAGLESS_OPCODE(0xEE): CYCLES(7); regs.a ^= IMM8(); NEXT();                                           // xri d8
+    FLAGLESS_OPCODE(0xB0): CYCLES(4); regs.a |= regs.b; NEXT();                                           // ora b
+    FLAGLESS_OPCODE(0xB1): CYCLES(4); regs.a |= regs.c; NEXT();                                           // ora c
+    FLAGLESS_OPCODE(0xB2): CYCLES(4); regs.a |= regs.d; NEXT();                                           // ora d
+    FLAGLESS_OPCODE(0xB3): CYCLES(4); regs.a |= regs.e; NEXT();                                           // ora e
+    FLAGLESS_OPCODE(0xB4): CYCLES(4); regs.a |= regs.h; NEXT();                                           // ora h
+    FLAGLESS_OPCODE(0xB5): CYCLES(4); regs.a |= regs.l; NEXT();                                           // ora l
+    FLAGLESS_OPCODE(0xB6): CYCLES(4); regs.a |= ReadMemoryByte(regs.hl); NEXT();                          // ora m
+    FLAGLESS_OPCODE(0xB7): CYCLES(4); regs.a |= regs.a; NEXT();                                           // ora a
+    FLAGLESS_OPCODE(0xF6): CYCLES(7); regs.a |= IMM8(); NEXT();                                           // ori d8
+    FLAGLESS_OPCODE(0xB8): CYCLES(4); NEXT();                                                             // cmp b
+    FLAGLESS_OPCODE(0xB9): CYCLES(4); NEXT();                                                             // cmp c
+    FLAGLESS_OPCODE(0xBA): CYCLES(4); NEXT();                                                             // cmp d
+    FLAGLESS_OPCODE(0xBB): CYCLES(4); NEXT();                                                             // cmp e
+    FLAGLESS_OPCODE(0xBC): CYCLES(4); NEXT();                                                             // cmp h
+    FLAGLESS_OPCODE(0xBD): CYCLES(4); NEXT();                                                             // cmp l
+    FLAGLESS_OPCODE(0xBE): CYCLES(4); ReadMemoryByte(regs.hl); NEXT();                                    // cmp m
+    FLAGLESS_OPCODE(0xBF): CYCLES(4); NEXT();                                                             // cmp a
+    FLAGLESS_OPCODE(0xFE): CYCLES(7); NEXT();                                                             // cpi d8
+    FLAGLESS_OPCODE(0x04): CYCLES(5); regs.b++; NEXT();                                                   // inr b
+    FLAGLESS_OPCODE(0x0C): CYCLES(5); regs.c++; NEXT();                                                   // inr c
+    FLAGLESS_OPCODE(0x14): CYCLES(5); regs.d++; NEXT();                                                   // inr d
+    FLAGLESS_OPCODE(0x1C): CYCLES(5); regs.e++; NEXT();                                                   // inr e
+    FLAGLESS_OPCODE(0x24): CYCLES(5); regs.h++; NEXT();                                                   // inr h
+    FLAGLESS_OPCODE(0x2C): CYCLES(5); regs.l++; NEXT();                                                   // inr l
+    FLAGLESS_OPCODE(0x34): CYCLES(10); WriteMemoryByte(regs.hl, ReadMemoryByte(regs.hl) + 1); NEXT();     // inr m
+    FLAGLESS_OPCODE(0x3C): CYCLES(5); regs.a++; NEXT();                                                   // inr a
+    FLAGLESS_OPCODE(0x05): CYCLES(5); regs.b--; NEXT();                                                   // dcr b
+    FLAGLESS_OPCODE(0x0D): CYCLES(5); regs.c--; NEXT();                                                   // dcr c
+    FLAGLESS_OPCODE(0x15): CYCLES(5); regs.d--; NEXT();                                                   // dcr d
+    FLAGLESS_OPCODE(0x1D): CYCLES(5); regs.e--; NEXT();                                                   // dcr e
+    FLAGLESS_OPCODE(0x25): CYCLES(5); regs.h--; NEXT();                                                   // dcr h
+    FLAGLESS_OPCODE(0x2D): CYCLES(5); regs.l--; NEXT();                                                   // dcr l
+    FLAGLESS_OPCODE(0x35): CYCLES(10); WriteMemoryByte(regs.hl, ReadMemoryByte(regs.hl) - 1); NEXT();     // dcr m
+    FLAGLESS_OPCODE(0x3D): CYCLES(5); regs.a--; NEXT();                                                   // dcr a
+
+      // Pairs from FUSED_PAIRS, see CompileBlock(). Each instruction keeps its own cycle count.
+    FUSED_OPCODE(0): CYCLES(7); regs.a = ReadMemoryByte(regs.hl); FUSE_NEXT_INSTRUCTION();                // mov a, m
+                     CYCLES(5); regs.hl++; NEXT();                                                        // inx h
+    FUSED_OPCODE(1): CYCLES(5); regs.b = op_dcr(regs.b); FUSE_NEXT_INSTRUCTION();                         // dcr b
+                     CYCLES(10); if (regs.b != 0) { op_jmp(regs, IMM16()); } NEXT();                      // jnz
+      // clang-format on
+
+    OPCODE(BLOCK_EXIT_HANDLER):
+      // The block was invalidated by one of its own writes. Resume at this instruction with a fresh lookup.
+      executed_instructions--;
+      regs.pc = instruction->pc;
+      goto next_block;
+  }
+
+#if !I8080_THREADED_DISPATCH
+next_instruction:
+  FETCH_NEXT();
+#endif
+
+next_block:
+  if constexpr (mode == LoopMode::CachedInterpreter)
+  {
+    STORE_STATE();
+
+  lookup_block:
+    // Interrupts are only accepted between blocks. Blocks end after ei and I/O, which are the only instructions that
+    // can enable an interrupt or raise a request from a device handler.
+    if (!BeginInstruction())
+      return;
+
+    const CodeBlock* block = LookupBlock(m_regs.pc);
+    if (!block)
+    {
+      // Code outside of mapped memory is never cached.
+      ExecuteInstructions<LoopMode::SingleStep>();
+      goto lookup_block;
+    }
+
+    if (block->idle_loop)
+      SkipIdleLoop(block);
+
+    // Generated code runs until it reaches a block which isn't translated or doesn't fit in the remaining cycles.
+    if (block->host_code && block->host_max_cycles < m_cycles_left)
+    {
+      MaterializeFlags(m_regs);
+      m_code_invalidated = false;
+      m_recompiler->Execute(this, block->host_code);
+      goto lookup_block;
+    }
+
+    // A block could stop at any instruction when it doesn't fit in the remaining cycles, where flags skipped by the
+    // flagless handlers would be visible. Leave the end of the slice to the interpreter instead.
+    if (block->max_cycles >= m_cycles_left)
+    {
+      ExecuteInstructions<LoopMode::Interpreter>();
+      return;
+    }
+
+    LOAD_STATE();
+    instruction = block->instructions.data();
+    block_end = instruction + block->instructions.size();
+    executed_instructions++;
+    regs.pc = static_cast<MemoryAddress>(instruction->pc + instruction->length);
+    DISPATCH(instruction->handler);
+  }
+
+#undef FLAGLESS_ROW
+#undef OPCODE_ROW
+#undef NEXT
+#undef DISPATCH
+#undef FUSE_NEXT_INSTRUCTION
+#undef FUSED_OPCODE
+#undef FLAGLESS_OPCODE
+#undef OPCODE
+#undef FETCH_NEXT
+#undef IMM16
+#undef IMM8
+#undef CYCLES
+#undef STORE_STATE
+#undef LOAD_STATE
+}
+
+template<typename BusType>
+u8 CPU<BusType>::ReadImmediateByte(Registers& regs)
+{
+  return ReadMemoryByte(regs.pc++);
+}
+
+template<typename BusType>
+u16 CPU<BusType>::ReadImmediateWord(Registers& regs)
+{
+  const u16 ret = ReadMemoryWord(regs.pc);
+  regs.pc += 2;
+  return ret;
+}
+
+template<typename BusType>
+void CPU<BusType>::SetLazyFlags(FlagOp op, u8 result, u8 operands)
+{
+  m_flag_op = op;
+  m_flag_result = result;
+  m_flag_operands = operands;
+}
+
+template<typename BusType>
+bool CPU<BusType>::GetFlagS(const Registers& regs) const
+{
+  return (m_flag_op == FlagOp::None) ? regs.f.s : ConvertToBoolUnchecked(m_flag_result >> 7);
+}
+
+template<typename BusType>
+bool CPU<BusType>::GetFlagZ(const Registers& regs) const
+{
+  return (m_flag_op == FlagOp::None) ? regs.f.z : (m_flag_result == 0);
+}
+
+template<typename BusType>
+bool CPU<BusType>::GetFlagH(const Registers& regs) const
+{
+  return (m_flag_op == FlagOp::None) ? regs.f.h : (GetHalfCarryFlag(m_flag_op, m_flag_result, m_flag_operands) != 0);
+}
+
+template<typename BusType>
+bool CPU<BusType>::GetFlagP(const Registers& regs) const
+{
+  return (m_flag_op == FlagOp::None) ? regs.f.p : ((SZP_FLAGS[m_flag_result] & FlagMask_P) != 0);
+}
+
+template<typename BusType>
+void CPU<BusType>::MaterializeFlags(Registers& regs)
+{
+  if (m_flag_op == FlagOp::None)
+    return;
+
+  regs.f.bits = static_cast<u8>((regs.f.bits & ~FlagMask_SZHP) | GetFlagsSZHP(m_flag_op, m_flag_result, m_flag_operands));
+  m_flag_op = FlagOp::None;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_inr(u8 rhs)
+{
+  const u8 res = rhs + 1;
+  SetLazyFlags(FlagOp::Inr, res);
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_dcr(u8 rhs)
+{
+  const u8 res = rhs - 1;
+  SetLazyFlags(FlagOp::Dcr, res);
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_add(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u16 res16 = ZeroExtend16(lhs) + ZeroExtend16(rhs);
+  const u8 res8 = Truncate8(res16);
+
+  regs.f.c = ConvertToBoolUnchecked(res16 >> 8);
+  SetLazyFlags(FlagOp::Add, res8, lhs ^ rhs);
+
+  return res8;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_adc(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u16 res16 = ZeroExtend16(lhs) + ZeroExtend16(rhs) + BoolToUInt16(regs.f.c);
+  const u8 res8 = Truncate8(res16);
+
+  regs.f.c = ConvertToBoolUnchecked(res16 >> 8);
+  SetLazyFlags(FlagOp::Add, res8, lhs ^ rhs);
+
+  return res8;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_sub(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u16 res16 = ZeroExtend16(lhs) - ZeroExtend16(rhs);
+  const u8 res8 = Truncate8(res16);
+
+  regs.f.c = ConvertToBoolUnchecked((res16 >> 8) & u16(1));
+  SetLazyFlags(FlagOp::Sub, res8, lhs ^ rhs);
+
+  return res8;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_sbb(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u16 res16 = ZeroExtend16(lhs) - ZeroExtend16(rhs) - BoolToUInt16(regs.f.c);
+  const u8 res8 = Truncate8(res16);
+
+  regs.f.c = ConvertToBoolUnchecked((res16 >> 8) & u16(1));
+  SetLazyFlags(FlagOp::Sub, res8, lhs ^ rhs);
+
+  return res8;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_and(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u8 res = lhs & rhs;
+
+  regs.f.c = false;
+  SetLazyFlags(FlagOp::And, res, lhs ^ rhs);
+
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_xor(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u8 res = lhs ^ rhs;
+
+  regs.f.c = false;
+  SetLazyFlags(FlagOp::Logic, res);
+
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_or(Registers& regs, u8 lhs, u8 rhs)
+{
+  const u8 res = lhs | rhs;
+
+  regs.f.c = false;
+  SetLazyFlags(FlagOp::Logic, res);
+
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_rlc(Registers& regs, u8 rhs)
+{
+  const u8 res = (rhs << 1) | (rhs >> 7);
+  regs.f.c = ConvertToBoolUnchecked(rhs >> 7);
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_rrc(Registers& regs, u8 rhs)
+{
+  const u8 res = (rhs >> 1) | (rhs << 7);
+  regs.f.c = ConvertToBoolUnchecked(rhs & u8(1));
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_ral(Registers& regs, u8 rhs)
+{
+  const u8 res = (rhs << 1) | BoolToUInt8(regs.f.c);
+  regs.f.c = ConvertToBoolUnchecked(rhs >> 7);
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_rar(Registers& regs, u8 rhs)
+{
+  const u8 res = (rhs >> 1) | (BoolToUInt8(regs.f.c) << 7);
+  regs.f.c = ConvertToBoolUnchecked(rhs & u8(1));
+  return res;
+}
+
+template<typename BusType>
+u8 CPU<BusType>::op_daa(Registers& regs, u8 rhs)
+{
+  u8 add = 0;
+  if ((rhs & u8(0xF)) > 0x9 || GetFlagH(regs))
+    add = 0x06;
+
+  if (rhs > 0x99 || regs.f.c)
+  {
+    add += 0x60;
+    regs.f.c = true;
+  }
+
+  const u16 res16 = ZeroExtend16(rhs) + ZeroExtend16(add);
+  const u8 res8 = Truncate8(res16);
+  SetLazyFlags(FlagOp::Add, res8, rhs ^ add);
+
+  return Truncate8(res8);
+}
+
+template<typename BusType>
+u16 CPU<BusType>::op_dad(Registers& regs, u16 lhs, u16 rhs)
+{
+  const u32 res32 = ZeroExtend32(lhs) + ZeroExtend32(rhs);
+  regs.f.c = ConvertToBoolUnchecked(res32 >> 16);
+  return Truncate16(res32);
+}
+
+template<typename BusType>
+void CPU<BusType>::op_jmp(Registers& regs, u16 rhs)
+{
+  regs.pc = rhs;
+}
+
+template<typename BusType>
+void CPU<BusType>::op_call(Registers& regs, u16 rhs)
+{
+  PushWord(regs, regs.pc);
+  op_jmp(regs, rhs);
+  if (IsProfiling())
+    m_profiler->RecordCall(rhs);
+}
+
+template<typename BusType>
+void CPU<BusType>::op_ret(Registers& regs)
+{
+  regs.pc = PopWord(regs);
+  if (IsProfiling())
+    m_profiler->RecordReturn();
+}
+
+template<typename BusType>
+void CPU<BusType>::op_xthl(Registers& regs)
+{
+  const u16 hl = regs.hl;
+  regs.hl = ReadMemoryWord(regs.sp);
+  WriteMemoryWord(regs.sp, hl);
+}
+
+} // namespace i8080
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+#include "types.h"
+
+class String;
+
+namespace i8080 {
+
+// Formats the instruction in bytes as "address: hex bytes  mnemonic". bytes must hold the whole instruction, i.e.
+// INSTRUCTION_INFO[bytes[0]].length bytes.
+void Disassemble(MemoryAddress address, const u8* bytes, String* dest);
+
+} // namespace i8080
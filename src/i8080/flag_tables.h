@@ -0,0 +1,62 @@
+#pragma once
+#include "instruction_info.h"
+#include "types.h"
+#include <array>
+
+namespace i8080 {
+
+// How H is derived from the result and operands recorded for an ALU instruction. S, Z and P only depend on the result.
+// The operands are recorded as lhs ^ rhs, or zero for inr and dcr.
+enum class FlagOp : u8
+{
+  None,  // the flags register is up to date
+  Add,   // H is bit 4 of operands ^ result
+  Sub,   // H is the inverse of bit 4 of operands ^ result
+  And,   // H is bit 3 of operands ^ result, which is bit 3 of lhs | rhs
+  Logic, // H is clear
+  Inr,
+  Dcr,
+  Count
+};
+
+// S, Z and P for each result byte, as bits of the F register.
+constexpr std::array<u8, 256> SZP_FLAGS = [] {
+  std::array<u8, 256> table = {};
+  for (u32 value = 0; value < 256; value++)
+  {
+    u32 bits = 0;
+    for (u32 i = 0; i < 8; i++)
+      bits += (value >> i) & 1;
+
+    table[value] = static_cast<u8>(((value & 0x80) ? FlagMask_S : 0) | ((value == 0) ? FlagMask_Z : 0) |
+                                   ((bits & 1) ? 0 : FlagMask_P));
+  }
+  return table;
+}();
+
+// H for each FlagOp, indexed by the low five bits of operands ^ result.
+constexpr std::array<std::array<u8, 32>, static_cast<size_t>(FlagOp::Count)> HALF_CARRY_FLAGS = [] {
+  std::array<std::array<u8, 32>, static_cast<size_t>(FlagOp::Count)> table = {};
+  for (u32 index = 0; index < 32; index++)
+  {
+    table[static_cast<size_t>(FlagOp::Add)][index] = (index & 0x10) ? FlagMask_H : 0;
+    table[static_cast<size_t>(FlagOp::Sub)][index] = (index & 0x10) ? 0 : FlagMask_H;
+    table[static_cast<size_t>(FlagOp::And)][index] = (index & 0x08) ? FlagMask_H : 0;
+    table[static_cast<size_t>(FlagOp::Inr)][index] = ((index & 0xF) == 0) ? FlagMask_H : 0;
+    table[static_cast<size_t>(FlagOp::Dcr)][index] = ((index & 0xF) != 0xF) ? FlagMask_H : 0;
+  }
+  return table;
+}();
+
+constexpr u8 GetHalfCarryFlag(FlagOp op, u8 result, u8 operands)
+{
+  return HALF_CARRY_FLAGS[static_cast<size_t>(op)][(operands ^ result) & 0x1F];
+}
+
+// S, Z, H and P after an ALU instruction, ready to be merged into F with a single store.
+constexpr u8 GetFlagsSZHP(FlagOp op, u8 result, u8 operands)
+{
+  return SZP_FLAGS[result] | GetHalfCarryFlag(op, result, operands);
+}
+
+} // namespace i8080
@@ -0,0 +1,384 @@
+#pragma once
+#include "types.h"
+#include <array>
+
+namespace i8080 {
+
+enum InstructionFlags : u8
+{
+  // Control transfers, hlt, ei and I/O. Anything executed after these may depend on state outside the CPU (the target
+  // address, a newly accepted interrupt or a device), so decoded blocks stop here.
+  InstructionFlag_EndsBlock = (1 << 0),
+
+  // Writes memory, accesses I/O, changes the interrupt enable or halts. Instructions without this flag only read memory
+  // and modify registers.
+  InstructionFlag_HasSideEffects = (1 << 1),
+};
+
+struct InstructionInfo
+{
+  u8 length; // opcode and immediate bytes
+  u8 cycles; // taken branch timing for conditional calls and returns
+  u8 flags;
+};
+
+// An instruction captured by the block decoder.
+struct DecodedInstruction
+{
+  u16 handler; // opcode, a variant which skips the flags, or CPU::BLOCK_EXIT_HANDLER once the block is invalidated
+  u16 operand; // immediate byte or word
+  MemoryAddress pc;
+  u8 length;
+  u8 opcode;
+};
+
+// Static properties of each opcode, indexed by the opcode byte.
+constexpr std::array<InstructionInfo, 256> INSTRUCTION_INFO = {{
+  {1,  4, 0},                                                          // 00 nop
+  {3, 10, 0},                                                          // 01 lxi b, d16
+  {1,  7, InstructionFlag_HasSideEffects},                             // 02 stax b
+  {1,  5, 0},                                                          // 03 inx b
+  {1,  5, 0},                                                          // 04 inr b
+  {1,  5, 0},                                                          // 05 dcr b
+  {2,  7, 0},                                                          // 06 mvi b, d8
+  {1,  4, 0},                                                          // 07 rlc
+  {1,  4, 0},                                                          // 08 nop
+  {1, 10, 0},                                                          // 09 dad b
+  {1,  7, 0},                                                          // 0A ldax b
+  {1,  5, 0},                                                          // 0B dcx b
+  {1,  5, 0},                                                          // 0C inr c
+  {1,  5, 0},                                                          // 0D dcr c
+  {2,  7, 0},                                                          // 0E mvi c, d8
+  {1,  4, 0},                                                          // 0F rrc
+  {1,  4, 0},                                                          // 10 nop
+  {3, 10, 0},                                                          // 11 lxi d, d16
+  {1,  7, InstructionFlag_HasSideEffects},                             // 12 stax d
+  {1,  5, 0},                                                          // 13 inx d
+  {1,  5, 0},                                                          // 14 inr d
+  {1,  5, 0},                                                          // 15 dcr d
+  {2,  7, 0},                                                          // 16 mvi d, d8
+  {1,  4, 0},                                                          // 17 ral
+  {1,  4, 0},                                                          // 18 nop
+  {1, 10, 0},                                                          // 19 dad d
+  {1,  7, 0},                                                          // 1A ldax d
+  {1,  5, 0},                                                          // 1B dcx d
+  {1,  5, 0},                                                          // 1C inr e
+  {1,  5, 0},                                                          // 1D dcr e
+  {2,  7, 0},                                                          // 1E mvi e, d8
+  {1,  4, 0},                                                          // 1F rar
+  {1,  4, 0},                                                          // 20 nop
+  {3, 10, 0},                                                          // 21 lxi h, d16
+  {3, 16, InstructionFlag_HasSideEffects},                             // 22 shld
+  {1,  5, 0},                                                          // 23 inx h
+  {1,  5, 0},                                                          // 24 inr h
+  {1,  5, 0},                                                          // 25 dcr h
+  {2,  7, 0},                                                          // 26 mvi h, d8
+  {1,  4, 0},                                                          // 27 daa
+  {1,  4, 0},                                                          // 28 nop
+  {1, 10, 0},                                                          // 29 dad h
+  {3, 16, 0},                                                          // 2A lhld
+  {1,  5, 0},                                                          // 2B dcx h
+  {1,  5, 0},                                                          // 2C inr l
+  {1,  5, 0},                                                          // 2D dcr l
+  {2,  7, 0},                                                          // 2E mvi l, d8
+  {1,  4, 0},                                                          // 2F cma
+  {1,  4, 0},                                                          // 30 nop
+  {3, 10, 0},                                                          // 31 lxi sp, d16
+  {3, 13, InstructionFlag_HasSideEffects},                             // 32 sta a16
+  {1,  5, 0},                                                          // 33 inx sp
+  {1, 10, InstructionFlag_HasSideEffects},                             // 34 inr m
+  {1, 10, InstructionFlag_HasSideEffects},                             // 35 dcr m
+  {2, 10, InstructionFlag_HasSideEffects},                             // 36 mvi m, d8
+  {1,  4, 0},                                                          // 37 stc
+  {1,  4, 0},                                                          // 38 nop
+  {1, 10, 0},                                                          // 39 dad sp
+  {3, 13, 0},                                                          // 3A lda a16
+  {1,  5, 0},                                                          // 3B dcx sp
+  {1,  5, 0},                                                          // 3C inr a
+  {1,  5, 0},                                                          // 3D dcr a
+  {2,  7, 0},                                                          // 3E mvi a, d8
+  {1,  4, 0},                                                          // 3F cmc
+  {1,  5, 0},                                                          // 40 mov b, b
+  {1,  5, 0},                                                          // 41 mov b, c
+  {1,  5, 0},                                                          // 42 mov b, d
+  {1,  5, 0},                                                          // 43 mov b, e
+  {1,  5, 0},                                                          // 44 mov b, h
+  {1,  5, 0},                                                          // 45 mov b, l
+  {1,  7, 0},                                                          // 46 mov b, m
+  {1,  5, 0},                                                          // 47 mov b, a
+  {1,  5, 0},                                                          // 48 mov c, b
+  {1,  5, 0},                                                          // 49 mov c, c
+  {1,  5, 0},                                                          // 4A mov c, d
+  {1,  5, 0},                                                          // 4B mov c, e
+  {1,  5, 0},                                                          // 4C mov c, h
+  {1,  5, 0},                                                          // 4D mov c, l
+  {1,  7, 0},                                                          // 4E mov c, m
+  {1,  5, 0},                                                          // 4F mov c, a
+  {1,  5, 0},                                                          // 50 mov d, b
+  {1,  5, 0},                                                          // 51 mov d, c
+  {1,  5, 0},                                                          // 52 mov d, d
+  {1,  5, 0},                                                          // 53 mov d, e
+  {1,  5, 0},                                                          // 54 mov d, h
+  {1,  5, 0},                                                          // 55 mov d, l
+  {1,  7, 0},                                                          // 56 mov d, m
+  {1,  5, 0},                                                          // 57 mov d, a
+  {1,  5, 0},                                                          // 58 mov e, b
+  {1,  5, 0},                                                          // 59 mov e, c
+  {1,  5, 0},                                                          // 5A mov e, d
+  {1,  5, 0},                                                          // 5B mov e, e
+  {1,  5, 0},                                                          // 5C mov e, h
+  {1,  5, 0},                                                          // 5D mov e, l
+  {1,  7, 0},                                                          // 5E mov e, m
+  {1,  5, 0},                                                          // 5F mov e, a
+  {1,  5, 0},                                                          // 60 mov h, b
+  {1,  5, 0},                                                          // 61 mov h, c
+  {1,  5, 0},                                                          // 62 mov h, d
+  {1,  5, 0},                                                          // 63 mov h, e
+  {1,  5, 0},                                                          // 64 mov h, h
+  {1,  5, 0},                                                          // 65 mov h, l
+  {1,  7, 0},                                                          // 66 mov h, m
+  {1,  5, 0},                                                          // 67 mov h, a
+  {1,  5, 0},                                                          // 68 mov l, b
+  {1,  5, 0},                                                          // 69 mov l, c
+  {1,  5, 0},                                                          // 6A mov l, d
+  {1,  5, 0},                                                          // 6B mov l, e
+  {1,  5, 0},                                                          // 6C mov l, h
+  {1,  5, 0},                                                          // 6D mov l, l
+  {1,  7, 0},                                                          // 6E mov l, m
+  {1,  5, 0},                                                          // 6F mov l, a
+  {1,  7, InstructionFlag_HasSideEffects},                             // 70 mov m, b
+  {1,  7, InstructionFlag_HasSideEffects},                             // 71 mov m, c
+  {1,  7, InstructionFlag_HasSideEffects},                             // 72 mov m, d
+  {1,  7, InstructionFlag_HasSideEffects},                             // 73 mov m, e
+  {1,  7, InstructionFlag_HasSideEffects},                             // 74 mov m, h
+  {1,  7, InstructionFlag_HasSideEffects},                             // 75 mov m, l
+  {1,  7, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // 76 hlt
+  {1,  7, InstructionFlag_HasSideEffects},                             // 77 mov m, a
+  {1,  5, 0},                                                          // 78 mov a, b
+  {1,  5, 0},                                                          // 79 mov a, c
+  {1,  5, 0},                                                          // 7A mov a, d
+  {1,  5, 0},                                                          // 7B mov a, e
+  {1,  5, 0},                                                          // 7C mov a, h
+  {1,  5, 0},                                                          // 7D mov a, l
+  {1,  7, 0},                                                          // 7E mov a, m
+  {1,  5, 0},                                                          // 7F mov a, a
+  {1,  4, 0},                                                          // 80 add b
+  {1,  4, 0},                                                          // 81 add c
+  {1,  4, 0},                                                          // 82 add d
+  {1,  4, 0},                                                          // 83 add e
+  {1,  4, 0},                                                          // 84 add h
+  {1,  4, 0},                                                          // 85 add l
+  {1,  4, 0},                                                          // 86 add m
+  {1,  4, 0},                                                          // 87 add a
+  {1,  4, 0},                                                          // 88 adc b
+  {1,  4, 0},                                                          // 89 adc c
+  {1,  4, 0},                                                          // 8A adc d
+  {1,  4, 0},                                                          // 8B adc e
+  {1,  4, 0},                                                          // 8C adc h
+  {1,  4, 0},                                                          // 8D adc l
+  {1,  4, 0},                                                          // 8E adc m
+  {1,  4, 0},                                                          // 8F adc a
+  {1,  4, 0},                                                          // 90 sub b
+  {1,  4, 0},                                                          // 91 sub c
+  {1,  4, 0},                                                          // 92 sub d
+  {1,  4, 0},                                                          // 93 sub e
+  {1,  4, 0},                                                          // 94 sub h
+  {1,  4, 0},                                                          // 95 sub l
+  {1,  4, 0},                                                          // 96 sub m
+  {1,  4, 0},                                                          // 97 sub a
+  {1,  4, 0},                                                          // 98 sbc b
+  {1,  4, 0},                                                          // 99 sbc c
+  {1,  4, 0},                                                          // 9A sbc d
+  {1,  4, 0},                                                          // 9B sbc e
+  {1,  4, 0},                                                          // 9C sbc h
+  {1,  4, 0},                                                          // 9D sbc l
+  {1,  4, 0},                                                          // 9E sbc m
+  {1,  4, 0},                                                          // 9F sbc a
+  {1,  4, 0},                                                          // A0 ana b
+  {1,  4, 0},                                                          // A1 ana c
+  {1,  4, 0},                                                          // A2 ana d
+  {1,  4, 0},                                                          // A3 ana e
+  {1,  4, 0},                                                          // A4 ana h
+  {1,  4, 0},                                                          // A5 ana l
+  {1,  4, 0},                                                          // A6 ana m
+  {1,  4, 0},                                                          // A7 ana a
+  {1,  4, 0},                                                          // A8 xra b
+  {1,  4, 0},                                                          // A9 xra c
+  {1,  4, 0},                                                          // AA xra d
+  {1,  4, 0},                                                          // AB xra e
+  {1,  4, 0},                                                          // AC xra h
+  {1,  4, 0},                                                          // AD xra l
+  {1,  4, 0},                                                          // AE xra m
+  {1,  4, 0},                                                          // AF xra a
+  {1,  4, 0},                                                          // B0 ora b
+  {1,  4, 0},                                                          // B1 ora c
+  {1,  4, 0},                                                          // B2 ora d
+  {1,  4, 0},                                                          // B3 ora e
+  {1,  4, 0},                                                          // B4 ora h
+  {1,  4, 0},                                                          // B5 ora l
+  {1,  4, 0},                                                          // B6 ora m
+  {1,  4, 0},                                                          // B7 ora a
+  {1,  4, 0},                                                          // B8 cmp b
+  {1,  4, 0},                                                          // B9 cmp c
+  {1,  4, 0},                                                          // BA cmp d
+  {1,  4, 0},                                                          // BB cmp e
+  {1,  4, 0},                                                          // BC cmp h
+  {1,  4, 0},                                                          // BD cmp l
+  {1,  4, 0},                                                          // BE cmp m
+  {1,  4, 0},                                                          // BF cmp a
+  {1, 11, InstructionFlag_EndsBlock},                                  // C0 rnz
+  {1, 10, 0},                                                          // C1 pop b
+  {3, 10, InstructionFlag_EndsBlock},                                  // C2 jnz a16
+  {3, 10, InstructionFlag_EndsBlock},                                  // C3 jmp a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // C4 cnz a16
+  {1, 11, InstructionFlag_HasSideEffects},                             // C5 push b
+  {2,  7, 0},                                                          // C6 adi d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // C7 rst 0
+  {1, 11, InstructionFlag_EndsBlock},                                  // C8 rz
+  {1, 10, InstructionFlag_EndsBlock},                                  // C9 ret
+  {3, 10, InstructionFlag_EndsBlock},                                  // CA jz a16
+  {3, 10, InstructionFlag_EndsBlock},                                  // CB jmp a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // CC cz a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // CD call a16
+  {2,  7, 0},                                                          // CE aci d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // CF rst 1
+  {1, 11, InstructionFlag_EndsBlock},                                  // D0 rnc
+  {1, 10, 0},                                                          // D1 pop d
+  {3, 10, InstructionFlag_EndsBlock},                                  // D2 jnc a16
+  {2, 10, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // D3 out d8
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // D4 cnc a16
+  {1, 11, InstructionFlag_HasSideEffects},                             // D5 push d
+  {2,  7, 0},                                                          // D6 sui d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // D7 rst 2
+  {1, 11, InstructionFlag_EndsBlock},                                  // D8 rc
+  {1, 10, InstructionFlag_EndsBlock},                                  // D9 ret
+  {3, 10, InstructionFlag_EndsBlock},                                  // DA jc a16
+  {2, 10, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // DB in d8
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // DC cc a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // DD call a16
+  {2,  7, 0},                                                          // DE sbi d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // DF rst 3
+  {1, 11, InstructionFlag_EndsBlock},                                  // E0 rpo
+  {1, 10, 0},                                                          // E1 pop h
+  {3, 10, InstructionFlag_EndsBlock},                                  // E2 jpo a16
+  {1, 18, InstructionFlag_HasSideEffects},                             // E3 xthl
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // E4 cpo a16
+  {1, 11, InstructionFlag_HasSideEffects},                             // E5 push h
+  {2,  7, 0},                                                          // E6 ani d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // E7 rst 4
+  {1, 11, InstructionFlag_EndsBlock},                                  // E8 rpe
+  {1,  5, InstructionFlag_EndsBlock},                                  // E9 pchl
+  {3, 10, InstructionFlag_EndsBlock},                                  // EA jo a16
+  {1,  5, 0},                                                          // EB xchg
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // EC cpe a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // ED call a16
+  {2,  7, 0},                                                          // EE xri d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // EF rst 5
+  {1, 11, InstructionFlag_EndsBlock},                                  // F0 rp
+  {1, 10, 0},                                                          // F1 pop psw
+  {3, 10, InstructionFlag_EndsBlock},                                  // F2 jp a16
+  {1,  4, InstructionFlag_HasSideEffects},                             // F3 di
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // F4 cp a16
+  {1, 11, InstructionFlag_HasSideEffects},                             // F5 push psw
+  {2,  7, 0},                                                          // F6 ori d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // F7 rst 6
+  {1, 11, InstructionFlag_EndsBlock},                                  // F8 rm
+  {1,  5, 0},                                                          // F9 sphl
+  {3, 10, InstructionFlag_EndsBlock},                                  // FA jm a16
+  {1,  4, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // FB ei
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // FC cm a16
+  {3, 17, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // FD call a16
+  {2,  7, 0},                                                          // FE cpi d8
+  {1, 11, InstructionFlag_EndsBlock | InstructionFlag_HasSideEffects}, // FF rst 7
+}};
+
+// Adjacent instructions which the cached interpreter runs with a single handler. Only pairs seen in a profile of the
+// Invaders ROM are listed; add pairs from `tracedump --pairs` on a trace of the program, not by guessing. Each pair has
+// a fused handler in CPU::ExecuteInstructions, in the same order.
+struct FusedPair
+{
+  u8 first;
+  u8 second;
+};
+
+constexpr std::array<FusedPair, 2> FUSED_PAIRS = {{
+  {0x7E, 0x23}, // mov a, m; inx h
+  {0x05, 0xC2}, // dcr b; jnz a16
+}};
+
+// Flags read or written by an instruction, as bits of the F register.
+enum FlagMask : u8
+{
+  FlagMask_S = (1 << 7),
+  FlagMask_Z = (1 << 6),
+  FlagMask_H = (1 << 4),
+  FlagMask_P = (1 << 2),
+  FlagMask_C = (1 << 0),
+  FlagMask_SZHP = FlagMask_S | FlagMask_Z | FlagMask_H | FlagMask_P,
+  FlagMask_All = FlagMask_SZHP | FlagMask_C,
+};
+
+constexpr u8 GetFlagsRead(u8 opcode)
+{
+  // Conditional jumps, calls and returns test Z, C, P or S depending on bits 4-5.
+  if ((opcode & 0xC7) == 0xC0 || (opcode & 0xC7) == 0xC2 || (opcode & 0xC7) == 0xC4)
+  {
+    constexpr u8 condition_flags[4] = {FlagMask_Z, FlagMask_C, FlagMask_P, FlagMask_S};
+    return condition_flags[(opcode >> 4) & 3];
+  }
+
+  switch (opcode)
+  {
+    case 0xF5: // push psw
+      return FlagMask_All;
+
+    case 0x27: // daa
+      return FlagMask_H | FlagMask_C;
+
+    case 0x17: // ral
+    case 0x1F: // rar
+    case 0x3F: // cmc
+    case 0xCE: // aci
+    case 0xDE: // sbi
+      return FlagMask_C;
+
+    default:
+      // adc and sbb
+      return (opcode >= 0x88 && opcode < 0xA0) ? FlagMask_C : 0;
+  }
+}
+
+constexpr u8 GetFlagsWritten(u8 opcode)
+{
+  // ALU operations with a register, memory or immediate operand.
+  if ((opcode >= 0x80 && opcode < 0xC0) || (opcode & 0xC7) == 0xC6)
+    return FlagMask_All;
+
+  // inr and dcr leave carry alone.
+  if ((opcode & 0xC6) == 0x04)
+    return FlagMask_SZHP;
+
+  switch (opcode)
+  {
+    case 0x27: // daa
+    case 0xF1: // pop psw
+      return FlagMask_All;
+
+    case 0x07: // rlc
+    case 0x0F: // rrc
+    case 0x17: // ral
+    case 0x1F: // rar
+    case 0x37: // stc
+    case 0x3F: // cmc
+    case 0x09: // dad b
+    case 0x19: // dad d
+    case 0x29: // dad h
+    case 0x39: // dad sp
+      return FlagMask_C;
+
+    default:
+      return 0;
+  }
+}
+
+} // namespace i8080
@@ -0,0 +1,193 @@
+#include "profiler.h"
+#include "disassembler.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/String.h"
+#include <algorithm>
+#include <cstdio>
+Log_SetChannel(Profiler);
+
+namespace i8080 {
+
+Profiler::Profiler()
+{
+  m_pc_executions = std::make_unique<u64[]>(0x10000);
+  m_pc_cycles = std::make_unique<u64[]>(0x10000);
+  Clear();
+}
+
+Profiler::~Profiler() = default;
+
+void Profiler::Clear()
+{
+  std::fill_n(m_pc_executions.get(), 0x10000, 0);
+  std::fill_n(m_pc_cycles.get(), 0x10000, 0);
+  m_opcode_executions.fill(0);
+  m_opcode_cycles.fill(0);
+  m_nodes.clear();
+  m_nodes.push_back({0, ROOT_FUNCTION, 0, 0});
+  m_child_nodes.clear();
+  m_current_node = 0;
+  m_call_edges.clear();
+}
+
+void Profiler::RecordCall(MemoryAddress target)
+{
+  const CallNode& current = m_nodes[m_current_node];
+  m_call_edges[(static_cast<u64>(current.function) << 17) | target]++;
+
+  // Code which never returns (e.g. a jump back to the main loop from an interrupt handler) would grow the stack forever,
+  // so deep stacks stop descending and charge further calls to the deepest function.
+  if (current.depth == MAX_CALL_DEPTH)
+    return;
+
+  const u64 key = (static_cast<u64>(m_current_node) << 17) | target;
+  auto it = m_child_nodes.find(key);
+  if (it == m_child_nodes.end())
+  {
+    const u32 node = static_cast<u32>(m_nodes.size());
+    m_nodes.push_back({m_current_node, target, current.depth + 1, 0});
+    it = m_child_nodes.emplace(key, node).first;
+  }
+
+  m_current_node = it->second;
+}
+
+void Profiler::RecordReturn()
+{
+  m_current_node = m_nodes[m_current_node].parent;
+}
+
+static void FormatFunction(u32 function, char* buf, size_t buf_size)
+{
+  if (function > 0xFFFF)
+    std::snprintf(buf, buf_size, "root");
+  else
+    std::snprintf(buf, buf_size, "%04X", function);
+}
+
+bool Profiler::WriteReport(const char* filename, const u8* memory, u32 max_addresses) const
+{
+  std::FILE* fp = std::fopen(filename, "w");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s' for writing", filename);
+    return false;
+  }
+
+  u64 total_instructions = 0;
+  u64 total_cycles = 0;
+  std::vector<MemoryAddress> addresses;
+  for (u32 pc = 0; pc < 0x10000; pc++)
+  {
+    if (m_pc_executions[pc] == 0)
+      continue;
+
+    total_instructions += m_pc_executions[pc];
+    total_cycles += m_pc_cycles[pc];
+    addresses.push_back(static_cast<MemoryAddress>(pc));
+  }
+
+  const double percent_scale = (total_cycles > 0) ? (100.0 / static_cast<double>(total_cycles)) : 0.0;
+  std::sort(addresses.begin(), addresses.end(), [this](MemoryAddress lhs, MemoryAddress rhs) {
+    return (m_pc_cycles[lhs] != m_pc_cycles[rhs]) ? (m_pc_cycles[lhs] > m_pc_cycles[rhs]) : (lhs < rhs);
+  });
+  if (addresses.size() > max_addresses)
+    addresses.resize(max_addresses);
+
+  std::fprintf(fp, "%llu instructions, %llu cycles\n\n", static_cast<unsigned long long>(total_instructions),
+               static_cast<unsigned long long>(total_cycles));
+
+  std::fprintf(fp, "address   executions         cycles       %%  instruction\n");
+  SmallString disasm;
+  for (const MemoryAddress pc : addresses)
+  {
+    disasm.Clear();
+    if (memory)
+    {
+      const u8 bytes[3] = {memory[pc], memory[static_cast<MemoryAddress>(pc + 1)],
+                           memory[static_cast<MemoryAddress>(pc + 2)]};
+      Disassemble(pc, bytes, &disasm);
+    }
+
+    std::fprintf(fp, "   %04X %12llu %14llu %6.2f%%  %s\n", pc, static_cast<unsigned long long>(m_pc_executions[pc]),
+                 static_cast<unsigned long long>(m_pc_cycles[pc]), static_cast<double>(m_pc_cycles[pc]) * percent_scale,
+                 disasm.GetCharArray());
+  }
+
+  std::vector<u32> opcodes;
+  for (u32 opcode = 0; opcode < 256; opcode++)
+  {
+    if (m_opcode_executions[opcode] > 0)
+      opcodes.push_back(opcode);
+  }
+  std::sort(opcodes.begin(), opcodes.end(), [this](u32 lhs, u32 rhs) {
+    return (m_opcode_cycles[lhs] != m_opcode_cycles[rhs]) ? (m_opcode_cycles[lhs] > m_opcode_cycles[rhs]) : (lhs < rhs);
+  });
+
+  std::fprintf(fp, "\nopcode   executions         cycles       %%\n");
+  for (const u32 opcode : opcodes)
+  {
+    std::fprintf(fp, "    %02X %12llu %14llu %6.2f%%\n", opcode,
+                 static_cast<unsigned long long>(m_opcode_executions[opcode]),
+                 static_cast<unsigned long long>(m_opcode_cycles[opcode]),
+                 static_cast<double>(m_opcode_cycles[opcode]) * percent_scale);
+  }
+
+  std::vector<std::pair<u64, u64>> edges(m_call_edges.begin(), m_call_edges.end());
+  std::sort(edges.begin(), edges.end(), [](const auto& lhs, const auto& rhs) {
+    return (lhs.second != rhs.second) ? (lhs.second > rhs.second) : (lhs.first < rhs.first);
+  });
+
+  std::fprintf(fp, "\ncaller callee        calls\n");
+  for (const auto& [key, count] : edges)
+  {
+    char caller[8], callee[8];
+    FormatFunction(static_cast<u32>(key >> 17), caller, sizeof(caller));
+    FormatFunction(static_cast<u32>(key & 0x1FFFF), callee, sizeof(callee));
+    std::fprintf(fp, "%6s   %4s %12llu\n", caller, callee, static_cast<unsigned long long>(count));
+  }
+
+  if (std::fclose(fp) != 0)
+  {
+    Log_ErrorPrintf("Failed to write profile report to '%s'", filename);
+    return false;
+  }
+
+  return true;
+}
+
+bool Profiler::WriteCollapsedStacks(const char* filename) const
+{
+  std::FILE* fp = std::fopen(filename, "w");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s' for writing", filename);
+    return false;
+  }
+
+  std::vector<u32> stack;
+  for (u32 node = 0; node < static_cast<u32>(m_nodes.size()); node++)
+  {
+    if (m_nodes[node].cycles == 0)
+      continue;
+
+    stack.clear();
+    for (u32 frame = node; frame != 0; frame = m_nodes[frame].parent)
+      stack.push_back(m_nodes[frame].function);
+
+    std::fputs("root", fp);
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+      std::fprintf(fp, ";%04X", *it);
+    std::fprintf(fp, " %llu\n", static_cast<unsigned long long>(m_nodes[node].cycles));
+  }
+
+  if (std::fclose(fp) != 0)
+  {
+    Log_ErrorPrintf("Failed to write collapsed stacks to '%s'", filename);
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace i8080
@@ -0,0 +1,79 @@
+#pragma once
+#include "types.h"
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace i8080 {
+
+// Counts executions and cycles for every address and opcode, and builds a call tree from calls, returns and interrupts.
+// A CPU built with I8080_ENABLE_PROFILE feeds the attached profiler one instruction at a time. Per address counters are
+// flat 64K arrays, so recording an instruction is a handful of increments.
+class Profiler
+{
+public:
+  Profiler();
+  ~Profiler();
+
+  void Clear();
+
+  u64 GetExecutionCount(MemoryAddress pc) const { return m_pc_executions[pc]; }
+  u64 GetCycleCount(MemoryAddress pc) const { return m_pc_cycles[pc]; }
+  u64 GetOpcodeExecutionCount(u8 opcode) const { return m_opcode_executions[opcode]; }
+  u64 GetOpcodeCycleCount(u8 opcode) const { return m_opcode_cycles[opcode]; }
+
+  // Cycles are charged to the function on top of the call stack once the instruction has executed, so calls and
+  // returns count towards the function being entered.
+  void RecordInstruction(MemoryAddress pc, u8 opcode, CycleCount cycles)
+  {
+    const u64 cycles64 = static_cast<u64>(cycles);
+    m_pc_executions[pc]++;
+    m_pc_cycles[pc] += cycles64;
+    m_opcode_executions[opcode]++;
+    m_opcode_cycles[opcode] += cycles64;
+    m_nodes[m_current_node].cycles += cycles64;
+  }
+
+  // Called for call, rst and accepted interrupts.
+  void RecordCall(MemoryAddress target);
+
+  // Called for taken returns. Returns without a matching call (e.g. code which pushes its own return address) are
+  // ignored at the top level.
+  void RecordReturn();
+
+  // Writes the hottest addresses by cycles, totals per opcode and the call edges as text. When memory (all 64KB of the
+  // address space) is given, each address is disassembled.
+  bool WriteReport(const char* filename, const u8* memory = nullptr, u32 max_addresses = 200) const;
+
+  // Writes one line per call stack in the collapsed format read by flamegraph.pl and compatible tools, e.g.
+  // "root;0100;0A3C 1234", where each frame is the entry address of a function and the count is cycles.
+  bool WriteCollapsedStacks(const char* filename) const;
+
+private:
+  static constexpr u32 ROOT_FUNCTION = 0x10000;
+  static constexpr u32 MAX_CALL_DEPTH = 512;
+
+  struct CallNode
+  {
+    u32 parent;
+    u32 function; // entry address, or ROOT_FUNCTION
+    u32 depth;
+    u64 cycles;   // excluding callees
+  };
+
+  std::unique_ptr<u64[]> m_pc_executions;
+  std::unique_ptr<u64[]> m_pc_cycles;
+  std::array<u64, 256> m_opcode_executions = {};
+  std::array<u64, 256> m_opcode_cycles = {};
+
+  // Call tree, node 0 is the root. Children are looked up by (parent node << 17) | function.
+  std::vector<CallNode> m_nodes;
+  std::unordered_map<u64, u32> m_child_nodes;
+  u32 m_current_node = 0;
+
+  // Number of calls from one function to another, keyed by (caller << 17) | callee.
+  std::unordered_map<u64, u64> m_call_edges;
+};
+
+} // namespace i8080
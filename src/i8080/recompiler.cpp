@@ -0,0 +1,1131 @@
+#include "recompiler.h"
+#include "YBaseLib/Assert.h"
+#include <algorithm>
+#include <cstring>
+
+#if I8080_RECOMPILER_SUPPORTED
+
+#ifdef Y_PLATFORM_WINDOWS
+#include "YBaseLib/Windows/WindowsHeaders.h"
+#else
+#include <sys/mman.h>
+#endif
+
+namespace i8080 {
+
+namespace {
+enum HostReg : u8
+{
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R12 = 12,
+
+  // Byte registers, only valid in instructions without a REX prefix.
+  AL = 0,
+  CL = 1,
+  DL = 2,
+  AH = 4,
+
+  NO_INDEX = 0xFF
+};
+
+// Generated code keeps the CPU object in RBX and the entry table in R12, both callee-saved.
+constexpr HostReg STATE_REG = RBX;
+constexpr HostReg ENTRY_TABLE_REG = R12;
+
+#ifdef Y_PLATFORM_WINDOWS
+constexpr HostReg ARG0 = RCX;
+constexpr HostReg ARG1 = RDX;
+constexpr HostReg ARG2 = R8;
+constexpr s32 STACK_RESERVE = 40; // shadow space, and keeps RSP 16-byte aligned at calls
+#else
+constexpr HostReg ARG0 = RDI;
+constexpr HostReg ARG1 = RSI;
+constexpr HostReg ARG2 = RDX;
+constexpr s32 STACK_RESERVE = 8;
+#endif
+
+enum Condition : u8
+{
+  CC_Z = 0x4,
+  CC_NZ = 0x5,
+  CC_G = 0xF,
+};
+
+// x86 "op r/m8, r8" opcodes, indexed by the 8080 ALU operation (bits 3-5 of the opcode).
+constexpr u8 ALU_OPCODES[8] = {
+  0x00, // add
+  0x10, // adc
+  0x28, // sub
+  0x18, // sbb
+  0x20, // and
+  0x30, // xor
+  0x08, // or
+  0x38, // cmp
+};
+
+enum AluOp : u8
+{
+  ALU_ADD,
+  ALU_ADC,
+  ALU_SUB,
+  ALU_SBB,
+  ALU_AND,
+  ALU_XOR,
+  ALU_OR,
+  ALU_CMP
+};
+
+// /digit values for the group 1 (0x80/0x81) and shift (0xD0) instructions.
+enum GroupOp : u8
+{
+  GRP_ADD = 0,
+  GRP_OR = 1,
+  GRP_AND = 4,
+  GRP_SUB = 5,
+  GRP_XOR = 6,
+  GRP_CMP = 7,
+
+  SHIFT_ROL = 0,
+  SHIFT_ROR = 1,
+  SHIFT_RCL = 2,
+  SHIFT_RCR = 3,
+  SHIFT_SHL = 4,
+  SHIFT_SHR = 5
+};
+
+// 8080 flag bits, which match the low byte of EFLAGS as loaded by lahf.
+constexpr u8 FLAG_S = 0x80;
+constexpr u8 FLAG_Z = 0x40;
+constexpr u8 FLAG_H = 0x10;
+constexpr u8 FLAG_P = 0x04;
+constexpr u8 FLAG_C = 0x01;
+
+// Offsets within Registers of each 8-bit register, in instruction encoding order (b, c, d, e, h, l, m, a).
+constexpr s32 REG8_OFFSETS[8] = {1, 0, 3, 2, 5, 4, -1, 7};
+
+// Offsets of bc, de, hl and sp, and of af for push/pop.
+constexpr s32 REG16_OFFSETS[4] = {0, 2, 4, 8};
+constexpr s32 REG_F_OFFSET = 6;
+constexpr s32 REG_A_OFFSET = 7;
+constexpr s32 REG_AF_OFFSET = 6;
+constexpr s32 REG_HL_OFFSET = 4;
+constexpr s32 REG_SP_OFFSET = 8;
+constexpr s32 REG_PC_OFFSET = 10;
+
+struct Mem
+{
+  u8 base;
+  u8 index;
+  u8 scale;
+  s32 disp;
+};
+
+Mem MemBase(u8 base, s32 disp)
+{
+  return Mem{base, NO_INDEX, 1, disp};
+}
+
+Mem MemIndex(u8 base, u8 index, u8 scale, s32 disp)
+{
+  return Mem{base, index, scale, disp};
+}
+} // namespace
+
+struct Recompiler::ColdExit
+{
+  u8* jump_site;
+  CycleCount cycles;
+  u32 instructions;
+  MemoryAddress pc;
+};
+
+// Minimal x86-64 encoder, covering the instruction forms used by the recompiler.
+class Recompiler::Emitter
+{
+public:
+  Emitter(u8* ptr) : m_ptr(ptr) {}
+
+  u8* GetPointer() const { return m_ptr; }
+
+  static void PatchJump(u8* site, const void* target)
+  {
+    const s32 displacement = static_cast<s32>(static_cast<const u8*>(target) - (site + 4));
+    std::memcpy(site, &displacement, sizeof(displacement));
+  }
+
+  void PatchJumpHere(u8* site) { PatchJump(site, m_ptr); }
+
+  void Byte(u8 value) { *(m_ptr++) = value; }
+  void Word(u16 value)
+  {
+    std::memcpy(m_ptr, &value, sizeof(value));
+    m_ptr += sizeof(value);
+  }
+  void Dword(u32 value)
+  {
+    std::memcpy(m_ptr, &value, sizeof(value));
+    m_ptr += sizeof(value);
+  }
+  void Qword(u64 value)
+  {
+    std::memcpy(m_ptr, &value, sizeof(value));
+    m_ptr += sizeof(value);
+  }
+
+  void Rex(bool w, u8 reg, u8 index, u8 base)
+  {
+    const u8 rex = 0x40 | (w ? 0x08 : 0x00) | (((reg >> 3) & 1) << 2) |
+                   (((index != NO_INDEX) ? ((index >> 3) & 1) : 0) << 1) | ((base >> 3) & 1);
+    if (rex != 0x40)
+      Byte(rex);
+  }
+
+  void ModRM(u8 reg, const Mem& m)
+  {
+    const u8 base = m.base & 7;
+    const bool has_index = (m.index != NO_INDEX);
+    u8 mod;
+    if (m.disp == 0 && base != RBP)
+      mod = 0;
+    else if (m.disp >= -128 && m.disp <= 127)
+      mod = 1;
+    else
+      mod = 2;
+
+    if (has_index || base == RSP)
+    {
+      const u8 scale_bits = (m.scale == 8) ? 3 : ((m.scale == 4) ? 2 : ((m.scale == 2) ? 1 : 0));
+      Byte(static_cast<u8>((mod << 6) | ((reg & 7) << 3) | 4));
+      Byte(static_cast<u8>((scale_bits << 6) | ((has_index ? (m.index & 7) : 4) << 3) | base));
+    }
+    else
+    {
+      Byte(static_cast<u8>((mod << 6) | ((reg & 7) << 3) | base));
+    }
+
+    if (mod == 1)
+      Byte(static_cast<u8>(static_cast<s8>(m.disp)));
+    else if (mod == 2)
+      Dword(static_cast<u32>(m.disp));
+  }
+
+  void OpMem(u8 opcode, u8 reg, const Mem& m, bool w = false, u8 prefix = 0)
+  {
+    if (prefix)
+      Byte(prefix);
+    Rex(w, reg, m.index, m.base);
+    Byte(opcode);
+    ModRM(reg, m);
+  }
+
+  void OpMem0F(u8 opcode, u8 reg, const Mem& m)
+  {
+    Rex(false, reg, m.index, m.base);
+    Byte(0x0F);
+    Byte(opcode);
+    ModRM(reg, m);
+  }
+
+  void OpReg(u8 opcode, u8 reg, u8 rm, bool w = false)
+  {
+    Rex(w, reg, NO_INDEX, rm);
+    Byte(opcode);
+    Byte(static_cast<u8>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+  }
+
+  void movzx_r32_m8(u8 dst, const Mem& m) { OpMem0F(0xB6, dst, m); }
+  void movzx_r32_m16(u8 dst, const Mem& m) { OpMem0F(0xB7, dst, m); }
+  void movzx_r32_r8(u8 dst, u8 src)
+  {
+    Byte(0x0F);
+    Byte(0xB6);
+    Byte(static_cast<u8>(0xC0 | (dst << 3) | src));
+  }
+  void mov_r8_m8(u8 dst, const Mem& m) { OpMem(0x8A, dst, m); }
+  void mov_m8_r8(const Mem& m, u8 src) { OpMem(0x88, src, m); }
+  void mov_m8_imm8(const Mem& m, u8 imm)
+  {
+    OpMem(0xC6, 0, m);
+    Byte(imm);
+  }
+  void mov_m16_r16(const Mem& m, u8 src) { OpMem(0x89, src, m, false, 0x66); }
+  void mov_m16_imm16(const Mem& m, u16 imm)
+  {
+    OpMem(0xC7, 0, m, false, 0x66);
+    Word(imm);
+  }
+  void mov_r64_m64(u8 dst, const Mem& m) { OpMem(0x8B, dst, m, true); }
+  void mov_r32_r32(u8 dst, u8 src) { OpReg(0x89, src, dst); }
+  void mov_r64_r64(u8 dst, u8 src) { OpReg(0x89, src, dst, true); }
+  void mov_r8_r8(u8 dst, u8 src) { OpReg(0x88, src, dst); }
+  void mov_r32_imm32(u8 dst, u32 imm)
+  {
+    Rex(false, 0, NO_INDEX, dst);
+    Byte(static_cast<u8>(0xB8 + (dst & 7)));
+    Dword(imm);
+  }
+  void mov_r64_imm64(u8 dst, u64 imm)
+  {
+    Rex(true, 0, NO_INDEX, dst);
+    Byte(static_cast<u8>(0xB8 + (dst & 7)));
+    Qword(imm);
+  }
+  void mov_r8_imm8(u8 dst, u8 imm)
+  {
+    Byte(static_cast<u8>(0xB0 + dst));
+    Byte(imm);
+  }
+
+  // "op r/m8, r8" forms, with one of ALU_OPCODES.
+  void alu_r8_r8(u8 opcode, u8 dst, u8 src) { OpReg(opcode, src, dst); }
+  void alu_m8_r8(u8 opcode, const Mem& m, u8 src) { OpMem(opcode, src, m); }
+
+  void grp_r8_imm8(GroupOp op, u8 dst, u8 imm)
+  {
+    OpReg(0x80, op, dst);
+    Byte(imm);
+  }
+  void grp_m8_imm8(GroupOp op, const Mem& m, u8 imm)
+  {
+    OpMem(0x80, op, m);
+    Byte(imm);
+  }
+  void grp_m64_imm32(GroupOp op, const Mem& m, s32 imm)
+  {
+    OpMem(0x81, op, m, true);
+    Dword(static_cast<u32>(imm));
+  }
+  void grp_r32_imm32(GroupOp op, u8 dst, u32 imm)
+  {
+    OpReg(0x81, op, dst);
+    Dword(imm);
+  }
+  void grp_r64_imm8(GroupOp op, u8 dst, s8 imm)
+  {
+    OpReg(0x83, op, dst, true);
+    Byte(static_cast<u8>(imm));
+  }
+  void add_r16_m16(u8 dst, const Mem& m) { OpMem(0x03, dst, m, false, 0x66); }
+  void shift_r8_1(GroupOp op, u8 dst) { OpReg(0xD0, op, dst); }
+  void shr_r32_imm8(u8 dst, u8 imm)
+  {
+    OpReg(0xC1, SHIFT_SHR, dst);
+    Byte(imm);
+  }
+  void inc_r8(u8 dst) { OpReg(0xFE, 0, dst); }
+  void dec_r8(u8 dst) { OpReg(0xFE, 1, dst); }
+  void inc_m16(const Mem& m) { OpMem(0xFF, 0, m, false, 0x66); }
+  void dec_m16(const Mem& m) { OpMem(0xFF, 1, m, false, 0x66); }
+  void not_m8(const Mem& m) { OpMem(0xF6, 2, m); }
+  void test_m8_imm8(const Mem& m, u8 imm)
+  {
+    OpMem(0xF6, 0, m);
+    Byte(imm);
+  }
+  void test_r64_r64(u8 lhs, u8 rhs) { OpReg(0x85, rhs, lhs, true); }
+  void lahf() { Byte(0x9F); }
+  void setc_r8(u8 dst)
+  {
+    Byte(0x0F);
+    Byte(0x92);
+    Byte(static_cast<u8>(0xC0 | dst));
+  }
+
+  void push_r64(u8 reg)
+  {
+    Rex(false, 0, NO_INDEX, reg);
+    Byte(static_cast<u8>(0x50 + (reg & 7)));
+  }
+  void pop_r64(u8 reg)
+  {
+    Rex(false, 0, NO_INDEX, reg);
+    Byte(static_cast<u8>(0x58 + (reg & 7)));
+  }
+  void ret() { Byte(0xC3); }
+  void call_r64(u8 reg) { OpReg(0xFF, 2, reg); }
+  void jmp_r64(u8 reg) { OpReg(0xFF, 4, reg); }
+  void jmp_m64(const Mem& m) { OpMem(0xFF, 4, m); }
+
+  // Returns the location of the displacement, to be filled in with PatchJump().
+  u8* jmp_rel32()
+  {
+    Byte(0xE9);
+    Dword(0);
+    return m_ptr - 4;
+  }
+  u8* jcc_rel32(Condition cc)
+  {
+    Byte(0x0F);
+    Byte(static_cast<u8>(0x80 | cc));
+    Dword(0);
+    return m_ptr - 4;
+  }
+
+  void jmp(const void* target) { PatchJump(jmp_rel32(), target); }
+
+  void call(const void* function)
+  {
+    mov_r64_imm64(RAX, reinterpret_cast<u64>(function));
+    call_r64(RAX);
+  }
+
+private:
+  u8* m_ptr;
+};
+
+Recompiler::Recompiler(const StateLayout& layout, const Helpers& helpers) : m_layout(layout), m_helpers(helpers)
+{
+#ifdef Y_PLATFORM_WINDOWS
+  m_code_buffer =
+    static_cast<u8*>(VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+  void* ptr = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  m_code_buffer = (ptr != MAP_FAILED) ? static_cast<u8*>(ptr) : nullptr;
+#endif
+  Assert(m_code_buffer);
+  m_code_ptr = m_code_buffer;
+  m_code_end = m_code_buffer + CODE_BUFFER_SIZE;
+
+  m_entry_table = std::make_unique<const void*[]>(0x10000);
+  m_invalidation_counts = std::make_unique<u8[]>(0x10000);
+  std::fill_n(m_invalidation_counts.get(), 0x10000, u8(0));
+
+  EmitThunks();
+  m_code_start = m_code_ptr;
+  Reset();
+}
+
+Recompiler::~Recompiler()
+{
+#ifdef Y_PLATFORM_WINDOWS
+  VirtualFree(m_code_buffer, 0, MEM_RELEASE);
+#else
+  munmap(m_code_buffer, CODE_BUFFER_SIZE);
+#endif
+}
+
+void Recompiler::EmitThunks()
+{
+  Emitter e(m_code_ptr);
+
+  // void enter(void* cpu, const void* code)
+  m_enter_code = reinterpret_cast<void (*)(void*, const void*)>(e.GetPointer());
+  e.push_r64(STATE_REG);
+  e.push_r64(ENTRY_TABLE_REG);
+  e.grp_r64_imm8(GRP_SUB, RSP, STACK_RESERVE);
+  e.mov_r64_r64(STATE_REG, ARG0);
+  e.mov_r64_imm64(ENTRY_TABLE_REG, reinterpret_cast<u64>(m_entry_table.get()));
+  e.jmp_r64(ARG1);
+
+  // Blocks jump here to return to the CPU, with PC already stored.
+  m_exit_code = e.GetPointer();
+  e.grp_r64_imm8(GRP_ADD, RSP, STACK_RESERVE);
+  e.pop_r64(ENTRY_TABLE_REG);
+  e.pop_r64(STATE_REG);
+  e.ret();
+
+  m_code_ptr = e.GetPointer();
+}
+
+u32 Recompiler::GetCompilableInstructionCount(const DecodedInstruction* instructions, u32 count)
+{
+  for (u32 i = 0; i < count; i++)
+  {
+    switch (instructions[i].opcode)
+    {
+      case 0x76: // hlt
+      case 0xD3: // out
+      case 0xDB: // in
+      case 0xFB: // ei
+        return i;
+
+      default:
+        break;
+    }
+  }
+
+  return count;
+}
+
+bool Recompiler::ShouldCompileBlock(MemoryAddress start_pc) const
+{
+  return (m_invalidation_counts[start_pc] < MAX_BLOCK_INVALIDATIONS);
+}
+
+void Recompiler::InvalidateBlock(MemoryAddress start_pc)
+{
+  m_entry_table[start_pc] = m_exit_code;
+  if (m_invalidation_counts[start_pc] < MAX_BLOCK_INVALIDATIONS)
+    m_invalidation_counts[start_pc]++;
+
+  // A zero displacement falls through to the unlinked exit path following the jump.
+  auto iter = m_link_sites.find(start_pc);
+  if (iter != m_link_sites.end())
+  {
+    for (u8* site : iter->second)
+      Emitter::PatchJump(site, site + 4);
+  }
+}
+
+void Recompiler::Reset()
+{
+  m_code_ptr = m_code_start;
+  std::fill_n(m_entry_table.get(), 0x10000, m_exit_code);
+  m_link_sites.clear();
+}
+
+void Recompiler::Execute(void* cpu, const void* code) const
+{
+  m_enter_code(cpu, code);
+}
+
+void Recompiler::EmitCycles(Emitter& e, CycleCount cycles, u32 instructions)
+{
+  if (cycles > 0)
+  {
+    e.grp_m64_imm32(GRP_SUB, MemBase(STATE_REG, m_layout.cycles_left), static_cast<s32>(cycles));
+    e.grp_m64_imm32(GRP_ADD, MemBase(STATE_REG, m_layout.pending_cycles), static_cast<s32>(cycles));
+  }
+  if (instructions > 0)
+    e.grp_m64_imm32(GRP_ADD, MemBase(STATE_REG, m_layout.executed_instructions), static_cast<s32>(instructions));
+}
+
+void Recompiler::EmitReadMemory(Emitter& e)
+{
+  // In: ECX = address. Out: EAX = value. Clobbers all caller-saved registers.
+  e.mov_r32_r32(RAX, RCX);
+  e.shr_r32_imm8(RAX, 10);
+  e.mov_r64_m64(RDX, MemIndex(STATE_REG, RAX, 8, m_layout.read_page_table));
+  e.test_r64_r64(RDX, RDX);
+  u8* slow_path = e.jcc_rel32(CC_Z);
+  e.grp_r32_imm32(GRP_AND, RCX, 0x3FF);
+  e.movzx_r32_m8(RAX, MemIndex(RDX, RCX, 1, 0));
+  u8* done = e.jmp_rel32();
+
+  e.PatchJumpHere(slow_path);
+  e.mov_r32_r32(ARG1, RCX);
+  e.mov_r64_r64(ARG0, STATE_REG);
+  e.call(reinterpret_cast<const void*>(m_helpers.read_memory));
+  e.movzx_r32_r8(RAX, AL);
+  e.PatchJumpHere(done);
+}
+
+void Recompiler::EmitWriteMemory(Emitter& e)
+{
+  // In: ECX = address, AL = value. Clobbers all caller-saved registers.
+  e.mov_r32_r32(RDX, RCX);
+  e.shr_r32_imm8(RDX, 10);
+  e.mov_r64_m64(RDX, MemIndex(STATE_REG, RDX, 8, m_layout.write_page_table));
+  e.test_r64_r64(RDX, RDX);
+  u8* slow_path = e.jcc_rel32(CC_Z);
+  e.grp_r32_imm32(GRP_AND, RCX, 0x3FF);
+  e.mov_m8_r8(MemIndex(RDX, RCX, 1, 0), AL);
+  u8* done = e.jmp_rel32();
+
+  // Pages holding decoded code are never mapped for writing, so invalidation is handled by the helper.
+  e.PatchJumpHere(slow_path);
+  e.mov_r32_r32(ARG2, RAX);
+  e.mov_r32_r32(ARG1, RCX);
+  e.mov_r64_r64(ARG0, STATE_REG);
+  e.call(reinterpret_cast<const void*>(m_helpers.write_memory));
+  e.PatchJumpHere(done);
+}
+
+void Recompiler::EmitPush(Emitter& e, s32 reg_offset, u16 value)
+{
+  // Pushes the register pair at reg_offset, or value if reg_offset is negative. High byte first, as PushWord().
+  const Mem sp = MemBase(STATE_REG, m_layout.regs + REG_SP_OFFSET);
+  for (u32 i = 0; i < 2; i++)
+  {
+    const u32 byte_index = 1 - i;
+    e.dec_m16(sp);
+    e.movzx_r32_m16(RCX, sp);
+    if (reg_offset >= 0)
+      e.movzx_r32_m8(RAX, MemBase(STATE_REG, m_layout.regs + reg_offset + byte_index));
+    else
+      e.mov_r32_imm32(RAX, (value >> (byte_index * 8)) & 0xFF);
+    EmitWriteMemory(e);
+  }
+}
+
+void Recompiler::EmitPop(Emitter& e, u32 reg_offset)
+{
+  const Mem sp = MemBase(STATE_REG, m_layout.regs + REG_SP_OFFSET);
+  for (u32 i = 0; i < 2; i++)
+  {
+    e.movzx_r32_m16(RCX, sp);
+    EmitReadMemory(e);
+    e.mov_m8_r8(MemBase(STATE_REG, m_layout.regs + reg_offset + i), AL);
+    e.inc_m16(sp);
+  }
+}
+
+void Recompiler::EmitInterpretInstruction(Emitter& e, MemoryAddress pc)
+{
+  e.mov_m16_imm16(MemBase(STATE_REG, m_layout.regs + REG_PC_OFFSET), pc);
+  e.mov_r64_r64(ARG0, STATE_REG);
+  e.call(reinterpret_cast<const void*>(m_helpers.interpret_instruction));
+}
+
+void Recompiler::EmitInvalidationCheck(Emitter& e, CycleCount cycles, u32 instructions, MemoryAddress next_pc)
+{
+  // If a write invalidated any block, the remainder of this one may be stale.
+  e.grp_m8_imm8(GRP_CMP, MemBase(STATE_REG, m_layout.code_invalidated), 0);
+  m_cold_exits.push_back(ColdExit{e.jcc_rel32(CC_NZ), cycles, instructions, next_pc});
+}
+
+void Recompiler::EmitStaticExit(Emitter& e, MemoryAddress target_pc)
+{
+  if (target_pc == m_block_start_pc && !m_block_links_to_self)
+  {
+    e.mov_m16_imm16(MemBase(STATE_REG, m_layout.regs + REG_PC_OFFSET), target_pc);
+    e.jmp(m_exit_code);
+    return;
+  }
+
+  // The jump initially has a zero displacement, and is patched to the target block's entry when it is compiled.
+  m_static_exits.emplace_back(e.jmp_rel32(), target_pc);
+  e.mov_m16_imm16(MemBase(STATE_REG, m_layout.regs + REG_PC_OFFSET), target_pc);
+  e.jmp_m64(MemBase(ENTRY_TABLE_REG, static_cast<s32>(target_pc) * 8));
+}
+
+void Recompiler::EmitDynamicExit(Emitter& e)
+{
+  e.movzx_r32_m16(RAX, MemBase(STATE_REG, m_layout.regs + REG_PC_OFFSET));
+  e.jmp_m64(MemIndex(ENTRY_TABLE_REG, RAX, 8, 0));
+}
+
+const void* Recompiler::CompileBlock(MemoryAddress start_pc, const DecodedInstruction* instructions, u32 count,
+                                     CycleCount max_cycles, bool link_to_self)
+{
+  DebugAssert(count > 0);
+  if (static_cast<size_t>(m_code_end - m_code_ptr) < (count + 2) * MAX_HOST_BYTES_PER_INSTRUCTION)
+    return nullptr;
+
+  auto Reg = [this](s32 offset) { return MemBase(STATE_REG, m_layout.regs + offset); };
+  auto Reg8 = [&Reg](u32 index) { return Reg(REG8_OFFSETS[index]); };
+
+  Emitter e(m_code_ptr);
+  m_cold_exits.clear();
+  m_static_exits.clear();
+  m_block_start_pc = start_pc;
+  m_block_links_to_self = link_to_self;
+
+  // Return to the CPU if the worst case timing doesn't fit, so it can stop on the right instruction.
+  const void* entry = e.GetPointer();
+  e.grp_m64_imm32(GRP_CMP, MemBase(STATE_REG, m_layout.cycles_left), static_cast<s32>(max_cycles));
+  u8* enough_cycles = e.jcc_rel32(CC_G);
+  e.mov_m16_imm16(Reg(REG_PC_OFFSET), start_pc);
+  e.jmp(m_exit_code);
+  e.PatchJumpHere(enough_cycles);
+
+  CycleCount cycles = 0;
+  u32 executed = 0;
+  bool ended = false;
+  MemoryAddress next_pc = start_pc;
+  for (u32 i = 0; i < count && !ended; i++)
+  {
+    const DecodedInstruction& instruction = instructions[i];
+    const u8 opcode = instruction.opcode;
+    const u16 operand = instruction.operand;
+    const CycleCount instruction_cycles = INSTRUCTION_INFO[opcode].cycles;
+    next_pc = static_cast<MemoryAddress>(instruction.pc + instruction.length);
+
+    const u32 dst = (opcode >> 3) & 7;
+    const u32 src = opcode & 7;
+    const s32 rp_offset = REG16_OFFSETS[(opcode >> 4) & 3];
+
+    // Condition for conditional jumps/calls/returns: nz, z, nc, c, po, pe, p, m.
+    static constexpr u8 condition_flags[4] = {FLAG_Z, FLAG_C, FLAG_P, FLAG_S};
+    const u8 condition_flag = condition_flags[dst >> 1];
+    const Condition not_taken = (dst & 1) ? CC_Z : CC_NZ;
+
+    bool writes_memory = false;
+    bool interpreted = false;
+
+    // Sets S, Z, P and H from lahf. C is left alone for inr/dcr, and H is inverted for subtraction, matching the
+    // interpreter's "no borrow" half-carry.
+    auto MergeFlags = [&](u8 mask, bool invert_h) {
+      if (invert_h)
+        e.grp_r8_imm8(GRP_XOR, AH, FLAG_H);
+      e.grp_r8_imm8(GRP_AND, AH, mask);
+      e.grp_m8_imm8(GRP_AND, Reg(REG_F_OFFSET), static_cast<u8>(~mask));
+      e.alu_m8_r8(0x08 /* or */, Reg(REG_F_OFFSET), AH);
+    };
+    auto SetCarryFromHost = [&]() {
+      e.setc_r8(DL);
+      e.grp_m8_imm8(GRP_AND, Reg(REG_F_OFFSET), static_cast<u8>(~FLAG_C));
+      e.alu_m8_r8(0x08 /* or */, Reg(REG_F_OFFSET), DL);
+    };
+    auto LoadCarryToHost = [&]() {
+      e.mov_r8_m8(DL, Reg(REG_F_OFFSET));
+      e.shift_r8_1(SHIFT_SHR, DL);
+    };
+    auto LoadHL = [&]() { e.movzx_r32_m16(RCX, Reg(REG_HL_OFFSET)); };
+
+    // ALU operation on A with the operand in CL.
+    auto EmitAlu = [&](u32 op) {
+      e.mov_r8_m8(AL, Reg(REG_A_OFFSET));
+      if (op == ALU_AND)
+      {
+        e.mov_r8_r8(DL, AL);
+        e.alu_r8_r8(0x08 /* or */, DL, CL);
+      }
+      else if (op == ALU_ADC || op == ALU_SBB)
+      {
+        LoadCarryToHost();
+      }
+
+      e.alu_r8_r8(ALU_OPCODES[op], AL, CL);
+      e.lahf();
+      if (op != ALU_CMP)
+        e.mov_m8_r8(Reg(REG_A_OFFSET), AL);
+
+      if (op == ALU_AND || op == ALU_XOR || op == ALU_OR)
+      {
+        // Carry is cleared by the host, half carry is zero for xor/or and (lhs | rhs) bit 3 for and.
+        MergeFlags(FLAG_S | FLAG_Z | FLAG_H | FLAG_P | FLAG_C, false);
+        e.grp_m8_imm8(GRP_AND, Reg(REG_F_OFFSET), static_cast<u8>(~FLAG_H));
+        if (op == ALU_AND)
+        {
+          e.shift_r8_1(SHIFT_SHL, DL);
+          e.grp_r8_imm8(GRP_AND, DL, FLAG_H);
+          e.alu_m8_r8(0x08 /* or */, Reg(REG_F_OFFSET), DL);
+        }
+      }
+      else
+      {
+        MergeFlags(FLAG_S | FLAG_Z | FLAG_H | FLAG_P | FLAG_C, op == ALU_SUB || op == ALU_SBB || op == ALU_CMP);
+      }
+    };
+
+    switch (opcode)
+    {
+      // clang-format off
+      case 0x00: case 0x08: case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // nop
+        break;
+      // clang-format on
+
+      case 0x01: // lxi
+      case 0x11:
+      case 0x21:
+      case 0x31:
+        e.mov_m16_imm16(Reg(rp_offset), operand);
+        break;
+
+      case 0x0A: // ldax
+      case 0x1A:
+        e.movzx_r32_m16(RCX, Reg(rp_offset));
+        EmitReadMemory(e);
+        e.mov_m8_r8(Reg(REG_A_OFFSET), AL);
+        break;
+
+      case 0x02: // stax
+      case 0x12:
+        e.movzx_r32_m16(RCX, Reg(rp_offset));
+        e.movzx_r32_m8(RAX, Reg(REG_A_OFFSET));
+        EmitWriteMemory(e);
+        writes_memory = true;
+        break;
+
+      case 0x3A: // lda
+        e.mov_r32_imm32(RCX, operand);
+        EmitReadMemory(e);
+        e.mov_m8_r8(Reg(REG_A_OFFSET), AL);
+        break;
+
+      case 0x32: // sta
+        e.mov_r32_imm32(RCX, operand);
+        e.movzx_r32_m8(RAX, Reg(REG_A_OFFSET));
+        EmitWriteMemory(e);
+        writes_memory = true;
+        break;
+
+      case 0x2A: // lhld
+        for (u32 byte_index = 0; byte_index < 2; byte_index++)
+        {
+          e.mov_r32_imm32(RCX, static_cast<u16>(operand + byte_index));
+          EmitReadMemory(e);
+          e.mov_m8_r8(Reg(REG_HL_OFFSET + byte_index), AL);
+        }
+        break;
+
+      case 0x22: // shld
+        for (u32 byte_index = 0; byte_index < 2; byte_index++)
+        {
+          e.mov_r32_imm32(RCX, static_cast<u16>(operand + byte_index));
+          e.movzx_r32_m8(RAX, Reg(REG_HL_OFFSET + byte_index));
+          EmitWriteMemory(e);
+        }
+        writes_memory = true;
+        break;
+
+      case 0x03: // inx
+      case 0x13:
+      case 0x23:
+      case 0x33:
+        e.inc_m16(Reg(rp_offset));
+        break;
+
+      case 0x0B: // dcx
+      case 0x1B:
+      case 0x2B:
+      case 0x3B:
+        e.dec_m16(Reg(rp_offset));
+        break;
+
+      case 0x09: // dad
+      case 0x19:
+      case 0x29:
+      case 0x39:
+        e.movzx_r32_m16(RAX, Reg(REG_HL_OFFSET));
+        e.add_r16_m16(RAX, Reg(rp_offset));
+        e.mov_m16_r16(Reg(REG_HL_OFFSET), RAX);
+        SetCarryFromHost();
+        break;
+
+      // clang-format off
+      case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C: // inr
+      case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: // dcr
+      // clang-format on
+      {
+        const bool decrement = (opcode & 1) != 0;
+        if (dst == 6)
+        {
+          LoadHL();
+          EmitReadMemory(e);
+        }
+        else
+        {
+          e.mov_r8_m8(AL, Reg8(dst));
+        }
+
+        if (decrement)
+          e.dec_r8(AL);
+        else
+          e.inc_r8(AL);
+        e.lahf();
+        MergeFlags(FLAG_S | FLAG_Z | FLAG_H | FLAG_P, decrement);
+
+        if (dst == 6)
+        {
+          LoadHL();
+          EmitWriteMemory(e);
+          writes_memory = true;
+        }
+        else
+        {
+          e.mov_m8_r8(Reg8(dst), AL);
+        }
+      }
+      break;
+
+      // clang-format off
+      case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // mvi
+      // clang-format on
+      {
+        if (dst == 6)
+        {
+          LoadHL();
+          e.mov_r32_imm32(RAX, Truncate8(operand));
+          EmitWriteMemory(e);
+          writes_memory = true;
+        }
+        else
+        {
+          e.mov_m8_imm8(Reg8(dst), Truncate8(operand));
+        }
+      }
+      break;
+
+      case 0x07: // rlc
+      case 0x0F: // rrc
+      case 0x17: // ral
+      case 0x1F: // rar
+      {
+        static constexpr GroupOp rotate_ops[4] = {SHIFT_ROL, SHIFT_ROR, SHIFT_RCL, SHIFT_RCR};
+        const GroupOp rotate_op = rotate_ops[(opcode >> 3) & 3];
+        e.mov_r8_m8(AL, Reg(REG_A_OFFSET));
+        if (rotate_op == SHIFT_RCL || rotate_op == SHIFT_RCR)
+          LoadCarryToHost();
+        e.shift_r8_1(rotate_op, AL);
+        e.mov_m8_r8(Reg(REG_A_OFFSET), AL);
+        SetCarryFromHost();
+      }
+      break;
+
+      case 0x27: // daa
+        EmitInterpretInstruction(e, instruction.pc);
+        interpreted = true;
+        break;
+
+      case 0x2F: // cma
+        e.not_m8(Reg(REG_A_OFFSET));
+        break;
+
+      case 0x37: // stc
+        e.grp_m8_imm8(GRP_OR, Reg(REG_F_OFFSET), FLAG_C);
+        break;
+
+      case 0x3F: // cmc
+        e.grp_m8_imm8(GRP_XOR, Reg(REG_F_OFFSET), FLAG_C);
+        break;
+
+      case 0xC6: // adi
+      case 0xCE: // aci
+      case 0xD6: // sui
+      case 0xDE: // sbi
+      case 0xE6: // ani
+      case 0xEE: // xri
+      case 0xF6: // ori
+      case 0xFE: // cpi
+        e.mov_r8_imm8(CL, Truncate8(operand));
+        EmitAlu(dst);
+        break;
+
+      // clang-format off
+      case 0xC3: case 0xCB: // jmp
+      // clang-format on
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitStaticExit(e, operand);
+        ended = true;
+        break;
+
+      // clang-format off
+      case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: // jcc
+      // clang-format on
+      {
+        e.test_m8_imm8(Reg(REG_F_OFFSET), condition_flag);
+        u8* skip = e.jcc_rel32(not_taken);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitStaticExit(e, operand);
+        e.PatchJumpHere(skip);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitStaticExit(e, next_pc);
+        ended = true;
+      }
+      break;
+
+      // clang-format off
+      case 0xCD: case 0xDD: case 0xED: case 0xFD: // call
+      // clang-format on
+        EmitPush(e, -1, next_pc);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitStaticExit(e, operand);
+        ended = true;
+        break;
+
+      // clang-format off
+      case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xE4: case 0xEC: case 0xF4: case 0xFC: // ccc
+      // clang-format on
+      {
+        e.test_m8_imm8(Reg(REG_F_OFFSET), condition_flag);
+        u8* skip = e.jcc_rel32(not_taken);
+        EmitPush(e, -1, next_pc);
+        EmitCycles(e, cycles + 17, executed + 1);
+        EmitStaticExit(e, operand);
+        e.PatchJumpHere(skip);
+        EmitCycles(e, cycles + 11, executed + 1);
+        EmitStaticExit(e, next_pc);
+        ended = true;
+      }
+      break;
+
+      // clang-format off
+      case 0xC9: case 0xD9: // ret
+      // clang-format on
+        EmitPop(e, REG_PC_OFFSET);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitDynamicExit(e);
+        ended = true;
+        break;
+
+      // clang-format off
+      case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xE0: case 0xE8: case 0xF0: case 0xF8: // rcc
+      // clang-format on
+      {
+        e.test_m8_imm8(Reg(REG_F_OFFSET), condition_flag);
+        u8* skip = e.jcc_rel32(not_taken);
+        EmitPop(e, REG_PC_OFFSET);
+        EmitCycles(e, cycles + 11, executed + 1);
+        EmitDynamicExit(e);
+        e.PatchJumpHere(skip);
+        EmitCycles(e, cycles + 5, executed + 1);
+        EmitStaticExit(e, next_pc);
+        ended = true;
+      }
+      break;
+
+      // clang-format off
+      case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst
+      // clang-format on
+        EmitPush(e, -1, next_pc);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitStaticExit(e, static_cast<MemoryAddress>(opcode & 0x38));
+        ended = true;
+        break;
+
+      case 0xE9: // pchl
+        e.movzx_r32_m16(RAX, Reg(REG_HL_OFFSET));
+        e.mov_m16_r16(Reg(REG_PC_OFFSET), RAX);
+        EmitCycles(e, cycles + instruction_cycles, executed + 1);
+        EmitDynamicExit(e);
+        ended = true;
+        break;
+
+      case 0xC5: // push
+      case 0xD5:
+      case 0xE5:
+      case 0xF5:
+        EmitPush(e, (opcode == 0xF5) ? REG_AF_OFFSET : rp_offset, 0);
+        writes_memory = true;
+        break;
+
+      case 0xC1: // pop
+      case 0xD1:
+      case 0xE1:
+      case 0xF1:
+        EmitPop(e, (opcode == 0xF1) ? REG_AF_OFFSET : rp_offset);
+        if (opcode == 0xF1)
+        {
+          // Flags::Fixup()
+          e.grp_m8_imm8(GRP_AND, Reg(REG_F_OFFSET), 0xD5);
+          e.grp_m8_imm8(GRP_OR, Reg(REG_F_OFFSET), 0x02);
+        }
+        break;
+
+      case 0xE3: // xthl
+        EmitInterpretInstruction(e, instruction.pc);
+        interpreted = true;
+        writes_memory = true;
+        break;
+
+      case 0xEB: // xchg
+        e.movzx_r32_m16(RAX, Reg(REG16_OFFSETS[1]));
+        e.movzx_r32_m16(RCX, Reg(REG_HL_OFFSET));
+        e.mov_m16_r16(Reg(REG16_OFFSETS[1]), RCX);
+        e.mov_m16_r16(Reg(REG_HL_OFFSET), RAX);
+        break;
+
+      case 0xF9: // sphl
+        e.movzx_r32_m16(RAX, Reg(REG_HL_OFFSET));
+        e.mov_m16_r16(Reg(REG_SP_OFFSET), RAX);
+        break;
+
+      case 0xF3: // di
+        e.mov_m8_imm8(MemBase(STATE_REG, m_layout.interrupt_enabled), 0);
+        break;
+
+      default:
+      {
+        if (opcode >= 0x40 && opcode < 0x80)
+        {
+          // mov, hlt is never compiled
+          DebugAssert(opcode != 0x76);
+          if (src == 6)
+          {
+            LoadHL();
+            EmitReadMemory(e);
+            e.mov_m8_r8(Reg8(dst), AL);
+          }
+          else if (dst == 6)
+          {
+            LoadHL();
+            e.movzx_r32_m8(RAX, Reg8(src));
+            EmitWriteMemory(e);
+            writes_memory = true;
+          }
+          else
+          {
+            e.mov_r8_m8(AL, Reg8(src));
+            e.mov_m8_r8(Reg8(dst), AL);
+          }
+        }
+        else if (opcode >= 0x80 && opcode < 0xC0)
+        {
+          // add, adc, sub, sbb, ana, xra, ora, cmp
+          if (src == 6)
+          {
+            LoadHL();
+            EmitReadMemory(e);
+            e.mov_r8_r8(CL, AL);
+          }
+          else
+          {
+            e.mov_r8_m8(CL, Reg8(src));
+          }
+          EmitAlu(dst);
+        }
+        else
+        {
+          // GetCompilableInstructionCount() excludes everything else.
+          Panic("Unhandled opcode in recompiler");
+        }
+      }
+      break;
+    }
+
+    if (ended)
+      break;
+
+    // The interpreter accounts for the cycles of instructions it executes.
+    if (!interpreted)
+    {
+      cycles += instruction_cycles;
+      executed++;
+    }
+
+    if (writes_memory)
+      EmitInvalidationCheck(e, cycles, executed, next_pc);
+  }
+
+  // Blocks which don't end in a control transfer fall through to the next instruction.
+  if (!ended)
+  {
+    EmitCycles(e, cycles, executed);
+    EmitStaticExit(e, next_pc);
+  }
+
+  for (const ColdExit& exit : m_cold_exits)
+  {
+    e.PatchJumpHere(exit.jump_site);
+    EmitCycles(e, exit.cycles, exit.instructions);
+    e.mov_m16_imm16(Reg(REG_PC_OFFSET), exit.pc);
+    e.jmp(m_exit_code);
+  }
+
+  m_code_ptr = e.GetPointer();
+  DebugAssert(m_code_ptr <= m_code_end);
+
+  // Link this block's exits to blocks which are already compiled, and other blocks' exits to this one.
+  m_entry_table[start_pc] = entry;
+  for (const auto& it : m_static_exits)
+  {
+    m_link_sites[it.second].push_back(it.first);
+    if (m_entry_table[it.second] != m_exit_code)
+      Emitter::PatchJump(it.first, m_entry_table[it.second]);
+    else
+      Emitter::PatchJump(it.first, it.first + 4);
+  }
+
+  auto iter = m_link_sites.find(start_pc);
+  if (iter != m_link_sites.end())
+  {
+    for (u8* site : iter->second)
+      Emitter::PatchJump(site, entry);
+  }
+
+  return entry;
+}
+
+} // namespace i8080
+
+#endif // I8080_RECOMPILER_SUPPORTED
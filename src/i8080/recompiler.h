@@ -0,0 +1,122 @@
+#pragma once
+#include "instruction_info.h"
+#include "types.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// The recompiler emits x86-64 code, other hosts use the cached interpreter instead.
+#if defined(__x86_64__) || defined(_M_X64)
+#define I8080_RECOMPILER_SUPPORTED 1
+#else
+#define I8080_RECOMPILER_SUPPORTED 0
+#endif
+
+namespace i8080 {
+
+// Translates decoded blocks into x86-64 code.
+//
+// The guest state stays in the CPU object, which generated code addresses through a host register. Every block
+// starts by checking that its worst case timing fits in the remaining cycles, and otherwise returns to the CPU, which
+// runs the block in the cached interpreter so that slices end on exactly the same instruction as the interpreter.
+// Exits to fixed addresses are patched into direct jumps once the target block is compiled, and exits to computed
+// addresses (ret, pchl) go through a table indexed by the guest PC.
+class Recompiler
+{
+public:
+  // Offsets of the state accessed by generated code, relative to the CPU object.
+  struct StateLayout
+  {
+    u32 regs;
+    u32 cycles_left;
+    u32 pending_cycles;
+    u32 executed_instructions;
+    u32 interrupt_enabled;
+    u32 code_invalidated;
+    u32 read_page_table;
+    u32 write_page_table;
+  };
+
+  // Called by generated code with the CPU object as the first argument.
+  struct Helpers
+  {
+    u8 (*read_memory)(void* cpu, u32 address);
+    void (*write_memory)(void* cpu, u32 address, u32 value);
+
+    // Executes the instruction at PC with the interpreter, including its cycles.
+    void (*interpret_instruction)(void* cpu);
+  };
+
+  Recompiler(const StateLayout& layout, const Helpers& helpers);
+  ~Recompiler();
+
+  // Number of leading instructions which can be translated. The block stops before I/O, ei and hlt, which are left
+  // to the interpreter so that device side effects and interrupts are seen between blocks.
+  static u32 GetCompilableInstructionCount(const DecodedInstruction* instructions, u32 count);
+
+  // Returns false for blocks which have been rewritten too often to be worth translating again.
+  bool ShouldCompileBlock(MemoryAddress start_pc) const;
+
+  // Translates the instructions, returning the entry point, or nullptr if the code buffer is full. Jumps back to the
+  // start of the block return to the CPU instead of looping in generated code unless link_to_self is set, so that the
+  // CPU can check each iteration.
+  const void* CompileBlock(MemoryAddress start_pc, const DecodedInstruction* instructions, u32 count,
+                           CycleCount max_cycles, bool link_to_self);
+
+  // Unlinks the block starting at start_pc, so that jumps to it return to the CPU.
+  void InvalidateBlock(MemoryAddress start_pc);
+
+  // Discards all generated code. Every compiled block must have been invalidated by the caller.
+  void Reset();
+
+  // Runs generated code until a block exits to the CPU.
+  void Execute(void* cpu, const void* code) const;
+
+private:
+  static constexpr u32 CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+  static constexpr u32 MAX_HOST_BYTES_PER_INSTRUCTION = 384;
+  static constexpr u8 MAX_BLOCK_INVALIDATIONS = 8;
+
+  struct ColdExit;
+  class Emitter;
+
+  void EmitThunks();
+  void EmitCycles(Emitter& e, CycleCount cycles, u32 instructions);
+  void EmitReadMemory(Emitter& e);
+  void EmitWriteMemory(Emitter& e);
+  void EmitPush(Emitter& e, s32 reg_offset, u16 value);
+  void EmitPop(Emitter& e, u32 reg_offset);
+  void EmitInterpretInstruction(Emitter& e, MemoryAddress pc);
+  void EmitInvalidationCheck(Emitter& e, CycleCount cycles, u32 instructions, MemoryAddress next_pc);
+  void EmitStaticExit(Emitter& e, MemoryAddress target_pc);
+  void EmitDynamicExit(Emitter& e);
+
+  StateLayout m_layout;
+  Helpers m_helpers;
+
+  u8* m_code_buffer = nullptr;
+  u8* m_code_start = nullptr;
+  u8* m_code_ptr = nullptr;
+  u8* m_code_end = nullptr;
+
+  void (*m_enter_code)(void* cpu, const void* code) = nullptr;
+  const void* m_exit_code = nullptr;
+
+  // Host entry point for each guest address, or the exit code when no block is compiled there.
+  std::unique_ptr<const void*[]> m_entry_table;
+
+  // Saturating count of invalidations for each guest address, used to stop translating self-modifying code.
+  std::unique_ptr<u8[]> m_invalidation_counts;
+
+  // Direct jump sites targeting each guest address. Sites in invalidated blocks are left in the lists until Reset(),
+  // since patching unreachable code is harmless.
+  std::unordered_map<MemoryAddress, std::vector<u8*>> m_link_sites;
+
+  // State while compiling a block.
+  std::vector<ColdExit> m_cold_exits;
+  std::vector<std::pair<u8*, MemoryAddress>> m_static_exits;
+  MemoryAddress m_block_start_pc = 0;
+  bool m_block_links_to_self = true;
+};
+
+} // namespace i8080
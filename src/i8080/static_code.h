@@ -0,0 +1,233 @@
+#pragma once
+#include "cpu.h"
+#include "types.h"
+#include <cstring>
+
+namespace i8080 {
+
+// Interface between the CPU and code translated ahead of time by the staticrec tool.
+//
+// Each block of the program becomes a C++ function which runs the block's instructions on the state below and leaves
+// the address of the next instruction in regs.pc. The CPU only enters a block when its worst case timing fits in the
+// remaining cycles, so that slices end on exactly the same instruction as the interpreter. Blocks never contain I/O,
+// ei, di or hlt, which are left to the interpreter so that device side effects and interrupts are seen between blocks.
+struct StaticCodeState
+{
+  static constexpr u32 MEMORY_PAGE_SHIFT = CPU<>::MEMORY_PAGE_SHIFT;
+  static constexpr u32 MEMORY_PAGE_MASK = CPU<>::MEMORY_PAGE_MASK;
+
+  // Flags are always materialized while translated code runs.
+  Registers regs;
+  CycleCount cycles_left;
+  CycleCount pending_cycles;
+  u64 executed_instructions;
+
+  // The CPU's page tables, accesses to unmapped pages go through the CPU so that writes can invalidate decoded code.
+  const u8* const* read_page_table;
+  u8* const* write_page_table;
+  void* cpu;
+  u8 (*read_memory)(void* cpu, u32 address);
+  void (*write_memory)(void* cpu, u32 address, u32 value);
+
+  // Translated code works on a local copy of the registers, so that the compiler can keep them in host registers.
+  void LoadRegisters(Registers& dest) const { std::memcpy(static_cast<void*>(&dest), &regs, sizeof(dest)); }
+  void EndBlock(const Registers& src, CycleCount cycles, u32 instructions)
+  {
+    std::memcpy(static_cast<void*>(&regs), &src, sizeof(regs));
+    cycles_left -= cycles;
+    pending_cycles += cycles;
+    executed_instructions += instructions;
+  }
+
+  u8 ReadMemoryByte(MemoryAddress address)
+  {
+    const u8* page = read_page_table[address >> MEMORY_PAGE_SHIFT];
+    return page ? page[address & MEMORY_PAGE_MASK] : read_memory(cpu, address);
+  }
+
+  u16 ReadMemoryWord(MemoryAddress address)
+  {
+    const u8 low = ReadMemoryByte(address);
+    const u8 high = ReadMemoryByte(static_cast<MemoryAddress>(address + 1));
+    return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+  }
+
+  void WriteMemoryByte(MemoryAddress address, u8 value)
+  {
+    u8* page = write_page_table[address >> MEMORY_PAGE_SHIFT];
+    if (page)
+      page[address & MEMORY_PAGE_MASK] = value;
+    else
+      write_memory(cpu, address, value);
+  }
+
+  void WriteMemoryWord(MemoryAddress address, u16 value)
+  {
+    WriteMemoryByte(address, Truncate8(value));
+    WriteMemoryByte(static_cast<MemoryAddress>(address + 1), Truncate8(value >> 8));
+  }
+
+  void PushWord(Registers& r, u16 value)
+  {
+    WriteMemoryByte(--r.sp, Truncate8(value >> 8));
+    WriteMemoryByte(--r.sp, Truncate8(value));
+  }
+
+  u16 PopWord(Registers& r)
+  {
+    const u8 low = ReadMemoryByte(r.sp++);
+    const u8 high = ReadMemoryByte(r.sp++);
+    return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+  }
+
+  void op_xthl(Registers& r)
+  {
+    const u16 hl = r.hl;
+    r.hl = ReadMemoryWord(r.sp);
+    WriteMemoryWord(r.sp, hl);
+  }
+
+  // ALU operations, with the same results as the interpreter's lazily evaluated flags.
+  static void SetFlags(Registers& r, u8 mask, u8 flags) { r.f.bits = static_cast<u8>((r.f.bits & ~mask) | flags); }
+
+  static u8 op_inr(Registers& r, u8 rhs)
+  {
+    const u8 res = rhs + 1;
+    SetFlags(r, FlagMask_SZHP, GetFlagsSZHP(FlagOp::Inr, res, 0));
+    return res;
+  }
+
+  static u8 op_dcr(Registers& r, u8 rhs)
+  {
+    const u8 res = rhs - 1;
+    SetFlags(r, FlagMask_SZHP, GetFlagsSZHP(FlagOp::Dcr, res, 0));
+    return res;
+  }
+
+  static u8 op_add(Registers& r, u8 lhs, u8 rhs, bool carry_in = false)
+  {
+    const u16 res16 = ZeroExtend16(lhs) + ZeroExtend16(rhs) + BoolToUInt16(carry_in);
+    const u8 res8 = Truncate8(res16);
+    SetFlags(r, FlagMask_All, GetFlagsSZHP(FlagOp::Add, res8, lhs ^ rhs) | Truncate8(res16 >> 8));
+    return res8;
+  }
+
+  static u8 op_adc(Registers& r, u8 lhs, u8 rhs) { return op_add(r, lhs, rhs, r.f.c); }
+
+  static u8 op_sub(Registers& r, u8 lhs, u8 rhs, bool borrow_in = false)
+  {
+    const u16 res16 = ZeroExtend16(lhs) - ZeroExtend16(rhs) - BoolToUInt16(borrow_in);
+    const u8 res8 = Truncate8(res16);
+    SetFlags(r, FlagMask_All, GetFlagsSZHP(FlagOp::Sub, res8, lhs ^ rhs) | Truncate8((res16 >> 8) & 1));
+    return res8;
+  }
+
+  static u8 op_sbb(Registers& r, u8 lhs, u8 rhs) { return op_sub(r, lhs, rhs, r.f.c); }
+
+  static u8 op_and(Registers& r, u8 lhs, u8 rhs)
+  {
+    const u8 res = lhs & rhs;
+    SetFlags(r, FlagMask_All, GetFlagsSZHP(FlagOp::And, res, lhs ^ rhs));
+    return res;
+  }
+
+  static u8 op_xor(Registers& r, u8 lhs, u8 rhs)
+  {
+    const u8 res = lhs ^ rhs;
+    SetFlags(r, FlagMask_All, SZP_FLAGS[res]);
+    return res;
+  }
+
+  static u8 op_or(Registers& r, u8 lhs, u8 rhs)
+  {
+    const u8 res = lhs | rhs;
+    SetFlags(r, FlagMask_All, SZP_FLAGS[res]);
+    return res;
+  }
+
+  static u8 op_daa(Registers& r, u8 rhs)
+  {
+    u8 add = 0;
+    if ((rhs & u8(0xF)) > 0x9 || r.f.h)
+      add = 0x06;
+
+    bool carry = r.f.c;
+    if (rhs > 0x99 || carry)
+    {
+      add += 0x60;
+      carry = true;
+    }
+
+    const u8 res = rhs + add;
+    SetFlags(r, FlagMask_All, GetFlagsSZHP(FlagOp::Add, res, rhs ^ add) | BoolToUInt8(carry));
+    return res;
+  }
+
+  static u8 op_rlc(Registers& r, u8 rhs)
+  {
+    r.f.c = ConvertToBoolUnchecked(rhs >> 7);
+    return (rhs << 1) | (rhs >> 7);
+  }
+
+  static u8 op_rrc(Registers& r, u8 rhs)
+  {
+    r.f.c = ConvertToBoolUnchecked(rhs & u8(1));
+    return (rhs >> 1) | (rhs << 7);
+  }
+
+  static u8 op_ral(Registers& r, u8 rhs)
+  {
+    const u8 res = (rhs << 1) | BoolToUInt8(r.f.c);
+    r.f.c = ConvertToBoolUnchecked(rhs >> 7);
+    return res;
+  }
+
+  static u8 op_rar(Registers& r, u8 rhs)
+  {
+    const u8 res = (rhs >> 1) | (BoolToUInt8(r.f.c) << 7);
+    r.f.c = ConvertToBoolUnchecked(rhs & u8(1));
+    return res;
+  }
+
+  static u16 op_dad(Registers& r, u16 lhs, u16 rhs)
+  {
+    const u32 res32 = ZeroExtend32(lhs) + ZeroExtend32(rhs);
+    r.f.c = ConvertToBoolUnchecked(res32 >> 16);
+    return Truncate16(res32);
+  }
+};
+
+struct StaticBlock
+{
+  MemoryAddress start_pc;
+
+  // Bytes of code translated, from start_pc.
+  u16 length;
+
+  // Sum of the instruction timings, assuming every conditional call/return is taken.
+  u16 max_cycles;
+
+  void (*function)(StaticCodeState& state);
+};
+
+// A program translated by staticrec. The checksum covers the memory the blocks were translated from, so that the CPU
+// can refuse code generated for a different program.
+struct StaticCode
+{
+  MemoryAddress start_address;
+  u32 size;
+  u32 checksum;
+  const StaticBlock* blocks;
+  u32 block_count;
+};
+
+// FNV-1a, shared by staticrec and CPU::SetStaticCode.
+inline u32 ComputeStaticCodeChecksum(const u8* data, u32 size)
+{
+  u32 hash = 0x811C9DC5u;
+  for (u32 i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 0x01000193u;
+  return hash;
+}
+
+} // namespace i8080
@@ -0,0 +1,88 @@
+#include "trace.h"
+#include "YBaseLib/Log.h"
+#include <cstdio>
+Log_SetChannel(Trace);
+
+namespace i8080 {
+
+static u32 RoundUpPow2(u32 value)
+{
+  u32 result = 1;
+  while (result < value)
+    result <<= 1;
+  return result;
+}
+
+TraceBuffer::TraceBuffer(u32 capacity) : m_mask(RoundUpPow2(std::max(capacity, 1u)) - 1)
+{
+  m_records = std::make_unique<TraceRecord[]>(static_cast<size_t>(m_mask) + 1);
+}
+
+TraceBuffer::~TraceBuffer() = default;
+
+bool TraceBuffer::WriteToFile(const char* filename) const
+{
+  std::FILE* fp = std::fopen(filename, "wb");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s' for writing", filename);
+    return false;
+  }
+
+  FileHeader header = {};
+  header.signature = FILE_SIGNATURE;
+  header.version = FILE_VERSION;
+  header.record_size = sizeof(TraceRecord);
+  header.record_count = GetRecordCount();
+  header.total_record_count = m_total_records;
+
+  bool result = (std::fwrite(&header, sizeof(header), 1, fp) == 1);
+
+  // The held records may wrap around the end of the buffer.
+  const u32 first = static_cast<u32>(m_total_records - header.record_count) & m_mask;
+  const u32 first_count = std::min(header.record_count, GetCapacity() - first);
+  const u32 second_count = header.record_count - first_count;
+  result = result && (first_count == 0 ||
+                       std::fwrite(&m_records[first], sizeof(TraceRecord), first_count, fp) == first_count);
+  result = result && (second_count == 0 ||
+                       std::fwrite(&m_records[0], sizeof(TraceRecord), second_count, fp) == second_count);
+  result = (std::fclose(fp) == 0) && result;
+  if (!result)
+    Log_ErrorPrintf("Failed to write %u trace records to '%s'", header.record_count, filename);
+
+  return result;
+}
+
+bool TraceBuffer::ReadFromFile(const char* filename, std::vector<TraceRecord>* records, u64* total_record_count)
+{
+  std::FILE* fp = std::fopen(filename, "rb");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s'", filename);
+    return false;
+  }
+
+  FileHeader header;
+  if (std::fread(&header, sizeof(header), 1, fp) != 1 || header.signature != FILE_SIGNATURE ||
+      header.version != FILE_VERSION || header.record_size != sizeof(TraceRecord))
+  {
+    Log_ErrorPrintf("'%s' is not a trace file, or was written by a different version", filename);
+    std::fclose(fp);
+    return false;
+  }
+
+  records->resize(header.record_count);
+  if (header.record_count > 0 &&
+      std::fread(records->data(), sizeof(TraceRecord), header.record_count, fp) != header.record_count)
+  {
+    Log_ErrorPrintf("Failed to read %u trace records from '%s'", header.record_count, filename);
+    std::fclose(fp);
+    return false;
+  }
+
+  std::fclose(fp);
+  *total_record_count = header.total_record_count;
+  return true;
+}
+
+} // namespace i8080
@@ -0,0 +1,74 @@
+#pragma once
+#include "types.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace i8080 {
+
+// State before an instruction executes, as recorded by the CPU when tracing. Records are fixed size and written without
+// any formatting, so that tracing a long run is cheap and the output can be disassembled offline.
+struct TraceRecord
+{
+  u64 cycle;  // cycles executed before this instruction
+  Registers regs;
+  u8 bytes[3]; // opcode and immediate bytes
+  u8 length;
+};
+static_assert(sizeof(TraceRecord) == 24, "trace records are written to files as-is");
+
+// Preallocated ring of trace records. Once full, each new record replaces the oldest one, so the buffer always holds the
+// instructions leading up to the point of interest.
+class TraceBuffer
+{
+public:
+  static constexpr u32 FILE_SIGNATURE = 0x43525438; // '8TRC'
+  static constexpr u32 FILE_VERSION = 1;
+
+  // capacity is rounded up to a power of two.
+  TraceBuffer(u32 capacity);
+  ~TraceBuffer();
+
+  u32 GetCapacity() const { return m_mask + 1; }
+
+  // Number of records appended since the last Clear(), including ones which have since been overwritten.
+  u64 GetTotalRecordCount() const { return m_total_records; }
+
+  // Number of records currently held.
+  u32 GetRecordCount() const
+  {
+    return static_cast<u32>(std::min<u64>(m_total_records, static_cast<u64>(m_mask) + 1));
+  }
+
+  // Returns the records in order, oldest first.
+  const TraceRecord& GetRecord(u32 index) const
+  {
+    return m_records[static_cast<u32>(m_total_records - GetRecordCount() + index) & m_mask];
+  }
+
+  TraceRecord& Append() { return m_records[static_cast<u32>(m_total_records++) & m_mask]; }
+
+  void Clear() { m_total_records = 0; }
+
+  // Writes the held records, oldest first, after a small header. The decoder in src/tracedump reads this format.
+  bool WriteToFile(const char* filename) const;
+
+  // Reads records written by WriteToFile.
+  static bool ReadFromFile(const char* filename, std::vector<TraceRecord>* records, u64* total_record_count);
+
+private:
+  struct FileHeader
+  {
+    u32 signature;
+    u32 version;
+    u32 record_size;
+    u32 record_count;
+    u64 total_record_count;
+  };
+
+  std::unique_ptr<TraceRecord[]> m_records;
+  u32 m_mask;
+  u64 m_total_records = 0;
+};
+
+} // namespace i8080
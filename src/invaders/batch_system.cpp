@@ -0,0 +1,1086 @@
+#include "batch_system.h"
+#include "i8080/flag_tables.h"
+#include "i8080/instruction_info.h"
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+// SSE2 is part of x86-64, and of 32-bit x86 builds targeting it. Define INVADERS_DISABLE_BATCH_SIMD to run the whole
+// batch through the scalar loops instead.
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) &&                            \
+  !defined(INVADERS_DISABLE_BATCH_SIMD)
+#define INVADERS_BATCH_SIMD 1
+#include <emmintrin.h>
+#else
+#define INVADERS_BATCH_SIMD 0
+#endif
+
+namespace Invaders {
+
+static constexpr u32 NO_LANE = 0xFFFFFFFFu;
+
+// Register index which selects (hl) in the instruction encoding.
+static constexpr u32 MEMORY_OPERAND = 6;
+
+// Instructions are decoded once per group when all of their bytes are in ROM, which is the same for every machine.
+static bool IsSharedCode(u16 pc)
+{
+  return pc < System::ROM_SIZE - 2;
+}
+
+template<typename Group, typename Func>
+static void ForEachLane(const Group& group, const Func& func)
+{
+  if (!group.lanes)
+  {
+    for (u32 lane = 0; lane < group.count; lane++)
+      func(lane);
+  }
+  else
+  {
+    for (u32 i = 0; i < group.count; i++)
+      func(group.lanes[i]);
+  }
+}
+
+static u8 SetFlags(u8 f, u8 mask, u8 flags)
+{
+  return static_cast<u8>((f & ~mask) | flags);
+}
+
+// Whether the condition in bits 3-5 of a conditional jump, call or return holds: nz, z, nc, c, po, pe, p, m.
+static bool TestCondition(u8 opcode, u8 f)
+{
+  static constexpr u8 condition_flags[4] = {i8080::FlagMask_Z, i8080::FlagMask_C, i8080::FlagMask_P,
+                                            i8080::FlagMask_S};
+  const u32 condition = (opcode >> 3) & 7;
+  return ((f & condition_flags[condition >> 1]) != 0) == ((condition & 1) != 0);
+}
+
+// Calls func with op as a std::integral_constant, so that each ALU operation gets its own loop.
+template<typename Func>
+static void DispatchALUOp(u32 op, const Func& func)
+{
+  switch (op)
+  {
+    case 0:
+      func(std::integral_constant<u32, 0>());
+      break;
+    case 1:
+      func(std::integral_constant<u32, 1>());
+      break;
+    case 2:
+      func(std::integral_constant<u32, 2>());
+      break;
+    case 3:
+      func(std::integral_constant<u32, 3>());
+      break;
+    case 4:
+      func(std::integral_constant<u32, 4>());
+      break;
+    case 5:
+      func(std::integral_constant<u32, 5>());
+      break;
+    case 6:
+      func(std::integral_constant<u32, 6>());
+      break;
+    default:
+      func(std::integral_constant<u32, 7>());
+      break;
+  }
+}
+
+// Conditional jumps, calls and returns, ret and pchl, which can send machines at the same PC to different PCs.
+static bool MayChangePCPerMachine(u8 opcode)
+{
+  const u8 pattern = opcode & 0xC7;
+  return pattern == 0xC0 || pattern == 0xC2 || pattern == 0xC4 || opcode == 0xC9 || opcode == 0xD9 || opcode == 0xE9;
+}
+
+// ALU operation from bits 3-5 of 0x80-0xBF and the immediate forms: add, adc, sub, sbb, ana, xra, ora, cmp. The flags
+// match those evaluated lazily by the CPU.
+template<u32 op>
+static u8 ExecuteALUOp(u8 lhs, u8 rhs, u8& f)
+{
+  using i8080::FlagOp;
+  if constexpr (op <= 1)
+  {
+    const u16 carry_in = (op == 1) ? ZeroExtend16(static_cast<u8>(f & i8080::FlagMask_C)) : 0;
+    const u16 res16 = ZeroExtend16(lhs) + ZeroExtend16(rhs) + carry_in;
+    const u8 res8 = Truncate8(res16);
+    f = SetFlags(f, i8080::FlagMask_All, i8080::GetFlagsSZHP(FlagOp::Add, res8, lhs ^ rhs) | Truncate8(res16 >> 8));
+    return res8;
+  }
+  else if constexpr (op <= 3 || op == 7)
+  {
+    const u16 borrow_in = (op == 3) ? ZeroExtend16(static_cast<u8>(f & i8080::FlagMask_C)) : 0;
+    const u16 res16 = static_cast<u16>(ZeroExtend16(lhs) - ZeroExtend16(rhs) - borrow_in);
+    const u8 res8 = Truncate8(res16);
+    f = SetFlags(f, i8080::FlagMask_All,
+                 i8080::GetFlagsSZHP(FlagOp::Sub, res8, lhs ^ rhs) | Truncate8((res16 >> 8) & 1));
+    return (op == 7) ? lhs : res8;
+  }
+  else if constexpr (op == 4)
+  {
+    const u8 res = lhs & rhs;
+    f = SetFlags(f, i8080::FlagMask_All, i8080::GetFlagsSZHP(FlagOp::And, res, lhs ^ rhs));
+    return res;
+  }
+  else
+  {
+    const u8 res = (op == 5) ? (lhs ^ rhs) : (lhs | rhs);
+    f = SetFlags(f, i8080::FlagMask_All, i8080::SZP_FLAGS[res]);
+    return res;
+  }
+}
+
+#if INVADERS_BATCH_SIMD
+
+// Machines per SSE2 register.
+static constexpr u32 WIDE_LANES = 16;
+
+static __m128i Splat8(u8 value)
+{
+  return _mm_set1_epi8(static_cast<char>(value));
+}
+
+// S, Z and P of 16 results, as in SZP_FLAGS.
+static __m128i GetFlagsSZPWide(__m128i res)
+{
+  const __m128i sign = _mm_and_si128(res, Splat8(i8080::FlagMask_S));
+  const __m128i zero = _mm_and_si128(_mm_cmpeq_epi8(res, _mm_setzero_si128()), Splat8(i8080::FlagMask_Z));
+
+  // Fold the parity of each byte into its bit 0. The 16-bit shifts carry bits in from the neighbouring byte, but they
+  // only reach bits which are discarded.
+  __m128i parity = _mm_xor_si128(res, _mm_srli_epi16(res, 4));
+  parity = _mm_xor_si128(parity, _mm_srli_epi16(parity, 2));
+  parity = _mm_xor_si128(parity, _mm_srli_epi16(parity, 1));
+  parity = _mm_andnot_si128(_mm_slli_epi16(parity, 2), Splat8(i8080::FlagMask_P));
+
+  return _mm_or_si128(_mm_or_si128(sign, zero), parity);
+}
+
+// ExecuteALUOp() for 16 machines.
+template<u32 op>
+static __m128i ExecuteALUOpWide(__m128i lhs, __m128i rhs, __m128i& f)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i carry_mask = Splat8(i8080::FlagMask_C);
+  const __m128i half_carry_mask = Splat8(i8080::FlagMask_H);
+  __m128i res;
+  __m128i flags;
+  if constexpr (op <= 1)
+  {
+    // The saturated sum only differs from the wrapped sum when the addition carries out.
+    res = _mm_add_epi8(lhs, rhs);
+    __m128i carry = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_adds_epu8(lhs, rhs), res), carry_mask);
+    if constexpr (op == 1)
+    {
+      const __m128i carry_in = _mm_and_si128(f, carry_mask);
+      res = _mm_add_epi8(res, carry_in);
+      carry = _mm_or_si128(carry, _mm_and_si128(_mm_cmpeq_epi8(res, zero), carry_in));
+    }
+
+    const __m128i half_carry = _mm_and_si128(_mm_xor_si128(_mm_xor_si128(lhs, rhs), res), half_carry_mask);
+    flags = _mm_or_si128(carry, half_carry);
+  }
+  else if constexpr (op <= 3 || op == 7)
+  {
+    // rhs - lhs saturates to zero unless the subtraction borrows.
+    const __m128i diff = _mm_sub_epi8(lhs, rhs);
+    __m128i borrow = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(rhs, lhs), zero), carry_mask);
+    res = diff;
+    if constexpr (op == 3)
+    {
+      const __m128i borrow_in = _mm_and_si128(f, carry_mask);
+      res = _mm_sub_epi8(diff, borrow_in);
+      borrow = _mm_or_si128(borrow, _mm_and_si128(_mm_cmpeq_epi8(diff, zero), borrow_in));
+    }
+
+    const __m128i half_carry = _mm_andnot_si128(_mm_xor_si128(_mm_xor_si128(lhs, rhs), res), half_carry_mask);
+    flags = _mm_or_si128(borrow, half_carry);
+  }
+  else if constexpr (op == 4)
+  {
+    res = _mm_and_si128(lhs, rhs);
+    flags = _mm_slli_epi16(_mm_and_si128(_mm_or_si128(lhs, rhs), Splat8(0x08)), 1);
+  }
+  else
+  {
+    res = (op == 5) ? _mm_xor_si128(lhs, rhs) : _mm_or_si128(lhs, rhs);
+    flags = zero;
+  }
+
+  flags = _mm_or_si128(flags, GetFlagsSZPWide(res));
+  f = _mm_or_si128(_mm_andnot_si128(Splat8(i8080::FlagMask_All), f), flags);
+  return (op == 7) ? lhs : res;
+}
+
+// ALU operation op on count machines, with the operand from src_reg, or imm8 when src_reg is null. src_reg may be a.
+template<u32 op>
+static void ExecuteALUWide(u8* a, u8* f, const u8* src_reg, u8 imm8, u32 count)
+{
+  const __m128i imm = Splat8(imm8);
+  u32 lane = 0;
+  for (; (lane + WIDE_LANES) <= count; lane += WIDE_LANES)
+  {
+    __m128i* const a_ptr = reinterpret_cast<__m128i*>(&a[lane]);
+    __m128i* const f_ptr = reinterpret_cast<__m128i*>(&f[lane]);
+    const __m128i rhs = src_reg ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src_reg[lane])) : imm;
+    __m128i flags = _mm_loadu_si128(f_ptr);
+    _mm_storeu_si128(a_ptr, ExecuteALUOpWide<op>(_mm_loadu_si128(a_ptr), rhs, flags));
+    _mm_storeu_si128(f_ptr, flags);
+  }
+
+  for (; lane < count; lane++)
+    a[lane] = ExecuteALUOp<op>(a[lane], src_reg ? src_reg[lane] : imm8, f[lane]);
+}
+
+// inr or dcr on count machines, C is left as it is.
+static void ExecuteIncDecWide(u8* reg, u8* f, bool increment, u32 count)
+{
+  const i8080::FlagOp flag_op = increment ? i8080::FlagOp::Inr : i8080::FlagOp::Dcr;
+  const u8 delta = increment ? 1 : 0xFF;
+  const __m128i low_nibble_mask = Splat8(0x0F);
+  const __m128i half_carry_mask = Splat8(i8080::FlagMask_H);
+  u32 lane = 0;
+  for (; (lane + WIDE_LANES) <= count; lane += WIDE_LANES)
+  {
+    __m128i* const reg_ptr = reinterpret_cast<__m128i*>(&reg[lane]);
+    __m128i* const f_ptr = reinterpret_cast<__m128i*>(&f[lane]);
+    const __m128i res = _mm_add_epi8(_mm_loadu_si128(reg_ptr), Splat8(delta));
+
+    // inr carries into bit 4 when the low nibble wraps to 0, dcr borrows from it when the low nibble wraps to F.
+    const __m128i low_nibble = _mm_and_si128(res, low_nibble_mask);
+    const __m128i half_carry =
+      increment ? _mm_and_si128(_mm_cmpeq_epi8(low_nibble, _mm_setzero_si128()), half_carry_mask) :
+                  _mm_andnot_si128(_mm_cmpeq_epi8(low_nibble, low_nibble_mask), half_carry_mask);
+
+    const __m128i flags = _mm_or_si128(GetFlagsSZPWide(res), half_carry);
+    const __m128i kept_flags = _mm_andnot_si128(Splat8(i8080::FlagMask_SZHP), _mm_loadu_si128(f_ptr));
+    _mm_storeu_si128(f_ptr, _mm_or_si128(kept_flags, flags));
+    _mm_storeu_si128(reg_ptr, res);
+  }
+
+  for (; lane < count; lane++)
+  {
+    const u8 res = static_cast<u8>(reg[lane] + delta);
+    f[lane] = SetFlags(f[lane], i8080::FlagMask_SZHP, i8080::GetFlagsSZHP(flag_op, res, 0));
+    reg[lane] = res;
+  }
+}
+
+#endif
+
+BatchSystem::BatchSystem(u32 machine_count) : m_machine_count(machine_count)
+{
+  m_ram.resize(machine_count * System::RAM_SIZE);
+  for (std::vector<u8>* reg : {&m_a, &m_f, &m_b, &m_c, &m_d, &m_e, &m_h, &m_l})
+    reg->resize(machine_count);
+  m_sp.resize(machine_count);
+  m_pc.resize(machine_count);
+  m_reg8 = {m_b.data(), m_c.data(), m_d.data(), m_e.data(), m_h.data(), m_l.data(), nullptr, m_a.data()};
+
+  m_interrupt_enabled.resize(machine_count);
+  m_interrupt_request.resize(machine_count);
+  m_interrupt_request_vector.resize(machine_count);
+  m_halted.resize(machine_count);
+  m_last_interrupt_was_vblank.resize(machine_count);
+  m_frame_complete.resize(machine_count);
+  m_cycles_until_interrupt.resize(machine_count);
+  m_shift_register_value.resize(machine_count);
+  m_shift_register_read_offset.resize(machine_count);
+  m_executed_instructions.resize(machine_count);
+
+  m_active_lanes.reserve(machine_count);
+  m_group_lanes.reserve(machine_count);
+  m_group_pcs.reserve(machine_count);
+  m_next_lane.resize(machine_count);
+  m_pc_first_lane.assign(0x10000, NO_LANE);
+
+  Reset();
+}
+
+BatchSystem::~BatchSystem() = default;
+
+bool BatchSystem::LoadROMs(const char* base_directory)
+{
+  return System::ReadROMs(base_directory, m_rom);
+}
+
+void BatchSystem::Reset()
+{
+  // Same state as System::Reset(), RAM is left as it is.
+  for (std::vector<u8>* reg : {&m_a, &m_f, &m_b, &m_c, &m_d, &m_e, &m_h, &m_l})
+    std::fill(reg->begin(), reg->end(), u8(0));
+  std::fill(m_sp.begin(), m_sp.end(), u16(0));
+  std::fill(m_pc.begin(), m_pc.end(), u16(0));
+
+  std::fill(m_interrupt_enabled.begin(), m_interrupt_enabled.end(), u8(1));
+  std::fill(m_interrupt_request.begin(), m_interrupt_request.end(), u8(0));
+  std::fill(m_interrupt_request_vector.begin(), m_interrupt_request_vector.end(), u8(0));
+  std::fill(m_halted.begin(), m_halted.end(), u8(0));
+  std::fill(m_last_interrupt_was_vblank.begin(), m_last_interrupt_was_vblank.end(), u8(1));
+  std::fill(m_cycles_until_interrupt.begin(), m_cycles_until_interrupt.end(), System::INTERRUPT_CYCLE_INTERVAL);
+  std::fill(m_shift_register_value.begin(), m_shift_register_value.end(), u16(0));
+  std::fill(m_shift_register_read_offset.begin(), m_shift_register_read_offset.end(), u8(0));
+}
+
+void BatchSystem::ExecuteFrame(const Inputs* inputs, u8* frames)
+{
+  m_inputs = inputs;
+  m_begin_pending = true;
+
+  m_active_lanes.clear();
+  for (u32 lane = 0; lane < m_machine_count; lane++)
+  {
+    m_frame_complete[lane] = false;
+    m_active_lanes.push_back(lane);
+  }
+
+  while (!m_active_lanes.empty())
+    ExecuteStep();
+
+  m_inputs = nullptr;
+
+  if (frames)
+  {
+    for (u32 lane = 0; lane < m_machine_count; lane++)
+      std::memcpy(&frames[lane * FRAME_SIZE], GetVRAM(lane), FRAME_SIZE);
+  }
+}
+
+i8080::Registers BatchSystem::GetRegisters(u32 machine) const
+{
+  i8080::Registers regs = {};
+  regs.a = m_a[machine];
+  regs.f.bits = m_f[machine];
+  regs.b = m_b[machine];
+  regs.c = m_c[machine];
+  regs.d = m_d[machine];
+  regs.e = m_e[machine];
+  regs.h = m_h[machine];
+  regs.l = m_l[machine];
+  regs.sp = m_sp[machine];
+  regs.pc = m_pc[machine];
+  return regs;
+}
+
+u8 BatchSystem::ReadMemory(u32 lane, u16 address) const
+{
+  // Same map as System::ReadMemory(), without logging unmapped accesses.
+  if (address < 0x2000)
+    return m_rom[address];
+  else if (address < 0x6000)
+    return m_ram[lane * System::RAM_SIZE + (address & 0x1FFF)];
+  else
+    return 0xFF;
+}
+
+void BatchSystem::WriteMemory(u32 lane, u16 address, u8 value)
+{
+  if (address >= 0x2000 && address < 0x6000)
+    m_ram[lane * System::RAM_SIZE + (address & 0x1FFF)] = value;
+}
+
+u16 BatchSystem::ReadMemoryWord(u32 lane, u16 address) const
+{
+  const u8 low = ReadMemory(lane, address);
+  const u8 high = ReadMemory(lane, static_cast<u16>(address + 1));
+  return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+}
+
+void BatchSystem::WriteMemoryWord(u32 lane, u16 address, u16 value)
+{
+  WriteMemory(lane, address, Truncate8(value));
+  WriteMemory(lane, static_cast<u16>(address + 1), Truncate8(value >> 8));
+}
+
+void BatchSystem::PushWord(u32 lane, u16 value)
+{
+  WriteMemory(lane, --m_sp[lane], Truncate8(value >> 8));
+  WriteMemory(lane, --m_sp[lane], Truncate8(value));
+}
+
+u16 BatchSystem::PopWord(u32 lane)
+{
+  const u8 low = ReadMemory(lane, m_sp[lane]++);
+  const u8 high = ReadMemory(lane, m_sp[lane]++);
+  return ZeroExtend16(low) | (ZeroExtend16(high) << 8);
+}
+
+u8 BatchSystem::ReadIO(u32 lane, u8 port)
+{
+  switch (port)
+  {
+    case 0x00:
+      return m_inputs[lane].INP0_bits | u8(0b00001110);
+    case 0x01:
+      return m_inputs[lane].INP1_bits | u8(0b00001000);
+    case 0x02:
+      return m_inputs[lane].INP2_bits;
+    case 0x03:
+      return Truncate8(m_shift_register_value[lane] >> (8 - m_shift_register_read_offset[lane]));
+    default:
+      return 0xFF;
+  }
+}
+
+void BatchSystem::WriteIO(u32 lane, u8 port, u8 value)
+{
+  switch (port)
+  {
+    case 0x02:
+      m_shift_register_read_offset[lane] = (value & u8(0x07));
+      return;
+    case 0x04:
+      m_shift_register_value[lane] = (ZeroExtend16(value) << 8) | (m_shift_register_value[lane] >> 8);
+      return;
+    default:
+      // Sound and watchdog.
+      return;
+  }
+}
+
+u16 BatchSystem::GetPair(u32 pair, u32 lane) const
+{
+  if (pair == i8080::Reg16_SP)
+    return m_sp[lane];
+
+  return (ZeroExtend16(m_reg8[pair * 2][lane]) << 8) | ZeroExtend16(m_reg8[pair * 2 + 1][lane]);
+}
+
+void BatchSystem::SetPair(u32 pair, u32 lane, u16 value)
+{
+  if (pair == i8080::Reg16_SP)
+  {
+    m_sp[lane] = value;
+    return;
+  }
+
+  m_reg8[pair * 2][lane] = Truncate8(value >> 8);
+  m_reg8[pair * 2 + 1][lane] = Truncate8(value);
+}
+
+void BatchSystem::AddCycles(u32 lane, CycleCount cycles)
+{
+  // System raises its interrupts from events, which run once the instruction that reaches the event time completes.
+  m_cycles_until_interrupt[lane] -= cycles;
+  if (m_cycles_until_interrupt[lane] <= 0)
+    ScreenInterrupt(lane);
+}
+
+void BatchSystem::AddCyclesToAll(CycleCount cycles)
+{
+  // Interrupts are rare, so the counts are updated in one pass and only searched when one of them has expired. A count
+  // has expired when count - 1 is negative, so the sign bits are combined for the whole batch.
+  CycleCount* const cycles_until_interrupt = m_cycles_until_interrupt.data();
+  CycleCount expired = 0;
+  u32 lane = 0;
+#if INVADERS_BATCH_SIMD
+  const __m128i delta = _mm_set1_epi64x(cycles);
+  const __m128i one = _mm_set1_epi64x(1);
+  __m128i expired_wide = _mm_setzero_si128();
+  for (; (lane + 2) <= m_machine_count; lane += 2)
+  {
+    __m128i* const ptr = reinterpret_cast<__m128i*>(&cycles_until_interrupt[lane]);
+    const __m128i res = _mm_sub_epi64(_mm_loadu_si128(ptr), delta);
+    _mm_storeu_si128(ptr, res);
+    expired_wide = _mm_or_si128(expired_wide, _mm_sub_epi64(res, one));
+  }
+  expired = (_mm_movemask_pd(_mm_castsi128_pd(expired_wide)) != 0) ? -1 : 0;
+#endif
+  for (; lane < m_machine_count; lane++)
+  {
+    cycles_until_interrupt[lane] -= cycles;
+    expired |= cycles_until_interrupt[lane] - 1;
+  }
+
+  if (expired >= 0)
+    return;
+
+  for (lane = 0; lane < m_machine_count; lane++)
+  {
+    if (cycles_until_interrupt[lane] <= 0)
+      ScreenInterrupt(lane);
+  }
+}
+
+void BatchSystem::ScreenInterrupt(u32 lane)
+{
+  // RST 1 when the beam reaches the middle of the screen, RST 2 at the start of vblank.
+  m_cycles_until_interrupt[lane] += System::INTERRUPT_CYCLE_INTERVAL;
+  m_last_interrupt_was_vblank[lane] ^= 1;
+  m_interrupt_request[lane] = true;
+  m_interrupt_request_vector[lane] = m_last_interrupt_was_vblank[lane] ? 2 : 1;
+  if (m_last_interrupt_was_vblank[lane])
+    m_frame_complete[lane] = true;
+
+  m_begin_pending = true;
+}
+
+bool BatchSystem::BeginInstruction(u32 lane)
+{
+  while (!m_frame_complete[lane])
+  {
+    if (m_interrupt_request[lane] & m_interrupt_enabled[lane])
+    {
+      PushWord(lane, m_pc[lane]);
+      m_pc[lane] = ZeroExtend16(m_interrupt_request_vector[lane]) * u16(8);
+      m_interrupt_enabled[lane] = false;
+      m_interrupt_request[lane] = false;
+      m_interrupt_request_vector[lane] = 0;
+      m_halted[lane] = false;
+    }
+
+    if (!m_halted[lane])
+      return true;
+
+    // Halted until the next interrupt is raised.
+    AddCycles(lane, m_cycles_until_interrupt[lane]);
+  }
+
+  return false;
+}
+
+void BatchSystem::ExecuteStep()
+{
+  // BeginInstruction() has no effect until an interrupt is raised, a machine halts or interrupts are enabled, so the
+  // machines are only visited when one of those has happened since the last visit.
+  if (m_begin_pending)
+  {
+    m_begin_pending = false;
+    m_same_pc = false;
+
+    u32 count = 0;
+    for (u32 i = 0; i < static_cast<u32>(m_active_lanes.size()); i++)
+    {
+      const u32 lane = m_active_lanes[i];
+      if (BeginInstruction(lane))
+        m_active_lanes[count++] = lane;
+    }
+    m_active_lanes.resize(count);
+  }
+
+  const u32 count = static_cast<u32>(m_active_lanes.size());
+  if (count == 0)
+    return;
+
+  // While every machine is at the same PC, the group is the whole batch and the register arrays are used directly.
+  const u16 first_pc = m_pc[m_active_lanes[0]];
+  if (count == m_machine_count)
+  {
+    if (!m_same_pc)
+      m_same_pc = std::all_of(m_pc.begin(), m_pc.end(), [first_pc](u16 pc) { return pc == first_pc; });
+
+    if (m_same_pc && IsSharedCode(first_pc))
+    {
+      ExecuteGroup(LaneGroup{nullptr, count}, first_pc);
+      return;
+    }
+  }
+  m_same_pc = false;
+
+  for (const u32 lane : m_active_lanes)
+  {
+    const u16 pc = m_pc[lane];
+    if (!IsSharedCode(pc))
+    {
+      ExecuteGroup(LaneGroup{&lane, 1}, pc);
+      continue;
+    }
+
+    if (m_pc_first_lane[pc] == NO_LANE)
+      m_group_pcs.push_back(pc);
+    m_next_lane[lane] = m_pc_first_lane[pc];
+    m_pc_first_lane[pc] = lane;
+  }
+
+  for (const u32 pc : m_group_pcs)
+  {
+    m_group_lanes.clear();
+    for (u32 lane = m_pc_first_lane[pc]; lane != NO_LANE; lane = m_next_lane[lane])
+      m_group_lanes.push_back(lane);
+    m_pc_first_lane[pc] = NO_LANE;
+
+    ExecuteGroup(LaneGroup{m_group_lanes.data(), static_cast<u32>(m_group_lanes.size())}, static_cast<u16>(pc));
+  }
+  m_group_pcs.clear();
+}
+
+template<typename Source>
+void BatchSystem::ExecuteALU(const LaneGroup& group, u32 op, const Source& source)
+{
+  u8* const a = m_a.data();
+  u8* const f = m_f.data();
+  const auto execute = [&](auto op_constant) {
+    ForEachLane(group, [&](u32 lane) {
+      a[lane] = ExecuteALUOp<decltype(op_constant)::value>(a[lane], source(lane), f[lane]);
+    });
+  };
+
+  DispatchALUOp(op, execute);
+}
+
+bool BatchSystem::ExecuteWide(u8 opcode, u8 imm8)
+{
+  const u32 dst = (opcode >> 3) & 7;
+  const u32 src = opcode & 7;
+  if (opcode >= 0x40 && opcode < 0x80 && dst != MEMORY_OPERAND && src != MEMORY_OPERAND)
+  {
+    // mov
+    if (dst != src)
+      std::memcpy(m_reg8[dst], m_reg8[src], m_machine_count);
+    return true;
+  }
+  else if ((opcode & 0xC7) == 0x06 && dst != MEMORY_OPERAND)
+  {
+    // mvi
+    std::memset(m_reg8[dst], imm8, m_machine_count);
+    return true;
+  }
+
+#if INVADERS_BATCH_SIMD
+  if ((opcode >= 0x80 && opcode < 0xC0 && src != MEMORY_OPERAND) || (opcode & 0xC7) == 0xC6)
+  {
+    const u8* const src_reg = (opcode < 0xC0) ? m_reg8[src] : nullptr;
+    DispatchALUOp(dst, [&](auto op_constant) {
+      ExecuteALUWide<decltype(op_constant)::value>(m_a.data(), m_f.data(), src_reg, imm8, m_machine_count);
+    });
+    return true;
+  }
+  else if (((opcode & 0xC7) == 0x04 || (opcode & 0xC7) == 0x05) && dst != MEMORY_OPERAND)
+  {
+    ExecuteIncDecWide(m_reg8[dst], m_f.data(), (opcode & 1) == 0, m_machine_count);
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+void BatchSystem::ExecuteGroup(const LaneGroup& group, u16 pc)
+{
+  const u32 first_lane = group.lanes ? group.lanes[0] : 0;
+  const u8 opcode = ReadMemory(first_lane, pc);
+  const u8 imm8 = ReadMemory(first_lane, static_cast<u16>(pc + 1));
+  const u16 imm16 = ZeroExtend16(imm8) | (ZeroExtend16(ReadMemory(first_lane, static_cast<u16>(pc + 2))) << 8);
+  const u16 next_pc = static_cast<u16>(pc + i8080::INSTRUCTION_INFO[opcode].length);
+  m_decode_count++;
+
+  // Conditional calls and returns add their cycles per machine, and clear this.
+  CycleCount cycles = i8080::INSTRUCTION_INFO[opcode].cycles;
+
+  u8* const a = m_a.data();
+  u8* const f = m_f.data();
+  u8* const h = m_h.data();
+  u8* const l = m_l.data();
+  u16* const sp = m_sp.data();
+  u16* const pcs = m_pc.data();
+  u64* const executed_instructions = m_executed_instructions.data();
+  if (!group.lanes)
+  {
+    // The group is the whole batch, so the instruction is counted once for all machines. Only conditional and computed
+    // jumps can leave the machines at different PCs.
+    std::fill_n(pcs, group.count, next_pc);
+    m_shared_executed_instructions++;
+    m_same_pc = !MayChangePCPerMachine(opcode);
+    if (ExecuteWide(opcode, imm8))
+    {
+      AddCyclesToAll(cycles);
+      return;
+    }
+  }
+  else
+  {
+    ForEachLane(group, [&](u32 lane) {
+      pcs[lane] = next_pc;
+      executed_instructions[lane]++;
+    });
+  }
+
+  const auto hl = [h, l](u32 lane) { return static_cast<u16>((ZeroExtend16(h[lane]) << 8) | ZeroExtend16(l[lane])); };
+  const u32 dst = (opcode >> 3) & 7;
+  const u32 src = opcode & 7;
+  const u32 pair = (opcode >> 4) & 3;
+
+  if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76)
+  {
+    // mov
+    u8* const dst_reg = m_reg8[dst];
+    const u8* const src_reg = m_reg8[src];
+    if (src == MEMORY_OPERAND)
+      ForEachLane(group, [&](u32 lane) { dst_reg[lane] = ReadMemory(lane, hl(lane)); });
+    else if (dst == MEMORY_OPERAND)
+      ForEachLane(group, [&](u32 lane) { WriteMemory(lane, hl(lane), src_reg[lane]); });
+    else
+      ForEachLane(group, [&](u32 lane) { dst_reg[lane] = src_reg[lane]; });
+  }
+  else if (opcode >= 0x80 && opcode < 0xC0)
+  {
+    const u8* const src_reg = m_reg8[src];
+    if (src == MEMORY_OPERAND)
+      ExecuteALU(group, dst, [this, &hl](u32 lane) { return ReadMemory(lane, hl(lane)); });
+    else
+      ExecuteALU(group, dst, [src_reg](u32 lane) { return src_reg[lane]; });
+  }
+  else if ((opcode & 0xC7) == 0xC6)
+  {
+    ExecuteALU(group, dst, [imm8](u32) { return imm8; });
+  }
+  else if ((opcode & 0xC7) == 0x04 || (opcode & 0xC7) == 0x05)
+  {
+    // inr, dcr
+    const bool increment = (opcode & 1) == 0;
+    const i8080::FlagOp flag_op = increment ? i8080::FlagOp::Inr : i8080::FlagOp::Dcr;
+    const u8 delta = increment ? 1 : 0xFF;
+    u8* const reg = m_reg8[dst];
+    if (dst == MEMORY_OPERAND)
+    {
+      ForEachLane(group, [&](u32 lane) {
+        const u8 res = static_cast<u8>(ReadMemory(lane, hl(lane)) + delta);
+        f[lane] = SetFlags(f[lane], i8080::FlagMask_SZHP, i8080::GetFlagsSZHP(flag_op, res, 0));
+        WriteMemory(lane, hl(lane), res);
+      });
+    }
+    else
+    {
+      ForEachLane(group, [&](u32 lane) {
+        const u8 res = static_cast<u8>(reg[lane] + delta);
+        f[lane] = SetFlags(f[lane], i8080::FlagMask_SZHP, i8080::GetFlagsSZHP(flag_op, res, 0));
+        reg[lane] = res;
+      });
+    }
+  }
+  else if ((opcode & 0xC7) == 0x06)
+  {
+    // mvi
+    u8* const reg = m_reg8[dst];
+    if (dst == MEMORY_OPERAND)
+      ForEachLane(group, [&](u32 lane) { WriteMemory(lane, hl(lane), imm8); });
+    else
+      ForEachLane(group, [&](u32 lane) { reg[lane] = imm8; });
+  }
+  else if ((opcode & 0xC7) == 0xC2)
+  {
+    // jcc
+    ForEachLane(group, [&](u32 lane) {
+      if (TestCondition(opcode, f[lane]))
+        pcs[lane] = imm16;
+    });
+  }
+  else if ((opcode & 0xC7) == 0xC4)
+  {
+    // ccc
+    ForEachLane(group, [&](u32 lane) {
+      if (TestCondition(opcode, f[lane]))
+      {
+        PushWord(lane, next_pc);
+        pcs[lane] = imm16;
+        AddCycles(lane, 17);
+      }
+      else
+      {
+        AddCycles(lane, 11);
+      }
+    });
+    cycles = 0;
+  }
+  else if ((opcode & 0xC7) == 0xC0)
+  {
+    // rcc
+    ForEachLane(group, [&](u32 lane) {
+      if (TestCondition(opcode, f[lane]))
+      {
+        pcs[lane] = PopWord(lane);
+        AddCycles(lane, 11);
+      }
+      else
+      {
+        AddCycles(lane, 5);
+      }
+    });
+    cycles = 0;
+  }
+  else if ((opcode & 0xC7) == 0xC7)
+  {
+    // rst
+    ForEachLane(group, [&](u32 lane) {
+      PushWord(lane, next_pc);
+      pcs[lane] = static_cast<u16>(opcode & 0x38);
+    });
+  }
+  else
+  {
+    switch (opcode)
+    {
+      // nop
+      case 0x00:
+      case 0x08:
+      case 0x10:
+      case 0x18:
+      case 0x20:
+      case 0x28:
+      case 0x30:
+      case 0x38:
+        break;
+
+      // lxi
+      case 0x01:
+      case 0x11:
+      case 0x21:
+      case 0x31:
+        ForEachLane(group, [&](u32 lane) { SetPair(pair, lane, imm16); });
+        break;
+
+      // stax
+      case 0x02:
+      case 0x12:
+        ForEachLane(group, [&](u32 lane) { WriteMemory(lane, GetPair(pair, lane), a[lane]); });
+        break;
+
+      // ldax
+      case 0x0A:
+      case 0x1A:
+        ForEachLane(group, [&](u32 lane) { a[lane] = ReadMemory(lane, GetPair(pair, lane)); });
+        break;
+
+      // shld
+      case 0x22:
+        ForEachLane(group, [&](u32 lane) { WriteMemoryWord(lane, imm16, hl(lane)); });
+        break;
+
+      // lhld
+      case 0x2A:
+        ForEachLane(group, [&](u32 lane) { SetPair(i8080::Reg16_HL, lane, ReadMemoryWord(lane, imm16)); });
+        break;
+
+      // sta
+      case 0x32:
+        ForEachLane(group, [&](u32 lane) { WriteMemory(lane, imm16, a[lane]); });
+        break;
+
+      // lda
+      case 0x3A:
+        ForEachLane(group, [&](u32 lane) { a[lane] = ReadMemory(lane, imm16); });
+        break;
+
+      // inx
+      case 0x03:
+      case 0x13:
+      case 0x23:
+      case 0x33:
+        ForEachLane(group, [&](u32 lane) { SetPair(pair, lane, static_cast<u16>(GetPair(pair, lane) + 1)); });
+        break;
+
+      // dcx
+      case 0x0B:
+      case 0x1B:
+      case 0x2B:
+      case 0x3B:
+        ForEachLane(group, [&](u32 lane) { SetPair(pair, lane, static_cast<u16>(GetPair(pair, lane) - 1)); });
+        break;
+
+      // dad
+      case 0x09:
+      case 0x19:
+      case 0x29:
+      case 0x39:
+        ForEachLane(group, [&](u32 lane) {
+          const u32 res = ZeroExtend32(hl(lane)) + ZeroExtend32(GetPair(pair, lane));
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_C, Truncate8(res >> 16));
+          SetPair(i8080::Reg16_HL, lane, Truncate16(res));
+        });
+        break;
+
+      // rlc
+      case 0x07:
+        ForEachLane(group, [&](u32 lane) {
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_C, a[lane] >> 7);
+          a[lane] = static_cast<u8>((a[lane] << 1) | (a[lane] >> 7));
+        });
+        break;
+
+      // rrc
+      case 0x0F:
+        ForEachLane(group, [&](u32 lane) {
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_C, a[lane] & 1);
+          a[lane] = static_cast<u8>((a[lane] >> 1) | (a[lane] << 7));
+        });
+        break;
+
+      // ral
+      case 0x17:
+        ForEachLane(group, [&](u32 lane) {
+          const u8 res = static_cast<u8>((a[lane] << 1) | (f[lane] & i8080::FlagMask_C));
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_C, a[lane] >> 7);
+          a[lane] = res;
+        });
+        break;
+
+      // rar
+      case 0x1F:
+        ForEachLane(group, [&](u32 lane) {
+          const u8 res = static_cast<u8>((a[lane] >> 1) | ((f[lane] & i8080::FlagMask_C) << 7));
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_C, a[lane] & 1);
+          a[lane] = res;
+        });
+        break;
+
+      // daa
+      case 0x27:
+        ForEachLane(group, [&](u32 lane) {
+          const u8 rhs = a[lane];
+          u8 add = 0;
+          if ((rhs & u8(0xF)) > 0x9 || (f[lane] & i8080::FlagMask_H))
+            add = 0x06;
+
+          bool carry = (f[lane] & i8080::FlagMask_C) != 0;
+          if (rhs > 0x99 || carry)
+          {
+            add += 0x60;
+            carry = true;
+          }
+
+          const u8 res = rhs + add;
+          f[lane] = SetFlags(f[lane], i8080::FlagMask_All,
+                             i8080::GetFlagsSZHP(i8080::FlagOp::Add, res, rhs ^ add) | BoolToUInt8(carry));
+          a[lane] = res;
+        });
+        break;
+
+      // cma
+      case 0x2F:
+        ForEachLane(group, [&](u32 lane) { a[lane] = ~a[lane]; });
+        break;
+
+      // stc
+      case 0x37:
+        ForEachLane(group, [&](u32 lane) { f[lane] |= i8080::FlagMask_C; });
+        break;
+
+      // cmc
+      case 0x3F:
+        ForEachLane(group, [&](u32 lane) { f[lane] ^= i8080::FlagMask_C; });
+        break;
+
+      // hlt
+      case 0x76:
+        ForEachLane(group, [&](u32 lane) { m_halted[lane] = true; });
+        m_begin_pending = true;
+        break;
+
+      // jmp
+      case 0xC3:
+      case 0xCB:
+        ForEachLane(group, [&](u32 lane) { pcs[lane] = imm16; });
+        break;
+
+      // call
+      case 0xCD:
+      case 0xDD:
+      case 0xED:
+      case 0xFD:
+        ForEachLane(group, [&](u32 lane) {
+          PushWord(lane, next_pc);
+          pcs[lane] = imm16;
+        });
+        break;
+
+      // ret
+      case 0xC9:
+      case 0xD9:
+        ForEachLane(group, [&](u32 lane) { pcs[lane] = PopWord(lane); });
+        break;
+
+      // push
+      case 0xC5:
+      case 0xD5:
+      case 0xE5:
+        ForEachLane(group, [&](u32 lane) { PushWord(lane, GetPair(pair, lane)); });
+        break;
+
+      // push psw
+      case 0xF5:
+        ForEachLane(group, [&](u32 lane) { PushWord(lane, static_cast<u16>((ZeroExtend16(a[lane]) << 8) | f[lane])); });
+        break;
+
+      // pop
+      case 0xC1:
+      case 0xD1:
+      case 0xE1:
+        ForEachLane(group, [&](u32 lane) { SetPair(pair, lane, PopWord(lane)); });
+        break;
+
+      // pop psw
+      case 0xF1:
+        ForEachLane(group, [&](u32 lane) {
+          const u16 value = PopWord(lane);
+          i8080::Flags flags;
+          flags.bits = Truncate8(value);
+          flags.Fixup();
+          f[lane] = flags.bits;
+          a[lane] = Truncate8(value >> 8);
+        });
+        break;
+
+      // xchg
+      case 0xEB:
+        ForEachLane(group, [&](u32 lane) {
+          std::swap(m_d[lane], h[lane]);
+          std::swap(m_e[lane], l[lane]);
+        });
+        break;
+
+      // xthl
+      case 0xE3:
+        ForEachLane(group, [&](u32 lane) {
+          const u16 value = hl(lane);
+          SetPair(i8080::Reg16_HL, lane, ReadMemoryWord(lane, sp[lane]));
+          WriteMemoryWord(lane, sp[lane], value);
+        });
+        break;
+
+      // pchl
+      case 0xE9:
+        ForEachLane(group, [&](u32 lane) { pcs[lane] = hl(lane); });
+        break;
+
+      // sphl
+      case 0xF9:
+        ForEachLane(group, [&](u32 lane) { sp[lane] = hl(lane); });
+        break;
+
+      // di
+      case 0xF3:
+        ForEachLane(group, [&](u32 lane) { m_interrupt_enabled[lane] = false; });
+        break;
+
+      // ei
+      case 0xFB:
+        ForEachLane(group, [&](u32 lane) { m_interrupt_enabled[lane] = true; });
+        m_begin_pending = true;
+        break;
+
+      // in
+      case 0xDB:
+        ForEachLane(group, [&](u32 lane) { a[lane] = ReadIO(lane, imm8); });
+        break;
+
+      // out
+      case 0xD3:
+        ForEachLane(group, [&](u32 lane) { WriteIO(lane, imm8, a[lane]); });
+        break;
+    }
+  }
+
+  if (cycles == 0)
+    return;
+
+  if (!group.lanes)
+    AddCyclesToAll(cycles);
+  else
+    ForEachLane(group, [&](u32 lane) { AddCycles(lane, cycles); });
+}
+
+} // namespace Invaders
@@ -0,0 +1,128 @@
+#pragma once
+#include "common/types.h"
+#include "i8080/types.h"
+#include "system.h"
+#include <array>
+#include <vector>
+
+namespace Invaders {
+
+// Runs many independent machines with the memory map, I/O ports and interrupt timing of System, for workloads such as
+// search or reinforcement learning which step thousands of games at once.
+//
+// Registers are stored as one array per register, indexed by machine. Each step, the machines are grouped by PC, and
+// every group executes its instruction with a single decode and one loop over its machines. When all machines share
+// a PC, register-only instructions run over whole arrays with SSE2, 16 machines per operation (see
+// INVADERS_BATCH_SIMD). Machines which have diverged form smaller groups, down to one machine per group, and code
+// outside of ROM always runs one machine at a time. Each machine keeps its own cycle count, so machines never wait for
+// each other within a frame.
+class BatchSystem
+{
+public:
+  // Size of the frame returned for each machine: the 1bpp VRAM at 2400-3FFF, in the same layout as System renders.
+  static constexpr u32 FRAME_SIZE = 0x1C00;
+
+  explicit BatchSystem(u32 machine_count);
+  ~BatchSystem();
+
+  u32 GetMachineCount() const { return m_machine_count; }
+
+  bool LoadROMs(const char* base_directory);
+  void Reset();
+
+  // Executes a frame on every machine, with one entry in inputs per machine, stopping each machine after its vblank
+  // interrupt has been raised. When frames is not null, it receives FRAME_SIZE bytes per machine.
+  void ExecuteFrame(const Inputs* inputs, u8* frames = nullptr);
+
+  const u8* GetRAM(u32 machine) const { return &m_ram[machine * System::RAM_SIZE]; }
+  const u8* GetVRAM(u32 machine) const { return GetRAM(machine) + 0x400; }
+  i8080::Registers GetRegisters(u32 machine) const;
+  u64 GetExecutedInstructionCount(u32 machine) const
+  {
+    return m_executed_instructions[machine] + m_shared_executed_instructions;
+  }
+
+  // Number of instruction decodes across all machines, compared with the number of instructions executed this shows
+  // how many machines share each decode on average.
+  u64 GetDecodeCount() const { return m_decode_count; }
+
+private:
+  // Machines executing the same instruction, or the first count machines in order when lanes is null.
+  struct LaneGroup
+  {
+    const u32* lanes;
+    u32 count;
+  };
+
+  u8 ReadMemory(u32 lane, u16 address) const;
+  void WriteMemory(u32 lane, u16 address, u8 value);
+  u16 ReadMemoryWord(u32 lane, u16 address) const;
+  void WriteMemoryWord(u32 lane, u16 address, u16 value);
+  void PushWord(u32 lane, u16 value);
+  u16 PopWord(u32 lane);
+  u8 ReadIO(u32 lane, u8 port);
+  void WriteIO(u32 lane, u8 port, u8 value);
+
+  u16 GetPair(u32 pair, u32 lane) const;
+  void SetPair(u32 pair, u32 lane, u16 value);
+
+  void AddCycles(u32 lane, CycleCount cycles);
+  void AddCyclesToAll(CycleCount cycles);
+  void ScreenInterrupt(u32 lane);
+
+  // Dispatches a pending interrupt or burns the cycles of a halted machine, returns false if the machine has completed
+  // its frame.
+  bool BeginInstruction(u32 lane);
+
+  // Groups the active machines by PC and executes one instruction on each group.
+  void ExecuteStep();
+  void ExecuteGroup(const LaneGroup& group, u16 pc);
+
+  // Executes ALU operation op (bits 3-5 of the opcode) with the operand for each machine returned by source.
+  template<typename Source>
+  void ExecuteALU(const LaneGroup& group, u32 op, const Source& source);
+
+  // Executes a register-only instruction (mov, mvi, ALU and inr/dcr without M) on every machine, returns false for
+  // other instructions.
+  bool ExecuteWide(u8 opcode, u8 imm8);
+
+  u32 m_machine_count;
+
+  u8 m_rom[System::ROM_SIZE] = {};
+  std::vector<u8> m_ram; // RAM_SIZE bytes per machine
+
+  // Registers, indexed by machine. m_reg8 holds the 8-bit registers by their index in the instruction encoding, with
+  // null for M.
+  std::vector<u8> m_a, m_f, m_b, m_c, m_d, m_e, m_h, m_l;
+  std::vector<u16> m_sp, m_pc;
+  std::array<u8*, 8> m_reg8 = {};
+
+  // Interrupt and device state, indexed by machine.
+  std::vector<u8> m_interrupt_enabled;
+  std::vector<u8> m_interrupt_request;
+  std::vector<u8> m_interrupt_request_vector;
+  std::vector<u8> m_halted;
+  std::vector<u8> m_last_interrupt_was_vblank;
+  std::vector<u8> m_frame_complete;
+  std::vector<CycleCount> m_cycles_until_interrupt;
+  std::vector<u16> m_shift_register_value;
+  std::vector<u8> m_shift_register_read_offset;
+  std::vector<u64> m_executed_instructions;
+  u64 m_shared_executed_instructions = 0; // instructions executed by all machines at once
+  u64 m_decode_count = 0;
+
+  // One entry per machine, for the frame being executed.
+  const Inputs* m_inputs = nullptr;
+
+  // Machines which have not yet completed the current frame, and scratch space for grouping them by PC. Each PC with
+  // machines waiting is listed once in m_group_pcs, and its machines are linked through m_next_lane from m_pc_first_lane.
+  std::vector<u32> m_active_lanes;
+  bool m_begin_pending = false; // BeginInstruction() may have an effect on one of the active machines
+  bool m_same_pc = false;       // every machine is known to be at the same PC
+  std::vector<u32> m_group_lanes;
+  std::vector<u32> m_group_pcs;
+  std::vector<u32> m_next_lane;
+  std::vector<u32> m_pc_first_lane;
+};
+
+} // namespace Invaders
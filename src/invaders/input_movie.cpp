@@ -0,0 +1,295 @@
+#include "input_movie.h"
+#include "YBaseLib/Log.h"
+#include "system.h"
+#include <cstdio>
+#include <cstring>
+Log_SetChannel(InputMovie);
+
+namespace Invaders {
+
+static void GetPortValues(const Inputs& inputs, u8* values)
+{
+  values[0] = inputs.INP0_bits;
+  values[1] = inputs.INP1_bits;
+  values[2] = inputs.INP2_bits;
+}
+
+static void SetPortValues(Inputs& inputs, const u8* values)
+{
+  inputs.INP0_bits = values[0];
+  inputs.INP1_bits = values[1];
+  inputs.INP2_bits = values[2];
+}
+
+InputMovie::InputMovie() = default;
+
+InputMovie::~InputMovie() = default;
+
+bool InputMovie::Load(const char* filename)
+{
+  m_events.clear();
+  m_event_count = 0;
+  m_frame_count = 0;
+
+  std::FILE* fp = std::fopen(filename, "rb");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s'", filename);
+    return false;
+  }
+
+  FileHeader header;
+  if (std::fread(&header, sizeof(header), 1, fp) != 1 || header.signature != FILE_SIGNATURE ||
+      header.version != FILE_VERSION)
+  {
+    Log_ErrorPrintf("'%s' is not an input movie, or was written by a different version", filename);
+    std::fclose(fp);
+    return false;
+  }
+
+  m_events.resize(header.event_data_size);
+  if (header.event_data_size > 0 && std::fread(m_events.data(), header.event_data_size, 1, fp) != 1)
+  {
+    Log_ErrorPrintf("Failed to read %u events from '%s'", header.event_count, filename);
+    m_events.clear();
+    std::fclose(fp);
+    return false;
+  }
+
+  std::fclose(fp);
+
+  // Check every event up front, so that playback can't run off the end.
+  size_t position = 0;
+  u32 frame = 0;
+  for (u32 i = 0; i < header.event_count; i++)
+  {
+    u32 frame_delta;
+    u8 flags;
+    u8 values[PORT_COUNT];
+    if (!ReadEvent(&position, &frame_delta, &flags, values) || (i > 0 && frame_delta == 0) ||
+        frame_delta >= header.frame_count - frame)
+    {
+      Log_ErrorPrintf("Event %u in '%s' is invalid", i, filename);
+      m_events.clear();
+      return false;
+    }
+
+    frame += frame_delta;
+  }
+  if (position != m_events.size())
+  {
+    Log_ErrorPrintf("'%s' has %zu bytes of trailing event data", filename, m_events.size() - position);
+    m_events.clear();
+    return false;
+  }
+
+  m_event_count = header.event_count;
+  m_frame_count = header.frame_count;
+  m_rom_checksum = header.rom_checksum;
+  m_final_state_checksum = header.final_state_checksum;
+  return true;
+}
+
+bool InputMovie::Save(const char* filename) const
+{
+  std::FILE* fp = std::fopen(filename, "wb");
+  if (!fp)
+  {
+    Log_ErrorPrintf("Failed to open '%s' for writing", filename);
+    return false;
+  }
+
+  FileHeader header = {};
+  header.signature = FILE_SIGNATURE;
+  header.version = FILE_VERSION;
+  header.rom_checksum = m_rom_checksum;
+  header.final_state_checksum = m_final_state_checksum;
+  header.frame_count = m_frame_count;
+  header.event_count = m_event_count;
+  header.event_data_size = static_cast<u32>(m_events.size());
+
+  bool result = (std::fwrite(&header, sizeof(header), 1, fp) == 1);
+  result = result && (m_events.empty() || std::fwrite(m_events.data(), m_events.size(), 1, fp) == 1);
+  result = (std::fclose(fp) == 0) && result;
+  if (!result)
+    Log_ErrorPrintf("Failed to write %u events to '%s'", m_event_count, filename);
+
+  return result;
+}
+
+void InputMovie::BeginRecording(const System& system)
+{
+  m_events.clear();
+  m_event_count = 0;
+  m_frame_count = 0;
+  m_rom_checksum = system.GetROMChecksum();
+  m_final_state_checksum = 0;
+
+  m_last_event_frame = 0;
+  m_reset_pending = false;
+}
+
+void InputMovie::RecordFrame(const System& system)
+{
+  u8 values[PORT_COUNT];
+  GetPortValues(system.GetInputs(), values);
+
+  // The first frame stores every port, so that playback doesn't depend on the system's initial inputs.
+  u8 flags = m_reset_pending ? EVENT_FLAG_RESET : 0;
+  for (u32 i = 0; i < PORT_COUNT; i++)
+  {
+    if (m_frame_count == 0 || values[i] != m_port_values[i])
+      flags |= (1u << i);
+  }
+
+  if (flags != 0)
+  {
+    WriteVarint(m_frame_count - m_last_event_frame);
+    m_events.push_back(flags);
+    for (u32 i = 0; i < PORT_COUNT; i++)
+    {
+      if (flags & (1u << i))
+      {
+        m_events.push_back(values[i]);
+        m_port_values[i] = values[i];
+      }
+    }
+
+    m_event_count++;
+    m_last_event_frame = m_frame_count;
+    m_reset_pending = false;
+  }
+
+  m_frame_count++;
+}
+
+void InputMovie::EndRecording(const System& system)
+{
+  m_final_state_checksum = system.GetStateChecksum();
+}
+
+bool InputMovie::BeginPlayback(System* system)
+{
+  std::memset(m_port_values, 0, sizeof(m_port_values));
+  m_current_frame = 0;
+  m_event_position = 0;
+  m_has_next_event = false;
+  if (m_event_count > 0)
+  {
+    // Events were checked when loading.
+    u32 frame_delta = 0;
+    size_t position = 0;
+    ReadVarint(&position, &frame_delta);
+    m_next_event_frame = frame_delta;
+    m_has_next_event = true;
+  }
+
+  if (system->GetROMChecksum() != m_rom_checksum)
+  {
+    Log_WarningPrintf("The movie was recorded with different ROMs (checksum %08X, expected %08X)",
+                      system->GetROMChecksum(), m_rom_checksum);
+    return false;
+  }
+
+  return true;
+}
+
+bool InputMovie::PlayFrame(System* system)
+{
+  if (m_current_frame == m_frame_count)
+    return false;
+
+  if (m_has_next_event && m_next_event_frame == m_current_frame)
+  {
+    u32 frame_delta;
+    u8 flags;
+    u8 values[PORT_COUNT];
+    ReadEvent(&m_event_position, &frame_delta, &flags, values);
+    for (u32 i = 0; i < PORT_COUNT; i++)
+    {
+      if (flags & (1u << i))
+        m_port_values[i] = values[i];
+    }
+
+    if (flags & EVENT_FLAG_RESET)
+      system->Reset();
+
+    // Peek at the delay before the following event.
+    size_t position = m_event_position;
+    m_has_next_event = (position < m_events.size() && ReadVarint(&position, &frame_delta));
+    m_next_event_frame = m_current_frame + frame_delta;
+  }
+
+  SetPortValues(system->GetInputs(), m_port_values);
+  m_current_frame++;
+  return true;
+}
+
+bool InputMovie::VerifyFinalState(const System& system) const
+{
+  const u32 checksum = system.GetStateChecksum();
+  if (checksum != m_final_state_checksum)
+  {
+    Log_ErrorPrintf("Final state differs from the recording (checksum %08X, expected %08X)", checksum,
+                    m_final_state_checksum);
+    return false;
+  }
+
+  return true;
+}
+
+void InputMovie::WriteVarint(u32 value)
+{
+  // Seven bits per byte, least significant first, with the top bit set on all but the last byte.
+  while (value >= 0x80)
+  {
+    m_events.push_back(static_cast<u8>(value) | u8(0x80));
+    value >>= 7;
+  }
+  m_events.push_back(static_cast<u8>(value));
+}
+
+bool InputMovie::ReadVarint(size_t* position, u32* value) const
+{
+  u32 result = 0;
+  for (u32 shift = 0; shift < 32; shift += 7)
+  {
+    if (*position == m_events.size())
+      return false;
+
+    const u8 byte = m_events[(*position)++];
+    result |= static_cast<u32>(byte & u8(0x7F)) << shift;
+    if (!(byte & u8(0x80)))
+    {
+      *value = result;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool InputMovie::ReadEvent(size_t* position, u32* frame_delta, u8* flags, u8* values) const
+{
+  if (!ReadVarint(position, frame_delta) || *position == m_events.size())
+    return false;
+
+  *flags = m_events[(*position)++];
+  if (*flags == 0 || *flags > (EVENT_FLAG_RESET | ((1u << PORT_COUNT) - 1)))
+    return false;
+
+  for (u32 i = 0; i < PORT_COUNT; i++)
+  {
+    if (!(*flags & (1u << i)))
+      continue;
+
+    if (*position == m_events.size())
+      return false;
+
+    values[i] = m_events[(*position)++];
+  }
+
+  return true;
+}
+
+} // namespace Invaders
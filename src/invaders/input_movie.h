@@ -0,0 +1,92 @@
+#pragma once
+#include "common/types.h"
+#include <vector>
+
+namespace Invaders {
+
+class System;
+
+// Inputs for a session, recorded at frame granularity, so that it can be played back exactly.
+//
+// The game only reads its inputs through port reads, and frames are otherwise deterministic, so applying the same
+// INP0-INP2 values before each frame of a freshly initialized system reproduces the session. Only changes are
+// stored: each event is the number of frames since the previous event as a varint, a byte flagging the ports which
+// changed and whether the system was reset, then the new value of each changed port. The file also holds a checksum of
+// the ROMs and of the final state, which playback checks against.
+class InputMovie
+{
+public:
+  static constexpr u32 FILE_SIGNATURE = 0x564F4D49; // 'IMOV'
+  static constexpr u32 FILE_VERSION = 1;
+  static constexpr u32 PORT_COUNT = 3;
+
+  InputMovie();
+  ~InputMovie();
+
+  u32 GetFrameCount() const { return m_frame_count; }
+  u32 GetEventCount() const { return m_event_count; }
+
+  bool Load(const char* filename);
+  bool Save(const char* filename) const;
+
+  // Starts recording a system which has just been initialized.
+  void BeginRecording(const System& system);
+
+  // Resets the system on the next recorded frame.
+  void RecordReset() { m_reset_pending = true; }
+
+  // Records the inputs of the system before each frame is executed.
+  void RecordFrame(const System& system);
+
+  void EndRecording(const System& system);
+
+  // Starts playing back into a system which has just been initialized. Returns false if the ROMs differ from the
+  // recording, in which case playback won't reproduce it.
+  bool BeginPlayback(System* system);
+
+  // Applies the inputs for the next frame, before it is executed. Returns false once every frame has been played.
+  bool PlayFrame(System* system);
+
+  // Checks that playback ended in the same state as the recording.
+  bool VerifyFinalState(const System& system) const;
+
+private:
+  struct FileHeader
+  {
+    u32 signature;
+    u32 version;
+    u32 rom_checksum;
+    u32 final_state_checksum;
+    u32 frame_count;
+    u32 event_count;
+    u32 event_data_size;
+  };
+
+  enum EventFlags : u8
+  {
+    EVENT_FLAG_RESET = (1 << PORT_COUNT)
+  };
+
+  void WriteVarint(u32 value);
+  bool ReadVarint(size_t* position, u32* value) const;
+
+  // Decodes the event at position, returning false if it is truncated or invalid.
+  bool ReadEvent(size_t* position, u32* frame_delta, u8* flags, u8* values) const;
+
+  std::vector<u8> m_events;
+  u32 m_event_count = 0;
+  u32 m_frame_count = 0;
+  u32 m_rom_checksum = 0;
+  u32 m_final_state_checksum = 0;
+
+  // Recording and playback state.
+  u8 m_port_values[PORT_COUNT] = {};
+  u32 m_last_event_frame = 0;
+  u32 m_current_frame = 0;
+  size_t m_event_position = 0;
+  u32 m_next_event_frame = 0;
+  bool m_has_next_event = false;
+  bool m_reset_pending = false;
+};
+
+} // namespace Invaders
@@ -1,8 +1,12 @@
 #include "YBaseLib/Log.h"
-#include "common/sdl_simple_display.h"
+#include "YBaseLib/Timer.h"
+#include "batch_system.h"
+#include "common/simple_display.h"
 #include "i8080/cpu.h"
+#include "input_movie.h"
+#include "rewind_buffer.h"
+#include "run_ahead.h"
 #include "system.h"
-#include <SDL.h>
 #include <algorithm>
 #include <cctype>
 #include <cstdio>
@@ -10,8 +14,21 @@
 #include <memory>
 #include <optional>
 #include <vector>
+
+// Define INVADERS_DISABLE_SDL to build without the window and input handling, for hosts without SDL or a display. The
+// headless mode and the benchmarks are still available.
+#if !defined(INVADERS_DISABLE_SDL)
+#include "common/sdl_simple_display.h"
+#include <SDL.h>
+#endif
+
 Log_SetChannel(Invaders);
 
+// Rewind history for the interactive mode, about two minutes at 60 FPS.
+static constexpr u32 REWIND_FRAMES = 60 * 120;
+static constexpr u32 REWIND_DATA_SIZE = 16 * 1024 * 1024;
+
+#if !defined(INVADERS_DISABLE_SDL)
 static void HandleKeyEvent(const SDL_Event* ev, Invaders::Inputs& inputs)
 {
   const bool down = (ev->type == SDL_KEYDOWN);
@@ -52,11 +69,425 @@ static void HandleKeyEvent(const SDL_Event* ev, Invaders::Inputs& inputs)
       break;
   }
 }
+#endif
+
+// Runs the attract mode for a fixed number of frames in each execution mode, and checks that they end in the same state.
+static int RunBenchmark(u32 frames)
+{
+  static constexpr i8080::ExecutionMode modes[] = {
+    i8080::ExecutionMode::Interpreter, i8080::ExecutionMode::CachedInterpreter, i8080::ExecutionMode::Recompiler,
+#if defined(INVADERS_ENABLE_STATIC_CODE)
+    i8080::ExecutionMode::Static,
+#endif
+  };
+
+  std::vector<u8> reference_framebuffer;
+  i8080::Registers reference_regs = {};
+  u64 reference_instructions = 0;
+  double reference_seconds = 0.0;
+  int result = 0;
+
+  for (const i8080::ExecutionMode mode : modes)
+  {
+    auto system = std::make_unique<Invaders::System>();
+    auto display = NullDisplay::Create();
+    if (!system->LoadROMs("invaders") || !system->Initialize(display.get()))
+    {
+      Log_ErrorPrintf("Failed to initialize system");
+      return EXIT_FAILURE;
+    }
+
+    system->SetExecutionMode(mode);
+
+    Timer timer;
+    for (u32 i = 0; i < frames; i++)
+      system->ExecuteFrame();
+    const double seconds = timer.GetTimeSeconds();
+
+    const u64 instructions = system->GetCPU().GetExecutedInstructionCount();
+    const i8080::Registers& regs = system->GetCPU().GetRegs();
+    const byte* framebuffer = display->GetFramebufferPointer();
+    const size_t framebuffer_size = display->GetFramebufferPitch() * display->GetFramebufferHeight();
+    if (mode == modes[0])
+    {
+      reference_framebuffer.assign(framebuffer, framebuffer + framebuffer_size);
+      std::memcpy(static_cast<void*>(&reference_regs), &regs, sizeof(reference_regs));
+      reference_instructions = instructions;
+      reference_seconds = seconds;
+    }
+    else if (instructions != reference_instructions || std::memcmp(&regs, &reference_regs, sizeof(regs)) != 0 ||
+             std::memcmp(framebuffer, reference_framebuffer.data(), framebuffer_size) != 0)
+    {
+      Log_ErrorPrintf("%s: state differs from %s", i8080::GetExecutionModeName(mode),
+                      i8080::GetExecutionModeName(modes[0]));
+      result = EXIT_FAILURE;
+    }
+
+    Log_InfoPrintf("%s: %u frames, %llu instructions in %.3f seconds, %.1f FPS, %.2fx", i8080::GetExecutionModeName(mode),
+                   frames, static_cast<unsigned long long>(instructions), seconds, frames / seconds,
+                   reference_seconds / seconds);
+  }
+
+  return result;
+}
+
+static u32 HashBatchBenchmarkInput(u32 machine, u32 value)
+{
+  u32 hash = (machine * UINT32_C(0x9E3779B9)) ^ (value * UINT32_C(0x85EBCA6B));
+  hash = (hash ^ (hash >> 15)) * UINT32_C(0x2C1B3C6D);
+  return hash ^ (hash >> 12);
+}
+
+// Inputs for a machine in the batch benchmark. A quarter of the machines stay in the attract mode, and the rest insert
+// a coin and start a game at different times, then move and fire at random, so the machines spread out over the ROM.
+static void GetBatchBenchmarkInputs(u32 machine, u32 frame, Invaders::Inputs* inputs)
+{
+  inputs->INP0_bits = 0;
+  inputs->INP1_bits = 0;
+  inputs->INP2_bits = 0;
+
+  const u32 hash = HashBatchBenchmarkInput(machine, 0);
+  if ((hash % 4) == 0)
+    return;
+
+  const u32 coin_frame = 60 + ((hash >> 2) % 64);
+  const u32 start_frame = coin_frame + 60 + ((hash >> 8) % 64);
+  inputs->credit = (frame >= coin_frame && frame < (coin_frame + 5));
+  inputs->start_1p = (frame >= start_frame && frame < (start_frame + 5));
+  if (frame < start_frame)
+    return;
+
+  // Each choice is held for 8 frames, as a player would.
+  const u32 choice = HashBatchBenchmarkInput(machine, 1 + (frame / 8));
+  inputs->left_1p = ((choice & 3) == 1);
+  inputs->right_1p = ((choice & 3) == 2);
+  inputs->fire_1p = ((choice & 4) != 0);
+}
+
+// Runs a batch of machines with different inputs, and checks a sample of them against a system each every frame. The
+// sample runs in the interpreter and in the default execution mode of System, and both are timed, so that the batch is
+// compared with running every machine as its own System. With same_inputs, every machine gets the inputs of machine 0,
+// so that the machines never diverge.
+static int RunBatchBenchmark(u32 machines, u32 frames, bool same_inputs)
+{
+  static constexpr u32 MAX_REFERENCE_MACHINES = 16;
+
+  auto batch = std::make_unique<Invaders::BatchSystem>(machines);
+  if (machines == 0 || !batch->LoadROMs("invaders"))
+  {
+    Log_ErrorPrintf("Failed to initialize system");
+    return EXIT_FAILURE;
+  }
+
+  // Spread over the batch, so that every input pattern is checked. The interpreter is reference 0, and the default
+  // execution mode reference 1.
+  std::vector<u32> reference_machines;
+  std::vector<u32> reference_indices;
+  std::vector<std::unique_ptr<Invaders::System>> references;
+  std::vector<std::unique_ptr<SimpleDisplay>> displays;
+  const u32 reference_count = std::min(machines, MAX_REFERENCE_MACHINES);
+  for (u32 reference = 0; reference < 2; reference++)
+  {
+    for (u32 i = 0; i < reference_count; i++)
+    {
+      auto system = std::make_unique<Invaders::System>();
+      displays.push_back(NullDisplay::Create());
+      if (!system->LoadROMs("invaders") || !system->Initialize(displays.back().get()))
+      {
+        Log_ErrorPrintf("Failed to initialize system");
+        return EXIT_FAILURE;
+      }
+
+      if (reference == 0)
+        system->SetExecutionMode(i8080::ExecutionMode::Interpreter);
+      system->SetRenderingEnabled(false);
+      reference_machines.push_back(static_cast<u32>(static_cast<u64>(i) * machines / reference_count));
+      reference_indices.push_back(reference);
+      references.push_back(std::move(system));
+    }
+  }
+
+  const i8080::ExecutionMode reference_modes[2] = {i8080::ExecutionMode::Interpreter,
+                                                   references.back()->GetCPU().GetExecutionMode()};
+  double reference_seconds[2] = {};
+  u64 reference_frames[2] = {};
+
+  int result = 0;
+  std::vector<Invaders::Inputs> inputs(machines);
+  double seconds = 0.0;
+  for (u32 frame = 0; frame < frames; frame++)
+  {
+    for (u32 i = 0; i < machines; i++)
+      GetBatchBenchmarkInputs(same_inputs ? 0 : i, frame, &inputs[i]);
+
+    Timer timer;
+    batch->ExecuteFrame(inputs.data());
+    seconds += timer.GetTimeSeconds();
+
+    // Machines which have diverged are dropped from the comparison, so each is only reported once.
+    for (size_t i = 0; i < references.size();)
+    {
+      const u32 machine = reference_machines[i];
+      const u32 reference = reference_indices[i];
+      Invaders::System* system = references[i].get();
+      GetBatchBenchmarkInputs(same_inputs ? 0 : machine, frame, &system->GetInputs());
+
+      Timer reference_timer;
+      system->ExecuteFrame();
+      reference_seconds[reference] += reference_timer.GetTimeSeconds();
+      reference_frames[reference]++;
+
+      const i8080::Registers regs = batch->GetRegisters(machine);
+      const char* difference = nullptr;
+      if (batch->GetExecutedInstructionCount(machine) != system->GetCPU().GetExecutedInstructionCount())
+        difference = "instruction count";
+      else if (std::memcmp(&regs, &system->GetCPU().GetRegs(), sizeof(regs)) != 0)
+        difference = "registers";
+      else if (std::memcmp(batch->GetRAM(machine), system->GetRAM(), 0x400) != 0)
+        difference = "RAM";
+      else if (std::memcmp(batch->GetVRAM(machine), system->GetRAM() + 0x400, Invaders::BatchSystem::FRAME_SIZE) != 0)
+        difference = "VRAM";
+
+      if (difference)
+      {
+        Log_ErrorPrintf("Machine %u differs from the %s in its %s after frame %u", machine,
+                        i8080::GetExecutionModeName(reference_modes[reference]), difference, frame);
+        result = EXIT_FAILURE;
+        reference_machines.erase(reference_machines.begin() + i);
+        reference_indices.erase(reference_indices.begin() + i);
+        references.erase(references.begin() + i);
+        continue;
+      }
+
+      i++;
+    }
+  }
+
+  u64 instructions = 0;
+  for (u32 i = 0; i < machines; i++)
+    instructions += batch->GetExecutedInstructionCount(i);
+
+  Log_InfoPrintf("%u machines: %u frames, %llu instructions in %.3f seconds, %.1f FPS per machine, %.2f machines per "
+                 "decode",
+                 machines, frames, static_cast<unsigned long long>(instructions), seconds, frames / seconds,
+                 static_cast<double>(instructions) / static_cast<double>(batch->GetDecodeCount()));
+
+  // Separate systems are timed on the sample, and scaled to running every machine in turn on one thread.
+  for (u32 reference = 0; reference < 2; reference++)
+  {
+    if (reference_frames[reference] == 0)
+      continue;
+
+    const double fps = static_cast<double>(reference_frames[reference]) / reference_seconds[reference] / machines;
+    Log_InfoPrintf("%u separate systems (%s): %.1f FPS per machine, the batch runs %.2fx as fast", machines,
+                   i8080::GetExecutionModeName(reference_modes[reference]), fps, (frames / seconds) / fps);
+  }
+
+  return result;
+}
+
+// Runs the game without a window for a fixed number of frames, as fast as possible, and reports the throughput and
+// the distribution of frame times.
+static int RunHeadless(u32 frames, bool render)
+{
+  auto system = std::make_unique<Invaders::System>();
+  auto display = NullDisplay::Create();
+  if (frames == 0 || !system->LoadROMs("invaders") || !system->Initialize(display.get()))
+  {
+    Log_ErrorPrintf("Failed to initialize system");
+    return EXIT_FAILURE;
+  }
+
+  system->SetRenderingEnabled(render);
+
+  std::vector<double> frame_times(frames);
+  Timer timer;
+  double last_time = 0.0;
+  for (u32 i = 0; i < frames; i++)
+  {
+    system->ExecuteFrame();
+
+    const double time = timer.GetTimeSeconds();
+    frame_times[i] = (time - last_time) * 1000000.0;
+    last_time = time;
+  }
+
+  const double seconds = last_time;
+  const u64 cycles = system->GetCPU().GetExecutedCycleCount();
+  std::sort(frame_times.begin(), frame_times.end());
+  const auto percentile = [&frame_times](u32 percent) {
+    return frame_times[std::min(frame_times.size() * percent / 100, frame_times.size() - 1)];
+  };
+
+  Log_InfoPrintf("%s%s: %u frames in %.3f seconds, %.1f FPS, %.2f emulated MHz",
+                 i8080::GetExecutionModeName(system->GetCPU().GetExecutionMode()), render ? "" : " without rendering",
+                 frames, seconds, frames / seconds, static_cast<double>(cycles) / seconds / 1000000.0);
+  Log_InfoPrintf("Frame time: min %.1f us, 50%% %.1f us, 90%% %.1f us, 99%% %.1f us, max %.1f us", frame_times.front(),
+                 percentile(50), percentile(90), percentile(99), frame_times.back());
+  return EXIT_SUCCESS;
+}
+
+// Plays back an input movie without a window, as fast as possible, and checks that it ends in the recorded state.
+static int RunPlayback(const char* filename, bool render)
+{
+  Invaders::InputMovie movie;
+  if (!movie.Load(filename))
+    return EXIT_FAILURE;
+
+  auto system = std::make_unique<Invaders::System>();
+  auto display = NullDisplay::Create();
+  if (!system->LoadROMs("invaders") || !system->Initialize(display.get()))
+  {
+    Log_ErrorPrintf("Failed to initialize system");
+    return EXIT_FAILURE;
+  }
+
+  system->SetRenderingEnabled(render);
+  if (!movie.BeginPlayback(system.get()))
+    return EXIT_FAILURE;
+
+  Timer timer;
+  while (movie.PlayFrame(system.get()))
+    system->ExecuteFrame();
+  const double seconds = timer.GetTimeSeconds();
+
+  Log_InfoPrintf("Played %u frames with %u input events in %.3f seconds, %.1f FPS", movie.GetFrameCount(),
+                 movie.GetEventCount(), seconds, movie.GetFrameCount() / seconds);
+  return movie.VerifyFinalState(*system) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs the attract mode with each run-ahead depth, reporting the host time per displayed frame, and checks that the real
+// frames end in the same state as without run-ahead.
+static int RunRunAheadBenchmark(u32 frames, u32 max_depth)
+{
+  u32 reference_checksum = 0;
+  double reference_frame_time = 0.0;
+  int result = EXIT_SUCCESS;
+
+  for (u32 depth = 0; depth <= max_depth; depth++)
+  {
+    auto system = std::make_unique<Invaders::System>();
+    auto display = NullDisplay::Create();
+    if (frames == 0 || !system->LoadROMs("invaders") || !system->Initialize(display.get()))
+    {
+      Log_ErrorPrintf("Failed to initialize system");
+      return EXIT_FAILURE;
+    }
+
+    Invaders::RunAhead run_ahead(depth);
+    std::vector<double> frame_times(frames);
+    Timer timer;
+    double last_time = 0.0;
+    for (u32 i = 0; i < frames; i++)
+    {
+      if (!run_ahead.ExecuteFrame(system.get()))
+        return EXIT_FAILURE;
+
+      const double time = timer.GetTimeSeconds();
+      frame_times[i] = (time - last_time) * 1000000.0;
+      last_time = time;
+    }
+
+    const double frame_time = last_time * 1000000.0 / frames;
+    const u32 checksum = system->GetStateChecksum();
+    if (depth == 0)
+    {
+      reference_checksum = checksum;
+      reference_frame_time = frame_time;
+    }
+    else if (checksum != reference_checksum)
+    {
+      Log_ErrorPrintf("Run-ahead of %u frames: state differs from no run-ahead", depth);
+      result = EXIT_FAILURE;
+    }
+
+    std::sort(frame_times.begin(), frame_times.end());
+    Log_InfoPrintf("Run-ahead of %u frames: %.1f us per frame, 99%% %.1f us, %.2fx the cost of no run-ahead", depth,
+                   frame_time, frame_times[std::min(frames * 99 / 100, frames - 1)], frame_time / reference_frame_time);
+  }
+
+  return result;
+}
 
 int main(int argc, char* argv[])
 {
   Log::GetInstance().SetConsoleOutputParams(true);
 
+  // invaders --benchmark [frames]
+  if (argc >= 2 && std::strcmp(argv[1], "--benchmark") == 0)
+    return RunBenchmark((argc >= 3) ? static_cast<u32>(std::strtoul(argv[2], nullptr, 10)) : 3600);
+
+  // invaders --batch-benchmark [machines] [frames] [--same-inputs]
+  if (argc >= 2 && std::strcmp(argv[1], "--batch-benchmark") == 0)
+  {
+    u32 values[2] = {256, 3600};
+    u32 value_count = 0;
+    bool same_inputs = false;
+    for (int i = 2; i < argc; i++)
+    {
+      if (std::strcmp(argv[i], "--same-inputs") == 0)
+        same_inputs = true;
+      else if (value_count < 2)
+        values[value_count++] = static_cast<u32>(std::strtoul(argv[i], nullptr, 10));
+    }
+
+    return RunBatchBenchmark(values[0], values[1], same_inputs);
+  }
+
+  // invaders --headless [frames] [--no-render]
+  if (argc >= 2 && std::strcmp(argv[1], "--headless") == 0)
+  {
+    u32 frames = 3600;
+    bool render = true;
+    for (int i = 2; i < argc; i++)
+    {
+      if (std::strcmp(argv[i], "--no-render") == 0)
+        render = false;
+      else
+        frames = static_cast<u32>(std::strtoul(argv[i], nullptr, 10));
+    }
+
+    return RunHeadless(frames, render);
+  }
+
+  // invaders --run-ahead-benchmark [frames] [max depth]
+  if (argc >= 2 && std::strcmp(argv[1], "--run-ahead-benchmark") == 0)
+  {
+    return RunRunAheadBenchmark((argc >= 3) ? static_cast<u32>(std::strtoul(argv[2], nullptr, 10)) : 3600,
+                                (argc >= 4) ? static_cast<u32>(std::strtoul(argv[3], nullptr, 10)) : 4);
+  }
+
+  // invaders --play <movie> [--no-render]
+  if (argc >= 3 && std::strcmp(argv[1], "--play") == 0)
+    return RunPlayback(argv[2], !(argc >= 4 && std::strcmp(argv[3], "--no-render") == 0));
+
+#if defined(INVADERS_DISABLE_SDL)
+  Log_ErrorPrintf("Built without SDL, only --headless, --play and the benchmarks are available");
+  return EXIT_FAILURE;
+#else
+  // invaders [--record <movie>] [--run-ahead <frames>]
+  std::unique_ptr<Invaders::InputMovie> movie;
+  const char* movie_filename = nullptr;
+  u32 run_ahead_frames = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--record") == 0 && (i + 1) < argc)
+    {
+      movie = std::make_unique<Invaders::InputMovie>();
+      movie_filename = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--run-ahead") == 0 && (i + 1) < argc)
+    {
+      run_ahead_frames = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else
+    {
+      Log_ErrorPrintf("Unknown option '%s'", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Requires I8080_ENABLE_TRACE.
   // i8080::TRACE_EXECUTION = true;
 
   auto system = std::make_unique<Invaders::System>();
@@ -79,7 +510,21 @@ int main(int argc, char* argv[])
     return EXIT_FAILURE;
   }
 
+  // Holding backspace steps back through the history. Rewinding would desynchronize a movie, so it is disabled while
+  // recording.
+  std::unique_ptr<Invaders::RewindBuffer> rewind;
+  if (movie)
+    movie->BeginRecording(*system);
+  else
+    rewind = std::make_unique<Invaders::RewindBuffer>(REWIND_FRAMES, REWIND_DATA_SIZE);
+
+  // Run-ahead only changes which frame is displayed, so it works with recording and rewind.
+  Invaders::RunAhead run_ahead(run_ahead_frames);
+  double run_ahead_seconds = 0.0;
+  u32 run_ahead_frames_executed = 0;
+
   bool running = true;
+  bool rewinding = false;
   while (running)
   {
     // SDL event loop...
@@ -99,7 +544,15 @@ int main(int argc, char* argv[])
         {
           HandleKeyEvent(&ev, system->GetInputs());
           if (ev.type == SDL_KEYUP && ev.key.keysym.sym == SDLK_PAUSE)
+          {
             system->Reset();
+            if (movie)
+              movie->RecordReset();
+          }
+          else if (ev.key.keysym.sym == SDLK_BACKSPACE)
+          {
+            rewinding = (ev.type == SDL_KEYDOWN);
+          }
         }
         break;
 
@@ -109,8 +562,44 @@ int main(int argc, char* argv[])
       }
     }
 
-    system->ExecuteFrame();
+    // Each rewound frame replaces an executed one, and is displayed when the state is loaded. Once the history runs out,
+    // the oldest frame is presented again, so that the loop is still paced by the display.
+    if (rewinding && rewind)
+    {
+      if (!rewind->StepBack(system.get()))
+        display->DisplayFramebuffer();
+
+      continue;
+    }
+
+    if (movie)
+      movie->RecordFrame(*system);
+
+    Timer frame_timer;
+    run_ahead.ExecuteFrame(system.get());
+    run_ahead_seconds += frame_timer.GetTimeSeconds();
+    run_ahead_frames_executed++;
+
+    if (rewind)
+      rewind->Capture(system.get());
+  }
+
+  if (run_ahead_frames_executed > 0)
+  {
+    Log_InfoPrintf("Run-ahead of %u frames: %.1f us of emulation per frame", run_ahead.GetFrames(),
+                   run_ahead_seconds * 1000000.0 / run_ahead_frames_executed);
+  }
+
+  if (movie)
+  {
+    movie->EndRecording(*system);
+    if (!movie->Save(movie_filename))
+      return EXIT_FAILURE;
+
+    Log_InfoPrintf("Recorded %u frames with %u input events to '%s'", movie->GetFrameCount(), movie->GetEventCount(),
+                   movie_filename);
   }
 
   return 0;
+#endif
 }
\ No newline at end of file
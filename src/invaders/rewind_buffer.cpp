@@ -0,0 +1,215 @@
+#include "rewind_buffer.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Log.h"
+#include <algorithm>
+#include <cstring>
+Log_SetChannel(RewindBuffer);
+
+namespace Invaders {
+
+static u8* WriteVarint(u8* out, u32 value)
+{
+  while (value >= 0x80)
+  {
+    *(out++) = static_cast<u8>(value) | u8(0x80);
+    value >>= 7;
+  }
+  *(out++) = static_cast<u8>(value);
+  return out;
+}
+
+static const u8* ReadVarint(const u8* in, u32* value)
+{
+  u32 result = 0;
+  for (u32 shift = 0;; shift += 7)
+  {
+    const u8 byte = *(in++);
+    result |= static_cast<u32>(byte & u8(0x7F)) << shift;
+    if (!(byte & u8(0x80)))
+      break;
+  }
+
+  *value = result;
+  return in;
+}
+
+RewindBuffer::RewindBuffer(u32 max_frames, u32 data_size)
+  : m_entries(max_frames), m_data(std::make_unique<u8[]>(data_size)), m_data_size(data_size),
+    m_state(std::make_unique<u8[]>(System::MAX_SAVE_STATE_SIZE)),
+    m_capture_state(std::make_unique<u8[]>(System::MAX_SAVE_STATE_SIZE)),
+    m_delta(std::make_unique<u8[]>(MAX_DELTA_SIZE))
+{
+  m_state_stream = ByteStream_CreateReadOnlyMemoryStream(m_state.get(), System::MAX_SAVE_STATE_SIZE);
+  m_capture_stream = ByteStream_CreateMemoryStream(m_capture_state.get(), System::MAX_SAVE_STATE_SIZE);
+}
+
+RewindBuffer::~RewindBuffer()
+{
+  m_capture_stream->Release();
+  m_state_stream->Release();
+}
+
+void RewindBuffer::Clear()
+{
+  m_entry_head = 0;
+  m_entry_count = 0;
+  m_data_used = 0;
+  m_write_offset = 0;
+  m_state_size = 0;
+}
+
+bool RewindBuffer::Capture(System* system)
+{
+  BinaryWriter writer(m_capture_stream);
+  if (!m_capture_stream->SeekAbsolute(0) || !system->SaveState(writer))
+  {
+    Log_ErrorPrintf("Failed to save state, the state is larger than %u bytes", System::MAX_SAVE_STATE_SIZE);
+    Clear();
+    return false;
+  }
+
+  // The previous state becomes the delta from this one. States only change size if the system is reconfigured, which
+  // breaks the chain of deltas.
+  const u32 size = static_cast<u32>(m_capture_stream->GetPosition());
+  if (size != m_state_size)
+  {
+    Clear();
+  }
+  else if (!m_entries.empty())
+  {
+    const u32 max_delta_size = std::min(m_data_size, MAX_DELTA_SIZE);
+    const u32 delta_size = EncodeDelta(m_capture_state.get(), m_state.get(), size, m_delta.get(), max_delta_size);
+    if (delta_size == 0)
+    {
+      Log_WarningPrintf("Frame delta doesn't fit in %u bytes, discarding history", max_delta_size);
+      Clear();
+    }
+    else
+    {
+      const u32 offset = AllocateData(delta_size);
+      std::memcpy(&m_data[offset], m_delta.get(), delta_size);
+      m_entries[(m_entry_head + m_entry_count) % m_entries.size()] = {offset, delta_size};
+      m_entry_count++;
+      m_data_used += delta_size;
+    }
+  }
+
+  std::memcpy(m_state.get(), m_capture_state.get(), size);
+  m_state_size = size;
+  return true;
+}
+
+bool RewindBuffer::StepBack(System* system)
+{
+  if (m_entry_count == 0)
+    return false;
+
+  const Entry& entry = m_entries[(m_entry_head + m_entry_count - 1) % m_entries.size()];
+  ApplyDelta(&m_data[entry.offset], entry.size, m_state.get());
+  m_write_offset = entry.offset;
+  m_data_used -= entry.size;
+  m_entry_count--;
+
+  BinaryReader reader(m_state_stream);
+  if (!m_state_stream->SeekAbsolute(0) || !system->LoadState(reader))
+  {
+    Clear();
+    return false;
+  }
+
+  return true;
+}
+
+void RewindBuffer::RemoveOldestEntry()
+{
+  m_data_used -= GetOldestEntry().size;
+  m_entry_head = (m_entry_head + 1) % static_cast<u32>(m_entries.size());
+  m_entry_count--;
+}
+
+u32 RewindBuffer::AllocateData(u32 size)
+{
+  if (m_entry_count == static_cast<u32>(m_entries.size()))
+    RemoveOldestEntry();
+
+  // The live deltas run from the oldest entry to the write offset, wrapping around the end of the ring. A delta which
+  // doesn't fit before the end starts again from the beginning, once the entries after the write offset are gone.
+  if ((m_write_offset + size) > m_data_size)
+  {
+    while (m_entry_count > 0 && GetOldestEntry().offset >= m_write_offset)
+      RemoveOldestEntry();
+
+    m_write_offset = 0;
+  }
+
+  while (m_entry_count > 0 && GetOldestEntry().offset >= m_write_offset &&
+         GetOldestEntry().offset < (m_write_offset + size))
+  {
+    RemoveOldestEntry();
+  }
+
+  const u32 offset = m_write_offset;
+  m_write_offset += size;
+  return offset;
+}
+
+u32 RewindBuffer::EncodeDelta(const u8* state, const u8* previous_state, u32 size, u8* out, u32 max_size)
+{
+  // Room for the two varints of a run and a byte which is only checked after being written.
+  static constexpr u32 RUN_HEADER_SIZE = 5 + 5 + 1;
+
+  u8* out_ptr = out;
+  u32 pos = 0;
+  while (pos < size)
+  {
+    const u32 zero_start = pos;
+    while (pos < size && state[pos] == previous_state[pos])
+      pos++;
+    if (pos == size)
+      break;
+
+    // Changed bytes run until the next MIN_ZERO_RUN unchanged bytes, since a shorter gap costs more to encode than it
+    // saves.
+    const u32 literal_start = pos;
+    u32 unchanged = 0;
+    for (; pos < size && unchanged < MIN_ZERO_RUN; pos++)
+      unchanged = (state[pos] == previous_state[pos]) ? (unchanged + 1) : 0;
+    pos -= unchanged;
+
+    const u32 literal_size = pos - literal_start;
+    if (static_cast<u32>(out_ptr - out) + RUN_HEADER_SIZE + literal_size > max_size)
+      return 0;
+
+    out_ptr = WriteVarint(out_ptr, literal_start - zero_start);
+    out_ptr = WriteVarint(out_ptr, literal_size);
+    for (u32 i = 0; i < literal_size; i++)
+      *(out_ptr++) = state[literal_start + i] ^ previous_state[literal_start + i];
+  }
+
+  // An identical state still needs an entry, marked by a lone zero.
+  if (out_ptr == out)
+    *(out_ptr++) = 0;
+
+  return static_cast<u32>(out_ptr - out);
+}
+
+void RewindBuffer::ApplyDelta(const u8* delta, u32 delta_size, u8* state)
+{
+  const u8* delta_end = delta + delta_size;
+  while (delta < delta_end)
+  {
+    u32 skip, literal_size;
+    delta = ReadVarint(delta, &skip);
+    if (delta == delta_end)
+      break;
+
+    delta = ReadVarint(delta, &literal_size);
+    state += skip;
+    for (u32 i = 0; i < literal_size; i++)
+      *(state++) ^= *(delta++);
+  }
+}
+
+} // namespace Invaders
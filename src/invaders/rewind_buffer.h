@@ -0,0 +1,83 @@
+#pragma once
+#include "common/types.h"
+#include "system.h"
+#include <memory>
+#include <vector>
+
+class ByteStream;
+
+namespace Invaders {
+
+// History of save states, for stepping a system backwards a frame at a time.
+//
+// Only the newest state is held in full. Each older state is stored as the XOR of its save state with the next newer
+// one, which is mostly zeros since little of RAM changes in a frame, run-length encoded. Stepping back decodes the
+// newest delta over the newest state in place, and the oldest history is dropped by discarding its delta, so there
+// are no keyframes. The deltas are held in a fixed-size ring, which together with the frame limit bounds the memory
+// used.
+class RewindBuffer
+{
+public:
+  // A delta only grows past the size of the state when nearly every other byte changes.
+  static constexpr u32 MAX_DELTA_SIZE = System::MAX_SAVE_STATE_SIZE * 2;
+
+  RewindBuffer(u32 max_frames, u32 data_size);
+  ~RewindBuffer();
+
+  // Number of frames which can be stepped back.
+  u32 GetFrameCount() const { return m_entry_count; }
+
+  // Bytes of deltas held.
+  u32 GetDataUsed() const { return m_data_used; }
+
+  void Clear();
+
+  // Captures the state of the system, after each frame is executed.
+  bool Capture(System* system);
+
+  // Restores the system to the state captured before the newest one, which is dropped. Returns false when there is no
+  // older state.
+  bool StepBack(System* system);
+
+private:
+  struct Entry
+  {
+    u32 offset;
+    u32 size;
+  };
+
+  static constexpr u32 MIN_ZERO_RUN = 4;
+
+  const Entry& GetOldestEntry() const { return m_entries[m_entry_head]; }
+  void RemoveOldestEntry();
+
+  // Encodes the XOR of two states as runs of unchanged bytes followed by runs of changed bytes, each a pair of varint
+  // lengths with the XORed bytes of the changed run. Returns the encoded size, or zero if it exceeds max_size.
+  static u32 EncodeDelta(const u8* state, const u8* previous_state, u32 size, u8* out, u32 max_size);
+
+  // Applies an encoded delta to a state in place.
+  static void ApplyDelta(const u8* delta, u32 delta_size, u8* state);
+
+  // Reserves space for a delta in the ring, evicting the oldest entries which overlap it.
+  u32 AllocateData(u32 size);
+
+  std::vector<Entry> m_entries;
+  u32 m_entry_head = 0;
+  u32 m_entry_count = 0;
+
+  std::unique_ptr<u8[]> m_data;
+  u32 m_data_size;
+  u32 m_data_used = 0;
+  u32 m_write_offset = 0;
+
+  // The newest state, and the state being captured.
+  std::unique_ptr<u8[]> m_state;
+  std::unique_ptr<u8[]> m_capture_state;
+  std::unique_ptr<u8[]> m_delta;
+  u32 m_state_size = 0;
+
+  ByteStream* m_state_stream;
+  ByteStream* m_capture_stream;
+};
+
+} // namespace Invaders
@@ -0,0 +1,64 @@
+#include "run_ahead.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Log.h"
+#include "system.h"
+Log_SetChannel(RunAhead);
+
+namespace Invaders {
+
+RunAhead::RunAhead(u32 frames) : m_frames(frames), m_state(std::make_unique<u8[]>(System::MAX_SAVE_STATE_SIZE))
+{
+  m_save_stream = ByteStream_CreateMemoryStream(m_state.get(), System::MAX_SAVE_STATE_SIZE);
+  m_load_stream = ByteStream_CreateReadOnlyMemoryStream(m_state.get(), System::MAX_SAVE_STATE_SIZE);
+}
+
+RunAhead::~RunAhead()
+{
+  m_load_stream->Release();
+  m_save_stream->Release();
+}
+
+bool RunAhead::ExecuteFrame(System* system)
+{
+  if (m_frames == 0)
+  {
+    system->ExecuteFrame();
+    return true;
+  }
+
+  const bool rendering_enabled = system->IsRenderingEnabled();
+  system->SetRenderingEnabled(false);
+  system->ExecuteFrame();
+
+  BinaryWriter writer(m_save_stream);
+  if (!m_save_stream->SeekAbsolute(0) || !system->SaveState(writer))
+  {
+    Log_ErrorPrintf("Failed to save state, disabling run-ahead");
+    m_frames = 0;
+    system->SetRenderingEnabled(rendering_enabled);
+    return false;
+  }
+
+  for (u32 i = 1; i <= m_frames; i++)
+  {
+    system->SetRenderingEnabled(rendering_enabled && i == m_frames);
+    system->ExecuteFrame();
+  }
+
+  // Loading would otherwise render the real frame over the one just displayed.
+  system->SetRenderingEnabled(false);
+  BinaryReader reader(m_load_stream);
+  const bool result = (m_load_stream->SeekAbsolute(0) && system->LoadState(reader));
+  system->SetRenderingEnabled(rendering_enabled);
+  if (!result)
+  {
+    Log_ErrorPrintf("Failed to load state, disabling run-ahead");
+    m_frames = 0;
+  }
+
+  return result;
+}
+
+} // namespace Invaders
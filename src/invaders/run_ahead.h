@@ -0,0 +1,38 @@
+#pragma once
+#include "common/types.h"
+#include <memory>
+
+class ByteStream;
+
+namespace Invaders {
+
+class System;
+
+// Hides input latency by showing frames from the future.
+//
+// The game reacts to input a frame or more after it is read, so after each real frame the system is snapshotted, run
+// ahead with the current inputs, and the last of those frames is displayed before the snapshot is restored. None of
+// the other frames are rendered. The real frames are unaffected, so movies and rewind see the same states as without
+// run-ahead, at the cost of emulating frames + 1 frames per displayed frame.
+class RunAhead
+{
+public:
+  RunAhead(u32 frames);
+  ~RunAhead();
+
+  u32 GetFrames() const { return m_frames; }
+  void SetFrames(u32 frames) { m_frames = frames; }
+
+  // Executes a real frame, then displays the frame GetFrames() frames after it. Returns false if the system couldn't
+  // be restored, in which case it is left at the end of the displayed frame.
+  bool ExecuteFrame(System* system);
+
+private:
+  u32 m_frames;
+
+  std::unique_ptr<u8[]> m_state;
+  ByteStream* m_save_stream;
+  ByteStream* m_load_stream;
+};
+
+} // namespace Invaders
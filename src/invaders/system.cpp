@@ -1,22 +1,72 @@
 #include "system.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
 #include "YBaseLib/Log.h"
 #include "common/simple_display.h"
 #include "common/util.h"
-#include "i8080/cpu.h"
+#include "i8080/cpu.inl"
+#include "i8080/static_code.h"
 #include <cstdio>
 Log_SetChannel(Bus);
 
+// System is final, so the CPU's memory and I/O accesses are direct calls which can be inlined.
+template class i8080::CPU<Invaders::System>;
+
+#if defined(INVADERS_ENABLE_STATIC_CODE)
+// Generated from the ROMs and added to the build, with:
+// staticrec invaders_static_code.cpp INVADERS_STATIC_CODE 0 invaders.h invaders.g invaders.f invaders.e
+extern const i8080::StaticCode INVADERS_STATIC_CODE;
+#endif
+
 namespace Invaders {
-System::System() : m_cpu(this) {}
+System::System() : m_cpu(this)
+{
+  m_clock.SetManager(&m_timing_manager);
+}
 
 System::~System() = default;
 
 bool System::LoadROMs(const char* base_directory)
 {
-  return (ReadROMToBuffer(Util::StringFromFormat("%s/invaders.h", base_directory).c_str(), &m_rom[0x0000], 0x800) &&
-          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.g", base_directory).c_str(), &m_rom[0x0800], 0x800) &&
-          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.f", base_directory).c_str(), &m_rom[0x1000], 0x800) &&
-          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.e", base_directory).c_str(), &m_rom[0x1800], 0x800));
+  return ReadROMs(base_directory, m_rom);
+}
+
+bool System::ReadROMs(const char* base_directory, u8* rom)
+{
+  return (ReadROMToBuffer(Util::StringFromFormat("%s/invaders.h", base_directory).c_str(), &rom[0x0000], 0x800) &&
+          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.g", base_directory).c_str(), &rom[0x0800], 0x800) &&
+          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.f", base_directory).c_str(), &rom[0x1000], 0x800) &&
+          ReadROMToBuffer(Util::StringFromFormat("%s/invaders.e", base_directory).c_str(), &rom[0x1800], 0x800));
+}
+
+// FNV-1a, continuing from hash.
+static u32 ComputeChecksum(u32 hash, const void* data, size_t size)
+{
+  const u8* bytes = static_cast<const u8*>(data);
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 0x01000193u;
+  return hash;
+}
+
+u32 System::GetROMChecksum() const
+{
+  return ComputeChecksum(0x811C9DC5u, m_rom, sizeof(m_rom));
+}
+
+u32 System::GetStateChecksum() const
+{
+  const i8080::Registers& regs = m_cpu.GetRegs();
+  const u64 instructions = m_cpu.GetExecutedInstructionCount();
+  const u16 sp = regs.sp;
+  const u16 pc = regs.pc;
+
+  u32 hash = ComputeChecksum(0x811C9DC5u, m_ram, sizeof(m_ram));
+  hash = ComputeChecksum(hash, &sp, sizeof(sp));
+  hash = ComputeChecksum(hash, &pc, sizeof(pc));
+  hash = ComputeChecksum(hash, &instructions, sizeof(instructions));
+  hash = ComputeChecksum(hash, &m_shift_register_value, sizeof(m_shift_register_value));
+  hash = ComputeChecksum(hash, &m_shift_register_read_offset, sizeof(m_shift_register_read_offset));
+  return hash;
 }
 
 bool System::Initialize(SimpleDisplay* display)
@@ -28,13 +78,32 @@ bool System::Initialize(SimpleDisplay* display)
   m_display->SetDisplayScale(2);
   m_display->ResizeDisplay();
   InitColorMask();
+
+  // ROM and RAM are accessed directly by the CPU. ROM writes, the RAM mirror at 0x4000 and unmapped regions
+  // still go through ReadMemory/WriteMemory.
+  m_cpu.MapMemory(0x0000, sizeof(m_rom), m_rom, nullptr);
+  m_cpu.MapMemory(0x2000, sizeof(m_ram), m_ram, m_ram);
+
+  // The game only runs code from ROM, so translated blocks are never invalidated.
+  m_cpu.SetExecutionMode(i8080::ExecutionMode::Recompiler);
+
+#if defined(INVADERS_ENABLE_STATIC_CODE)
+  // Code translated at build time avoids generating any code at run time.
+  if (m_cpu.SetStaticCode(&INVADERS_STATIC_CODE))
+    m_cpu.SetExecutionMode(i8080::ExecutionMode::Static);
+  else
+    Log_WarningPrintf("Static code was translated from different ROMs, using the recompiler");
+#endif
+
+  m_screen_interrupt_event = m_clock.NewEvent("Screen Interrupt", INTERRUPT_CYCLE_INTERVAL,
+                                              [this](TimingEvent*, CycleCount, CycleCount) { ScreenInterrupt(); });
   return true;
 }
 
 void System::Reset()
 {
   m_cpu.Reset();
-  m_cycles_to_next_interrupt = INTERRUPT_CYCLE_INTERVAL;
+  m_screen_interrupt_event->Reset();
   m_last_interrupt_was_vblank = true;
   m_shift_register_value = 0;
   m_shift_register_read_offset = 0;
@@ -45,23 +114,54 @@ void System::Reset()
 
 void System::ExecuteFrame()
 {
-  if (m_last_interrupt_was_vblank)
-    m_cpu.ExecuteCycles(m_cycles_to_next_interrupt);
-
-  m_cpu.ExecuteCycles(m_cycles_to_next_interrupt);
+  m_frame_complete = false;
+  while (!m_frame_complete)
+  {
+    // Run the CPU up to the next event. The events are serviced when the slice's cycles are added.
+    const SimulationTime time_to_next_event =
+      m_timing_manager.GetNextEventTime() - m_timing_manager.GetPendingTime();
+    m_cpu.ExecuteCycles((time_to_next_event + CPU_CYCLE_PERIOD - 1) / CPU_CYCLE_PERIOD);
+  }
 }
 
-void System::AddCycles(CycleCount cycles)
+bool System::LoadState(BinaryReader& reader)
 {
-  m_cycles_to_next_interrupt -= cycles;
-  if (m_cycles_to_next_interrupt > 0)
-    return;
+  u32 signature, version;
+  if (!reader.SafeReadUInt32(&signature) || signature != SAVE_STATE_SIGNATURE || !reader.SafeReadUInt32(&version) ||
+      version != SAVE_STATE_VERSION)
+  {
+    Log_ErrorPrintf("Not a save state, or saved by a different version");
+    return false;
+  }
 
-  m_last_interrupt_was_vblank = !m_last_interrupt_was_vblank;
-  m_cycles_to_next_interrupt += INTERRUPT_CYCLE_INTERVAL;
-  m_cpu.InterruptRequest(true, m_last_interrupt_was_vblank ? 2 : 1);
-  if (m_last_interrupt_was_vblank)
+  if (!m_cpu.LoadState(reader) || !reader.SafeReadBytes(m_ram, sizeof(m_ram)) ||
+      !reader.SafeReadUInt16(&m_shift_register_value) || !reader.SafeReadUInt8(&m_shift_register_read_offset) ||
+      !reader.SafeReadBool(&m_last_interrupt_was_vblank) || !m_timing_manager.LoadState(reader))
+  {
+    Log_ErrorPrintf("Failed to load save state");
+    return false;
+  }
+
+  // Code is only decoded from ROM, so this is normally free.
+  m_cpu.InvalidateCode(0x2000, sizeof(m_ram));
+
+  if (m_rendering_enabled)
     RenderDisplay();
+
+  return true;
+}
+
+bool System::SaveState(BinaryWriter& writer)
+{
+  return (writer.SafeWriteUInt32(SAVE_STATE_SIGNATURE) && writer.SafeWriteUInt32(SAVE_STATE_VERSION) &&
+          m_cpu.SaveState(writer) && writer.SafeWriteBytes(m_ram, sizeof(m_ram)) &&
+          writer.SafeWriteUInt16(m_shift_register_value) && writer.SafeWriteUInt8(m_shift_register_read_offset) &&
+          writer.SafeWriteBool(m_last_interrupt_was_vblank) && m_timing_manager.SaveState(writer));
+}
+
+void System::AddCycles(CycleCount cycles)
+{
+  m_timing_manager.AddPendingTime(cycles * CPU_CYCLE_PERIOD);
 }
 
 u8 System::ReadMemory(i8080::MemoryAddress address)
@@ -104,9 +204,14 @@ void System::WriteMemory(i8080::MemoryAddress address, u8 value)
 
     case 0x2:
     case 0x3:
+      m_ram[address & static_cast<i8080::MemoryAddress>(0x1FFF)] = value;
+      return;
+
     case 0x4:
     case 0x5:
+      // The CPU invalidates code at the address it wrote, but code is decoded from RAM at 0x2000, not the mirror.
       m_ram[address & static_cast<i8080::MemoryAddress>(0x1FFF)] = value;
+      m_cpu.InvalidateCode(static_cast<i8080::MemoryAddress>(0x2000 | (address & 0x1FFF)), 1);
       return;
 
     case 0x6:
@@ -269,6 +374,20 @@ void System::RenderDisplay()
   m_display->DisplayFramebuffer();
 }
 
+void System::ScreenInterrupt()
+{
+  // RST 1 when the beam reaches the middle of the screen, RST 2 at the start of vblank.
+  m_last_interrupt_was_vblank = !m_last_interrupt_was_vblank;
+  m_cpu.InterruptRequest(true, m_last_interrupt_was_vblank ? 2 : 1);
+  if (!m_last_interrupt_was_vblank)
+    return;
+
+  if (m_rendering_enabled)
+    RenderDisplay();
+
+  m_frame_complete = true;
+}
+
 u8 System::Read_SHFT_IN()
 {
   return Truncate8(m_shift_register_value >> (8 - m_shift_register_read_offset));
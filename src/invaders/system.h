@@ -1,9 +1,14 @@
 #pragma once
+#include "common/clock.h"
+#include "common/timing.h"
 #include "common/types.h"
 #include "i8080/cpu.h"
 #include "i8080/bus.h"
 #include <memory>
+#include <vector>
 
+class BinaryReader;
+class BinaryWriter;
 class SimpleDisplay;
 
 namespace Invaders {
@@ -36,33 +41,68 @@ struct Inputs
     BitField<u8, bool, 1, 1> dip5;
     BitField<u8, bool, 2, 1> tilt;
     BitField<u8, bool, 3, 1> dip6;
-    BitField<u8, bool, 1, 1> start_2p;
-    BitField<u8, bool, 2, 1> start_1p;
     BitField<u8, bool, 4, 1> fire_2p;
     BitField<u8, bool, 5, 1> left_2p;
     BitField<u8, bool, 6, 1> right_2p;
-    BitField<u8, bool, 6, 1> dip7;
+    BitField<u8, bool, 7, 1> dip7;
     u8 INP2_bits;
   };
 };
 
-class System : public i8080::Bus
+class System final : public i8080::Bus
 {
 public:
+  static constexpr u32 ROM_SIZE = 0x2000;
+  static constexpr u32 RAM_SIZE = 0x2000;
+
+  // The mid-screen and vblank interrupts are each raised once per frame, half a frame apart.
+  static constexpr CycleCount INTERRUPT_CYCLE_INTERVAL = 17066;
+
   System();
   ~System();
 
   const Inputs& GetInputs() const { return m_inputs; }
   Inputs& GetInputs() { return m_inputs; }
 
+  const i8080::CPU<System>& GetCPU() const { return m_cpu; }
+  const u8* GetRAM() const { return m_ram; }
+  void SetExecutionMode(i8080::ExecutionMode mode) { m_cpu.SetExecutionMode(mode); }
+
+  // When disabled, VRAM isn't converted to the display's framebuffer at vblank, for running headless at full speed and
+  // for frames which are never shown.
+  bool IsRenderingEnabled() const { return m_rendering_enabled; }
+  void SetRenderingEnabled(bool enabled) { m_rendering_enabled = enabled; }
+
+  // Hooks into the game code, see i8080::CPU::SetTrap().
+  void SetTrap(i8080::MemoryAddress address, i8080::TrapHandler handler) { m_cpu.SetTrap(address, std::move(handler)); }
+  void RemoveTrap(i8080::MemoryAddress address) { m_cpu.RemoveTrap(address); }
+
   bool LoadROMs(const char* base_directory);
 
+  // Reads the four ROMs into ROM_SIZE bytes at rom.
+  static bool ReadROMs(const char* base_directory, u8* rom);
+
+  // Checksums for checking that input movies are played back on the same ROMs, and end in the same state. The state
+  // checksum covers memory, the CPU's position and the devices, but not the flags.
+  u32 GetROMChecksum() const;
+  u32 GetStateChecksum() const;
+
   bool Initialize(SimpleDisplay* display);
   void Reset();
 
-  // Executes a frame
+  // Executes a frame, stopping after the vblank interrupt has been raised and the display rendered (if enabled).
   void ExecuteFrame();
 
+  // Save states hold the CPU, RAM, shift register and interrupt timing, and are rejected if saved by another version.
+  // The inputs belong to the host, so aren't included. States should be taken between frames, and loading renders
+  // VRAM to the display, so that the frame which was on screen when the state was saved is shown again. If loading
+  // fails part way, the system must be reset or loaded from another state.
+  bool LoadState(BinaryReader& reader);
+  bool SaveState(BinaryWriter& writer);
+
+  // Upper bound on the size of a save state, for hosts which save into fixed buffers.
+  static constexpr u32 MAX_SAVE_STATE_SIZE = 16384;
+
   // Inherited via Bus
   void AddCycles(CycleCount cycles) override;
   u8 ReadMemory(i8080::MemoryAddress address) override;
@@ -71,13 +111,17 @@ public:
   void WriteIO(i8080::MemoryAddress address, u8 value) override;
 
 private:
-  static constexpr CycleCount INTERRUPT_CYCLE_INTERVAL = 17066;
+  static constexpr u32 CPU_FREQUENCY = 2000000;
+  static constexpr SimulationTime CPU_CYCLE_PERIOD = SecondsToSimulationTime(1) / CPU_FREQUENCY;
   static constexpr u32 DISPLAY_WIDTH = 256;
   static constexpr u32 DISPLAY_HEIGHT = 224;
+  static constexpr u32 SAVE_STATE_SIGNATURE = 0x53534E49;
+  static constexpr u32 SAVE_STATE_VERSION = 1;
 
-  bool ReadROMToBuffer(const char* filename, void* buffer, u32 buffer_size);
+  static bool ReadROMToBuffer(const char* filename, void* buffer, u32 buffer_size);
   void InitColorMask();
   void RenderDisplay();
+  void ScreenInterrupt();
 
   u8 Read_SHFT_IN();
   void Write_SHFT_AMNT(u8 val);
@@ -88,18 +132,23 @@ private:
 
   SimpleDisplay* m_display = nullptr;
 
-  i8080::CPU m_cpu;
+  i8080::CPU<System> m_cpu;
 
-  u8 m_rom[0x2000] = {};      // h - 0000-07FF, g - 0800-0FFF, f - 1000-17FF, e - 1800-1FFF
-  u8 m_ram[0x2000] = {};      // 2000-23FF RAM, 2400-3FFF VRAM
+  u8 m_rom[ROM_SIZE] = {};    // h - 0000-07FF, g - 0800-0FFF, f - 1000-17FF, e - 1800-1FFF
+  u8 m_ram[RAM_SIZE] = {};    // 2000-23FF RAM, 2400-3FFF VRAM
 
   Inputs m_inputs = {};
 
   u16 m_shift_register_value = 0;
   u8 m_shift_register_read_offset = 0;
 
-  CycleCount m_cycles_to_next_interrupt = INTERRUPT_CYCLE_INTERVAL;
+  // Devices schedule their work as events, and the CPU runs uninterrupted until the next event is due.
+  TimingManager m_timing_manager;
+  Clock m_clock{"CPU", float(CPU_FREQUENCY)};
+  TimingEvent::Pointer m_screen_interrupt_event;
   bool m_last_interrupt_was_vblank = true;
+  bool m_frame_complete = false;
+  bool m_rendering_enabled = true;
 
   std::vector<u32> m_color_mask;
 };
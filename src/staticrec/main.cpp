@@ -0,0 +1,477 @@
+#include "YBaseLib/Log.h"
+#include "YBaseLib/String.h"
+#include "i8080/disassembler.h"
+#include "i8080/instruction_info.h"
+#include "i8080/static_code.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <vector>
+Log_SetChannel(StaticRec);
+
+// Translates a program which never modifies its own code (e.g. a ROM) to C++, for ExecutionMode::Static.
+//
+// Blocks are discovered by following the control flow from the reset and RST vectors. Targets which are only known at
+// run time (pchl, or return addresses pushed by the program) are only found if they are also reached statically, the
+// CPU interprets any address without a block until it reaches one.
+
+static constexpr u32 MAX_BLOCK_INSTRUCTIONS = 64;
+
+struct Image
+{
+  i8080::MemoryAddress start_address;
+  std::vector<u8> bytes;
+
+  bool Contains(u32 address, u32 length) const
+  {
+    return (address >= start_address && (address + length) <= (start_address + bytes.size()));
+  }
+  const u8* GetPointer(u32 address) const { return &bytes[address - start_address]; }
+};
+
+struct Instruction
+{
+  i8080::MemoryAddress pc;
+  u8 opcode;
+  u16 operand;
+  u8 length;
+};
+
+struct Block
+{
+  std::vector<Instruction> instructions;
+
+  // Address of the instruction after the block, when it is not reached through a branch.
+  u32 next_pc;
+};
+
+static std::optional<std::vector<u8>> ReadFile(const char* filename)
+{
+  std::FILE* fp = std::fopen(filename, "rb");
+  if (!fp)
+    return std::nullopt;
+
+  std::fseek(fp, 0, SEEK_END);
+  size_t len = std::ftell(fp);
+  std::fseek(fp, 0, SEEK_SET);
+
+  std::vector<u8> ret(len);
+  if (len > 0 && std::fread(ret.data(), len, 1, fp) != 1)
+  {
+    std::fclose(fp);
+    return std::nullopt;
+  }
+
+  std::fclose(fp);
+  return ret;
+}
+
+// I/O, interrupt enable and hlt are left to the interpreter, so that the CPU can service interrupts between blocks.
+static bool IsTranslatable(u8 opcode)
+{
+  return (opcode != 0xD3 && opcode != 0xDB && opcode != 0xF3 && opcode != 0xFB && opcode != 0x76);
+}
+
+static Block DecodeBlock(const Image& image, i8080::MemoryAddress start_pc)
+{
+  Block block;
+  u32 pc = start_pc;
+  while (block.instructions.size() < MAX_BLOCK_INSTRUCTIONS && image.Contains(pc, 1))
+  {
+    const u8 opcode = *image.GetPointer(pc);
+    const i8080::InstructionInfo& info = i8080::INSTRUCTION_INFO[opcode];
+    if (!IsTranslatable(opcode) || !image.Contains(pc, info.length))
+      break;
+
+    Instruction instruction = {static_cast<i8080::MemoryAddress>(pc), opcode, 0, info.length};
+    if (info.length == 2)
+      instruction.operand = image.GetPointer(pc)[1];
+    else if (info.length == 3)
+      instruction.operand = ZeroExtend16(image.GetPointer(pc)[1]) | (ZeroExtend16(image.GetPointer(pc)[2]) << 8);
+
+    block.instructions.push_back(instruction);
+    pc += info.length;
+    if (info.flags & i8080::InstructionFlag_EndsBlock)
+      break;
+  }
+
+  block.next_pc = pc & 0xFFFF;
+  return block;
+}
+
+// Addresses execution can continue at after the block.
+static std::vector<u32> GetSuccessors(const Image& image, const Block& block)
+{
+  std::vector<u32> successors;
+  if (block.instructions.empty())
+  {
+    // The block starts with an instruction which is interpreted, continue after it.
+    const u8 opcode = *image.GetPointer(block.next_pc);
+    successors.push_back((block.next_pc + i8080::INSTRUCTION_INFO[opcode].length) & 0xFFFF);
+    return successors;
+  }
+
+  const Instruction& last = block.instructions.back();
+  const u8 op = last.opcode;
+  if (op == 0xC3 || op == 0xCB)
+  {
+    successors.push_back(last.operand);
+  }
+  else if ((op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4 || (op & 0xCF) == 0xCD)
+  {
+    // Conditional jumps, and calls which return to the next instruction.
+    successors.push_back(last.operand);
+    successors.push_back(block.next_pc);
+  }
+  else if ((op & 0xC7) == 0xC7)
+  {
+    successors.push_back(op & 0x38);
+    successors.push_back(block.next_pc);
+  }
+  else if (op == 0xC9 || op == 0xD9 || op == 0xE9)
+  {
+    // Unconditional return or pchl, the target is only known at run time.
+  }
+  else
+  {
+    successors.push_back(block.next_pc);
+  }
+
+  return successors;
+}
+
+static std::map<i8080::MemoryAddress, Block> DiscoverBlocks(const Image& image)
+{
+  std::map<i8080::MemoryAddress, Block> blocks;
+  std::vector<bool> visited(image.bytes.size());
+  std::vector<u32> worklist;
+  for (u32 vector = 0; vector < 0x40; vector += 8)
+    worklist.push_back(vector);
+
+  while (!worklist.empty())
+  {
+    const u32 pc = worklist.back();
+    worklist.pop_back();
+    if (!image.Contains(pc, 1) || visited[pc - image.start_address])
+      continue;
+
+    visited[pc - image.start_address] = true;
+    Block block = DecodeBlock(image, static_cast<i8080::MemoryAddress>(pc));
+    for (u32 successor : GetSuccessors(image, block))
+      worklist.push_back(successor);
+
+    // Interpreted instructions are still walked for their successors, but don't get a block.
+    if (!block.instructions.empty())
+      blocks.emplace(static_cast<i8080::MemoryAddress>(pc), std::move(block));
+  }
+
+  return blocks;
+}
+
+static const char* Reg8Read(u32 index)
+{
+  static constexpr const char* names[] = {"r.b", "r.c", "r.d", "r.e", "r.h", "r.l", "s.ReadMemoryByte(r.hl)", "r.a"};
+  return names[index];
+}
+
+static const char* Reg16Name(u32 index, bool psw)
+{
+  static constexpr const char* names[] = {"r.bc", "r.de", "r.hl", "r.sp"};
+  return (psw && index == 3) ? "r.af" : names[index];
+}
+
+static const char* ConditionString(u32 index)
+{
+  static constexpr const char* conditions[] = {"!r.f.z", "r.f.z", "!r.f.c", "r.f.c",
+                                               "!r.f.p", "r.f.p", "!r.f.s", "r.f.s"};
+  return conditions[index];
+}
+
+static void WriteReg8(String* out, u32 index, const char* value)
+{
+  if (index == 6)
+    out->AppendFormattedString("  s.WriteMemoryByte(r.hl, %s);\n", value);
+  else
+    out->AppendFormattedString("  %s = %s;\n", Reg8Read(index), value);
+}
+
+// Appends the statements for an instruction which does not end the block.
+static void EmitInstruction(String* out, const Instruction& instruction)
+{
+  static constexpr const char* alu_ops[] = {"op_add", "op_adc", "op_sub", "op_sbb",
+                                            "op_and", "op_xor", "op_or",  "op_sub"};
+
+  const u8 op = instruction.opcode;
+  const u16 operand = instruction.operand;
+  SmallString value;
+
+  if ((op & 0xC0) == 0x40)
+  {
+    WriteReg8(out, (op >> 3) & 7, Reg8Read(op & 7));
+  }
+  else if ((op & 0xC0) == 0x80 || (op & 0xC7) == 0xC6)
+  {
+    const u32 alu_op = (op >> 3) & 7;
+    if ((op & 0xC0) == 0x80)
+      value.Format("s.%s(r, r.a, %s)", alu_ops[alu_op], Reg8Read(op & 7));
+    else
+      value.Format("s.%s(r, r.a, 0x%02X)", alu_ops[alu_op], operand);
+
+    // cmp only sets the flags.
+    if (alu_op == 7)
+      out->AppendFormattedString("  %s;\n", value.GetCharArray());
+    else
+      WriteReg8(out, 7, value.GetCharArray());
+  }
+  else if ((op & 0xCF) == 0x01)
+  {
+    out->AppendFormattedString("  %s = 0x%04X;\n", Reg16Name(op >> 4, false), operand);
+  }
+  else if ((op & 0xCF) == 0x03 || (op & 0xCF) == 0x0B)
+  {
+    out->AppendFormattedString("  %s%s;\n", Reg16Name((op >> 4) & 3, false), (op & 0x08) ? "--" : "++");
+  }
+  else if ((op & 0xCF) == 0x09)
+  {
+    out->AppendFormattedString("  r.hl = s.op_dad(r, r.hl, %s);\n", Reg16Name((op >> 4) & 3, false));
+  }
+  else if ((op & 0xC6) == 0x04)
+  {
+    value.Format("s.%s(r, %s)", (op & 1) ? "op_dcr" : "op_inr", Reg8Read((op >> 3) & 7));
+    WriteReg8(out, (op >> 3) & 7, value.GetCharArray());
+  }
+  else if ((op & 0xC7) == 0x06)
+  {
+    value.Format("0x%02X", operand);
+    WriteReg8(out, (op >> 3) & 7, value.GetCharArray());
+  }
+  else if ((op & 0xCF) == 0xC5)
+  {
+    out->AppendFormattedString("  s.PushWord(r, %s);\n", Reg16Name((op >> 4) & 3, true));
+  }
+  else if ((op & 0xCF) == 0xC1)
+  {
+    out->AppendFormattedString("  %s = s.PopWord(r);\n", Reg16Name((op >> 4) & 3, true));
+    if (op == 0xF1)
+      out->AppendString("  r.f.Fixup();\n");
+  }
+  else
+  {
+    switch (op)
+    {
+      case 0x02:
+      case 0x12:
+        out->AppendFormattedString("  s.WriteMemoryByte(%s, r.a);\n", Reg16Name(op >> 4, false));
+        break;
+      case 0x0A:
+      case 0x1A:
+        out->AppendFormattedString("  r.a = s.ReadMemoryByte(%s);\n", Reg16Name(op >> 4, false));
+        break;
+      case 0x22:
+        out->AppendFormattedString("  s.WriteMemoryWord(0x%04X, r.hl);\n", operand);
+        break;
+      case 0x2A:
+        out->AppendFormattedString("  r.hl = s.ReadMemoryWord(0x%04X);\n", operand);
+        break;
+      case 0x32:
+        out->AppendFormattedString("  s.WriteMemoryByte(0x%04X, r.a);\n", operand);
+        break;
+      case 0x3A:
+        out->AppendFormattedString("  r.a = s.ReadMemoryByte(0x%04X);\n", operand);
+        break;
+      case 0x07:
+        out->AppendString("  r.a = s.op_rlc(r, r.a);\n");
+        break;
+      case 0x0F:
+        out->AppendString("  r.a = s.op_rrc(r, r.a);\n");
+        break;
+      case 0x17:
+        out->AppendString("  r.a = s.op_ral(r, r.a);\n");
+        break;
+      case 0x1F:
+        out->AppendString("  r.a = s.op_rar(r, r.a);\n");
+        break;
+      case 0x27:
+        out->AppendString("  r.a = s.op_daa(r, r.a);\n");
+        break;
+      case 0x2F:
+        out->AppendString("  r.a = ~r.a;\n");
+        break;
+      case 0x37:
+        out->AppendString("  r.f.c = true;\n");
+        break;
+      case 0x3F:
+        out->AppendString("  r.f.c = !r.f.c;\n");
+        break;
+      case 0xEB:
+        out->AppendString("  std::swap(r.de, r.hl);\n");
+        break;
+      case 0xE3:
+        out->AppendString("  s.op_xthl(r);\n");
+        break;
+      case 0xF9:
+        out->AppendString("  r.sp = r.hl;\n");
+        break;
+      default:
+        // nop
+        break;
+    }
+  }
+}
+
+static bool IsBranch(u8 op)
+{
+  return (i8080::INSTRUCTION_INFO[op].flags & i8080::InstructionFlag_EndsBlock) != 0;
+}
+
+// Appends the statements which leave the block, including the final instruction if it is a branch.
+static void EmitBlockExit(String* out, const Block& block, u32 cycles)
+{
+  const Instruction& last = block.instructions.back();
+  const u32 count = static_cast<u32>(block.instructions.size());
+  const u8 op = last.opcode;
+  const u32 next_pc = block.next_pc;
+
+  if ((op & 0xC7) == 0xC4 || (op & 0xC7) == 0xC0)
+  {
+    // Conditional calls and returns take longer when the branch is taken.
+    const bool is_call = ((op & 0xC7) == 0xC4);
+    out->AppendFormattedString("  if (%s)\n  {\n", ConditionString((op >> 3) & 7));
+    if (is_call)
+      out->AppendFormattedString("    s.PushWord(r, 0x%04X);\n    r.pc = 0x%04X;\n", next_pc, last.operand);
+    else
+      out->AppendString("    r.pc = s.PopWord(r);\n");
+    out->AppendFormattedString("    s.EndBlock(r, %u, %u);\n  }\n  else\n  {\n", cycles + (is_call ? 17 : 11), count);
+    out->AppendFormattedString("    r.pc = 0x%04X;\n    s.EndBlock(r, %u, %u);\n  }\n", next_pc,
+                               cycles + (is_call ? 11 : 5), count);
+    return;
+  }
+
+  if (IsBranch(op))
+    cycles += i8080::INSTRUCTION_INFO[op].cycles;
+
+  if (op == 0xC3 || op == 0xCB)
+    out->AppendFormattedString("  r.pc = 0x%04X;\n", last.operand);
+  else if ((op & 0xC7) == 0xC2)
+    out->AppendFormattedString("  r.pc = (%s) ? 0x%04X : 0x%04X;\n", ConditionString((op >> 3) & 7), last.operand, next_pc);
+  else if ((op & 0xCF) == 0xCD)
+    out->AppendFormattedString("  s.PushWord(r, 0x%04X);\n  r.pc = 0x%04X;\n", next_pc, last.operand);
+  else if ((op & 0xC7) == 0xC7)
+    out->AppendFormattedString("  s.PushWord(r, 0x%04X);\n  r.pc = 0x%04X;\n", next_pc, op & 0x38);
+  else if (op == 0xC9 || op == 0xD9)
+    out->AppendString("  r.pc = s.PopWord(r);\n");
+  else if (op == 0xE9)
+    out->AppendString("  r.pc = r.hl;\n");
+  else
+    out->AppendFormattedString("  r.pc = 0x%04X;\n", next_pc);
+
+  out->AppendFormattedString("  s.EndBlock(r, %u, %u);\n", cycles, count);
+}
+
+static void EmitBlock(String* out, const Image& image, i8080::MemoryAddress start_pc, const Block& block, u32* max_cycles)
+{
+  out->AppendFormattedString("static void Block_%04X(i8080::StaticCodeState& s)\n{\n", start_pc);
+  out->AppendString("  i8080::Registers r;\n  s.LoadRegisters(r);\n\n");
+
+  SmallString disasm;
+  u32 cycles = 0;
+  *max_cycles = 0;
+  for (const Instruction& instruction : block.instructions)
+  {
+    i8080::Disassemble(instruction.pc, image.GetPointer(instruction.pc), &disasm);
+    out->AppendFormattedString("  // %s\n", disasm.GetCharArray());
+    *max_cycles += i8080::INSTRUCTION_INFO[instruction.opcode].cycles;
+    if (&instruction == &block.instructions.back() && IsBranch(instruction.opcode))
+      break;
+
+    EmitInstruction(out, instruction);
+    cycles += i8080::INSTRUCTION_INFO[instruction.opcode].cycles;
+  }
+
+  if (!IsBranch(block.instructions.back().opcode))
+    out->AppendString("\n");
+  EmitBlockExit(out, block, cycles);
+  out->AppendString("}\n\n");
+}
+
+// staticrec <output.cpp> <symbol> <load address> <file> [file...]
+// The files are concatenated and translated as if loaded at the address, e.g. for Space Invaders:
+// staticrec invaders_static_code.cpp INVADERS_STATIC_CODE 0 invaders.h invaders.g invaders.f invaders.e
+int main(int argc, char* argv[])
+{
+  Log::GetInstance().SetConsoleOutputParams(true);
+
+  if (argc < 5)
+  {
+    std::fprintf(stderr, "usage: %s <output.cpp> <symbol> <load address> <file> [file...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char* output_filename = argv[1];
+  const char* symbol = argv[2];
+
+  Image image;
+  image.start_address = static_cast<i8080::MemoryAddress>(std::strtoul(argv[3], nullptr, 0));
+  for (int i = 4; i < argc; i++)
+  {
+    std::optional<std::vector<u8>> data = ReadFile(argv[i]);
+    if (!data)
+    {
+      Log_ErrorPrintf("Failed to read '%s'", argv[i]);
+      return EXIT_FAILURE;
+    }
+
+    image.bytes.insert(image.bytes.end(), data->begin(), data->end());
+  }
+
+  if (image.bytes.empty() || (image.start_address + image.bytes.size()) > 0x10000)
+  {
+    Log_ErrorPrintf("Program must be between 1 and %u bytes", 0x10000u - image.start_address);
+    return EXIT_FAILURE;
+  }
+
+  const std::map<i8080::MemoryAddress, Block> blocks = DiscoverBlocks(image);
+
+  String out;
+  out.AppendFormattedString("// Generated by staticrec, do not edit.\n");
+  out.AppendString("#include \"i8080/static_code.h\"\n#include <utility>\n\n");
+
+  std::vector<u32> max_cycles;
+  u32 instruction_count = 0;
+  for (const auto& it : blocks)
+  {
+    max_cycles.push_back(0);
+    EmitBlock(&out, image, it.first, it.second, &max_cycles.back());
+    instruction_count += static_cast<u32>(it.second.instructions.size());
+  }
+
+  out.AppendFormattedString("static const i8080::StaticBlock BLOCKS[] = {\n");
+  size_t index = 0;
+  for (const auto& it : blocks)
+  {
+    const Instruction& last = it.second.instructions.back();
+    const u32 length = ZeroExtend32(last.pc) + last.length - it.first;
+    out.AppendFormattedString("  {0x%04X, %u, %u, Block_%04X},\n", it.first, length, max_cycles[index++], it.first);
+  }
+  out.AppendString("};\n\n");
+
+  out.AppendFormattedString("extern const i8080::StaticCode %s;\n", symbol);
+  out.AppendFormattedString("const i8080::StaticCode %s = {0x%04X, %u, 0x%08X, BLOCKS, %u};\n", symbol,
+                            image.start_address, static_cast<u32>(image.bytes.size()),
+                            i8080::ComputeStaticCodeChecksum(image.bytes.data(), static_cast<u32>(image.bytes.size())),
+                            static_cast<u32>(blocks.size()));
+
+  std::FILE* fp = std::fopen(output_filename, "wb");
+  if (!fp || std::fwrite(out.GetCharArray(), out.GetLength(), 1, fp) != 1)
+  {
+    Log_ErrorPrintf("Failed to write '%s'", output_filename);
+    if (fp)
+      std::fclose(fp);
+    return EXIT_FAILURE;
+  }
+
+  std::fclose(fp);
+  Log_InfoPrintf("Translated %u instructions in %u blocks", instruction_count, static_cast<u32>(blocks.size()));
+  return EXIT_SUCCESS;
+}
@@ -1,158 +1,344 @@
 #include "YBaseLib/Log.h"
-#include "i8080/bus.h"
-#include "i8080/cpu.h"
+#include "YBaseLib/Timer.h"
+#include "cpm/machine.h"
+#include "i8080/profiler.h"
+#include "i8080/trace.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
-#include <optional>
+#include <string>
+#include <thread>
 #include <vector>
 Log_SetChannel(Test);
 
-static std::optional<std::vector<u8>> ReadFile(const char* filename)
+// A CP/M program running on its own machine. Console output is captured per run, so that runs can execute in parallel
+// and their output printed afterwards without interleaving.
+struct TestRun
 {
-  std::FILE* fp = std::fopen(filename, "rb");
-  if (!fp)
-    return std::nullopt;
+  TestRun(const char* filename_, const char* completion_text_)
+    : filename(filename_), completion_text(completion_text_), machine(std::make_unique<CPM::Machine>())
+  {
+  }
+
+  const char* filename;
+  const char* completion_text;
+  std::unique_ptr<CPM::Machine> machine;
+
+  std::vector<std::string> output;
+  std::string line_buffer;
+  double seconds = 0.0;
+};
 
-  std::fseek(fp, 0, SEEK_END);
-  size_t len = std::ftell(fp);
-  std::fseek(fp, 0, SEEK_SET);
+static void AddLineCharacter(TestRun* run, u8 ch)
+{
+  if (ch == '\r')
+    return;
+  else if (ch != '\n' && !std::isprint(ch))
+    ch = '?';
 
-  std::vector<u8> ret(len);
-  if (std::fread(ret.data(), len, 1, fp) != 1)
+  if (ch != '\n')
   {
-    std::fclose(fp);
-    return std::nullopt;
+    run->line_buffer.push_back(static_cast<char>(ch));
+    return;
   }
 
-  return ret;
+  if (!run->line_buffer.empty())
+    run->output.push_back(std::move(run->line_buffer));
+
+  run->line_buffer.clear();
 }
 
-class TestBus : public i8080::Bus
+static bool LoadTestProgram(TestRun* run)
 {
-public:
-  TestBus() = default;
-  ~TestBus() = default;
+  if (!run->machine->LoadProgram(run->filename))
+  {
+    Log_ErrorPrintf("Failed to load %s", run->filename);
+    return false;
+  }
 
-  const u8* GetRAM() const { return m_ram; }
-  u8* GetRAM() { return m_ram; }
+  run->machine->SetConsoleOutputCallback([run](const char* data, u32 size) {
+    for (u32 i = 0; i < size; i++)
+      AddLineCharacter(run, static_cast<u8>(data[i]));
+  });
 
-  void AddCycles(CycleCount cycles) override {}
+  return true;
+}
 
-  u8 ReadMemory(i8080::MemoryAddress address) override { return m_ram[address & 0xFFFF]; }
-  void WriteMemory(i8080::MemoryAddress address, u8 value) override { m_ram[address & 0xFFFF] = value; }
+static void ExecuteTestProgram(TestRun* run)
+{
+  Timer timer;
+  run->machine->Run();
+  AddLineCharacter(run, '\n');
+  run->seconds = timer.GetTimeSeconds();
+}
 
-  u8 ReadIO(i8080::MemoryAddress address) override { return 0xFF; }
-  void WriteIO(i8080::MemoryAddress address, u8 value) override {}
+// Executes the runs on a pool of up to one thread per hardware thread. Each run owns its machine, so the only shared
+// state is the index of the next run to start.
+static void ExecuteTestPrograms(std::vector<std::unique_ptr<TestRun>>& runs)
+{
+  const u32 hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  const u32 thread_count = std::min(hardware_threads, static_cast<u32>(runs.size()));
+  std::atomic<u32> next_run{0};
 
-  bool LoadFileToAddress(const char* filename, i8080::MemoryAddress base)
+  std::vector<std::thread> threads;
+  for (u32 i = 0; i < thread_count; i++)
   {
-    auto data = ReadFile(filename);
-    if (!data)
-      return false;
+    threads.emplace_back([&runs, &next_run]() {
+      u32 index;
+      while ((index = next_run.fetch_add(1)) < runs.size())
+        ExecuteTestProgram(runs[index].get());
+    });
+  }
 
-    const size_t copy_size = std::min(static_cast<size_t>(base) + data->size(), sizeof(m_ram)) - base;
-    if (copy_size == 0)
-      return false;
+  for (std::thread& thread : threads)
+    thread.join();
+}
 
-    Log_DevPrintf("Loading %zu bytes at %04X from %s", copy_size, base, filename);
-    std::memcpy(m_ram + base, data->data(), copy_size);
-    return true;
+// The test programs print ERROR (8080PRE, 8080EXM, CPUTEST) or FAILED (TST8080) when a test does not pass, and their
+// completion text once every test has run. A program which halts or stops early never prints the completion text.
+static bool TestProgramPassed(const TestRun* run)
+{
+  if (run->machine->GetCPU().IsHalted())
+  {
+    Log_ErrorPrintf("%s halted at %04X", run->filename, run->machine->GetCPU().GetRegs().pc);
+    return false;
   }
 
-private:
-  u8 m_ram[0x10000] = {};
-};
+  const auto contains = [run](const char* text) {
+    return std::any_of(run->output.begin(), run->output.end(),
+                       [text](const std::string& line) { return line.find(text) != std::string::npos; });
+  };
+  if (contains("ERROR") || contains("FAILED"))
+    return false;
 
-static String s_line_buffer;
+  if (!contains(run->completion_text))
+  {
+    Log_ErrorPrintf("%s exited without printing \"%s\"", run->filename, run->completion_text);
+    return false;
+  }
+
+  return true;
+}
 
-static void AddLineCharacter(u8 ch)
+// Runs a CP/M program for a fixed number of cycles, restarting it whenever it exits, and reports the throughput. Files
+// are accessed in the current directory.
+static int RunBenchmark(const char* filename, const char* arguments, CycleCount cycles, i8080::ExecutionMode mode)
 {
-  if (ch == '\r')
-    return;
-  else if (ch != '\n' && !std::isprint(ch))
-    ch = '?';
+  auto machine = std::make_unique<CPM::Machine>();
+  if (!machine->LoadProgram(filename, arguments))
+    return -1;
 
-  s_line_buffer.AppendCharacter(static_cast<char>(ch));
-  if (s_line_buffer[s_line_buffer.GetLength() - 1] != '\n')
-    return;
+  // Console output is discarded, so that only the CPU and BDOS are measured.
+  CPM::Machine::CPUType& cpu = machine->GetCPU();
+  machine->SetConsoleOutputCallback([](const char*, u32) {});
+  cpu.SetExecutionMode(mode);
 
-  s_line_buffer.Erase(-1);
-  if (s_line_buffer.GetLength() > 0)
-    Log_DevPrintf("CP/M: %s", s_line_buffer.GetCharArray());
+  Timer timer;
+  CycleCount cycles_executed = 0;
+  while (cycles_executed < cycles)
+  {
+    const CycleCount start_cycles = machine->GetCyclesExecuted();
+    const bool exited = machine->Run(cycles - cycles_executed);
+    cycles_executed += machine->GetCyclesExecuted() - start_cycles;
+    if (exited && !machine->LoadProgram(filename, arguments))
+      return -1;
+  }
 
-  s_line_buffer.Clear();
+  const double seconds = timer.GetTimeSeconds();
+  const double instructions = static_cast<double>(cpu.GetExecutedInstructionCount());
+  Log_InfoPrintf("%s %s dispatch: %.0f instructions, %lld cycles in %.3f seconds",
+                 i8080::GetExecutionModeName(cpu.GetExecutionMode()), I8080_THREADED_DISPATCH ? "threaded" : "switch",
+                 instructions, static_cast<long long>(cycles_executed), seconds);
+  Log_InfoPrintf("%.2f MIPS, %.2f emulated MHz", instructions / seconds / 1000000.0,
+                 static_cast<double>(cycles_executed) / seconds / 1000000.0);
+  return 0;
 }
 
-static void HandleBDOSCommand(i8080::CPU* cpu)
+// Times each ALU instruction followed by push psw, which forces the lazily evaluated flags to be built, against the
+// same loop with a nop in its place. The difference is the cost of the instruction and its flags.
+static int RunOpcodeBenchmark(CycleCount cycles, i8080::ExecutionMode mode)
 {
-  switch (cpu->GetRegs().c)
+  static constexpr CycleCount SLICE_CYCLES = 17066;
+  static constexpr u32 UNROLL = 64;
+  static constexpr struct
   {
-    case 2: // print single character from reg e
-    {
-      AddLineCharacter(cpu->GetRegs().e);
-    }
-    break;
+    u8 opcode;
+    const char* name;
+  } opcodes[] = {{0x00, "nop"},   {0x80, "add b"}, {0x88, "adc b"}, {0x90, "sub b"}, {0x98, "sbb b"}, {0xA0, "ana b"},
+                 {0xA8, "xra b"}, {0xB0, "ora b"}, {0x04, "inr b"}, {0x05, "dcr b"}, {0x27, "daa"}};
+
+  double nop_ns = 0.0;
+  for (const auto& op : opcodes)
+  {
+    auto machine = std::make_unique<CPM::Machine>();
+    CPM::Machine::CPUType& cpu = machine->GetCPU();
+    cpu.SetExecutionMode(mode);
 
-    case 9: // print string from memory at (de)
+    // op; push psw; pop b, repeated, then jmp 0x100.
+    u8* code = machine->GetRAM() + CPM::Machine::TPA_START;
+    for (u32 i = 0; i < UNROLL; i++)
     {
-      SmallString buf;
-      i8080::MemoryAddress addr = cpu->GetRegs().de;
-      u8 ch;
-      while ((ch = cpu->GetBus()->ReadMemory(addr)) != '$')
-      {
-        if (ch == '\r')
-        {
-          addr++;
-          continue;
-        }
-
-        if (ch != '\n' && !std::isprint(ch))
-          ch = '?';
-
-        AddLineCharacter(ch);
-        addr++;
-      }
+      *(code++) = op.opcode;
+      *(code++) = 0xF5;
+      *(code++) = 0xC1;
     }
-    break;
+    *(code++) = 0xC3;
+    *(code++) = 0x00;
+    *(code++) = 0x01;
+    cpu.GetRegs().sp = 0xF000;
+
+    Timer timer;
+    while (machine->GetCyclesExecuted() < cycles)
+      cpu.ExecuteCycles(SLICE_CYCLES);
+
+    const double seconds = timer.GetTimeSeconds();
+    const double iterations = static_cast<double>(cpu.GetExecutedInstructionCount()) / 3.0;
+    const double ns = seconds * 1000000000.0 / iterations;
+    if (op.opcode == 0x00)
+      nop_ns = ns;
 
-    default:
-      Log_ErrorPrintf("Unknown bdos command 0x%02x", cpu->GetRegs().c);
-      break;
+    Log_InfoPrintf("%-6s %6.2f ns per iteration, %+6.2f ns over nop", op.name, ns, ns - nop_ns);
   }
+
+  return 0;
 }
 
 int main(int argc, char* argv[])
 {
   Log::GetInstance().SetConsoleOutputParams(true);
 
-  auto bus = std::make_unique<TestBus>();
-  auto cpu = std::make_unique<i8080::CPU>(bus.get());
+  // test --benchmark <program> [cycles] [interpreter|cached|recompiler] [program arguments...]
+  if (argc >= 3 && std::strcmp(argv[1], "--benchmark") == 0)
+  {
+    std::string arguments;
+    for (int i = 5; i < argc; i++)
+      arguments.append(arguments.empty() ? "" : " ").append(argv[i]);
+
+    const CycleCount cycles = (argc >= 4) ? std::strtoll(argv[3], nullptr, 10) : INT64_C(2000000000);
+    i8080::ExecutionMode mode = i8080::ExecutionMode::Interpreter;
+    if (argc >= 5 && std::strcmp(argv[4], "cached") == 0)
+      mode = i8080::ExecutionMode::CachedInterpreter;
+    else if (argc >= 5 && std::strcmp(argv[4], "recompiler") == 0)
+      mode = i8080::ExecutionMode::Recompiler;
+    return RunBenchmark(argv[2], arguments.c_str(), cycles, mode);
+  }
 
-  // if (!bus->LoadFileToAddress("tests/CPUTEST.COM", 0x100))
-  // if (!bus->LoadFileToAddress("tests/TST8080.COM", 0x100))
-  // if (!bus->LoadFileToAddress("tests/8080PRE.COM", 0x100))
-  if (!bus->LoadFileToAddress("tests/8080EXM.COM", 0x100))
+  // test --opbench [cycles] [interpreter|cached|recompiler]
+  if (argc >= 2 && std::strcmp(argv[1], "--opbench") == 0)
+  {
+    const CycleCount cycles = (argc >= 3) ? std::strtoll(argv[2], nullptr, 10) : INT64_C(200000000);
+    i8080::ExecutionMode mode = i8080::ExecutionMode::Interpreter;
+    if (argc >= 4 && std::strcmp(argv[3], "cached") == 0)
+      mode = i8080::ExecutionMode::CachedInterpreter;
+    else if (argc >= 4 && std::strcmp(argv[3], "recompiler") == 0)
+      mode = i8080::ExecutionMode::Recompiler;
+    return RunOpcodeBenchmark(cycles, mode);
+  }
+
+  // Longest running first, so that it is started first when there are fewer threads than programs.
+  static constexpr struct
+  {
+    const char* filename;
+    const char* completion_text;
+  } test_programs[] = {{"tests/8080EXM.COM", "Tests complete"},
+                       {"tests/8080PRE.COM", "8080 Preliminary tests complete"},
+                       {"tests/TST8080.COM", "CPU IS OPERATIONAL"},
+                       {"tests/CPUTEST.COM", "CPU TESTS OK"}};
+
+  std::vector<std::unique_ptr<TestRun>> runs;
+  for (const auto& program : test_programs)
+    runs.push_back(std::make_unique<TestRun>(program.filename, program.completion_text));
+
+  // test [interpreter|cached|recompiler], runs the test programs in the given execution mode
+  if (argc >= 2 && argv[1][0] != '-')
+  {
+    i8080::ExecutionMode mode = i8080::ExecutionMode::Interpreter;
+    if (std::strcmp(argv[1], "cached") == 0)
+      mode = i8080::ExecutionMode::CachedInterpreter;
+    else if (std::strcmp(argv[1], "recompiler") == 0)
+      mode = i8080::ExecutionMode::Recompiler;
+
+    for (const auto& run : runs)
+      run->machine->GetCPU().SetExecutionMode(mode);
+  }
+
+  // test --trace <output file> [records], keeps the last records (default 1M) executed by 8080EXM
+  std::unique_ptr<i8080::TraceBuffer> trace_buffer;
+  const char* trace_filename = nullptr;
+  if (argc >= 3 && std::strcmp(argv[1], "--trace") == 0)
+  {
+#if I8080_TRACE
+    trace_filename = argv[2];
+    trace_buffer = std::make_unique<i8080::TraceBuffer>(
+      (argc >= 4) ? static_cast<u32>(std::strtoul(argv[3], nullptr, 10)) : (1u << 20));
+    runs.resize(1);
+    runs[0]->machine->GetCPU().SetTraceBuffer(trace_buffer.get());
+    i8080::TRACE_EXECUTION = true;
+#else
+    Log_ErrorPrintf("Tracing is not compiled in, rebuild with I8080_ENABLE_TRACE defined.");
     return -1;
+#endif
+  }
 
-  cpu->GetRegs().pc = 0x100;
+  // test --profile <report file> [collapsed stacks file], profiles 8080EXM
+  std::unique_ptr<i8080::Profiler> profiler;
+  const char* profile_report_filename = nullptr;
+  const char* profile_stacks_filename = nullptr;
+  if (argc >= 3 && std::strcmp(argv[1], "--profile") == 0)
+  {
+#if I8080_PROFILE
+    profile_report_filename = argv[2];
+    profile_stacks_filename = (argc >= 4) ? argv[3] : nullptr;
+    profiler = std::make_unique<i8080::Profiler>();
+    runs.resize(1);
+    runs[0]->machine->GetCPU().SetProfiler(profiler.get());
+#else
+    Log_ErrorPrintf("Profiling is not compiled in, rebuild with I8080_ENABLE_PROFILE defined.");
+    return -1;
+#endif
+  }
+
+  for (const auto& run : runs)
+  {
+    if (!LoadTestProgram(run.get()))
+      return -1;
+  }
 
-  // inject RET into CALL 5 site for CP/M
-  bus->GetRAM()[0x0005] = 0xC9;
+  Timer timer;
+  ExecuteTestPrograms(runs);
+  const double seconds = timer.GetTimeSeconds();
 
-  SmallString str;
-  while (1)
+  // Reported shortest first, the reverse of the order in which they were started.
+  int result = 0;
+  for (auto it = runs.rbegin(); it != runs.rend(); ++it)
   {
-    if (cpu->GetRegs().pc == 0x0005)
-      HandleBDOSCommand(cpu.get());
-    else if (cpu->GetRegs().pc == 0x0000)
-      break;
+    const TestRun* run = it->get();
+    for (const std::string& line : run->output)
+      Log_DevPrintf("CP/M: %s", line.c_str());
 
-    cpu->SingleStep();
+    const bool passed = TestProgramPassed(run);
+    const double instructions = static_cast<double>(run->machine->GetCPU().GetExecutedInstructionCount());
+    Log_InfoPrintf("%s %s: %.3f seconds, %lld cycles, %.2f MIPS", run->filename, passed ? "passed" : "FAILED",
+                   run->seconds, static_cast<long long>(run->machine->GetCyclesExecuted()),
+                   instructions / run->seconds / 1000000.0);
+    if (!passed)
+      result = 1;
   }
 
-  AddLineCharacter('\n');
-  return 0;
-}
\ No newline at end of file
+  Log_InfoPrintf("%zu test programs in %.3f seconds", runs.size(), seconds);
+
+  if (trace_buffer && !trace_buffer->WriteToFile(trace_filename))
+    return -1;
+
+  if (profiler && (!profiler->WriteReport(profile_report_filename, runs[0]->machine->GetRAM()) ||
+                   (profile_stacks_filename && !profiler->WriteCollapsedStacks(profile_stacks_filename))))
+  {
+    return -1;
+  }
+
+  return result;
+}
@@ -0,0 +1,117 @@
+#include "YBaseLib/Log.h"
+#include "YBaseLib/String.h"
+#include "i8080/disassembler.h"
+#include "i8080/instruction_info.h"
+#include "i8080/trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+Log_SetChannel(TraceDump);
+
+// Prints the most frequent pairs of adjacent instructions which the cached interpreter could fuse, i.e. where the first
+// instruction doesn't end a block and execution falls through to the second. Used to choose i8080::FUSED_PAIRS.
+static int DumpPairs(const std::vector<i8080::TraceRecord>& records, size_t count)
+{
+  std::vector<u64> pair_counts(0x10000);
+  std::vector<size_t> first_occurrence(0x10000);
+  u64 total = 0;
+  for (size_t i = 0; i + 1 < records.size(); i++)
+  {
+    const i8080::TraceRecord& first = records[i];
+    const i8080::TraceRecord& second = records[i + 1];
+    if ((i8080::INSTRUCTION_INFO[first.bytes[0]].flags & i8080::InstructionFlag_EndsBlock) ||
+        second.regs.pc != static_cast<i8080::MemoryAddress>(first.regs.pc + first.length))
+    {
+      continue;
+    }
+
+    const u32 pair = (ZeroExtend32(first.bytes[0]) << 8) | second.bytes[0];
+    if (pair_counts[pair]++ == 0)
+      first_occurrence[pair] = i;
+    total++;
+  }
+
+  std::vector<u32> pairs;
+  for (u32 pair = 0; pair < 0x10000; pair++)
+  {
+    if (pair_counts[pair] > 0)
+      pairs.push_back(pair);
+  }
+  std::sort(pairs.begin(), pairs.end(), [&pair_counts](u32 lhs, u32 rhs) {
+    return (pair_counts[lhs] != pair_counts[rhs]) ? (pair_counts[lhs] > pair_counts[rhs]) : (lhs < rhs);
+  });
+  if (pairs.size() > count)
+    pairs.resize(count);
+
+  std::printf("%llu adjacent pairs in %zu instructions\n", static_cast<unsigned long long>(total), records.size());
+
+  SmallString first_disasm, second_disasm;
+  for (const u32 pair : pairs)
+  {
+    // Show where the pair was first seen, as an example.
+    const i8080::TraceRecord& first = records[first_occurrence[pair]];
+    const i8080::TraceRecord& second = records[first_occurrence[pair] + 1];
+    i8080::Disassemble(first.regs.pc, first.bytes, &first_disasm);
+    i8080::Disassemble(second.regs.pc, second.bytes, &second_disasm);
+    std::printf("%12llu %6.2f%%  {0x%02X, 0x%02X}  %s / %s\n", static_cast<unsigned long long>(pair_counts[pair]),
+                static_cast<double>(pair_counts[pair]) * 100.0 / static_cast<double>(total), pair >> 8, pair & 0xFF,
+                first_disasm.GetCharArray(), second_disasm.GetCharArray());
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Prints a trace written by i8080::TraceBuffer in the same format as CPU::GetStateString, prefixed with the cycle count.
+// tracedump <trace file> [number of records from the end]
+// tracedump --pairs <trace file> [number of pairs]
+int main(int argc, char* argv[])
+{
+  Log::GetInstance().SetConsoleOutputParams(true);
+
+  if (argc >= 3 && std::strcmp(argv[1], "--pairs") == 0)
+  {
+    std::vector<i8080::TraceRecord> records;
+    u64 total_record_count;
+    if (!i8080::TraceBuffer::ReadFromFile(argv[2], &records, &total_record_count))
+      return EXIT_FAILURE;
+
+    return DumpPairs(records, (argc >= 4) ? static_cast<size_t>(std::strtoull(argv[3], nullptr, 10)) : 20);
+  }
+
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s <trace file> [count]\n       %s --pairs <trace file> [count]\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<i8080::TraceRecord> records;
+  u64 total_record_count;
+  if (!i8080::TraceBuffer::ReadFromFile(argv[1], &records, &total_record_count))
+    return EXIT_FAILURE;
+
+  size_t first = 0;
+  if (argc >= 3)
+  {
+    const size_t count = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+    first = (count < records.size()) ? (records.size() - count) : 0;
+  }
+
+  std::printf("%zu of %llu instructions\n", records.size() - first, static_cast<unsigned long long>(total_record_count));
+
+  SmallString disasm;
+  for (size_t i = first; i < records.size(); i++)
+  {
+    const i8080::TraceRecord& record = records[i];
+    const i8080::Registers& regs = record.regs;
+    i8080::Disassemble(regs.pc, record.bytes, &disasm);
+
+    std::printf("%12llu A: %02X F: %02X_%c%c%c%c%c B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X %s\n",
+                static_cast<unsigned long long>(record.cycle), regs.a, regs.f.bits, regs.f.s ? 'S' : 's',
+                regs.f.z ? 'Z' : 'z', regs.f.h ? 'H' : 'h', regs.f.p ? 'P' : 'p', regs.f.c ? 'C' : 'c', regs.b, regs.c,
+                regs.d, regs.e, regs.h, regs.l, regs.sp, disasm.GetCharArray());
+  }
+
+  return EXIT_SUCCESS;
+}